@@ -0,0 +1,618 @@
+#include <cmdline.h>
+
+#include "aten.h"
+#include "atenscene.h"
+
+#include <stb_image_write.h>
+
+// NOTE
+// Render the scene without the window and write the result to the file.
+// This doesn't need GL, so this works in the headless build (ATEN_HEADLESS).
+//
+// To render one frame in multiple processes, run each worker with --workers, --worker and --checkpoint.
+// The checkpoint of each worker keeps the partial result,
+// and "atenrender --merge -o result.exr worker0.ckpt worker1.ckpt ..." resolves them into one image.
+
+struct Options {
+    std::string input;
+    std::string output;
+    std::string base;
+    std::string renderer;
+    std::string denoise;
+    std::string checkpoint;
+    std::string cache;
+    std::string split;
+    std::string vertexFormat;
+    std::string texFilter;
+    std::vector<std::string> merged;
+
+    int spp{ 0 };
+    int bootstrap{ 0 };
+    int threads{ 0 };
+    int passes{ 1 };
+    int worker{ 0 };
+    int workers{ 1 };
+    int seed{ 0 };
+    float adaptiveThreshold{ 0.01f };
+    bool isDeterministic{ false };
+    bool tonemap{ false };
+    bool adaptive{ false };
+    bool mipmap{ false };
+    bool compactTexture{ false };
+};
+
+bool parseOption(
+    int argc, char* argv[],
+    cmdline::parser& cmd,
+    Options& opt)
+{
+    {
+        cmd.add<std::string>("input", 'i', "input scene filename", false);
+        cmd.add<std::string>("output", 'o', "output filename (.hdr, .exr, .png)", false, "result.png");
+        cmd.add<std::string>("base", 'b', "base path of the assets", false);
+        cmd.add<std::string>("renderer", 'r', "renderer type (pt, spt, rt, erpt, pssmlt, bdpt, direct, aov)", false);
+        cmd.add<std::string>("denoise", 'd', "denoiser (none, nlm, bilateral, atrous)", false, "none",
+            cmdline::oneof<std::string>("none", "nlm", "bilateral", "atrous"));
+        cmd.add<int>("spp", 's', "samples per pixel (override the scene)", false, 0);
+        cmd.add<int>("bootstrap", 'B', "number of seed paths of pssmlt (override the scene)", false, 0);
+        cmd.add<int>("threads", 't', "number of threads", false, 0);
+        cmd.add("adaptive", '\0', "adaptive sampling which spends the samples on the noisy pixels (pt only, spp is the average)");
+        cmd.add<float>("adaptive-threshold", '\0', "relative error to stop sampling the pixel in the adaptive sampling", false, 0.01f);
+        cmd.add<int>("passes", 'p', "number of passes to accumulate (spp per pass is the scene's or --spp)", false, 1);
+        cmd.add<std::string>("checkpoint", 'c', "checkpoint file which is saved after every pass, and resumed from if it exists", false);
+        cmd.add<std::string>("cache", 'C', "directory to store the built acceleration structures, which are reused in the next renders", false);
+        cmd.add<std::string>("vertex-format", 'v', "format to store the vertices of the meshes (full, packed, quantized)", false, "full",
+            cmdline::oneof<std::string>("full", "packed", "quantized"));
+        cmd.add<std::string>("tex-filter", '\0', "filter of the textures (nearest, bilinear, trilinear)", false, "nearest",
+            cmdline::oneof<std::string>("nearest", "bilinear", "trilinear"));
+        cmd.add("mipmap", '\0', "generate the mip chain of the textures");
+        cmd.add("compact-texture", '\0', "store the textures in the 8/16bit format to save the memory (CPU renderers only)");
+        cmd.add("tonemap", 'm', "apply tonemap before writing png");
+        cmd.add("deterministic", 'D', "make the result independent of the thread count and the time");
+        cmd.add<int>("seed", 'S', "seed of the sampler", false, 0);
+
+        cmd.add<int>("workers", 'n', "number of processes which render the frame", false, 1);
+        cmd.add<int>("worker", 'w', "index of this process in the workers", false, 0);
+        cmd.add<std::string>("split", 'x', "how to split the frame among the workers (tile, pass)", false, "tile",
+            cmdline::oneof<std::string>("tile", "pass"));
+        cmd.add("merge", 'M', "merge the checkpoints of the workers (rest of the arguments) into the output");
+
+        cmd.add("help", '?', "print usage");
+    }
+
+    bool isCmdOk = cmd.parse(argc, argv);
+
+    if (cmd.exist("help")) {
+        std::cerr << cmd.usage();
+        return false;
+    }
+
+    if (!isCmdOk) {
+        std::cerr << cmd.error() << std::endl << cmd.usage();
+        return false;
+    }
+
+    if (cmd.exist("merge")) {
+        opt.merged = cmd.rest();
+
+        if (opt.merged.empty()) {
+            std::cerr << "no checkpoint to merge" << std::endl << cmd.usage();
+            return false;
+        }
+    }
+    else if (cmd.exist("input")) {
+        opt.input = cmd.get<std::string>("input");
+    }
+    else {
+        std::cerr << "input is required" << std::endl << cmd.usage();
+        return false;
+    }
+
+    opt.output = cmd.get<std::string>("output");
+    opt.denoise = cmd.get<std::string>("denoise");
+    opt.spp = cmd.get<int>("spp");
+    opt.bootstrap = cmd.get<int>("bootstrap");
+    opt.threads = cmd.get<int>("threads");
+    opt.passes = std::max(cmd.get<int>("passes"), 1);
+    opt.tonemap = cmd.exist("tonemap");
+    opt.isDeterministic = cmd.exist("deterministic");
+    opt.seed = cmd.get<int>("seed");
+    opt.workers = std::max(cmd.get<int>("workers"), 1);
+    opt.worker = cmd.get<int>("worker");
+    opt.split = cmd.get<std::string>("split");
+    opt.vertexFormat = cmd.get<std::string>("vertex-format");
+    opt.adaptive = cmd.exist("adaptive");
+    opt.adaptiveThreshold = cmd.get<float>("adaptive-threshold");
+    opt.texFilter = cmd.get<std::string>("tex-filter");
+    opt.mipmap = cmd.exist("mipmap");
+    opt.compactTexture = cmd.exist("compact-texture");
+
+    if (opt.texFilter == "trilinear" && !opt.mipmap) {
+        std::cerr << "trilinear filter requires mipmap" << std::endl << cmd.usage();
+        return false;
+    }
+
+    if (opt.worker < 0 || opt.worker >= opt.workers) {
+        std::cerr << "worker has to be less than workers" << std::endl << cmd.usage();
+        return false;
+    }
+
+    if (opt.workers > 1 && !cmd.exist("checkpoint")) {
+        std::cerr << "checkpoint is required to keep the result of the worker" << std::endl << cmd.usage();
+        return false;
+    }
+
+    // The adaptive sampling decides the sample count per pixel in one render, so it can't be accumulated over the passes.
+    if (opt.adaptive && (opt.passes > 1 || cmd.exist("checkpoint") || opt.workers > 1)) {
+        std::cerr << "adaptive can't be used with passes, checkpoint and workers" << std::endl << cmd.usage();
+        return false;
+    }
+
+    if (cmd.exist("base")) {
+        opt.base = cmd.get<std::string>("base");
+    }
+    if (cmd.exist("renderer")) {
+        opt.renderer = cmd.get<std::string>("renderer");
+    }
+    if (cmd.exist("cache")) {
+        opt.cache = cmd.get<std::string>("cache");
+    }
+    if (cmd.exist("checkpoint")) {
+        opt.checkpoint = cmd.get<std::string>("checkpoint");
+    }
+
+    return true;
+}
+
+static aten::Renderer* createRenderer(const std::string& type)
+{
+    if (type == "pt") {
+        return new aten::PathTracing();
+    }
+    else if (type == "spt") {
+        return new aten::SortedPathTracing();
+    }
+    else if (type == "rt") {
+        return new aten::RayTracing();
+    }
+    else if (type == "erpt") {
+        return new aten::ERPT();
+    }
+    else if (type == "pssmlt") {
+        return new aten::PSSMLT();
+    }
+    else if (type == "bdpt") {
+        return new aten::BDPT();
+    }
+    else if (type == "direct") {
+        return new aten::DirectLightRenderer();
+    }
+    else if (type == "aov") {
+        return new aten::AOVRenderer();
+    }
+
+    return nullptr;
+}
+
+static std::string getExtension(const std::string& path)
+{
+    auto pos = path.find_last_of('.');
+    if (pos == std::string::npos) {
+        return std::string();
+    }
+
+    auto ext = path.substr(pos + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+    return ext;
+}
+
+static bool exportAsPNG(
+    const std::string& filename,
+    const aten::vec4* image,
+    int width, int height,
+    bool needTonemap)
+{
+    using ScreenShotImageType = aten::TColor<uint8_t, 3>;
+
+    std::vector<aten::vec4> tmp;
+
+    if (needTonemap) {
+        tmp.resize(width * height);
+
+        aten::TonemapPreProc tonemap;
+        tonemap(image, width, height, &tmp[0]);
+
+        image = &tmp[0];
+    }
+
+    std::vector<ScreenShotImageType> dst(width * height);
+
+    static const int bpp = sizeof(ScreenShotImageType);
+    const int pitch = width * bpp;
+
+    static const real gamma = real(1) / real(2.2);
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int yy = height - 1 - y;
+
+            const auto& c = image[y * width + x];
+
+            dst[yy * width + x].r() = (uint8_t)aten::clamp(aten::pow(c.x, gamma) * real(255), real(0), real(255));
+            dst[yy * width + x].g() = (uint8_t)aten::clamp(aten::pow(c.y, gamma) * real(255), real(0), real(255));
+            dst[yy * width + x].b() = (uint8_t)aten::clamp(aten::pow(c.z, gamma) * real(255), real(0), real(255));
+        }
+    }
+
+    auto ret = ::stbi_write_png(filename.c_str(), width, height, bpp, &dst[0], pitch);
+
+    return (ret > 0);
+}
+
+static bool saveImage(
+    const Options& opt,
+    const aten::vec4* image,
+    int width, int height)
+{
+    auto ext = getExtension(opt.output);
+
+    if (ext == "hdr") {
+        return aten::HDRExporter::save(opt.output, image, width, height);
+    }
+    else if (ext == "exr") {
+        return aten::EXRExporter::save(opt.output, image, width, height);
+    }
+    else if (ext == "png") {
+        return exportAsPNG(opt.output, image, width, height, opt.tonemap);
+    }
+
+    AT_PRINTF("Unknown format %s\n", opt.output.c_str());
+
+    return false;
+}
+
+static int merge(const Options& opt)
+{
+    aten::Accumulator accum;
+    std::vector<uint32_t> workers;
+
+    for (const auto& path : opt.merged) {
+        aten::Accumulator partial;
+
+        if (!partial.load(path)) {
+            return 1;
+        }
+
+        auto idx = partial.getPartitionIndex();
+
+        if (std::find(workers.begin(), workers.end(), idx) != workers.end()) {
+            AT_PRINTF("Worker %d is duplicated (%s)\n", idx, path.c_str());
+            return 1;
+        }
+        workers.push_back(idx);
+
+        if (workers.size() == 1) {
+            accum = std::move(partial);
+        }
+        else if (!accum.merge(partial)) {
+            AT_PRINTF("Failed to merge %s\n", path.c_str());
+            return 1;
+        }
+    }
+
+    if (workers.size() != accum.getPartitionNum()) {
+        AT_PRINTF("Only %d of %d workers are merged\n", (int)workers.size(), accum.getPartitionNum());
+    }
+
+    const int width = accum.width();
+    const int height = accum.height();
+
+    std::vector<aten::vec4> image(width * height);
+
+    for (int i = 0; i < width * height; i++) {
+        image[i] = aten::vec4(accum.getMean(i), 1);
+    }
+
+    const aten::vec4* result = &image[0];
+
+    std::vector<aten::vec4> denoised;
+
+    if (opt.denoise == "nlm" || opt.denoise == "bilateral") {
+        denoised.resize(width * height);
+
+        if (opt.denoise == "nlm") {
+            aten::NonLocalMeanFilter nlm;
+            nlm(result, width, height, &denoised[0]);
+        }
+        else {
+            aten::BilateralFilter bilateral;
+            bilateral(result, width, height, &denoised[0]);
+        }
+
+        result = &denoised[0];
+    }
+    else if (opt.denoise != "none") {
+        // The features need the scene.
+        AT_PRINTF("%s is not available in merging\n", opt.denoise.c_str());
+    }
+
+    return saveImage(opt, result, width, height) ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    Options opt;
+    cmdline::parser cmd;
+
+    if (!parseOption(argc, argv, cmd, opt)) {
+        return 0;
+    }
+
+    if (!opt.base.empty()) {
+        aten::SceneLoader::setBasePath(opt.base);
+        aten::ImageLoader::setBasePath(opt.base);
+        aten::ObjLoader::setBasePath(opt.base);
+        aten::MaterialLoader::setBasePath(opt.base);
+    }
+
+    if (opt.texFilter == "bilinear") {
+        aten::ImageLoader::setFilter(aten::texture::Filter::Bilinear);
+    }
+    else if (opt.texFilter == "trilinear") {
+        aten::ImageLoader::setFilter(aten::texture::Filter::Trilinear);
+    }
+    aten::ImageLoader::enableMipmap(opt.mipmap);
+    aten::ImageLoader::enableCompactTexture(opt.compactTexture);
+
+    if (!opt.cache.empty()) {
+        aten::AccelCache::setDirectory(opt.cache.c_str());
+    }
+
+    if (opt.vertexFormat == "packed") {
+        aten::SceneLoader::setVertexFormat(aten::VertexFormat::Packed);
+    }
+    else if (opt.vertexFormat == "quantized") {
+        aten::SceneLoader::setVertexFormat(aten::VertexFormat::Quantized);
+    }
+
+    aten::timer::init();
+
+    if (opt.threads > 0) {
+        aten::OMPUtil::setThreadNum(opt.threads);
+    }
+
+    if (!opt.merged.empty()) {
+        return merge(opt);
+    }
+
+    aten::context ctxt;
+
+    aten::SceneLoader::SceneInfo info;
+
+    try {
+        info = aten::SceneLoader::load(opt.input, ctxt);
+    }
+    catch (std::exception* e) {
+        AT_PRINTF("Failed to load %s\n", opt.input.c_str());
+        return 1;
+    }
+
+    auto& dst = info.dst;
+
+    const int width = dst.width;
+    const int height = dst.height;
+
+    if (opt.spp > 0) {
+        dst.sample = opt.spp;
+    }
+    if (opt.bootstrap > 0) {
+        dst.bootstrapNum = opt.bootstrap;
+    }
+
+    auto rendererType = opt.renderer.empty() ? info.rendererType : opt.renderer;
+
+    auto renderer = createRenderer(rendererType);
+    if (!renderer) {
+        AT_PRINTF("Unknown renderer %s\n", rendererType.c_str());
+        return 1;
+    }
+
+    renderer->setDeterministic(opt.isDeterministic, opt.seed);
+
+    aten::initSampler(width, height, opt.seed, true);
+
+    info.scene->build(ctxt);
+
+    auto ibl = info.scene->getIBL();
+    if (ibl) {
+        renderer->setBG(const_cast<aten::envmap*>(ibl->getEnvMap()));
+    }
+
+    aten::Film buffer(width, height);
+    aten::Film variance(width, height);
+
+    aten::Film nmlDepth;
+    aten::Film albedo;
+    aten::Film ids;
+
+    dst.buffer = &buffer;
+    dst.variance = &variance;
+
+    if (opt.adaptive) {
+        if (rendererType == "pt") {
+            dst.adaptive.enable = true;
+            dst.adaptive.threshold = real(opt.adaptiveThreshold);
+        }
+        else {
+            AT_PRINTF("%s doesn't support adaptive sampling. Render with the fixed sample count\n", rendererType.c_str());
+        }
+    }
+
+    // Accumulate the passes, when it is multi pass or can be resumed.
+    aten::Accumulator accum;
+
+    // NOTE
+    // Only PathTracing supports the accumulator.
+    bool needAccumulate = (opt.passes > 1 || !opt.checkpoint.empty());
+
+    const bool isWorker = (opt.workers > 1);
+
+    if (needAccumulate && rendererType != "pt") {
+        if (isWorker) {
+            AT_PRINTF("%s can't be rendered in multiple processes\n", rendererType.c_str());
+            return 1;
+        }
+
+        AT_PRINTF("%s doesn't support multi pass. Render in one pass\n", rendererType.c_str());
+        needAccumulate = false;
+    }
+
+    // Count of the passes which this process renders.
+    int passes = opt.passes;
+
+    if (needAccumulate) {
+        accum.init(width, height);
+
+        if (isWorker) {
+            if (opt.split == "pass") {
+                accum.setPartition(aten::Accumulator::Split::Pass, opt.worker, opt.workers);
+                passes = (opt.passes - opt.worker + opt.workers - 1) / opt.workers;
+            }
+            else {
+                accum.setPartition(aten::Accumulator::Split::Tile, opt.worker, opt.workers);
+            }
+        }
+
+        if (!opt.checkpoint.empty()) {
+            auto isMatched = [&]() {
+                return accum.width() == width && accum.height() == height
+                    && (int)accum.getPartitionNum() == opt.workers
+                    && (int)accum.getPartitionIndex() == opt.worker;
+            };
+
+            FILE* fp = fopen(opt.checkpoint.c_str(), "rb");
+            if (fp) {
+                fclose(fp);
+
+                if (!accum.load(opt.checkpoint) || !isMatched()) {
+                    AT_PRINTF("Failed to resume from %s\n", opt.checkpoint.c_str());
+                    return 1;
+                }
+
+                AT_PRINTF("Resume from pass %d\n", accum.getPassNum());
+            }
+            else {
+                // If the process was killed while replacing the checkpoint, only the temporary file remains.
+                // It is complete if it can be loaded. If it is truncated, start over.
+                const auto tmpPath = opt.checkpoint + ".tmp";
+
+                fp = fopen(tmpPath.c_str(), "rb");
+                if (fp) {
+                    fclose(fp);
+
+                    if (accum.load(tmpPath)) {
+                        if (!isMatched()) {
+                            AT_PRINTF("Failed to resume from %s\n", tmpPath.c_str());
+                            return 1;
+                        }
+
+                        AT_PRINTF("Resume from pass %d (%s)\n", accum.getPassNum(), tmpPath.c_str());
+                    }
+                }
+            }
+        }
+
+        dst.accumulator = &accum;
+    }
+
+    aten::timer timer;
+    timer.begin();
+
+    if (needAccumulate) {
+        for (int pass = accum.getPassNum(); pass < passes; pass++) {
+            renderer->render(ctxt, dst, info.scene, info.camera);
+
+            if (!opt.checkpoint.empty()) {
+                accum.save(opt.checkpoint);
+            }
+
+            AT_PRINTF("Pass %d/%d\n", pass + 1, passes);
+        }
+
+        if (isWorker) {
+            // The image is resolved after merging the results of all workers.
+            AT_PRINTF("Render %f[ms]\n", timer.end());
+            return 0;
+        }
+
+        if (accum.getPassNum() > 0) {
+            // Resolve the buffer, even if all passes are done in the previous run.
+            for (int i = 0; i < width * height; i++) {
+                buffer.put(i, aten::vec4(accum.getMean(i), 1));
+                variance.put(i, aten::vec4(accum.getVariance(i), 1));
+            }
+
+            // The variance is divided by the accumulated sample count in the denoiser.
+            dst.sample *= accum.getPassNum();
+        }
+    }
+    else {
+        renderer->render(ctxt, dst, info.scene, info.camera);
+    }
+
+    AT_PRINTF("Render %f[ms]\n", timer.end());
+
+    const aten::vec4* image = buffer.image();
+
+    std::vector<aten::vec4> denoised;
+
+    if (opt.denoise != "none") {
+        denoised.resize(width * height);
+
+        if (opt.denoise == "nlm") {
+            aten::NonLocalMeanFilter nlm;
+            nlm(image, width, height, &denoised[0]);
+        }
+        else if (opt.denoise == "bilateral") {
+            aten::BilateralFilter bilateral;
+            bilateral(image, width, height, &denoised[0]);
+        }
+        else if (opt.denoise == "atrous") {
+            // Render the features which guide the filter.
+            nmlDepth.init(width, height);
+            albedo.init(width, height);
+            ids.init(width, height);
+
+            aten::Destination aovDst = dst;
+            {
+                aovDst.buffer = nullptr;
+                aovDst.variance = nullptr;
+                aovDst.geominfo.nml_depth = &nmlDepth;
+                aovDst.geominfo.albedo_vis = &albedo;
+                aovDst.geominfo.ids = &ids;
+                aovDst.geominfo.depthMax = 1000;
+            }
+
+            aten::AOVRenderer aov;
+            aov.render(ctxt, aovDst, info.scene, info.camera);
+
+            // The variance is divided by the sample count in the filter.
+            // Only the path tracers and the direct light renderer write the variance.
+            // For the others, the filter estimates the variance of the luminance from the neighbours.
+            const bool hasVariance = (rendererType == "pt" || rendererType == "spt" || rendererType == "direct");
+            aovDst.variance = (hasVariance ? &variance : nullptr);
+
+            aten::ATrousFilter atrous;
+            atrous.setFeatures(aovDst);
+            atrous(image, width, height, &denoised[0]);
+        }
+
+        image = &denoised[0];
+    }
+
+    return saveImage(opt, image, width, height) ? 0 : 1;
+}
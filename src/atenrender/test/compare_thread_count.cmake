@@ -0,0 +1,36 @@
+# Render the scene with 1 thread and multiple threads in the deterministic mode, and check the outputs are identical.
+#
+# cmake -DATENRENDER=<path> -DSCENE=<path> -DRENDERER=<type> -DTHREADS=<num> -DOUTPUT_DIR=<path> -P compare_thread_count.cmake
+
+file(MAKE_DIRECTORY ${OUTPUT_DIR})
+
+foreach(THREAD_NUM 1 ${THREADS})
+  set(OUTPUT ${OUTPUT_DIR}/${RENDERER}_t${THREAD_NUM}.hdr)
+
+  # Remove the previous result not to compare it when the render fails.
+  file(REMOVE ${OUTPUT})
+
+  execute_process(
+    COMMAND ${ATENRENDER}
+      -i ${SCENE}
+      -o ${OUTPUT}
+      -r ${RENDERER}
+      -t ${THREAD_NUM}
+      --deterministic
+      --seed 1
+    RESULT_VARIABLE RESULT)
+
+  if(NOT RESULT EQUAL 0 OR NOT EXISTS ${OUTPUT})
+    message(FATAL_ERROR "Failed to render with ${RENDERER} in ${THREAD_NUM} threads")
+  endif()
+endforeach()
+
+execute_process(
+  COMMAND ${CMAKE_COMMAND} -E compare_files
+    ${OUTPUT_DIR}/${RENDERER}_t1.hdr
+    ${OUTPUT_DIR}/${RENDERER}_t${THREADS}.hdr
+  RESULT_VARIABLE RESULT)
+
+if(NOT RESULT EQUAL 0)
+  message(FATAL_ERROR "${RENDERER} output with ${THREADS} threads differs from 1 thread")
+endif()
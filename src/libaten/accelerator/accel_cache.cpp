@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "accelerator/accel_cache.h"
+#include "accelerator/accelerator.h"
+
+namespace aten {
+    std::string AccelCache::s_dir;
+
+    struct AccelCacheHeader {
+        char magic[4];
+        uint32_t version;
+
+        uint32_t type;
+        uint32_t sectionNum;
+
+        uint64_t hash;
+
+        // Whole file size to detect the truncated file.
+        uint64_t size;
+    };
+
+    struct AccelCacheSection {
+        uint32_t id;
+        uint32_t padding;
+
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    static const char AccelCacheMagic[4] = { 'A', 'C', 'C', 'L' };
+
+    static inline uint64_t alignSize(uint64_t size)
+    {
+        return (size + AccelCache::SectionAlignment - 1) / AccelCache::SectionAlignment * AccelCache::SectionAlignment;
+    }
+
+    // FNV-1a.
+    static const uint64_t HashBasis = 0xcbf29ce484222325ULL;
+    static const uint64_t HashPrime = 0x100000001b3ULL;
+
+    static inline uint64_t hashBytes(uint64_t h, const void* data, size_t size)
+    {
+        auto p = (const uint8_t*)data;
+        for (size_t i = 0; i < size; i++) {
+            h ^= p[i];
+            h *= HashPrime;
+        }
+        return h;
+    }
+
+    template <typename _T>
+    static inline uint64_t hashValue(uint64_t h, const _T& v)
+    {
+        return hashBytes(h, &v, sizeof(v));
+    }
+
+    static inline uint64_t hashVec3(uint64_t h, const vec3& v)
+    {
+        h = hashValue(h, v.x);
+        h = hashValue(h, v.y);
+        h = hashValue(h, v.z);
+        return h;
+    }
+
+    static uint64_t hashItem(const context& ctxt, const hitable* item)
+    {
+        uint64_t h = HashBasis;
+
+        int triIdx = ctxt.findTriIdxFromPointer(item);
+
+        h = hashValue(h, triIdx);
+
+        if (triIdx >= 0) {
+            // The leaves refer the triangle by its index, the material and the mesh in the context.
+            const auto& param = ctxt.getTriangleParam(triIdx);
+
+            for (int i = 0; i < 3; i++) {
+                h = hashValue(h, param.idx[i]);
+
+                auto pos = ctxt.getVertexPosition(param.idx[i]);
+                h = hashVec3(h, vec3(pos.x, pos.y, pos.z));
+            }
+
+            h = hashValue(h, param.mtrlid);
+            h = hashValue(h, param.gemoid);
+        }
+        else {
+            int shapeIdx = ctxt.findTransformableIdxFromPointer(item);
+            h = hashValue(h, shapeIdx);
+        }
+
+        const auto& bbox = item->getBoundingbox();
+        h = hashVec3(h, bbox.minPos());
+        h = hashVec3(h, bbox.maxPos());
+
+        return h;
+    }
+
+    void AccelCache::setDirectory(const char* dir)
+    {
+        s_dir = (dir ? dir : "");
+
+        // Remove the trailing separator.
+        while (!s_dir.empty() && (s_dir.back() == '/' || s_dir.back() == '\\')) {
+            s_dir.pop_back();
+        }
+    }
+
+    uint64_t AccelCache::computeHash(
+        const context& ctxt,
+        hitable** list,
+        uint32_t num,
+        AccelType type,
+        uint32_t settings)
+    {
+        std::vector<uint64_t> hashes(num);
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+        for (int i = 0; i < (int)num; i++) {
+            hashes[i] = hashItem(ctxt, list[i]);
+        }
+
+        uint64_t h = HashBasis;
+
+        // Copy it, because binding the reference to the static member needs its definition outside of the class.
+        h = hashValue(h, (uint32_t)Version);
+        h = hashValue(h, (uint32_t)type);
+        h = hashValue(h, settings);
+        h = hashValue(h, num);
+
+        // Combine in order, so the hash doesn't depend on the count of the threads.
+        for (uint32_t i = 0; i < num; i++) {
+            h = hashValue(h, hashes[i]);
+        }
+
+        return h;
+    }
+
+    std::string AccelCache::getPath(uint64_t hash)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.accel", (unsigned long long)hash);
+
+        return s_dir + "/" + name;
+    }
+
+    void AccelCache::Writer::add(uint32_t id, const void* data, size_t size)
+    {
+        AT_ASSERT(data || size == 0);
+
+        m_sections.push_back(Section());
+
+        auto& section = m_sections.back();
+        section.id = id;
+
+        if (size > 0) {
+            auto p = (const uint8_t*)data;
+            section.data.assign(p, p + size);
+        }
+    }
+
+    bool AccelCache::Writer::save(const char* path, AccelType type, uint64_t hash) const
+    {
+        const uint32_t sectionNum = (uint32_t)m_sections.size();
+
+        std::vector<AccelCacheSection> table(sectionNum);
+
+        uint64_t offset = alignSize(sizeof(AccelCacheHeader) + sizeof(AccelCacheSection) * sectionNum);
+
+        for (uint32_t i = 0; i < sectionNum; i++) {
+            table[i].id = m_sections[i].id;
+            table[i].padding = 0;
+            table[i].offset = offset;
+            table[i].size = m_sections[i].data.size();
+
+            offset = alignSize(offset + m_sections[i].data.size());
+        }
+
+        AccelCacheHeader header;
+        {
+            memcpy(header.magic, AccelCacheMagic, sizeof(header.magic));
+            header.version = Version;
+            header.type = (uint32_t)type;
+            header.sectionNum = sectionNum;
+            header.hash = hash;
+            header.size = offset;
+        }
+
+        std::string tmpPath(path);
+        tmpPath += ".tmp";
+
+        FILE* fp = fopen(tmpPath.c_str(), "wb");
+        if (!fp) {
+            AT_PRINTF("Failed to write the cache file [%s]\n", tmpPath.c_str());
+            return false;
+        }
+
+        static const uint8_t zeros[SectionAlignment] = { 0 };
+
+        bool isWritten = (fwrite(&header, sizeof(header), 1, fp) == 1);
+
+        if (sectionNum > 0) {
+            isWritten &= (fwrite(&table[0], sizeof(AccelCacheSection), sectionNum, fp) == sectionNum);
+        }
+
+        uint64_t pos = sizeof(AccelCacheHeader) + sizeof(AccelCacheSection) * sectionNum;
+
+        for (uint32_t i = 0; isWritten && i < sectionNum; i++) {
+            // Fill zero until the aligned offset.
+            isWritten &= (fwrite(zeros, 1, (size_t)(table[i].offset - pos), fp) == table[i].offset - pos);
+
+            if (table[i].size > 0) {
+                isWritten &= (fwrite(&m_sections[i].data[0], 1, (size_t)table[i].size, fp) == table[i].size);
+            }
+
+            pos = table[i].offset + table[i].size;
+        }
+
+        if (isWritten && pos < offset) {
+            isWritten &= (fwrite(zeros, 1, (size_t)(offset - pos), fp) == offset - pos);
+        }
+
+        isWritten &= (fclose(fp) == 0);
+
+        if (isWritten) {
+            if (rename(tmpPath.c_str(), path) != 0) {
+                // The existing file can't be replaced on some platforms.
+                remove(path);
+                isWritten = (rename(tmpPath.c_str(), path) == 0);
+            }
+        }
+
+        if (!isWritten) {
+            AT_PRINTF("Failed to write the cache file [%s]\n", path);
+            remove(tmpPath.c_str());
+        }
+
+        return isWritten;
+    }
+
+    bool AccelCache::Reader::open(const char* path, AccelType type, uint64_t hash)
+    {
+        if (!m_file.open(path)) {
+            return false;
+        }
+
+        const auto size = (uint64_t)m_file.size();
+        const auto data = (const uint8_t*)m_file.data();
+
+        bool isValid = (size >= sizeof(AccelCacheHeader));
+
+        if (isValid) {
+            const auto header = (const AccelCacheHeader*)data;
+
+            isValid = (memcmp(header->magic, AccelCacheMagic, sizeof(header->magic)) == 0)
+                && header->version == Version
+                && header->type == (uint32_t)type
+                && header->hash == hash
+                && header->size == size
+                && sizeof(AccelCacheHeader) + sizeof(AccelCacheSection) * (uint64_t)header->sectionNum <= size;
+
+            if (isValid) {
+                const auto table = (const AccelCacheSection*)(data + sizeof(AccelCacheHeader));
+
+                for (uint32_t i = 0; isValid && i < header->sectionNum; i++) {
+                    isValid = (table[i].offset % SectionAlignment) == 0
+                        && table[i].offset <= size
+                        && table[i].size <= size - table[i].offset;
+                }
+            }
+        }
+
+        if (!isValid) {
+            AT_PRINTF("Invalid cache file [%s]\n", path);
+            m_file.close();
+        }
+
+        return isValid;
+    }
+
+    const void* AccelCache::Reader::get(uint32_t id, size_t& size) const
+    {
+        size = 0;
+
+        if (!m_file.isOpened()) {
+            return nullptr;
+        }
+
+        const auto data = (const uint8_t*)m_file.data();
+        const auto header = (const AccelCacheHeader*)data;
+        const auto table = (const AccelCacheSection*)(data + sizeof(AccelCacheHeader));
+
+        for (uint32_t i = 0; i < header->sectionNum; i++) {
+            if (table[i].id == id) {
+                size = (size_t)table[i].size;
+                return data + table[i].offset;
+            }
+        }
+
+        return nullptr;
+    }
+}
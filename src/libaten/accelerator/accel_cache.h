@@ -0,0 +1,153 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "types.h"
+#include "misc/mapped_file.h"
+#include "scene/hitable.h"
+#include "scene/context.h"
+
+namespace aten {
+    enum class AccelType;
+
+    /**
+     * @brief Binary cache of the built acceleration structures on the disk.
+     * The cache file is keyed by the hash of the geometry and the build settings,
+     * so the structure for the same asset can be loaded instead of building it again.
+     * The file consists of the header, the section table and the sections which are aligned to SectionAlignment.
+     */
+    class AccelCache {
+    private:
+        AccelCache() = delete;
+        ~AccelCache() = delete;
+
+    public:
+        /**
+         * @brief Version of the file format. If it is not matched, the cache file is ignored.
+         */
+        static const uint32_t Version = 1;
+
+        static const uint32_t SectionAlignment = 16;
+
+        /**
+         * @brief Set the directory to store the cache files.
+         * If the empty string or nullptr is specified, the cache is disabled.
+         */
+        static void setDirectory(const char* dir);
+
+        /**
+         * @brief Return the directory to store the cache files.
+         */
+        static const std::string& getDirectory()
+        {
+            return s_dir;
+        }
+
+        /**
+         * @brief Return whether the cache is enabled.
+         */
+        static bool isEnabled()
+        {
+            return !s_dir.empty();
+        }
+
+        /**
+         * @brief Compute the hash from the primitives in the list and the build settings.
+         * The primitives' positions, materials, ids in the context and the order in the list are taken into account.
+         */
+        static uint64_t computeHash(
+            const context& ctxt,
+            hitable** list,
+            uint32_t num,
+            AccelType type,
+            uint32_t settings);
+
+        /**
+         * @brief Return the path of the cache file for the hash.
+         */
+        static std::string getPath(uint64_t hash);
+
+        /**
+         * @brief Writer to store the sections to the cache file.
+         */
+        class Writer {
+        public:
+            Writer() {}
+            ~Writer() {}
+
+        public:
+            /**
+             * @brief Register the section. The data is copied into the writer.
+             */
+            void add(uint32_t id, const void* data, size_t size);
+
+            template <typename _T>
+            void add(uint32_t id, const std::vector<_T>& data)
+            {
+                add(id, data.empty() ? nullptr : &data[0], data.size() * sizeof(_T));
+            }
+
+            /**
+             * @brief Write all registered sections to the file.
+             * The file is written to the temporary file at first, and renamed to the path.
+             * So, the incomplete file is never read.
+             */
+            bool save(const char* path, AccelType type, uint64_t hash) const;
+
+        private:
+            struct Section {
+                uint32_t id;
+                std::vector<uint8_t> data;
+            };
+            std::vector<Section> m_sections;
+        };
+
+        /**
+         * @brief Reader to access the sections in the cache file.
+         * The file is mapped to the memory, and the sections are accessed without copying them.
+         */
+        class Reader {
+        public:
+            Reader() {}
+            ~Reader() {}
+
+        public:
+            /**
+             * @brief Open the cache file and validate it.
+             * @return If the file doesn't exist or is not matched with the type, the hash and the version, return false.
+             */
+            bool open(const char* path, AccelType type, uint64_t hash);
+
+            /**
+             * @brief Return the pointer to the section in the mapped memory.
+             * @return If the section doesn't exist, return nullptr.
+             */
+            const void* get(uint32_t id, size_t& size) const;
+
+            /**
+             * @brief Return the section as the array.
+             * @return If the section doesn't exist or its size is not matched with the element, return nullptr.
+             */
+            template <typename _T>
+            const _T* get(uint32_t id, uint32_t& num) const
+            {
+                size_t size = 0;
+                auto ret = get(id, size);
+
+                if (!ret || (size % sizeof(_T)) != 0) {
+                    num = 0;
+                    return nullptr;
+                }
+
+                num = (uint32_t)(size / sizeof(_T));
+                return reinterpret_cast<const _T*>(ret);
+            }
+
+        private:
+            MappedFile m_file;
+        };
+
+    private:
+        static std::string s_dir;
+    };
+}
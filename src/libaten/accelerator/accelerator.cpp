@@ -6,6 +6,7 @@
 namespace aten {
     AccelType accelerator::s_internalType = AccelType::Bvh;
     std::function<accelerator*()> accelerator::s_userDefsInternalAccelCreator = nullptr;
+    bool accelerator::s_enableTriangleBatch = false;
 
     void accelerator::setInternalAccelType(AccelType type)
     {
@@ -52,4 +53,41 @@ namespace aten {
 
         return ret;
     }
+
+    void accelerator::buildWithCache(
+        const context& ctxt,
+        hitable** list,
+        uint32_t num,
+        aabb* bbox)
+    {
+        if (!AccelCache::isEnabled() || num == 0) {
+            build(ctxt, list, num, bbox);
+            return;
+        }
+
+        // NOTE
+        // The list is sorted in building, so the original order is kept to refer the items from the cache.
+        std::vector<hitable*> items(list, list + num);
+
+        const auto hash = AccelCache::computeHash(ctxt, &items[0], num, m_type, getCacheSettings());
+        const auto path = AccelCache::getPath(hash);
+
+        {
+            AccelCache::Reader reader;
+
+            if (reader.open(path.c_str(), m_type, hash)
+                && importCache(ctxt, &items[0], num, reader))
+            {
+                return;
+            }
+        }
+
+        build(ctxt, list, num, bbox);
+
+        AccelCache::Writer writer;
+
+        if (exportCache(ctxt, &items[0], num, writer)) {
+            writer.save(path.c_str(), m_type, hash);
+        }
+    }
 }
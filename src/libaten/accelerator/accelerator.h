@@ -4,6 +4,7 @@
 #include "scene/hitable.h"
 #include "math/frustum.h"
 #include "scene/context.h"
+#include "accelerator/accel_cache.h"
 
 namespace aten {
     /**
@@ -44,6 +45,8 @@ namespace aten {
         static AccelType s_internalType;
         static std::function<accelerator*()> s_userDefsInternalAccelCreator;
 
+        static bool s_enableTriangleBatch;
+
         /**
          * @brief Return a created acceleration structure for internal used.
          */
@@ -67,12 +70,39 @@ namespace aten {
             m_isNested = true;
         }
 
+        /**
+         * @brief Load the structure tree from the cache file if it exists, otherwise build it and store it to the cache file.
+         * If the cache is disabled, the structure tree is just built.
+         */
+        void buildWithCache(
+            const context& ctxt,
+            hitable** list,
+            uint32_t num,
+            aabb* bbox);
+
     public:
         /**
          * @brief Set a function to create user defined acceleration structure for internal used.
          */
         static void setUserDefsInternalAccelCreator(std::function<accelerator*()> creator);
 
+        /**
+         * @brief Specify whether the triangles in the small sub trees are tested together with the SIMD kernel.
+         * @note This is applied to the structures which are built after it is specified.
+         */
+        static void enableTriangleBatch(bool enable)
+        {
+            s_enableTriangleBatch = enable;
+        }
+
+        /**
+         * @brief Return whether the triangles in the small sub trees are tested together.
+         */
+        static bool isEnabledTriangleBatch()
+        {
+            return s_enableTriangleBatch;
+        }
+
         /**
          * @brief Bulid structure tree from the specified list.
          */
@@ -154,6 +184,43 @@ namespace aten {
             return false;
         }
 
+        /**
+         * @brief Return the value of the build settings which change the built structure tree.
+         * It is taken into account to compute the key of the cache.
+         */
+        virtual uint32_t getCacheSettings() const
+        {
+            return 0;
+        }
+
+        /**
+         * @brief Register the built structure data to the cache writer.
+         * @param[in] list Items in the order which are passed to build. The items are referred by the index in it.
+         * @return If the structure can't be cached, return false.
+         */
+        virtual bool exportCache(
+            const context& ctxt,
+            hitable** list,
+            uint32_t num,
+            AccelCache::Writer& writer)
+        {
+            return false;
+        }
+
+        /**
+         * @brief Restore the structure data from the cache instead of building it.
+         * @param[in] list Items in the order which are passed to build.
+         * @return If the cache is not available, return false. Then, the structure is not changed.
+         */
+        virtual bool importCache(
+            const context& ctxt,
+            hitable** list,
+            uint32_t num,
+            const AccelCache::Reader& reader)
+        {
+            return false;
+        }
+
         /**
          * @brief Return the type about acceleration structure.
          */
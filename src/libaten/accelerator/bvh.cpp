@@ -1,9 +1,12 @@
+#include <algorithm>
 #include <random>
 #include <vector>
 
 #include "accelerator/bvh.h"
 #include "geometry/transformable.h"
 #include "geometry/object.h"
+#include "misc/omputil.h"
+#include "misc/timer.h"
 
 //#define TEST_NODE_LIST
 //#pragma optimize( "", off)
@@ -132,6 +135,35 @@ namespace aten {
         }
     }
 
+    bool bvhnode::occluded(
+        const context& ctxt,
+        const ray& r,
+        real t_min, real t_max) const
+    {
+        if (m_childrenNum > 0) {
+            for (int i = 0; i < m_childrenNum; i++) {
+                if (m_children[i]->occluded(ctxt, r, t_min, t_max)) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+        else if (m_item) {
+            return m_item->occluded(ctxt, r, t_min, t_max);
+        }
+        else {
+            auto bbox = getBoundingbox();
+            auto isHit = bbox.hit(r, t_min, t_max);
+
+            if (isHit) {
+                isHit = bvh::onOccluded(ctxt, this, r, t_min, t_max);
+            }
+
+            return isHit;
+        }
+    }
+
     void bvhnode::drawAABB(
         aten::hitable::FuncDrawAABB func,
         const aten::mat4& mtxL2W) const
@@ -174,22 +206,243 @@ namespace aten {
         return axis;
     }
 
+    bvh::BuildMode bvh::s_defaultBuildMode = bvh::BuildMode::Sweep;
+    bool bvh::s_enableBuildReport = false;
+
+    // Compute the count of primitives under which the sub tree is built in parallel.
+    static uint32_t computeSubTreeThreshold(uint32_t num)
+    {
+        // Sub tree which has primitives less than this is not worth to build in parallel.
+        static const uint32_t MinSubTreePrimNum = 1024;
+
+        uint32_t threshold = 0;
+
+        const uint32_t threadNum = OMPUtil::getParallelThreadNum(num, MinSubTreePrimNum);
+
+        if (threadNum > 1) {
+            // Make enough sub trees per thread to balance the load.
+            threshold = std::max(num / (threadNum * 8), MinSubTreePrimNum);
+            threshold = (num > threshold ? threshold : 0);
+        }
+
+        return threshold;
+    }
+
+    void bvh::buildSubTrees(
+        BuildMode mode,
+        std::vector<SubTreeTask>& subTrees)
+    {
+        // NOTE
+        // Each sub tree has the disjoint range of the primitives and its own root node.
+        // So, the sub trees can be built independently and the result is same as the serial build.
+
+        const int taskNum = (int)subTrees.size();
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic, 1) if(taskNum > 1)
+#endif
+        for (int i = 0; i < taskNum; i++) {
+            const auto& task = subTrees[i];
+
+            if (mode == BuildMode::Binned) {
+                buildByBinnedSAH(task.node, task.refs, task.num, task.depth, task.parent);
+            }
+            else {
+                buildBySAH(task.node, task.list, task.num, task.depth, task.parent);
+            }
+        }
+
+        subTrees.clear();
+    }
+
     void bvh::build(
         const context& ctxt,
         hitable** list,
         uint32_t num,
         aabb* bbox)
     {
-        int axis = 0;
+        timer timer;
+        timer.begin();
+
+        const auto mode = getBuildMode();
 
-        if (bbox) {
-            axis = findLongestAxis(*bbox);
+        m_root = new bvhnode(nullptr, nullptr, this);
+
+        // The top levels are built serially and the remaining sub trees are built in parallel.
+        m_subTreeThreshold = computeSubTreeThreshold(num);
+
+        std::vector<SubTreeTask> subTrees;
+        auto* subTreesPtr = (m_subTreeThreshold > 0 ? &subTrees : nullptr);
+
+        if (mode == BuildMode::Binned) {
+            // Build the flat array of the primitive references.
+            std::vector<PrimitiveRef> refs(num);
+
+            for (uint32_t i = 0; i < num; i++) {
+                refs[i].item = list[i];
+                refs[i].bbox = list[i]->getBoundingbox();
+                refs[i].centroid = refs[i].bbox.getCenter();
+            }
+
+            buildByBinnedSAH(m_root, &refs[0], num, 0, m_root, subTreesPtr);
+
+            buildSubTrees(mode, subTrees);
         }
+        else {
+            int axis = 0;
 
-        sortList(list, num, axis);
+            if (bbox) {
+                axis = findLongestAxis(*bbox);
+            }
 
-        m_root = new bvhnode(nullptr, nullptr, this);
-        buildBySAH(m_root, list, num, 0, m_root);
+            sortList(list, num, axis);
+
+            buildBySAH(m_root, list, num, 0, m_root, subTreesPtr);
+
+            buildSubTrees(mode, subTrees);
+        }
+
+        onBuilt(ctxt, mode, num, timer.end(), false);
+    }
+
+    void bvh::onBuilt(
+        const context& ctxt,
+        BuildMode mode,
+        uint32_t num,
+        real buildTime,
+        bool isCached)
+    {
+        m_buildStats = BuildStatistics();
+        m_buildStats.mode = mode;
+        m_buildStats.primNum = num;
+        m_buildStats.buildTime = buildTime;
+
+        collectBuildStatistics();
+
+        m_triBatch.clear();
+
+        if (isEnabledTriangleBatch()) {
+            std::vector<const AT_NAME::face*> triangles;
+
+            if (buildTriangleBatch(ctxt, m_root, triangles) && !m_root->isLeaf()) {
+                m_root->m_triBatchIdx = m_triBatch.add(ctxt, &triangles[0], (int)triangles.size());
+            }
+        }
+
+        if (s_enableBuildReport) {
+            AT_PRINTF("BVH(%s%s) %f[ms] : prims %d nodes %d leaves %d depth %d SAH %f\n",
+                mode == BuildMode::Binned ? "Binned" : "Sweep",
+                isCached ? ", Cached" : "",
+                m_buildStats.buildTime,
+                m_buildStats.primNum,
+                m_buildStats.nodeNum,
+                m_buildStats.leafNum,
+                m_buildStats.maxDepth,
+                m_buildStats.sahCost);
+        }
+    }
+
+    bool bvh::buildTriangleBatch(
+        const context& ctxt,
+        bvhnode* node,
+        std::vector<const AT_NAME::face*>& triangles)
+    {
+        triangles.clear();
+
+        if (node->isLeaf()) {
+            auto item = node->m_item;
+
+            if (node->m_childrenNum == 0 && item && TriangleBatch::isBatchable(item)) {
+                triangles.push_back(static_cast<const AT_NAME::face*>(item));
+                return true;
+            }
+
+            return false;
+        }
+
+        std::vector<const AT_NAME::face*> left;
+        std::vector<const AT_NAME::face*> right;
+
+        bool isLeftBatchable = node->m_left ? buildTriangleBatch(ctxt, node->m_left, left) : true;
+        bool isRightBatchable = node->m_right ? buildTriangleBatch(ctxt, node->m_right, right) : true;
+
+        if (isLeftBatchable && isRightBatchable
+            && left.size() + right.size() <= TriangleBatch::MaxTriangleNum)
+        {
+            // The parent may take all triangles in the larger batch.
+            triangles.insert(triangles.end(), left.begin(), left.end());
+            triangles.insert(triangles.end(), right.begin(), right.end());
+            return true;
+        }
+
+        // The batch for the single leaf doesn't reduce any test.
+        if (isLeftBatchable && node->m_left && !node->m_left->isLeaf()) {
+            node->m_left->m_triBatchIdx = m_triBatch.add(ctxt, &left[0], (int)left.size());
+        }
+        if (isRightBatchable && node->m_right && !node->m_right->isLeaf()) {
+            node->m_right->m_triBatchIdx = m_triBatch.add(ctxt, &right[0], (int)right.size());
+        }
+
+        return false;
+    }
+
+    bool bvh::hitTriangleBatch(
+        const bvhnode* node,
+        const ray& r,
+        real t_min, real t_max,
+        Intersection& isect,
+        bool isAnyHit)
+    {
+        if (!node->getBoundingbox().hit(r, t_min, t_max)) {
+            return false;
+        }
+
+        return node->m_bvh->m_triBatch.hit(node->m_triBatchIdx, r, t_min, t_max, isect, isAnyHit);
+    }
+
+    void bvh::collectBuildStatistics()
+    {
+        if (!m_root) {
+            return;
+        }
+
+        // Triangleとrayのヒットにかかる処理時間の見積もり.
+        static const real T_tri = 1;
+
+        // AABBとrayのヒットにかかる処理時間の見積もり.
+        static const real T_aabb = 1;
+
+        auto rootSurfaceArea = m_root->getBoundingbox().computeSurfaceArea();
+        rootSurfaceArea = (rootSurfaceArea > real(0) ? rootSurfaceArea : real(1));
+
+        std::vector<std::pair<const bvhnode*, uint32_t>> stack;
+        stack.push_back(std::make_pair(m_root, 0));
+
+        while (!stack.empty()) {
+            auto node = stack.back().first;
+            auto depth = stack.back().second;
+            stack.pop_back();
+
+            auto area = node->getBoundingbox().computeSurfaceArea() / rootSurfaceArea;
+
+            m_buildStats.nodeNum++;
+            m_buildStats.maxDepth = std::max(m_buildStats.maxDepth, depth);
+
+            if (node->isLeaf()) {
+                m_buildStats.leafNum++;
+                m_buildStats.sahCost += T_tri * area;
+            }
+            else {
+                m_buildStats.sahCost += T_aabb * area;
+
+                if (node->m_left) {
+                    stack.push_back(std::make_pair(node->m_left, depth + 1));
+                }
+                if (node->m_right) {
+                    stack.push_back(std::make_pair(node->m_right, depth + 1));
+                }
+            }
+        }
     }
 
     bool bvh::hit(
@@ -202,6 +455,15 @@ namespace aten {
         return isHit;
     }
 
+    bool bvh::occluded(
+        const context& ctxt,
+        const ray& r,
+        real t_min, real t_max) const
+    {
+        bool isHit = onOccluded(ctxt, m_root, r, t_min, t_max);
+        return isHit;
+    }
+
     bool bvh::onHit(
         const context& ctxt,
         const bvhnode* root,
@@ -225,7 +487,13 @@ namespace aten {
 
             stackpos -= 1;
 
-            if (node->isLeaf()) {
+            if (node->m_triBatchIdx >= 0) {
+                // Test all triangles under the node at once.
+                if (hitTriangleBatch(node, r, t_min, t_max, isect, false)) {
+                    t_max = isect.t;
+                }
+            }
+            else if (node->isLeaf()) {
                 Intersection isectTmp;
                 if (node->hit(ctxt, r, t_min, t_max, isectTmp)) {
                     if (isectTmp.t < isect.t) {
@@ -254,6 +522,55 @@ namespace aten {
         return (isect.objid >= 0);
     }
 
+    bool bvh::onOccluded(
+        const context& ctxt,
+        const bvhnode* root,
+        const ray& r,
+        real t_min, real t_max)
+    {
+        static const uint32_t stacksize = 64;
+        const bvhnode* stackbuf[stacksize];
+
+        stackbuf[0] = root;
+        int stackpos = 1;
+
+        while (stackpos > 0) {
+            auto node = stackbuf[stackpos - 1];
+
+            stackpos -= 1;
+
+            if (node->m_triBatchIdx >= 0) {
+                Intersection isect;
+                if (hitTriangleBatch(node, r, t_min, t_max, isect, true)) {
+                    return true;
+                }
+            }
+            else if (node->isLeaf()) {
+                // Any hit is enough, so we don't need to find the closest one.
+                if (node->occluded(ctxt, r, t_min, t_max)) {
+                    return true;
+                }
+            }
+            else {
+                if (node->getBoundingbox().hit(r, t_min, t_max)) {
+                    if (node->m_left) {
+                        stackbuf[stackpos++] = node->m_left;
+                    }
+                    if (node->m_right) {
+                        stackbuf[stackpos++] = node->m_right;
+                    }
+
+                    if (stackpos > stacksize) {
+                        AT_ASSERT(false);
+                        return false;
+                    }
+                }
+            }
+        }
+
+        return false;
+    }
+
     template<typename T>
     static void pop_front(std::vector<T>& vec)
     {
@@ -266,7 +583,8 @@ namespace aten {
         hitable** list,
         uint32_t num,
         int depth/*= 0*/,
-        bvhnode* parent/*= nullptr*/)
+        bvhnode* parent/*= nullptr*/,
+        std::vector<SubTreeTask>* subTrees/*= nullptr*/)
     {
         // NOTE
         // http://qiita.com/omochi64/items/9336f57118ba918f82ec
@@ -275,6 +593,20 @@ namespace aten {
         // ある？
         AT_ASSERT(num > 0);
 
+        if (subTrees && num <= m_subTreeThreshold) {
+            // 十分小さいので、後で並列に構築する.
+            SubTreeTask task;
+            task.node = root;
+            task.parent = parent;
+            task.list = list;
+            task.num = num;
+            task.depth = depth;
+
+            subTrees->push_back(task);
+
+            return;
+        }
+
         // 全体を覆うAABBを計算.
         root->m_aabb = list[0]->getBoundingbox();
         for (uint32_t i = 1; i < num; i++) {
@@ -340,12 +672,9 @@ namespace aten {
             std::vector<real> s1SurfaceArea(num + 1, AT_MATH_INF);
             std::vector<real> s2SurfaceArea(num + 1, AT_MATH_INF);
 
-            // 分割された2つの領域.
-            std::vector<hitable*> s1;                    // 右側.
-            std::vector<hitable*> s2(list, list + num);    // 左側.
-
             // NOTE
-            // s2側から取り出して、s1に格納するため、s2にリストを全部入れる.
+            // ソート済みなので、s1側は list[0, i)、s2側は list[i, num) になる.
+            // 個数だけ分かればいいので、リストを実際に移動させる必要はない.
 
             aabb s1bbox;
 
@@ -353,14 +682,10 @@ namespace aten {
             for (uint32_t i = 0; i <= num; i++) {
                 s1SurfaceArea[i] = s1bbox.computeSurfaceArea();
 
-                if (s2.size() > 0) {
+                if (i < num) {
                     // s2側で、axis について最左 (最小位置) にいるポリゴンをs1の最右 (最大位置) に移す
-                    auto p = s2.front();
-                    s1.push_back(p);
-                    pop_front(s2);
-
                     // 移したポリゴンのAABBをマージしてs1のAABBとする.
-                    auto bbox = p->getBoundingbox();
+                    auto bbox = list[i]->getBoundingbox();
                     s1bbox = aabb::merge(s1bbox, bbox);
                 }
             }
@@ -371,10 +696,13 @@ namespace aten {
             for (int i = num; i >= 0; i--) {
                 s2SurfaceArea[i] = s2bbox.computeSurfaceArea();
 
-                if (s1.size() > 0 && s2.size() > 0) {
+                const uint32_t s1Num = i;
+                const uint32_t s2Num = num - i;
+
+                if (s1Num > 0 && s2Num > 0) {
                     // SAH-based cost の計算.
                     auto cost =    2 * T_aabb
-                        + (s1SurfaceArea[i] * s1.size() + s2SurfaceArea[i] * s2.size()) * T_tri / rootSurfaceArea;
+                        + (s1SurfaceArea[i] * s1Num + s2SurfaceArea[i] * s2Num) * T_tri / rootSurfaceArea;
 
                     // 最良コストが更新されたか.
                     if (cost < bestCost) {
@@ -384,17 +712,10 @@ namespace aten {
                     }
                 }
 
-                if (s1.size() > 0) {
+                if (s1Num > 0) {
                     // s1側で、axis について最右にいるポリゴンをs2の最左に移す.
-                    auto p = s1.back();
-                    
-                    // 先頭に挿入.
-                    s2.insert(s2.begin(), p); 
-
-                    s1.pop_back();
-
                     // 移したポリゴンのAABBをマージしてS2のAABBとする.
-                    auto bbox = p->getBoundingbox();
+                    auto bbox = list[i - 1]->getBoundingbox();
                     s2bbox = aabb::merge(s2bbox, bbox);
                 }
             }
@@ -419,8 +740,8 @@ namespace aten {
             AT_ASSERT(rightListNum > 0);
 
             // 再帰処理
-            buildBySAH(root->m_left, list, leftListNum, depth + 1, root->m_left);
-            buildBySAH(root->m_right, list + leftListNum, rightListNum, depth + 1, root->m_right);
+            buildBySAH(root->m_left, list, leftListNum, depth + 1, root->m_left, subTrees);
+            buildBySAH(root->m_right, list + leftListNum, rightListNum, depth + 1, root->m_right, subTrees);
         }
 #else
         struct BuildInfo {
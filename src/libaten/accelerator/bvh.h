@@ -7,6 +7,7 @@
 #include "geometry/transformable.h"
 #include "geometry/object.h"
 #include "accelerator/accelerator.h"
+#include "accelerator/triangle_batch.h"
 
 namespace aten {
     class bvh;
@@ -31,6 +32,14 @@ namespace aten {
             real t_min, real t_max,
             Intersection& isect) const;
 
+        /**
+         * @brief Test if a ray is occluded by any object under the node.
+         */
+        bool occluded(
+            const context& ctxt,
+            const ray& r,
+            real t_min, real t_max) const;
+
         /**
          * @brief Return a AABB which the node has.
          */
@@ -223,6 +232,15 @@ namespace aten {
          */
         static void refitChildren(bvhnode* node, bool propagate);
 
+        /**
+         * @brief Return the index of the triangle batch which covers all triangles under the node.
+         * If the node doesn't have the batch, return -1.
+         */
+        int getTriangleBatchIdx() const
+        {
+            return m_triBatchIdx;
+        }
+
         void setIsCandidate(bool c)
         {
             m_isCandidate = c;
@@ -270,10 +288,16 @@ namespace aten {
         // Depth in the tree which the node belonges to
         int m_depth{ 0 };
 
+        // Index of the triangle batch which covers all triangles under the node.
+        int m_triBatchIdx{ -1 };
+
         // BVH which the node belongs to.
         bvh* m_bvh{ nullptr };
 
         bool m_isCandidate{ false };
+
+        // Flag whether the node is already gathered in the bulk refit.
+        bool m_isDirty{ false };
     };
 
     //////////////////////////////////////////////
@@ -286,11 +310,123 @@ namespace aten {
         friend class accelerator;
         friend class ThreadedBVH;
 
+    public:
+        /**
+         * @enum BuildMode
+         * @brief Algorithm to build the tree.
+         */
+        enum class BuildMode {
+            Sweep,      ///< Full sweep SAH over the sorted primitives.
+            Binned,     ///< Binned SAH over the primitive centroids.
+
+            Default,    ///< Default mode.
+        };
+
+        /**
+         * @brief Statistics about the built tree.
+         */
+        struct BuildStatistics {
+            BuildMode mode{ BuildMode::Sweep };
+
+            real buildTime{ real(0) };  ///< Elapsed time to build [msec].
+            real sahCost{ real(0) };    ///< SAH cost of the whole tree.
+
+            uint32_t primNum{ 0 };      ///< Count of primitives.
+            uint32_t nodeNum{ 0 };      ///< Count of all nodes.
+            uint32_t leafNum{ 0 };      ///< Count of leaf nodes.
+            uint32_t maxDepth{ 0 };     ///< Max depth of the tree.
+        };
+
+        /**
+         * @brief Statistics about the last update.
+         */
+        struct UpdateStatistics {
+            real updateTime{ real(0) }; ///< Elapsed time to update [msec].
+
+            uint32_t leafNum{ 0 };      ///< Count of the changed leaf nodes.
+            uint32_t refitNum{ 0 };     ///< Count of the re-fitted internal nodes.
+            uint32_t rotationNum{ 0 };  ///< Count of the performed rotations.
+        };
+
     public:
         bvh() : accelerator(AccelType::Bvh) {}
         virtual ~bvh() {}
 
     public:
+        /**
+         * @brief Set the default build mode which is used if the build mode is not specified.
+         */
+        static void setDefaultBuildMode(BuildMode mode)
+        {
+            AT_ASSERT(mode != BuildMode::Default);
+            s_defaultBuildMode = mode;
+        }
+
+        /**
+         * @brief Return the default build mode.
+         */
+        static BuildMode getDefaultBuildMode()
+        {
+            return s_defaultBuildMode;
+        }
+
+        /**
+         * @brief Specify whether the statistics about the built tree is printed after building.
+         */
+        static void enableBuildReport(bool enable)
+        {
+            s_enableBuildReport = enable;
+        }
+
+        /**
+         * @brief Set the build mode.
+         */
+        void setBuildMode(BuildMode mode)
+        {
+            m_buildMode = mode;
+        }
+
+        /**
+         * @brief Return the build mode.
+         */
+        BuildMode getBuildMode() const
+        {
+            return (m_buildMode == BuildMode::Default ? s_defaultBuildMode : m_buildMode);
+        }
+
+        /**
+         * @brief Return the statistics about the built tree.
+         */
+        const BuildStatistics& getBuildStatistics() const
+        {
+            return m_buildStats;
+        }
+
+        /**
+         * @brief Specify whether the tree is rotated to recover the quality in updating.
+         * If the rotation is disabled, the structure of the tree is never changed in updating.
+         */
+        void enableRotation(bool enable)
+        {
+            m_enableRotation = enable;
+        }
+
+        /**
+         * @brief Return whether the tree is rotated in updating.
+         */
+        bool isEnabledRotation() const
+        {
+            return m_enableRotation;
+        }
+
+        /**
+         * @brief Return the statistics about the last update.
+         */
+        const UpdateStatistics& getUpdateStatistics() const
+        {
+            return m_updateStats;
+        }
+
         /**
          * @brief Bulid structure tree from the specified list.
          */
@@ -300,6 +436,29 @@ namespace aten {
             uint32_t num,
             aabb* bbox) override;
 
+        /**
+         * @brief Return the value of the build settings which change the built structure tree.
+         */
+        virtual uint32_t getCacheSettings() const override;
+
+        /**
+         * @brief Register the built structure data to the cache writer.
+         */
+        virtual bool exportCache(
+            const context& ctxt,
+            hitable** list,
+            uint32_t num,
+            AccelCache::Writer& writer) override;
+
+        /**
+         * @brief Restore the structure tree from the cache instead of building it.
+         */
+        virtual bool importCache(
+            const context& ctxt,
+            hitable** list,
+            uint32_t num,
+            const AccelCache::Reader& reader) override;
+
         /**
          * @brief Test if a ray hits a object.
          */
@@ -322,6 +481,14 @@ namespace aten {
             return hit(ctxt, r, t_min, t_max, isect);
         }
 
+        /**
+         * @brief Test if a ray is occluded by any object.
+         */
+        virtual bool occluded(
+            const context& ctxt,
+            const ray& r,
+            real t_min, real t_max) const override;
+
         /**
          * @brief Return AABB.
          */
@@ -451,9 +618,19 @@ namespace aten {
 
         /**
          * @brief Update the tree.
+         * The changed leaf nodes and their ancestors are re-fitted in bulk,
+         * and then the tree is rotated if the rotation is enabled.
          */
         virtual void update() override;
 
+        /**
+         * @brief Update the structure tree.
+         */
+        virtual void update(const context& ctxt) override
+        {
+            update();
+        }
+
     private:
         /**
          * @brief Register the node which will be re-fitted.
@@ -463,6 +640,12 @@ namespace aten {
             m_refitNodes.push_back(node);
         }
 
+        /**
+         * @brief Re-fit the registered leaf nodes and all their ancestors.
+         * The ancestors are gathered per depth, and re-fitted from the deepest level to the root in parallel per level.
+         */
+        void refit();
+
         /**
          * @brief Test whether a ray is hit to a object.
          */
@@ -473,15 +656,124 @@ namespace aten {
             real t_min, real t_max,
             Intersection& isect);
 
+        /**
+         * @brief Test whether a ray is occluded by any object.
+         * Unlike onHit, it terminates at the first hit.
+         */
+        static bool onOccluded(
+            const context& ctxt,
+            const bvhnode* root,
+            const ray& r,
+            real t_min, real t_max);
+
+        /**
+         * @brief Reference to the primitive for the binned SAH build.
+         */
+        struct PrimitiveRef {
+            hitable* item{ nullptr };
+            aabb bbox;
+            vec3 centroid;
+        };
+
+        /**
+         * @brief Sub tree which is deferred to build in parallel.
+         */
+        struct SubTreeTask {
+            bvhnode* node{ nullptr };
+            bvhnode* parent{ nullptr };
+
+            // Primitives list for the sweep build.
+            hitable** list{ nullptr };
+
+            // Primitives list for the binned build.
+            PrimitiveRef* refs{ nullptr };
+
+            uint32_t num{ 0 };
+            int depth{ 0 };
+        };
+
         /**
          * @brief Build the tree with Sufrace Area Heuristic.
+         * @param [out] subTrees If it is specified, the sub trees which are small enough are not built but stored to it.
          */
         void buildBySAH(
             bvhnode* root,
             hitable** list,
             uint32_t num,
             int depth,
-            bvhnode* parent);
+            bvhnode* parent,
+            std::vector<SubTreeTask>* subTrees = nullptr);
+
+        /**
+         * @brief Build the tree with binned Sufrace Area Heuristic.
+         * @param [out] subTrees If it is specified, the sub trees which are small enough are not built but stored to it.
+         */
+        void buildByBinnedSAH(
+            bvhnode* root,
+            PrimitiveRef* refs,
+            uint32_t num,
+            int depth,
+            bvhnode* parent,
+            std::vector<SubTreeTask>* subTrees = nullptr);
+
+        /**
+         * @brief Build the deferred sub trees in parallel.
+         */
+        void buildSubTrees(
+            BuildMode mode,
+            std::vector<SubTreeTask>& subTrees);
+
+        /**
+         * @brief Find the best split position with binned Sufrace Area Heuristic.
+         * @param [in] refs Primitives list in the node.
+         * @param [in] num Count of the primitives.
+         * @param [in] centroidBox AABB which covers all primitives' centroids.
+         * @param [out] axis Axis (xyz) along which the split will run.
+         * @param [out] splitBin Index of the bin to split.
+         * @return If the split is found, return true.
+         */
+        bool findBinnedSplit(
+            const PrimitiveRef* refs,
+            uint32_t num,
+            const aabb& centroidBox,
+            int& axis,
+            int& splitBin) const;
+
+        /**
+         * @brief Finish building the tree. The statistics and the triangle batches are built from the tree.
+         * @param [in] isCached Whether the tree is loaded from the cache.
+         */
+        void onBuilt(
+            const context& ctxt,
+            BuildMode mode,
+            uint32_t num,
+            real buildTime,
+            bool isCached);
+
+        /**
+         * @brief Collect the statistics about the built tree.
+         */
+        void collectBuildStatistics();
+
+        /**
+         * @brief Register the triangles under the largest sub trees which fit in the batch.
+         * @param [out] triangles Triangles under the node, if all of them can be put into one batch.
+         * @return If all items under the node can be put into one batch, return true.
+         */
+        bool buildTriangleBatch(
+            const context& ctxt,
+            bvhnode* node,
+            std::vector<const AT_NAME::face*>& triangles);
+
+        /**
+         * @brief Test the triangle batch which the node has.
+         */
+        static bool hitTriangleBatch(
+            const bvhnode* node,
+            const ray& r,
+            real t_min, real t_max,
+            Intersection& isect,
+            bool isAnyHit);
 
         struct Candidate {
             bvhnode* node{ nullptr };
@@ -510,5 +802,38 @@ namespace aten {
 
         // Array of the node which will be re-fitted.
         std::vector<bvhnode*> m_refitNodes;
+
+        // Array of the node which were re-fitted in the last update.
+        std::vector<bvhnode*> m_refittedNodes;
+
+        // Flag whether the tree is rotated in updating.
+        bool m_enableRotation{ true };
+
+        // Statistics about the last update.
+        UpdateStatistics m_updateStats;
+
+        // Algorithm to build the tree.
+        BuildMode m_buildMode{ BuildMode::Default };
+
+        // Statistics about the built tree.
+        BuildStatistics m_buildStats;
+
+        // Sub trees which have primitives less than this are built in parallel.
+        uint32_t m_subTreeThreshold{ 0 };
+
+        // Triangles which are tested together in the small sub trees.
+        TriangleBatch m_triBatch;
+
+        // Count of bins for binned SAH.
+        static const uint32_t BinNum = 32;
+
+        // Bin the primitives in parallel if the node has primitives more than this.
+        static const uint32_t ParallelBinningThreshold = 64 * 1024;
+
+        // Re-fit the nodes in one level in parallel if the level has nodes more than this.
+        static const uint32_t ParallelRefitThreshold = 256;
+
+        static BuildMode s_defaultBuildMode;
+        static bool s_enableBuildReport;
     };
 }
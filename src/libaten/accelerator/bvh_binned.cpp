@@ -0,0 +1,299 @@
+#include "accelerator/bvh.h"
+#include "misc/omputil.h"
+
+#include <algorithm>
+#include <vector>
+
+// NOTE
+// On fast Construction of SAH-based Bounding Volume Hierarchies.
+// http://www.sci.utah.edu/~wald/Publications/2007/ParallelBVHBuild/fastbuild.pdf
+
+namespace aten
+{
+    // Compute the index of the bin to which the specified centroid belongs.
+    inline int computeBinIdx(
+        real centroid,
+        real centroidMin,
+        real scale,
+        uint32_t binNum)
+    {
+        int idx = (int)((centroid - centroidMin) * scale);
+        idx = aten::clamp<int>(idx, 0, binNum - 1);
+        return idx;
+    }
+
+    inline int findLongestCentroidAxis(const aabb& bbox)
+    {
+        auto size = bbox.size();
+
+        auto maxAxis = std::max(std::max(size.x, size.y), size.z);
+
+        auto axis = (maxAxis == size.x
+            ? 0
+            : maxAxis == size.y ? 1 : 2);
+
+        return axis;
+    }
+
+    // Compute the range of the primitives which the specified thread processes.
+    inline void computeThreadRange(
+        uint32_t num,
+        int threadIdx,
+        int threadNum,
+        uint32_t& start,
+        uint32_t& end)
+    {
+        start = (uint32_t)(((uint64_t)num * threadIdx) / threadNum);
+        end = (uint32_t)(((uint64_t)num * (threadIdx + 1)) / threadNum);
+    }
+
+    bool bvh::findBinnedSplit(
+        const PrimitiveRef* refs,
+        uint32_t num,
+        const aabb& centroidBox,
+        int& axis,
+        int& splitBin) const
+    {
+        struct Bin {
+            aabb bbox;
+            uint32_t num{ 0 };
+        };
+
+        struct BinSet {
+            Bin bins[3][BinNum];
+        };
+
+        // Surface area of the right side which is accumulated from the last bin.
+        real rightArea[BinNum];
+        uint32_t rightNum[BinNum];
+
+        const auto& centroidMin = centroidBox.minPos();
+        const auto& centroidMax = centroidBox.maxPos();
+
+        real scale[3];
+
+        for (int dim = 0; dim < 3; dim++) {
+            const auto extent = centroidMax[dim] - centroidMin[dim];
+            scale[dim] = (extent > real(0) ? BinNum / extent : real(0));
+        }
+
+        // Distribute the primitives to the bins of all axes based on the centroids.
+        // Merging the bins is order independent, so the result is same as the serial one.
+        const auto threadNum = OMPUtil::getParallelThreadNum(num, ParallelBinningThreshold);
+
+        // Avoid the allocation if we process it serially.
+        BinSet localBinSet;
+        std::vector<BinSet> parallelBinSets(threadNum > 1 ? threadNum : 0);
+
+        BinSet* binSets = (threadNum > 1 ? &parallelBinSets[0] : &localBinSet);
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for num_threads(threadNum) if(threadNum > 1)
+#endif
+        for (int t = 0; t < threadNum; t++) {
+            auto& binSet = binSets[t];
+
+            uint32_t start, end;
+            computeThreadRange(num, t, threadNum, start, end);
+
+            for (uint32_t i = start; i < end; i++) {
+                const auto& ref = refs[i];
+
+                for (int dim = 0; dim < 3; dim++) {
+                    auto binIdx = computeBinIdx(ref.centroid[dim], centroidMin[dim], scale[dim], BinNum);
+
+                    binSet.bins[dim][binIdx].num++;
+                    binSet.bins[dim][binIdx].bbox.expand(ref.bbox);
+                }
+            }
+        }
+
+        for (int t = 1; t < threadNum; t++) {
+            for (int dim = 0; dim < 3; dim++) {
+                for (uint32_t i = 0; i < BinNum; i++) {
+                    binSets[0].bins[dim][i].num += binSets[t].bins[dim][i].num;
+                    binSets[0].bins[dim][i].bbox.expand(binSets[t].bins[dim][i].bbox);
+                }
+            }
+        }
+
+        real bestCost = AT_MATH_INF;
+
+        axis = -1;
+        splitBin = -1;
+
+        for (int dim = 0; dim < 3; dim++) {
+            // Skip the axis which has no extent.
+            if (scale[dim] <= real(0)) {
+                continue;
+            }
+
+            const auto& bins = binSets[0].bins[dim];
+
+            // Accumulate the right side from the last bin.
+            {
+                aabb accum;
+                uint32_t accumNum = 0;
+
+                for (int i = BinNum - 1; i > 0; i--) {
+                    accum.expand(bins[i].bbox);
+                    accumNum += bins[i].num;
+
+                    rightArea[i] = (accumNum > 0 ? accum.computeSurfaceArea() : real(0));
+                    rightNum[i] = accumNum;
+                }
+            }
+
+            // Sweep the left side and evaluate SAH cost at each bin boundary.
+            aabb leftBox;
+            uint32_t leftNum = 0;
+
+            for (uint32_t i = 0; i < BinNum - 1; i++) {
+                leftBox.expand(bins[i].bbox);
+                leftNum += bins[i].num;
+
+                if (leftNum == 0 || rightNum[i + 1] == 0) {
+                    continue;
+                }
+
+                auto cost = leftBox.computeSurfaceArea() * leftNum
+                    + rightArea[i + 1] * rightNum[i + 1];
+
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    axis = dim;
+                    splitBin = (int)i;
+                }
+            }
+        }
+
+        return (axis >= 0);
+    }
+
+    void bvh::buildByBinnedSAH(
+        bvhnode* root,
+        PrimitiveRef* refs,
+        uint32_t num,
+        int depth,
+        bvhnode* parent,
+        std::vector<SubTreeTask>* subTrees/*= nullptr*/)
+    {
+        AT_ASSERT(num > 0);
+
+        if (subTrees && num <= m_subTreeThreshold) {
+            // Small enough, so defer to build it in parallel.
+            SubTreeTask task;
+            task.node = root;
+            task.parent = parent;
+            task.refs = refs;
+            task.num = num;
+            task.depth = depth;
+
+            subTrees->push_back(task);
+
+            return;
+        }
+
+        // Compute AABB which covers all primitives and their centroids.
+        aabb centroidBox;
+
+        root->m_aabb = refs[0].bbox;
+
+        const auto threadNum = OMPUtil::getParallelThreadNum(num, ParallelBinningThreshold);
+
+        if (threadNum > 1) {
+            std::vector<aabb> bboxes(threadNum);
+            std::vector<aabb> centroidBoxes(threadNum);
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for num_threads(threadNum)
+#endif
+            for (int t = 0; t < threadNum; t++) {
+                uint32_t start, end;
+                computeThreadRange(num, t, threadNum, start, end);
+
+                for (uint32_t i = start; i < end; i++) {
+                    bboxes[t].expand(refs[i].bbox);
+                    centroidBoxes[t].expand(refs[i].centroid);
+                }
+            }
+
+            for (int t = 0; t < threadNum; t++) {
+                root->m_aabb.expand(bboxes[t]);
+                centroidBox.expand(centroidBoxes[t]);
+            }
+        }
+        else {
+            for (uint32_t i = 0; i < num; i++) {
+                root->m_aabb.expand(refs[i].bbox);
+                centroidBox.expand(refs[i].centroid);
+            }
+        }
+
+        if (num == 1) {
+            root->m_left = new bvhnode(parent, refs[0].item, this);
+
+            root->m_left->setBoundingBox(refs[0].bbox);
+            root->m_left->setDepth(depth + 1);
+
+            return;
+        }
+        else if (num == 2) {
+            int axis = findLongestCentroidAxis(centroidBox);
+
+            if (refs[1].centroid[axis] < refs[0].centroid[axis]) {
+                std::swap(refs[0], refs[1]);
+            }
+
+            root->m_left = new bvhnode(parent, refs[0].item, this);
+            root->m_right = new bvhnode(parent, refs[1].item, this);
+
+            root->m_left->setBoundingBox(refs[0].bbox);
+            root->m_right->setBoundingBox(refs[1].bbox);
+
+            root->m_left->setDepth(depth + 1);
+            root->m_right->setDepth(depth + 1);
+
+            return;
+        }
+
+        int axis = -1;
+        int splitBin = -1;
+
+        uint32_t leftNum = 0;
+
+        if (findBinnedSplit(refs, num, centroidBox, axis, splitBin)) {
+            const auto centroidMin = centroidBox.minPos()[axis];
+            const real scale = BinNum / (centroidBox.maxPos()[axis] - centroidMin);
+
+            auto mid = std::partition(
+                refs, refs + num,
+                [&](const PrimitiveRef& ref) {
+                return computeBinIdx(ref.centroid[axis], centroidMin, scale, BinNum) <= splitBin;
+            });
+
+            leftNum = (uint32_t)(mid - refs);
+        }
+
+        if (leftNum == 0 || leftNum == num) {
+            // All centroids fall into the same bin, so split at the median.
+            axis = findLongestCentroidAxis(centroidBox);
+            leftNum = num / 2;
+
+            std::nth_element(
+                refs, refs + leftNum, refs + num,
+                [axis](const PrimitiveRef& a, const PrimitiveRef& b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+        }
+
+        root->m_left = new bvhnode(root, nullptr, this);
+        root->m_right = new bvhnode(root, nullptr, this);
+
+        root->m_left->setDepth(depth + 1);
+        root->m_right->setDepth(depth + 1);
+
+        buildByBinnedSAH(root->m_left, refs, leftNum, depth + 1, root->m_left, subTrees);
+        buildByBinnedSAH(root->m_right, refs + leftNum, num - leftNum, depth + 1, root->m_right, subTrees);
+    }
+}
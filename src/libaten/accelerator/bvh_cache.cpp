@@ -0,0 +1,180 @@
+#include <unordered_map>
+#include <vector>
+
+#include "accelerator/bvh.h"
+#include "misc/timer.h"
+
+namespace aten {
+    // Sections in the cache file for bvh.
+    enum BvhCacheSection : uint32_t {
+        BvhCacheNodes = 0,
+    };
+
+    /**
+     * @brief Node of bvh in the cache file. The nodes are stored in pre-order, so the root is the first.
+     */
+    struct BvhCacheNode {
+        real boxmin[3];
+        int32_t parent;     ///< Index of the parent node. If it doesn't exist, -1.
+
+        real boxmax[3];
+        int32_t item;       ///< Index of the item in the list. If the node is not leaf, -1.
+
+        int32_t left;       ///< Index of the left child. If it doesn't exist, -1.
+        int32_t right;      ///< Index of the right child. If it doesn't exist, -1.
+        int32_t depth;
+        int32_t padding;
+    };
+
+    uint32_t bvh::getCacheSettings() const
+    {
+        // The layout of the node is also taken into account, because the tree is restored from it directly.
+        return ((uint32_t)sizeof(BvhCacheNode) << 8) | (uint32_t)getBuildMode();
+    }
+
+    bool bvh::exportCache(
+        const context& ctxt,
+        hitable** list,
+        uint32_t num,
+        AccelCache::Writer& writer)
+    {
+        if (!m_root) {
+            return false;
+        }
+
+        std::unordered_map<const hitable*, int32_t> itemIndices;
+        for (uint32_t i = 0; i < num; i++) {
+            itemIndices.insert(std::make_pair(list[i], (int32_t)i));
+        }
+
+        // Gather the nodes in pre-order.
+        std::vector<bvhnode*> nodes;
+        std::unordered_map<const bvhnode*, int32_t> nodeIndices;
+        {
+            std::vector<bvhnode*> stack;
+            stack.push_back(m_root);
+
+            while (!stack.empty()) {
+                auto node = stack.back();
+                stack.pop_back();
+
+                nodeIndices.insert(std::make_pair(node, (int32_t)nodes.size()));
+                nodes.push_back(node);
+
+                if (node->m_right) {
+                    stack.push_back(node->m_right);
+                }
+                if (node->m_left) {
+                    stack.push_back(node->m_left);
+                }
+            }
+        }
+
+        auto findNode = [&](const bvhnode* node) {
+            auto found = nodeIndices.find(node);
+            return (found != nodeIndices.end() ? found->second : -1);
+        };
+
+        std::vector<BvhCacheNode> cacheNodes(nodes.size());
+
+        for (size_t i = 0; i < nodes.size(); i++) {
+            const auto node = nodes[i];
+            auto& dst = cacheNodes[i];
+
+            const auto& bbox = node->getBoundingbox();
+            const auto& boxmin = bbox.minPos();
+            const auto& boxmax = bbox.maxPos();
+
+            dst.boxmin[0] = boxmin.x;
+            dst.boxmin[1] = boxmin.y;
+            dst.boxmin[2] = boxmin.z;
+
+            dst.boxmax[0] = boxmax.x;
+            dst.boxmax[1] = boxmax.y;
+            dst.boxmax[2] = boxmax.z;
+
+            dst.parent = findNode(node->m_parent);
+            dst.left = findNode(node->m_left);
+            dst.right = findNode(node->m_right);
+            dst.depth = node->m_depth;
+            dst.padding = 0;
+
+            dst.item = -1;
+
+            if (node->m_item) {
+                auto found = itemIndices.find(node->m_item);
+                if (found == itemIndices.end() || node->m_childrenNum > 0) {
+                    // The item can't be referred from the cache.
+                    return false;
+                }
+                dst.item = found->second;
+            }
+        }
+
+        writer.add(BvhCacheNodes, cacheNodes);
+
+        return true;
+    }
+
+    bool bvh::importCache(
+        const context& ctxt,
+        hitable** list,
+        uint32_t num,
+        const AccelCache::Reader& reader)
+    {
+        timer timer;
+        timer.begin();
+
+        uint32_t nodeNum = 0;
+        const auto cacheNodes = reader.get<BvhCacheNode>(BvhCacheNodes, nodeNum);
+
+        if (!cacheNodes || nodeNum == 0) {
+            return false;
+        }
+
+        // Validate all indices before changing the tree.
+        for (uint32_t i = 0; i < nodeNum; i++) {
+            const auto& n = cacheNodes[i];
+
+            bool isValid = (-1 <= n.parent && n.parent < (int32_t)nodeNum)
+                && (-1 <= n.left && n.left < (int32_t)nodeNum)
+                && (-1 <= n.right && n.right < (int32_t)nodeNum)
+                && (-1 <= n.item && n.item < (int32_t)num);
+
+            if (!isValid) {
+                return false;
+            }
+        }
+
+        std::vector<bvhnode*> nodes(nodeNum);
+
+        for (uint32_t i = 0; i < nodeNum; i++) {
+            const auto& n = cacheNodes[i];
+            nodes[i] = new bvhnode(nullptr, n.item >= 0 ? list[n.item] : nullptr, this);
+        }
+
+        auto getNode = [&](int32_t idx) {
+            return (idx >= 0 ? nodes[idx] : nullptr);
+        };
+
+        for (uint32_t i = 0; i < nodeNum; i++) {
+            const auto& n = cacheNodes[i];
+            auto node = nodes[i];
+
+            node->m_parent = getNode(n.parent);
+            node->m_left = getNode(n.left);
+            node->m_right = getNode(n.right);
+            node->m_depth = n.depth;
+
+            node->m_aabb = aabb(
+                vec3(n.boxmin[0], n.boxmin[1], n.boxmin[2]),
+                vec3(n.boxmax[0], n.boxmax[1], n.boxmax[2]));
+        }
+
+        m_root = nodes[0];
+
+        onBuilt(ctxt, getBuildMode(), num, timer.end(), true);
+
+        return true;
+    }
+}
@@ -1,6 +1,8 @@
 #include "accelerator/bvh.h"
 #include "geometry/transformable.h"
 #include "geometry/object.h"
+#include "misc/omputil.h"
+#include "misc/timer.h"
 
 #include <random>
 #include <vector>
@@ -24,10 +26,8 @@ namespace aten
             bool isEqual = (memcmp(&oldBox, &m_aabb, sizeof(m_aabb)) == 0);
 
             if (!isEqual) {
-                if (m_parent) {
-                    refitChildren(m_parent, true);
-                }
-
+                // NOTE
+                // The ancestors are re-fitted in bulk in bvh::update.
                 m_bvh->addToRefit(this);
             }
         }
@@ -301,6 +301,8 @@ namespace aten
                 return;
             }
             else {
+                bvh->m_updateStats.rotationNum++;
+
                 // In order to swap we need to:
                 //    1. swap the node locations
                 //    2. update the depth (if child-to-grandchild)
@@ -390,8 +392,73 @@ namespace aten
         }
     }
 
+    void bvh::refit()
+    {
+        m_refittedNodes.clear();
+
+        // Gather the ancestors of the changed leaves per depth.
+        // If the node is already gathered, its ancestors are also already gathered.
+        std::vector<std::vector<bvhnode*>> levels;
+
+        for (auto leaf : m_refitNodes) {
+            if (leaf->m_isDirty) {
+                continue;
+            }
+
+            leaf->m_isDirty = true;
+            m_refittedNodes.push_back(leaf);
+
+            for (auto node = leaf->m_parent; node && !node->m_isDirty; node = node->m_parent) {
+                node->m_isDirty = true;
+
+                auto depth = node->getDepth();
+                AT_ASSERT(depth >= 0);
+
+                if (levels.size() <= (size_t)depth) {
+                    levels.resize(depth + 1);
+                }
+
+                levels[depth].push_back(node);
+            }
+        }
+
+        m_updateStats.leafNum = (uint32_t)m_refittedNodes.size();
+
+        // The children are always in the deeper level, so the levels are re-fitted from the deepest one.
+        for (int depth = (int)levels.size() - 1; depth >= 0; depth--) {
+            auto& nodes = levels[depth];
+            const int num = (int)nodes.size();
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for if (num > (int)ParallelRefitThreshold)
+#endif
+            for (int i = 0; i < num; i++) {
+                bvhnode::refitChildren(nodes[i], false);
+            }
+
+            m_refittedNodes.insert(m_refittedNodes.end(), nodes.begin(), nodes.end());
+
+            m_updateStats.refitNum += num;
+        }
+
+        for (auto node : m_refittedNodes) {
+            node->m_isDirty = false;
+        }
+    }
+
     void bvh::update()
     {
+        timer timer;
+        timer.begin();
+
+        m_updateStats = UpdateStatistics();
+
+        refit();
+
+        if (!m_enableRotation) {
+            m_refitNodes.clear();
+        }
+
         std::vector<bvhnode*> sweepNodes;
         sweepNodes.reserve(m_refitNodes.size());
 
@@ -423,5 +490,16 @@ namespace aten
                 node->tryRotate(this);
             }
         }
+
+        m_updateStats.updateTime = timer.end();
+
+        if (s_enableBuildReport && m_updateStats.leafNum > 0) {
+            AT_PRINTF("BVH update %f[ms] : leaves %d refit %d rotations %d (build %f[ms])\n",
+                m_updateStats.updateTime,
+                m_updateStats.leafNum,
+                m_updateStats.refitNum,
+                m_updateStats.rotationNum,
+                m_buildStats.buildTime);
+        }
     }
 }
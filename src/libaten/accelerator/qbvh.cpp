@@ -63,6 +63,45 @@ namespace aten
                 listBvhNode[i],
                 m_listQbvhNode[i]);
         }
+
+        m_triBatch.clear();
+        m_triBatchShapeIds.clear();
+        m_listTriBatchIdx.clear();
+
+        if (isEnabledTriangleBatch()) {
+            m_listTriBatchIdx.resize(m_listQbvhNode.size());
+
+            for (int i = 0; i < m_listQbvhNode.size(); i++) {
+                m_listTriBatchIdx[i].assign(m_listQbvhNode[i].size(), -1);
+
+                std::vector<const AT_NAME::face*> triangles;
+                int shapeid = -1;
+
+                if (buildTriangleBatch(ctxt, i, 0, triangles, shapeid)
+                    && !m_listQbvhNode[i][0].isLeaf)
+                {
+                    m_listTriBatchIdx[i][0] = m_triBatch.add(ctxt, &triangles[0], (int)triangles.size());
+                    m_triBatchShapeIds.push_back(shapeid);
+                }
+            }
+        }
+
+        m_simdType = SimdUtil::getType();
+
+        m_listQbvhNode8.clear();
+
+#ifndef ENABLE_BVH_MULTI_TRIANGLES
+        if (m_enableWideNode && m_simdType == SimdType::AVX2) {
+            m_listQbvhNode8.resize(m_listQbvhNode.size());
+
+            for (int i = 0; i < m_listQbvhNode.size(); i++) {
+                convertToWideNode(
+                    m_listQbvhNode[i],
+                    m_listTriBatchIdx.empty() ? nullptr : &m_listTriBatchIdx[i],
+                    m_listQbvhNode8[i]);
+            }
+        }
+#endif
     }
 
     void qbvh::registerBvhNodeToLinearList(
@@ -378,6 +417,208 @@ namespace aten
         return numChildren;
     }
 
+    bool qbvh::buildTriangleBatch(
+        const context& ctxt,
+        int exid,
+        int nodeIdx,
+        std::vector<const AT_NAME::face*>& triangles,
+        int& shapeid)
+    {
+        triangles.clear();
+
+        const auto& node = m_listQbvhNode[exid][nodeIdx];
+
+        if (node.isLeaf) {
+            if (node.exid < 0 && node.primid >= 0) {
+                triangles.push_back(ctxt.getTriangle((int)node.primid));
+                shapeid = (int)node.shapeid;
+                return true;
+            }
+
+            return false;
+        }
+
+        const int numChildren = (int)node.numChildren;
+        const int leftChildrenIdx = (int)node.leftChildrenIdx;
+
+        std::vector<const AT_NAME::face*> children[4];
+        bool isBatchable[4];
+        int shapeids[4];
+
+        bool isAllBatchable = true;
+        size_t triNum = 0;
+
+        for (int i = 0; i < numChildren; i++) {
+            isBatchable[i] = buildTriangleBatch(ctxt, exid, leftChildrenIdx + i, children[i], shapeids[i]);
+
+            isAllBatchable &= isBatchable[i];
+            triNum += children[i].size();
+        }
+
+        if (isAllBatchable && triNum <= TriangleBatch::MaxTriangleNum) {
+            // The parent may take all triangles in the larger batch.
+            for (int i = 0; i < numChildren; i++) {
+                triangles.insert(triangles.end(), children[i].begin(), children[i].end());
+            }
+            shapeid = shapeids[0];
+            return true;
+        }
+
+        for (int i = 0; i < numChildren; i++) {
+            const auto childIdx = leftChildrenIdx + i;
+
+            // The batch for the single leaf doesn't reduce any test.
+            if (isBatchable[i] && !m_listQbvhNode[exid][childIdx].isLeaf) {
+                m_listTriBatchIdx[exid][childIdx] = m_triBatch.add(ctxt, &children[i][0], (int)children[i].size());
+                m_triBatchShapeIds.push_back(shapeids[i]);
+            }
+        }
+
+        return false;
+    }
+
+    void qbvh::convertToWideNode(
+        const std::vector<QbvhNode>& listQbvhNode,
+        const std::vector<int>* listTriBatchIdx,
+        std::vector<QbvhNode8>& listQbvhNode8)
+    {
+        // NOTE
+        // Collapse the QBVH into the 8-wide tree.
+        // The interior child which has the largest surface area is replaced with its children,
+        // while the children fit in one 8-wide node.
+
+        struct Child {
+            uint32_t qbvhNodeIdx;
+            aten::vec3 bmin;
+            aten::vec3 bmax;
+        };
+
+        struct StackEntry {
+            uint32_t nodeIdx;
+            uint32_t qbvhNodeIdx;
+        };
+
+        listQbvhNode8.clear();
+
+        if (listQbvhNode.empty()) {
+            return;
+        }
+
+        listQbvhNode8.reserve(listQbvhNode.size());
+        listQbvhNode8.push_back(QbvhNode8());
+
+        std::vector<StackEntry> stack;
+        stack.push_back({ 0, 0 });
+
+        Child children[8];
+
+        auto setChild = [&](const QbvhNode& qbvhNode, int pos, int i) {
+            auto& child = children[pos];
+            child.qbvhNodeIdx = (uint32_t)qbvhNode.leftChildrenIdx + i;
+            child.bmin = aten::vec3(qbvhNode.bminx[i], qbvhNode.bminy[i], qbvhNode.bminz[i]);
+            child.bmax = aten::vec3(qbvhNode.bmaxx[i], qbvhNode.bmaxy[i], qbvhNode.bmaxz[i]);
+        };
+
+        while (!stack.empty()) {
+            auto top = stack.back();
+            stack.pop_back();
+
+            const auto& qbvhNode = listQbvhNode[top.qbvhNodeIdx];
+
+            if (listTriBatchIdx && (*listTriBatchIdx)[top.qbvhNodeIdx] >= 0) {
+                // All triangles under the node are tested at once, so the node becomes leaf.
+                auto& node = listQbvhNode8[top.nodeIdx];
+
+                node.isLeaf = true;
+                node.triBatchIdx = (*listTriBatchIdx)[top.qbvhNodeIdx];
+
+                continue;
+            }
+
+            if (qbvhNode.isLeaf) {
+                auto& node = listQbvhNode8[top.nodeIdx];
+
+                node.isLeaf = true;
+                node.shapeid = (int)qbvhNode.shapeid;
+                node.primid = (int)qbvhNode.primid;
+                node.exid = (int)qbvhNode.exid;
+                node.meshid = (int)qbvhNode.meshid;
+
+                continue;
+            }
+
+            int numChildren = (int)qbvhNode.numChildren;
+
+            for (int i = 0; i < numChildren; i++) {
+                setChild(qbvhNode, i, i);
+            }
+
+            for (;;) {
+                int best = -1;
+                real bestArea = real(-1);
+
+                for (int i = 0; i < numChildren; i++) {
+                    const auto& child = listQbvhNode[children[i].qbvhNodeIdx];
+
+                    const bool isTriBatch = listTriBatchIdx && (*listTriBatchIdx)[children[i].qbvhNodeIdx] >= 0;
+
+                    if (child.isLeaf || isTriBatch || numChildren - 1 + (int)child.numChildren > 8) {
+                        continue;
+                    }
+
+                    auto size = children[i].bmax - children[i].bmin;
+                    auto area = size.x * size.y + size.y * size.z + size.z * size.x;
+
+                    if (area > bestArea) {
+                        best = i;
+                        bestArea = area;
+                    }
+                }
+
+                if (best < 0) {
+                    break;
+                }
+
+                // The first grandchild takes the place of the opened child, and the others are appended.
+                const auto& opened = listQbvhNode[children[best].qbvhNodeIdx];
+                const int num = (int)opened.numChildren;
+
+                setChild(opened, best, 0);
+
+                for (int i = 1; i < num; i++) {
+                    setChild(opened, numChildren++, i);
+                }
+            }
+
+            const auto leftChildrenIdx = (uint32_t)listQbvhNode8.size();
+
+            auto& node = listQbvhNode8[top.nodeIdx];
+
+            node.isLeaf = false;
+            node.leftChildrenIdx = (int)leftChildrenIdx;
+            node.numChildren = numChildren;
+
+            for (int i = 0; i < numChildren; i++) {
+                const auto& child = children[i];
+
+                node.bminx[i] = child.bmin.x;
+                node.bminy[i] = child.bmin.y;
+                node.bminz[i] = child.bmin.z;
+
+                node.bmaxx[i] = child.bmax.x;
+                node.bmaxy[i] = child.bmax.y;
+                node.bmaxz[i] = child.bmax.z;
+            }
+
+            // NOTE
+            // The node reference is invalidated from here.
+            for (int i = 0; i < numChildren; i++) {
+                listQbvhNode8.push_back(QbvhNode8());
+                stack.push_back({ leftChildrenIdx + i, children[i].qbvhNodeIdx });
+            }
+        }
+    }
+
     inline int intersectAABB(
         aten::vec4& result,
         const aten::ray& r,
@@ -432,6 +673,104 @@ namespace aten
         return ret;
     }
 
+#ifdef AT_ENABLE_SIMD
+    // Ray to test 4 aabbs with SSE.
+    struct RaySSE {
+        __m128 invdx, invdy, invdz;
+        __m128 ox, oy, oz;
+
+        RaySSE(const aten::ray& r)
+        {
+            aten::vec3 invdir = real(1) / (r.dir + aten::vec3(real(1e-6)));
+            aten::vec3 oxinvdir = -r.org * invdir;
+
+            invdx = _mm_set1_ps(invdir.x);
+            invdy = _mm_set1_ps(invdir.y);
+            invdz = _mm_set1_ps(invdir.z);
+
+            ox = _mm_set1_ps(oxinvdir.x);
+            oy = _mm_set1_ps(oxinvdir.y);
+            oz = _mm_set1_ps(oxinvdir.z);
+        }
+    };
+
+    inline int intersectAABB(
+        aten::vec4& result,
+        const RaySSE& r,
+        real t_min, real t_max,
+        const QbvhNode& node)
+    {
+        auto fx = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(node.bmaxx.p), r.invdx), r.ox);
+        auto nx = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(node.bminx.p), r.invdx), r.ox);
+
+        auto fy = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(node.bmaxy.p), r.invdy), r.oy);
+        auto ny = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(node.bminy.p), r.invdy), r.oy);
+
+        auto fz = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(node.bmaxz.p), r.invdz), r.oz);
+        auto nz = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(node.bminz.p), r.invdz), r.oz);
+
+        auto t1 = _mm_min_ps(
+            _mm_min_ps(_mm_max_ps(fx, nx), _mm_max_ps(fy, ny)),
+            _mm_min_ps(_mm_max_ps(fz, nz), _mm_set1_ps(t_max)));
+        auto t0 = _mm_max_ps(
+            _mm_max_ps(_mm_min_ps(fx, nx), _mm_min_ps(fy, ny)),
+            _mm_max_ps(_mm_min_ps(fz, nz), _mm_set1_ps(t_min)));
+
+        _mm_storeu_ps(result.p, t0);
+
+        return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+    }
+
+    // Ray to test 8 aabbs with AVX2.
+    struct RayAVX2 {
+        __m256 invdx, invdy, invdz;
+        __m256 ox, oy, oz;
+    };
+
+    AT_SIMD_TARGET_AVX2 inline void initRayAVX2(
+        RayAVX2& dst,
+        const aten::ray& r)
+    {
+        aten::vec3 invdir = real(1) / (r.dir + aten::vec3(real(1e-6)));
+        aten::vec3 oxinvdir = -r.org * invdir;
+
+        dst.invdx = _mm256_set1_ps(invdir.x);
+        dst.invdy = _mm256_set1_ps(invdir.y);
+        dst.invdz = _mm256_set1_ps(invdir.z);
+
+        dst.ox = _mm256_set1_ps(oxinvdir.x);
+        dst.oy = _mm256_set1_ps(oxinvdir.y);
+        dst.oz = _mm256_set1_ps(oxinvdir.z);
+    }
+
+    AT_SIMD_TARGET_AVX2 inline int intersectAABB(
+        float* result,
+        const RayAVX2& r,
+        real t_min, real t_max,
+        const QbvhNode8& node)
+    {
+        auto fx = _mm256_fmadd_ps(_mm256_loadu_ps(node.bmaxx), r.invdx, r.ox);
+        auto nx = _mm256_fmadd_ps(_mm256_loadu_ps(node.bminx), r.invdx, r.ox);
+
+        auto fy = _mm256_fmadd_ps(_mm256_loadu_ps(node.bmaxy), r.invdy, r.oy);
+        auto ny = _mm256_fmadd_ps(_mm256_loadu_ps(node.bminy), r.invdy, r.oy);
+
+        auto fz = _mm256_fmadd_ps(_mm256_loadu_ps(node.bmaxz), r.invdz, r.oz);
+        auto nz = _mm256_fmadd_ps(_mm256_loadu_ps(node.bminz), r.invdz, r.oz);
+
+        auto t1 = _mm256_min_ps(
+            _mm256_min_ps(_mm256_max_ps(fx, nx), _mm256_max_ps(fy, ny)),
+            _mm256_min_ps(_mm256_max_ps(fz, nz), _mm256_set1_ps(t_max)));
+        auto t0 = _mm256_max_ps(
+            _mm256_max_ps(_mm256_min_ps(fx, nx), _mm256_min_ps(fy, ny)),
+            _mm256_max_ps(_mm256_min_ps(fz, nz), _mm256_set1_ps(t_min)));
+
+        _mm256_storeu_ps(result, t0);
+
+        return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+    }
+#endif
+
     inline int intersectTriangle(
         const context& ctxt,
         const aten::ray& r,
@@ -453,15 +792,13 @@ namespace aten
         aten::vec4 v2z;
 
         for (int i = 0; i < qnode.numChildren; i++) {
-            auto f = ctxt.getTriangle((int)primidx[i]);
-
-            const auto& faceParam = f->getParam();
+            const auto& faceParam = ctxt.getTriangleParam((int)primidx[i]);
 
-            const auto& v2 = ctxt.getVertex(faceParam.idx[2]);
+            const auto v2 = ctxt.getVertexPosition(faceParam.idx[2]);
 
-            v2x[i] = v2.pos.x;
-            v2y[i] = v2.pos.y;
-            v2z[i] = v2.pos.z;
+            v2x[i] = v2.x;
+            v2y[i] = v2.y;
+            v2z[i] = v2.z;
         }
 
         // e1 = v1 - v0
@@ -536,7 +873,113 @@ namespace aten
         real t_min, real t_max,
         Intersection& isect) const
     {
-        return hit(ctxt, 0, m_listQbvhNode, r, t_min, t_max, isect);
+        return traverse(ctxt, 0, r, t_min, t_max, isect, false);
+    }
+
+    bool qbvh::occluded(
+        const context& ctxt,
+        const ray& r,
+        real t_min, real t_max) const
+    {
+        Intersection isect;
+        return traverse(ctxt, 0, r, t_min, t_max, isect, true);
+    }
+
+    bool qbvh::traverse(
+        const context& ctxt,
+        int exid,
+        const ray& r,
+        real t_min, real t_max,
+        Intersection& isect,
+        bool isAnyHit) const
+    {
+#ifdef AT_ENABLE_SIMD
+        if (m_simdType == SimdType::AVX2 && !m_listQbvhNode8.empty()) {
+            return hitWithWideNode(ctxt, exid, r, t_min, t_max, isect, isAnyHit);
+        }
+#endif
+
+        return hit(ctxt, exid, m_listQbvhNode, r, t_min, t_max, isect, isAnyHit);
+    }
+
+    bool qbvh::hitLeaf(
+        const context& ctxt,
+        int shapeid, int exid, int primid,
+        const ray& r,
+        real t_min, real t_max,
+        Intersection& isect,
+        bool isAnyHit) const
+    {
+        bool isHit = false;
+
+        auto s = ctxt.getTransformable(shapeid);
+
+        if (exid >= 0) {
+            // Traverse external qbvh.
+            const auto& param = s->getParam();
+
+            int mtxid = param.mtxid;
+
+            aten::ray transformedRay;
+
+            // Range of the ray in the local coordinate.
+            real localTmin = t_min;
+            real localTmax = t_max;
+
+            if (mtxid >= 0) {
+                const auto& mtxW2L = m_mtxs[mtxid * 2 + 1];
+
+                if (isAnyHit) {
+                    // The occlusion test needs the exact range in the local coordinate.
+                    transformedRay = mtxW2L.applyRay(r, localTmin, localTmax);
+                }
+                else {
+                    transformedRay = mtxW2L.applyRay(r);
+                }
+            }
+            else {
+                transformedRay = r;
+            }
+
+            isHit = traverse(
+                ctxt,
+                exid,
+                transformedRay,
+                localTmin, localTmax,
+                isect,
+                isAnyHit);
+        }
+        else if (primid >= 0) {
+            isHit = ctxt.hitTriangle(primid, r, t_min, t_max, isect);
+
+            if (isHit) {
+                isect.objid = s->id();
+            }
+        }
+        else {
+            // sphere, cube.
+            isHit = s->hit(ctxt, r, t_min, t_max, isect);
+        }
+
+        return isHit;
+    }
+
+    bool qbvh::hitTriangleBatch(
+        const context& ctxt,
+        int batchIdx,
+        const ray& r,
+        real t_min, real t_max,
+        Intersection& isect,
+        bool isAnyHit) const
+    {
+        bool isHit = m_triBatch.hit(batchIdx, r, t_min, t_max, isect, isAnyHit);
+
+        if (isHit) {
+            auto s = ctxt.getTransformable(m_triBatchShapeIds[batchIdx]);
+            isect.objid = s->id();
+        }
+
+        return isHit;
     }
 
     bool qbvh::hit(
@@ -545,7 +988,8 @@ namespace aten
         const std::vector<std::vector<QbvhNode>>& listQbvhNode,
         const ray& r,
         real t_min, real t_max,
-        Intersection& isect) const
+        Intersection& isect,
+        bool isAnyHit/*= false*/) const
     {
         static const uint32_t stacksize = 64;
 
@@ -560,6 +1004,11 @@ namespace aten
         stackbuf[0] = Intersect(&listQbvhNode[exid][0], t_max);
         int stackpos = 1;
 
+#ifdef AT_ENABLE_SIMD
+        const bool isSSE = (m_simdType != SimdType::Scalar);
+        const RaySSE raySSE(r);
+#endif
+
         while (stackpos > 0) {
             const auto& node = stackbuf[stackpos - 1];
             stackpos -= 1;
@@ -572,7 +1021,26 @@ namespace aten
 
             const auto numChildren = pnode->numChildren;
 
-            if (pnode->isLeaf) {
+            const int triBatchIdx = m_listTriBatchIdx.empty()
+                ? -1
+                : m_listTriBatchIdx[exid][pnode - &listQbvhNode[exid][0]];
+
+            if (triBatchIdx >= 0) {
+                // Test all triangles under the node at once.
+                Intersection isectTmp;
+
+                if (hitTriangleBatch(ctxt, triBatchIdx, r, t_min, t_max, isectTmp, isAnyHit)) {
+                    if (isectTmp.t < isect.t) {
+                        isect = isectTmp;
+                        t_max = isect.t;
+                    }
+
+                    if (isAnyHit) {
+                        return true;
+                    }
+                }
+            }
+            else if (pnode->isLeaf) {
                 Intersection isectTmp;
 
                 bool isHit = false;
@@ -637,71 +1105,146 @@ namespace aten
                     }
                 }
 #else
-                auto s = ctxt.getTransformable((int)pnode->shapeid);
-
-                if (pnode->exid >= 0) {
-                    // Traverse external qbvh.
-                    const auto& param = s->getParam();
-
-                    int mtxid = param.mtxid;
-
-                    aten::ray transformedRay;
-
-                    if (mtxid >= 0) {
-                        const auto& mtxW2L = m_mtxs[mtxid * 2 + 1];
+                isHit = hitLeaf(
+                    ctxt,
+                    (int)pnode->shapeid, (int)pnode->exid, (int)pnode->primid,
+                    r,
+                    t_min, t_max,
+                    isectTmp,
+                    isAnyHit);
+#endif
 
-                        transformedRay = mtxW2L.applyRay(r);
+                if (isHit) {
+                    if (isectTmp.t < isect.t) {
+                        isect = isectTmp;
+                        t_max = isect.t;
                     }
-                    else {
-                        transformedRay = r;
+
+                    if (isAnyHit) {
+                        // Any hit is enough for the occlusion test.
+                        return true;
                     }
+                }
+            }
+            else {
+                // Hit test children aabb.
+                aten::vec4 interserctT;
+                int res = 0;
 
-                    isHit = hit(
-                        ctxt,
-                        (int)pnode->exid,
-                        listQbvhNode,
-                        transformedRay,
+#ifdef AT_ENABLE_SIMD
+                if (isSSE) {
+                    res = intersectAABB(interserctT, raySSE, t_min, t_max, *pnode);
+                }
+                else
+#endif
+                {
+                    res = intersectAABB(
+                        interserctT,
+                        r,
                         t_min, t_max,
-                        isectTmp);
+                        pnode->bminx, pnode->bmaxx,
+                        pnode->bminy, pnode->bmaxy,
+                        pnode->bminz, pnode->bmaxz);
                 }
-                else if (pnode->primid >= 0) {
-                    auto f = ctxt.getTriangle((int)pnode->primid);
-                    isHit = f->hit(ctxt, r, t_min, t_max, isectTmp);
 
-                    if (isHit) {
-                        isectTmp.objid = s->id();
+                // Stack hit children.
+                if (res > 0) {
+                    for (int i = 0; i < numChildren; i++) {
+                        if ((res & (1 << i)) > 0) {
+                            stackbuf[stackpos] = Intersect(
+                                &listQbvhNode[exid][(int)pnode->leftChildrenIdx + i],
+                                interserctT[i]);
+                            stackpos++;
+                        }
                     }
                 }
+            }
+        }
+
+        return (isect.objid >= 0);
+    }
+
+#ifdef AT_ENABLE_SIMD
+    AT_SIMD_TARGET_AVX2 bool qbvh::hitWithWideNode(
+        const context& ctxt,
+        int exid,
+        const ray& r,
+        real t_min, real t_max,
+        Intersection& isect,
+        bool isAnyHit) const
+    {
+        static const uint32_t stacksize = 128;
+
+        struct Intersect {
+            const QbvhNode8* node{ nullptr };
+            real t;
+
+            Intersect(const QbvhNode8* n, real _t) : node(n), t(_t) {}
+            Intersect() {}
+        } stackbuf[stacksize];
+
+        const auto& listNode = m_listQbvhNode8[exid];
+
+        stackbuf[0] = Intersect(&listNode[0], t_max);
+        int stackpos = 1;
+
+        RayAVX2 rayAVX2;
+        initRayAVX2(rayAVX2, r);
+
+        alignas(32) float interserctT[8];
+
+        while (stackpos > 0) {
+            const auto& node = stackbuf[stackpos - 1];
+            stackpos -= 1;
+
+            if (node.t > t_max) {
+                continue;
+            }
+
+            auto pnode = node.node;
+
+            if (pnode->isLeaf) {
+                Intersection isectTmp;
+
+                bool isHit = false;
+
+                if (pnode->triBatchIdx >= 0) {
+                    isHit = hitTriangleBatch(ctxt, pnode->triBatchIdx, r, t_min, t_max, isectTmp, isAnyHit);
+                }
                 else {
-                    // sphere, cube.
-                    isHit = s->hit(ctxt, r, t_min, t_max, isectTmp);
+                    isHit = hitLeaf(
+                        ctxt,
+                        pnode->shapeid, pnode->exid, pnode->primid,
+                        r,
+                        t_min, t_max,
+                        isectTmp,
+                        isAnyHit);
                 }
-#endif
 
                 if (isHit) {
                     if (isectTmp.t < isect.t) {
                         isect = isectTmp;
                         t_max = isect.t;
                     }
+
+                    if (isAnyHit) {
+                        // Any hit is enough for the occlusion test.
+                        return true;
+                    }
                 }
             }
             else {
-                // Hit test children aabb.
-                aten::vec4 interserctT;
-                auto res = intersectAABB(
-                    interserctT,
-                    r,
-                    t_min, t_max,
-                    pnode->bminx, pnode->bmaxx,
-                    pnode->bminy, pnode->bmaxy,
-                    pnode->bminz, pnode->bmaxz);
+                // Hit test all children aabb at once.
+                auto res = intersectAABB(interserctT, rayAVX2, t_min, t_max, *pnode);
 
                 // Stack hit children.
                 if (res > 0) {
-                    for (int i = 0; i < numChildren; i++) {
+                    for (int i = 0; i < pnode->numChildren; i++) {
                         if ((res & (1 << i)) > 0) {
+                            AT_ASSERT(stackpos < stacksize);
+
                             stackbuf[stackpos] = Intersect(
-                                &listQbvhNode[exid][(int)pnode->leftChildrenIdx + i],
+                                &listNode[pnode->leftChildrenIdx + i],
                                 interserctT[i]);
                             stackpos++;
                         }
@@ -712,4 +1255,16 @@ namespace aten
 
         return (isect.objid >= 0);
     }
+#else
+    bool qbvh::hitWithWideNode(
+        const context& ctxt,
+        int exid,
+        const ray& r,
+        real t_min, real t_max,
+        Intersection& isect,
+        bool isAnyHit) const
+    {
+        return hit(ctxt, exid, m_listQbvhNode, r, t_min, t_max, isect, isAnyHit);
+    }
+#endif
 }
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "accelerator/bvh.h"
+#include "accelerator/triangle_batch.h"
 #include "scene/context.h"
+#include "misc/simd.h"
 
 namespace aten {
     struct QbvhNode {
@@ -101,6 +103,39 @@ namespace aten {
         }
     };
 
+    /**
+     * @brief 8-wide node to test all children with one AVX2 instruction.
+     * @note This is built from the QBVH nodes and used only for the CPU traversal.
+     */
+    struct QbvhNode8 {
+        float bminx[8];
+        float bmaxx[8];
+        float bminy[8];
+        float bmaxy[8];
+        float bminz[8];
+        float bmaxz[8];
+
+        int leftChildrenIdx{ 0 };
+        int numChildren{ 0 };
+        bool isLeaf{ false };
+
+        int triBatchIdx{ -1 };  ///< If the leaf is the triangle batch, index of the batch.
+
+        int shapeid{ -1 };  ///< Object index.
+        int primid{ -1 };   ///< Triangle index.
+        int exid{ -1 };     ///< External bvh index.
+        int meshid{ -1 };   ///< Mesh id.
+
+        QbvhNode8()
+        {
+            for (int i = 0; i < 8; i++) {
+                bminx[i] = bmaxx[i] = real(0);
+                bminy[i] = bmaxy[i] = real(0);
+                bminz[i] = bmaxz[i] = real(0);
+            }
+        }
+    };
+
     class transformable;
 
     class qbvh : public accelerator {
@@ -131,6 +166,20 @@ namespace aten {
             return hit(ctxt, r, t_min, t_max, isect);
         }
 
+        virtual bool occluded(
+            const context& ctxt,
+            const ray& r,
+            real t_min, real t_max) const override;
+
+        /**
+         * @brief Enable to build the 8-wide nodes for the AVX2 traversal.
+         * If the CPU doesn't support AVX2, the 8-wide nodes are not built even if this is enabled.
+         */
+        void enableWideNode(bool enable)
+        {
+            m_enableWideNode = enable;
+        }
+
         std::vector<std::vector<QbvhNode>>& getNodes()
         {
             return m_listQbvhNode;
@@ -183,18 +232,80 @@ namespace aten {
             int bvhNodeIdx,
             int children[4]);
 
+        void convertToWideNode(
+            const std::vector<QbvhNode>& listQbvhNode,
+            const std::vector<int>* listTriBatchIdx,
+            std::vector<QbvhNode8>& listQbvhNode8);
+
+        bool buildTriangleBatch(
+            const context& ctxt,
+            int exid,
+            int nodeIdx,
+            std::vector<const AT_NAME::face*>& triangles,
+            int& shapeid);
+
+        bool hitTriangleBatch(
+            const context& ctxt,
+            int batchIdx,
+            const ray& r,
+            real t_min, real t_max,
+            Intersection& isect,
+            bool isAnyHit) const;
+
         bool hit(
             const context& ctxt,
             int exid,
             const std::vector<std::vector<QbvhNode>>& listQbvhNode,
             const ray& r,
             real t_min, real t_max,
-            Intersection& isect) const;
+            Intersection& isect,
+            bool isAnyHit = false) const;
+
+        bool hitWithWideNode(
+            const context& ctxt,
+            int exid,
+            const ray& r,
+            real t_min, real t_max,
+            Intersection& isect,
+            bool isAnyHit) const;
+
+        /**
+         * @brief Traverse the specified tree with the kernel for the running CPU.
+         */
+        bool traverse(
+            const context& ctxt,
+            int exid,
+            const ray& r,
+            real t_min, real t_max,
+            Intersection& isect,
+            bool isAnyHit) const;
+
+        bool hitLeaf(
+            const context& ctxt,
+            int shapeid, int exid, int primid,
+            const ray& r,
+            real t_min, real t_max,
+            Intersection& isect,
+            bool isAnyHit) const;
 
     private:
         bvh m_bvh;
 
         std::vector<std::vector<QbvhNode>> m_listQbvhNode;
         std::vector<aten::mat4> m_mtxs;
+
+        std::vector<std::vector<QbvhNode8>> m_listQbvhNode8;
+
+        // Triangles which are tested together in the small sub trees.
+        TriangleBatch m_triBatch;
+
+        // Index of the triangle batch per node. If it is empty, the triangle batch is disabled.
+        std::vector<std::vector<int>> m_listTriBatchIdx;
+
+        // Object which has the triangles per triangle batch.
+        std::vector<int> m_triBatchShapeIds;
+
+        SimdType m_simdType{ SimdType::Scalar };
+        bool m_enableWideNode{ true };
     };
 }
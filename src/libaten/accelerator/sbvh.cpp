@@ -5,6 +5,7 @@
 #include <omp.h>
 
 #include "accelerator/sbvh.h"
+#include "misc/omputil.h"
 
 //#pragma optimize( "", off)
 
@@ -31,54 +32,6 @@ namespace aten
         return false;
     }
 
-    template <class Iter, class Cmp>
-    void mergeSort(Iter first, Iter last, Cmp cmp)
-    {
-        const auto numThreads = ::omp_get_max_threads();
-
-        const auto numItems = last - first;
-        const auto numItemPerThread = numItems / numThreads;
-
-        // Sort each blocks.
-#pragma omp parallel num_threads(numThreads)
-        {
-            const auto idx = ::omp_get_thread_num();
-        
-            const auto startPos = idx * numItemPerThread;
-            const auto endPos = (idx + 1 == numThreads ? numItems : startPos + numItemPerThread);
-
-            std::sort(first + startPos, first + endPos, cmp);
-        }
-
-        int blockNum = numThreads;
-
-        // Merge blocks.
-        while (blockNum >= 2)
-        {
-            const auto numItemsInBlocks = numItems / blockNum;
-
-            // ２つのブロックを１つにマージする.
-#pragma omp parallel num_threads(blockNum / 2)
-            {
-                const auto idx = ::omp_get_thread_num();
-
-                // ２つのブロックを１つにマージするので、numItemsInBlocks * 2 となる.
-                auto startPos = idx * numItemsInBlocks * 2;
-
-                // 中間地点なので、numItemsInBlocks * 2 の半分で numItemsInBlocks となる.
-                auto pivot = startPos + numItemsInBlocks;
-
-                // 終端.
-                auto endPos = (idx + 1 == blockNum / 2 ? numItems : pivot + numItemsInBlocks);
-
-                std::inplace_merge(first + startPos, first + pivot, first + endPos);
-            }
-
-            // ２つを１つにマージするので、半分になる.
-            blockNum = (blockNum + 1) / 2;
-        }
-    }
-
     void sbvh::build(
         const context& ctxt,
         hitable** list,
@@ -180,6 +133,87 @@ namespace aten
         }
 
         setBoundingBox(boundingBox);
+
+        buildTriangleBatch(ctxt);
+    }
+
+    void sbvh::buildTriangleBatch(const context& ctxt)
+    {
+        m_triBatch.clear();
+        m_listTriBatchIdx.clear();
+
+        if (!isEnabledTriangleBatch()) {
+            return;
+        }
+
+        m_listTriBatchIdx.resize(m_threadedNodes.size());
+
+        std::vector<const face*> triangles;
+
+        // NOTE
+        // 0 is the top layer, it has no triangle.
+        for (int exid = 1; exid < (int)m_threadedNodes.size(); exid++) {
+            const auto& nodes = m_threadedNodes[exid];
+            auto& listTriBatchIdx = m_listTriBatchIdx[exid];
+
+            listTriBatchIdx.resize(nodes.size(), -1);
+
+            // Assign the batch to the largest sub trees which the batch can contain.
+            int nodeid = 0;
+
+            while (nodeid >= 0) {
+                const auto& node = nodes[nodeid];
+
+                if (!node.isLeaf()
+                    && collectTriangles(ctxt, nodes, nodeid, triangles))
+                {
+                    listTriBatchIdx[nodeid] = m_triBatch.add(ctxt, &triangles[0], (int)triangles.size());
+
+                    // Skip the sub tree.
+                    nodeid = (int)node.miss;
+                }
+                else {
+                    nodeid = (int)node.hit;
+                }
+            }
+        }
+    }
+
+    bool sbvh::collectTriangles(
+        const context& ctxt,
+        const std::vector<ThreadedSbvhNode>& nodes,
+        int nodeid,
+        std::vector<const face*>& triangles) const
+    {
+        triangles.clear();
+
+        // NOTE
+        // In the threaded tree, the sub tree is traversed with the hit link until the miss link of the root of the sub tree.
+        const int end = (int)nodes[nodeid].miss;
+
+        for (int id = nodeid; id >= 0 && id != end; id = (int)nodes[id].hit) {
+            const auto& node = nodes[id];
+
+            if (AT_IS_VOXEL(node.voxeldepth)) {
+                // The voxel can't be tested in the batch.
+                return false;
+            }
+
+            if (node.isLeaf()) {
+                if (triangles.size() == TriangleBatch::MaxTriangleNum) {
+                    return false;
+                }
+
+                auto tri = ctxt.getTriangle((int)node.triid);
+                if (!tri) {
+                    return false;
+                }
+
+                triangles.push_back(tri);
+            }
+        }
+
+        return !triangles.empty();
     }
 
     void sbvh::onBuild(
@@ -202,10 +236,13 @@ namespace aten
 
         m_offsetTriIdx = INT32_MAX;
 
-        for (uint32_t i = 0; i < tris.size(); i++) {
+#pragma omp parallel for
+        for (int i = 0; i < (int)tris.size(); i++) {
             m_refs[i].triid = i;
             m_refs[i].bbox = tris[i]->computeAABB(ctxt);
+        }
 
+        for (uint32_t i = 0; i < tris.size(); i++) {
             m_offsetTriIdx = std::min<int>(m_offsetTriIdx, tris[i]->getId());
 
             rootBox.expand(m_refs[i].bbox);
@@ -225,6 +262,54 @@ namespace aten
 
         auto rootSurfaceArea = rootBox.computeSurfaceArea();
 
+        m_nodes.reserve(m_refs.size() * 3);
+        m_nodes.push_back(SBVHNode());
+        m_nodes[0] = SBVHNode(std::move(refIndices), rootBox);
+
+        // The top levels are built serially and the remaining sub trees are built in parallel.
+        const uint32_t threadNum = OMPUtil::getParallelThreadNum(num, MinSubTreeRefNum);
+
+        uint32_t subTreeThreshold = 0;
+
+        if (threadNum > 1) {
+            // Make enough sub trees per thread to balance the load.
+            subTreeThreshold = std::max(num / (threadNum * 8), MinSubTreeRefNum);
+            subTreeThreshold = (num > subTreeThreshold ? subTreeThreshold : 0);
+        }
+
+        if (subTreeThreshold > 0) {
+            std::vector<uint32_t> subTreeRoots;
+
+            buildNodes(m_nodes, m_refs, rootSurfaceArea, subTreeThreshold, &subTreeRoots);
+
+            buildSubTrees(rootSurfaceArea, subTreeRoots);
+
+            // Make the tree same as the serial build.
+            reorderAsSerialBuild(num);
+        }
+        else {
+            buildNodes(m_nodes, m_refs, rootSurfaceArea, 0, nullptr);
+        }
+
+        m_refIndexNum = 0;
+        m_maxDepth = 0;
+
+        for (const auto& node : m_nodes) {
+            m_maxDepth = std::max<uint32_t>(node.depth, m_maxDepth);
+
+            if (node.isLeaf()) {
+                m_refIndexNum += (uint32_t)node.refIds.size();
+            }
+        }
+    }
+
+    void sbvh::buildNodes(
+        std::vector<SBVHNode>& nodes,
+        std::vector<Reference>& refs,
+        real rootSurfaceArea,
+        uint32_t subTreeThreshold,
+        std::vector<uint32_t>* subTreeRoots)
+    {
         // TODO
         const real areaAlpha = real(1e-5);
 
@@ -237,28 +322,23 @@ namespace aten
         } stack[128];
 
         int stackpos = 1;
-        stack[0] = SBVHEntry(0, 0);
+        stack[0] = SBVHEntry(0, nodes[0].depth);
 
-        m_nodes.reserve(m_refs.size() * 3);
-        m_nodes.push_back(SBVHNode());
-        m_nodes[0] = SBVHNode(std::move(refIndices), rootBox);
-
-        uint32_t numNodes = 1;
-
-        m_refIndexNum = 0;
-
-        m_maxDepth = 0;
+        uint32_t numNodes = (uint32_t)nodes.size();
 
         while (stackpos > 0)
         {
             auto top = stack[--stackpos];
-            auto& node = m_nodes[top.nodeIdx];
-
-            m_maxDepth = std::max<uint32_t>(node.depth, m_maxDepth);
+            auto& node = nodes[top.nodeIdx];
 
             // enough triangles so far.
             if (node.refIds.size() <= m_maxTriangles) {
-                m_refIndexNum += (uint32_t)node.refIds.size();
+                continue;
+            }
+
+            if (subTreeRoots && node.refIds.size() <= subTreeThreshold) {
+                // Small enough, so defer to build it in parallel.
+                subTreeRoots->push_back(top.nodeIdx);
                 continue;
             }
 
@@ -267,7 +347,7 @@ namespace aten
             aabb objRightBB;
             int sahBin = -1;
             int sahComponent = -1;
-            findObjectSplit(node, objCost, objLeftBB, objRightBB, sahBin, sahComponent);
+            findObjectSplit(node, refs, objCost, objLeftBB, objRightBB, sahBin, sahComponent);
 
             // check whether the object split produces overlapping nodes
             // if so, check whether we are close enough to the root so that the spatial split makes sense.
@@ -293,6 +373,7 @@ namespace aten
             if (needComputeSpatial) {
                 findSpatialSplit(
                     node,
+                    refs,
                     spatialCost,
                     leftCnt, rightCnt,
                     spatialLeftBB, spatialRightBB,
@@ -310,8 +391,11 @@ namespace aten
 
             if (needComputeSpatial && spatialCost <= objCost) {
                 // use spatial split.
+                const auto refNum = (uint32_t)refs.size();
+
                 spatialSort(
                     node,
+                    refs,
                     spatialSplitPlane,
                     spatialDimension,
                     spatialCost,
@@ -319,6 +403,10 @@ namespace aten
                     spatialLeftBB, spatialRightBB,
                     leftList, rightList);
 
+                // Keep the split references to renumber them later.
+                node.createdRefStart = refNum;
+                node.createdRefNum = (uint32_t)refs.size() - refNum;
+
                 objLeftBB = spatialLeftBB;
                 objRightBB = spatialRightBB;
 
@@ -343,11 +431,13 @@ namespace aten
                     usedAxis = bestAxis;
 
                     // bestAxisに基づいてbboxの位置に応じてソート.
-                    mergeSort(
+                    // NOTE
+                    // Stable sort to make the result independent from the count of threads.
+                    std::stable_sort(
                         node.refIds.begin(),
                         node.refIds.end(),
-                        [bestAxis, this](const uint32_t a, const uint32_t b) {
-                        return m_refs[a].bbox.getCenter()[bestAxis] < m_refs[b].bbox.getCenter()[bestAxis];
+                        [bestAxis, &refs](const uint32_t a, const uint32_t b) {
+                        return refs[a].bbox.getCenter()[bestAxis] < refs[b].bbox.getCenter()[bestAxis];
                     });
 
                     // 分割AABBの大きさをリセット.
@@ -358,7 +448,7 @@ namespace aten
                     // 半分ずつ右と左に均等に分割.
                     for (int i = 0; i < node.refIds.size(); i++) {
                         const auto id = node.refIds[i];
-                        const auto& ref = m_refs[id];
+                        const auto& ref = refs[id];
 
                         if (i < node.refIds.size() / 2) {
                             leftList.push_back(node.refIds[i]);
@@ -373,6 +463,7 @@ namespace aten
                 else {
                     objectSort(
                         node,
+                        refs,
                         sahBin,
                         sahComponent,
                         leftList, rightList);
@@ -394,17 +485,17 @@ namespace aten
 
             // copy node data to left and right children.
             // ここで push_back することで、std::vector 内部のメモリ構造が変わることがあるので、参照である node の変更はこの前までに終わらせること.
-            m_nodes.push_back(SBVHNode());
-            m_nodes.push_back(SBVHNode());
+            nodes.push_back(SBVHNode());
+            nodes.push_back(SBVHNode());
 
-            m_nodes[leftIdx] = SBVHNode(std::move(leftList), objLeftBB);
-            m_nodes[rightIdx] = SBVHNode(std::move(rightList), objRightBB);
+            nodes[leftIdx] = SBVHNode(std::move(leftList), objLeftBB);
+            nodes[rightIdx] = SBVHNode(std::move(rightList), objRightBB);
 
-            m_nodes[leftIdx].parent = top.nodeIdx;
-            m_nodes[leftIdx].depth = top.depth + 1;
+            nodes[leftIdx].parent = top.nodeIdx;
+            nodes[leftIdx].depth = top.depth + 1;
 
-            m_nodes[rightIdx].parent = top.nodeIdx;
-            m_nodes[rightIdx].depth = top.depth + 1;
+            nodes[rightIdx].parent = top.nodeIdx;
+            nodes[rightIdx].depth = top.depth + 1;
 
             stack[stackpos++] = SBVHEntry(leftIdx, top.depth + 1);
             stack[stackpos++] = SBVHEntry(rightIdx, top.depth + 1);
@@ -412,7 +503,190 @@ namespace aten
             numNodes += 2;
         }
 
-        AT_ASSERT(m_nodes.size() == numNodes);
+        AT_ASSERT(nodes.size() == numNodes);
+    }
+
+    void sbvh::buildSubTrees(
+        real rootSurfaceArea,
+        const std::vector<uint32_t>& subTreeRoots)
+    {
+        // NOTE
+        // Each sub tree has its own nodes and references list, so the sub trees can be built independently.
+        // And, they are merged to the tree serially.
+
+        struct SubTree {
+            std::vector<SBVHNode> nodes;
+            std::vector<Reference> refs;
+        };
+
+        const int subTreeNum = (int)subTreeRoots.size();
+
+        std::vector<SubTree> subTrees(subTreeNum);
+
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int i = 0; i < subTreeNum; i++) {
+            const auto& root = m_nodes[subTreeRoots[i]];
+            auto& subTree = subTrees[i];
+
+            const auto refNum = (uint32_t)root.refIds.size();
+
+            // Copy the references to the local list.
+            std::vector<uint32_t> refIndices(refNum);
+            std::iota(refIndices.begin(), refIndices.end(), 0);
+
+            subTree.refs.reserve(2 * refNum);
+            subTree.refs.resize(refNum);
+
+            for (uint32_t n = 0; n < refNum; n++) {
+                subTree.refs[n] = m_refs[root.refIds[n]];
+            }
+
+            subTree.nodes.reserve(refNum * 3);
+            subTree.nodes.push_back(SBVHNode());
+            subTree.nodes[0] = SBVHNode(std::move(refIndices), root.bbox);
+            subTree.nodes[0].parent = root.parent;
+            subTree.nodes[0].depth = root.depth;
+
+            buildNodes(subTree.nodes, subTree.refs, rootSurfaceArea, 0, nullptr);
+        }
+
+        // Merge the sub trees.
+        for (int i = 0; i < subTreeNum; i++) {
+            const auto rootIdx = subTreeRoots[i];
+            auto& subTree = subTrees[i];
+
+            const auto nodeBase = (uint32_t)m_nodes.size();
+            const auto refBase = (uint32_t)m_refs.size();
+
+            const auto orgRefIds = std::move(m_nodes[rootIdx].refIds);
+            const auto orgRefNum = (uint32_t)orgRefIds.size();
+
+            // The root of the sub tree is placed to the original position and the others are appended.
+            auto toNodeIdx = [&](int idx) {
+                return (idx == 0 ? (int)rootIdx : (int)(nodeBase + idx - 1));
+            };
+
+            // The original references keep the indices and the split references are appended.
+            auto toRefIdx = [&](uint32_t idx) {
+                return (idx < orgRefNum ? orgRefIds[idx] : refBase + idx - orgRefNum);
+            };
+
+            for (uint32_t n = 0; n < orgRefNum; n++) {
+                m_refs[orgRefIds[n]] = subTree.refs[n];
+            }
+
+            m_refs.insert(m_refs.end(), subTree.refs.begin() + orgRefNum, subTree.refs.end());
+
+            for (size_t n = 0; n < subTree.nodes.size(); n++) {
+                auto& node = subTree.nodes[n];
+
+                if (!node.isLeaf()) {
+                    node.setChild(toNodeIdx(node.left), toNodeIdx(node.right));
+                }
+
+                if (n > 0) {
+                    node.parent = toNodeIdx(node.parent);
+                }
+
+                for (auto& id : node.refIds) {
+                    id = toRefIdx(id);
+                }
+
+                if (node.createdRefNum > 0) {
+                    node.createdRefStart = toRefIdx(node.createdRefStart);
+                }
+
+                if (n == 0) {
+                    m_nodes[rootIdx] = std::move(node);
+                }
+                else {
+                    m_nodes.push_back(std::move(node));
+                }
+            }
+
+            // Release the memory.
+            subTree = SubTree();
+        }
+    }
+
+    void sbvh::reorderAsSerialBuild(uint32_t triNum)
+    {
+        // NOTE
+        // In the serial build, the nodes are traversed with the stack from the root and the right child is processed first.
+        // The child nodes and the split references are numbered in the traversal order.
+        // So, replay it to compute the indices in the serial build.
+
+        std::vector<uint32_t> nodeMap(m_nodes.size());
+        std::vector<uint32_t> refMap(m_refs.size());
+
+        // The references for the triangles are not changed.
+        std::iota(refMap.begin(), refMap.begin() + triNum, 0);
+
+        uint32_t numNodes = 1;
+        uint32_t numRefs = triNum;
+
+        nodeMap[0] = 0;
+
+        std::vector<uint32_t> stack;
+        stack.push_back(0);
+
+        while (!stack.empty()) {
+            const auto idx = stack.back();
+            stack.pop_back();
+
+            const auto& node = m_nodes[idx];
+
+            if (node.isLeaf()) {
+                continue;
+            }
+
+            for (int i = 0; i < node.createdRefNum; i++) {
+                refMap[node.createdRefStart + i] = numRefs++;
+            }
+
+            nodeMap[node.left] = numNodes;
+            nodeMap[node.right] = numNodes + 1;
+
+            stack.push_back(node.left);
+            stack.push_back(node.right);
+
+            numNodes += 2;
+        }
+
+        AT_ASSERT(numNodes == m_nodes.size());
+        AT_ASSERT(numRefs == m_refs.size());
+
+        std::vector<SBVHNode> nodes(m_nodes.size());
+        std::vector<Reference> refs(m_refs.size());
+
+        for (size_t i = 0; i < m_nodes.size(); i++) {
+            auto& node = m_nodes[i];
+
+            if (!node.isLeaf()) {
+                node.setChild(nodeMap[node.left], nodeMap[node.right]);
+            }
+
+            if (node.parent >= 0) {
+                node.parent = nodeMap[node.parent];
+            }
+
+            for (auto& id : node.refIds) {
+                id = refMap[id];
+            }
+
+            if (node.createdRefNum > 0) {
+                node.createdRefStart = refMap[node.createdRefStart];
+            }
+
+            nodes[nodeMap[i]] = std::move(node);
+        }
+
+        for (size_t i = 0; i < m_refs.size(); i++) {
+            refs[refMap[i]] = m_refs[i];
+        }
+
+        m_nodes.swap(nodes);
+        m_refs.swap(refs);
     }
 
     inline real evalPreSplitCost(
@@ -424,24 +698,40 @@ namespace aten
 
     void sbvh::findObjectSplit(
         SBVHNode& node,
+        const std::vector<Reference>& refs,
         real& cost,
         aabb& leftBB,
         aabb& rightBB,
         int& splitBinPos,
         int& axis)
     {
-        std::vector<Bin> bins(m_numBins);
-
         aabb bbCentroid = aabb(node.bbox.maxPos(), node.bbox.minPos());
 
         uint32_t refNum = (uint32_t)node.refIds.size();
 
+        // NOTE
+        // If the node has many references, they are processed in parallel.
+        // Merging AABBs and counts is order independent, so the result is same as the serial one.
+        const auto threadNum = OMPUtil::getParallelThreadNum(refNum, ParallelBinningThreshold);
+
         // compute the aabb of all centroids.
-        for (uint32_t i = 0; i < refNum; i++) {
-            auto id = node.refIds[i];
-            const auto& ref = m_refs[id];
-            auto center = ref.bbox.getCenter();
-            bbCentroid.expand(center);
+        std::vector<aabb> centroidBoxes(threadNum);
+
+#pragma omp parallel for num_threads(threadNum) if(threadNum > 1)
+        for (int t = 0; t < threadNum; t++) {
+            const auto start = (uint32_t)(((uint64_t)refNum * t) / threadNum);
+            const auto end = (uint32_t)(((uint64_t)refNum * (t + 1)) / threadNum);
+
+            for (uint32_t i = start; i < end; i++) {
+                auto id = node.refIds[i];
+                const auto& ref = refs[id];
+                auto center = ref.bbox.getCenter();
+                centroidBoxes[t].expand(center);
+            }
+        }
+
+        for (int t = 0; t < threadNum; t++) {
+            bbCentroid.expand(centroidBoxes[t]);
         }
 
         cost = AT_MATH_INF;
@@ -451,41 +741,72 @@ namespace aten
         auto centroidMin = bbCentroid.minPos();
         auto centroidMax = bbCentroid.maxPos();
 
-        // for each dimension check the best splits.
-        for (int dim = 0; dim < 3; ++dim)
-        {
-            // Skip empty axis.
-            if ((centroidMax[dim] - centroidMin[dim]) == 0.0f) {
-                continue;
-            }
+        real invLen[3];
+
+        for (int dim = 0; dim < 3; ++dim) {
+            const auto len = centroidMax[dim] - centroidMin[dim];
+            invLen[dim] = (len == 0.0f ? real(0) : real(1) / len);
+        }
 
-            const real invLen = real(1) / (centroidMax[dim] - centroidMin[dim]);
+        // Bins for each thread and each dimension.
+        std::vector<Bin> threadBins(threadNum * 3 * m_numBins);
 
-            // clear bins;
-            for (uint32_t i = 0; i < m_numBins; i++) {
-                bins[i] = Bin();
-            }
+        // distribute references in the bins based on the centroids.
+#pragma omp parallel for num_threads(threadNum) if(threadNum > 1)
+        for (int t = 0; t < threadNum; t++) {
+            const auto start = (uint32_t)(((uint64_t)refNum * t) / threadNum);
+            const auto end = (uint32_t)(((uint64_t)refNum * (t + 1)) / threadNum);
 
-            // distribute references in the bins based on the centroids.
-            for (uint32_t i = 0; i < refNum; i++) {
+            for (uint32_t i = start; i < end; i++) {
                 // ノードに含まれる三角形のAABBについて計算.
 
                 auto id = node.refIds[i];
-                const auto& ref = m_refs[id];
+                const auto& ref = refs[id];
 
                 auto center = ref.bbox.getCenter();
 
-                // 分割情報(bins)へのインデックス.
-                // 最小端点から三角形AABBの中心への距離を軸の長さで正規化することで計算.
-                int binIdx = (int)(m_numBins * ((center[dim] - centroidMin[dim]) * invLen));
+                for (int dim = 0; dim < 3; ++dim) {
+                    // Skip empty axis.
+                    if (invLen[dim] == real(0)) {
+                        continue;
+                    }
+
+                    auto bins = &threadBins[(t * 3 + dim) * m_numBins];
+
+                    // 分割情報(bins)へのインデックス.
+                    // 最小端点から三角形AABBの中心への距離を軸の長さで正規化することで計算.
+                    int binIdx = (int)(m_numBins * ((center[dim] - centroidMin[dim]) * invLen[dim]));
+
+                    binIdx = std::min<int>(binIdx, m_numBins - 1);
+                    AT_ASSERT(binIdx >= 0);
+
+                    bins[binIdx].start += 1;    // Binに含まれる三角形の数を増やす.
+                    bins[binIdx].bbox.expand(ref.bbox);
+                }
+            }
+        }
+
+        // Merge the bins of all threads to the first thread's bins.
+        for (int t = 1; t < threadNum; t++) {
+            for (uint32_t i = 0; i < 3 * m_numBins; i++) {
+                const auto& src = threadBins[t * 3 * m_numBins + i];
+                auto& dst = threadBins[i];
 
-                binIdx = std::min<int>(binIdx, m_numBins - 1);
-                AT_ASSERT(binIdx >= 0);
+                dst.start += src.start;
+                dst.bbox.expand(src.bbox);
+            }
+        }
 
-                bins[binIdx].start += 1;    // Binに含まれる三角形の数を増やす.
-                bins[binIdx].bbox.expand(ref.bbox);
+        // for each dimension check the best splits.
+        for (int dim = 0; dim < 3; ++dim)
+        {
+            // Skip empty axis.
+            if (invLen[dim] == real(0)) {
+                continue;
             }
 
+            auto bins = &threadBins[dim * m_numBins];
+
             // 後ろから分割情報を蓄積する.
             bins[m_numBins - 1].accum = bins[m_numBins - 1].bbox;
             bins[m_numBins - 1].end = bins[m_numBins - 1].start;
@@ -542,6 +863,7 @@ namespace aten
 
     void sbvh::findSpatialSplit(
         SBVHNode& node,
+        const std::vector<Reference>& refs,
         real& cost,
         int& retLeftCount,
         int& retRightCount,
@@ -554,73 +876,115 @@ namespace aten
         splitPlane = -1;
         bestAxis = -1;
 
-        std::vector<Bin> bins(m_numBins);
-
         uint32_t refNum = (uint32_t)node.refIds.size();
 
         const auto& box = node.bbox;
         const auto boxMin = box.minPos();
         const auto boxMax = box.maxPos();
 
-        // check along each dimension
-        for (int dim = 0; dim < 3; ++dim)
-        {
+        real invLen[3];
+
+        // 分割情報当たりの軸の長さ.
+        real lenghthPerBin[3];
+
+        for (int dim = 0; dim < 3; ++dim) {
             const auto segmentLength = boxMax[dim] - boxMin[dim];
 
-            if (segmentLength == real(0)) {
-                continue;
-            }
+            invLen[dim] = (segmentLength == real(0) ? real(0) : real(1) / segmentLength);
+            lenghthPerBin[dim] = segmentLength / (float)m_numBins;
+        }
+
+        // NOTE
+        // If the node has many references, they are processed in parallel.
+        // Merging the clipped AABBs and counts is order independent, so the result is same as the serial one.
+        const auto threadNum = OMPUtil::getParallelThreadNum(refNum, ParallelBinningThreshold);
+
+        // Bins for each thread and each dimension.
+        std::vector<Bin> threadBins(threadNum * 3 * m_numBins);
 
-            const auto invLen = real(1) / segmentLength;
+        // Clip the bin's AABB within the bin's range.
+        auto clipBin = [&](Bin& bin, int dim, int n) {
+            const auto binMin = boxMin[dim] + n * lenghthPerBin[dim];
+            const auto binMax = boxMin[dim] + (n + 1) * lenghthPerBin[dim];
+            AT_ASSERT(binMin <= binMax);
 
-            // 分割情報当たりの軸の長さ.
-            const auto lenghthPerBin = segmentLength / (float)m_numBins;
+            if (bin.bbox.minPos()[dim] < binMin) {
+                bin.bbox.minPos()[dim] = binMin;
+            }
 
-            // clear bins;
-            for (uint32_t i = 0; i < m_numBins; i++) {
-                bins[i] = Bin();
+            if (bin.bbox.maxPos()[dim] > binMax) {
+                bin.bbox.maxPos()[dim] = binMax;
             }
+        };
+
+        // Check all triangles which the node has.
+#pragma omp parallel for num_threads(threadNum) if(threadNum > 1)
+        for (int t = 0; t < threadNum; t++) {
+            const auto start = (uint32_t)(((uint64_t)refNum * t) / threadNum);
+            const auto end = (uint32_t)(((uint64_t)refNum * (t + 1)) / threadNum);
 
-            // Check all triangles which the node has.
-            for (uint32_t i = 0; i < refNum; i++) {
+            for (uint32_t i = start; i < end; i++) {
                 const auto id = node.refIds[i];
-                const auto& ref = m_refs[id];
+                const auto& ref = refs[id];
 
-                const auto triMin = ref.bbox.minPos()[dim];
-                const auto triMax = ref.bbox.maxPos()[dim];
+                for (int dim = 0; dim < 3; ++dim) {
+                    if (invLen[dim] == real(0)) {
+                        continue;
+                    }
 
-                // split each triangle into references.
-                // each triangle will be recorded into multiple bins.
-                // 三角形が入る分割情報のインデックス範囲を計算.
-                int binStartIdx = (int)(m_numBins * ((triMin - boxMin[dim]) * invLen));
-                int binEndIdx = (int)(m_numBins * ((triMax - boxMin[dim]) * invLen));
+                    auto bins = &threadBins[(t * 3 + dim) * m_numBins];
 
-                binStartIdx = aten::clamp<int>(binStartIdx, 0, m_numBins - 1);
-                binEndIdx = aten::clamp<int>(binEndIdx, 0, m_numBins - 1);
+                    const auto triMin = ref.bbox.minPos()[dim];
+                    const auto triMax = ref.bbox.maxPos()[dim];
 
-                //AT_ASSERT(binStartIdx <= binEndIdx);
+                    // split each triangle into references.
+                    // each triangle will be recorded into multiple bins.
+                    // 三角形が入る分割情報のインデックス範囲を計算.
+                    int binStartIdx = (int)(m_numBins * ((triMin - boxMin[dim]) * invLen[dim]));
+                    int binEndIdx = (int)(m_numBins * ((triMax - boxMin[dim]) * invLen[dim]));
 
-                for (int n = binStartIdx; n <= binEndIdx; n++) {
-                    const auto binMin = boxMin[dim] + n * lenghthPerBin;
-                    const auto binMax = boxMin[dim] + (n + 1) * lenghthPerBin;
-                    AT_ASSERT(binMin <= binMax);
+                    binStartIdx = aten::clamp<int>(binStartIdx, 0, m_numBins - 1);
+                    binEndIdx = aten::clamp<int>(binEndIdx, 0, m_numBins - 1);
 
-                    bins[n].bbox.expand(ref.bbox);
+                    //AT_ASSERT(binStartIdx <= binEndIdx);
 
-                    if (bins[n].bbox.minPos()[dim] < binMin) {
-                        bins[n].bbox.minPos()[dim] = binMin;
+                    for (int n = binStartIdx; n <= binEndIdx; n++) {
+                        bins[n].bbox.expand(ref.bbox);
+                        clipBin(bins[n], dim, n);
                     }
 
-                    if (bins[n].bbox.maxPos()[dim] > binMax) {
-                        bins[n].bbox.maxPos()[dim] = binMax;
-                    }
+                    // 分割情報が取り扱う三角形数を更新.
+                    bins[binStartIdx].start++;
+                    bins[binEndIdx].end++;
+                }
+            }
+        }
+
+        // Merge the bins of all threads to the first thread's bins.
+        for (int t = 1; t < threadNum; t++) {
+            for (int dim = 0; dim < 3; ++dim) {
+                for (uint32_t n = 0; n < m_numBins; n++) {
+                    const auto& src = threadBins[(t * 3 + dim) * m_numBins + n];
+                    auto& dst = threadBins[dim * m_numBins + n];
+
+                    dst.start += src.start;
+                    dst.end += src.end;
+
+                    dst.bbox.expand(src.bbox);
+                    clipBin(dst, dim, n);
                 }
+            }
+        }
 
-                // 分割情報が取り扱う三角形数を更新.
-                bins[binStartIdx].start++;
-                bins[binEndIdx].end++;
+        // check along each dimension
+        for (int dim = 0; dim < 3; ++dim)
+        {
+            if (invLen[dim] == real(0)) {
+                continue;
             }
 
+            auto bins = &threadBins[dim * m_numBins];
+
             // augment the bins from right to left.
 
             bins[m_numBins - 1].accum = bins[m_numBins - 1].bbox;
@@ -671,6 +1035,7 @@ namespace aten
 
     void sbvh::spatialSort(
         SBVHNode& node,
+        std::vector<Reference>& refs,
         real splitPlane,
         int axis,
         real splitCost,
@@ -691,7 +1056,7 @@ namespace aten
         // distribute the refenreces to left, right or both children.
         for (uint32_t i = 0; i < refNum; i++) {
             const auto refIdx = node.refIds[i];
-            const auto& ref = m_refs[refIdx];
+            const auto& ref = refs[refIdx];
 
             const auto refMin = ref.bbox.minPos()[axis];
             const auto refMax = ref.bbox.maxPos()[axis];
@@ -748,25 +1113,25 @@ namespace aten
                     // push left and right.
                     // 二つに分割.
 
-                    Reference leftRef(m_refs[refIdx]);
+                    Reference leftRef(refs[refIdx]);
 
                     // バウンディングボックスを更新.
                     if (leftRef.bbox.maxPos()[axis] > splitPlane) {
                         leftRef.bbox.maxPos()[axis] = splitPlane;
                     }
 
-                    Reference rightRef(m_refs[refIdx]);
+                    Reference rightRef(refs[refIdx]);
 
                     // バウンディングボックスを更新.
                     if (rightRef.bbox.minPos()[axis] < splitPlane) {
                         rightRef.bbox.minPos()[axis] = splitPlane;
                     }
 
-                    m_refs[refIdx] = leftRef;
-                    m_refs.push_back(rightRef);
+                    refs[refIdx] = leftRef;
+                    refs.push_back(rightRef);
 
                     leftList.push_back(refIdx);
-                    rightList.push_back((uint32_t)m_refs.size() - 1);
+                    rightList.push_back((uint32_t)refs.size() - 1);
                 }
             }
         }
@@ -774,6 +1139,7 @@ namespace aten
 
     void sbvh::objectSort(
         SBVHNode& node,
+        const std::vector<Reference>& refs,
         int splitBin,
         int axis,
         std::vector<uint32_t>& leftList,
@@ -788,7 +1154,7 @@ namespace aten
         // compute the aabb of all centroids.
         for (int i = 0; i < refNum; i++) {
             const auto id = node.refIds[i];
-            const auto& ref = m_refs[id];
+            const auto& ref = refs[id];
             auto centroid = ref.bbox.getCenter();
             bbCentroid.expand(centroid);
         }
@@ -798,7 +1164,7 @@ namespace aten
         // distribute to left and right based on the provided split bin
         for (int i = 0; i < refNum; i++) {
             const auto id = node.refIds[i];
-            const auto& ref = m_refs[id];
+            const auto& ref = refs[id];
 
             auto center = ref.bbox.getCenter();
 
@@ -984,6 +1350,26 @@ namespace aten
         real t_min, real t_max,
         bool enableLod,
         Intersection& isect) const
+    {
+        return onHit(ctxt, r, t_min, t_max, enableLod, false, isect);
+    }
+
+    bool sbvh::occluded(
+        const context& ctxt,
+        const ray& r,
+        real t_min, real t_max) const
+    {
+        Intersection isect;
+        return onHit(ctxt, r, t_min, t_max, false, true, isect);
+    }
+
+    bool sbvh::onHit(
+        const context& ctxt,
+        const ray& r,
+        real t_min, real t_max,
+        bool enableLod,
+        bool isAnyHit,
+        Intersection& isect) const
     {
         auto& mtxs = m_bvh.getMatrices();
 
@@ -1020,10 +1406,20 @@ namespace aten
 
                     aten::ray transformedRay;
 
+                    // Range of the ray in the local coordinate.
+                    real localTmin = t_min;
+                    real localTmax = t_max;
+
                     if (mtxid >= 0) {
                         const auto& mtxW2L = mtxs[mtxid * 2 + 1];
 
-                        transformedRay = mtxW2L.applyRay(r);
+                        if (isAnyHit) {
+                            // The occlusion test needs the exact range in the local coordinate.
+                            transformedRay = mtxW2L.applyRay(r, localTmin, localTmax);
+                        }
+                        else {
+                            transformedRay = mtxW2L.applyRay(r);
+                        }
                     }
                     else {
                         transformedRay = r;
@@ -1039,14 +1435,14 @@ namespace aten
                         ctxt,
                         exid,
                         transformedRay,
-                        t_min, t_max,
+                        localTmin, localTmax,
                         isectTmp,
-                        enableLod);
+                        enableLod,
+                        isAnyHit);
                 }
                 else if (node->primid >= 0) {
                     // Hit test for a primitive.
-                    auto prim = ctxt.getTriangle((int)node->primid);
-                    isHit = prim->hit(ctxt, r, t_min, t_max, isectTmp);
+                    isHit = ctxt.hitTriangle((int)node->primid, r, t_min, t_max, isectTmp);
                     if (isHit) {
                         isectTmp.objid = s->id();
                     }
@@ -1062,6 +1458,11 @@ namespace aten
                         isect.objid = s->id();
                         t_max = isect.t;
                     }
+
+                    if (isAnyHit) {
+                        // Any hit is enough for the occlusion test.
+                        return true;
+                    }
                 }
             }
             else {
@@ -1085,7 +1486,8 @@ namespace aten
         const ray& r,
         real t_min, real t_max,
         Intersection& isect,
-        bool enableLod) const
+        bool enableLod,
+        bool isAnyHit/*= false*/) const
     {
         real hitt = AT_MATH_INF;
 
@@ -1104,15 +1506,40 @@ namespace aten
 
             bool isHit = false;
 
-            if (node->isLeaf()) {
+            const int triBatchIdx = (exid < (int)m_listTriBatchIdx.size() && !m_listTriBatchIdx[exid].empty())
+                ? m_listTriBatchIdx[exid][nodeid]
+                : -1;
+
+            if (triBatchIdx >= 0) {
+                // Test all triangles in the sub tree at once, and skip the sub tree.
+                if (aten::aabb::hit(r, node->boxmin, node->boxmax, t_min, t_max)) {
+                    Intersection isectTmp;
+
+                    if (m_triBatch.hit(triBatchIdx, r, t_min, t_max, isectTmp, isAnyHit)) {
+                        isectTmp.meshid = ctxt.getTriangleParam(isectTmp.primid).gemoid;
+
+                        if (isectTmp.t < isect.t) {
+                            isect = isectTmp;
+                            t_max = isect.t;
+                        }
+
+                        if (isAnyHit) {
+                            return true;
+                        }
+                    }
+                }
+
+                nodeid = (int)node->miss;
+                continue;
+            }
+            else if (node->isLeaf()) {
                 Intersection isectTmp;
 
 #if (SBVH_TRIANGLE_NUM == 1)
-                auto prim = ctxt.getTriangle((int)node->triid);
-                isHit = prim->hit(ctxt, r, t_min, t_max, isectTmp);
+                isHit = ctxt.hitTriangle((int)node->triid, r, t_min, t_max, isectTmp);
 
                 if (isHit) {
-                    const auto& primParam = prim->getParam();
+                    const auto& primParam = ctxt.getTriangleParam((int)node->triid);
                     isectTmp.meshid = primParam.gemoid;
                 }
 #else
@@ -1140,6 +1567,11 @@ namespace aten
                         isect = isectTmp;
                         t_max = isect.t;
                     }
+
+                    if (isAnyHit) {
+                        // Any hit is enough for the occlusion test.
+                        return true;
+                    }
                 }
             }
 #if 1
@@ -1408,6 +1840,103 @@ namespace aten
         return true;
     }
 
+    // Sections in the cache file for sbvh.
+    enum SbvhCacheSection : uint32_t {
+        SbvhCacheNodes = 0,
+        SbvhCacheParams = 1,
+    };
+
+    struct SbvhCacheParam {
+        aabb bbox;
+        uint32_t maxDepth;
+    };
+
+    uint32_t sbvh::getCacheSettings() const
+    {
+        // The nodes are restored as they are, so the layout of the node is also taken into account.
+        return ((uint32_t)sizeof(ThreadedSbvhNode) << 16) | (m_maxTriangles << 8) | m_numBins;
+    }
+
+    bool sbvh::exportCache(
+        const context& ctxt,
+        hitable** list,
+        uint32_t num,
+        AccelCache::Writer& writer)
+    {
+#if (SBVH_TRIANGLE_NUM == 1)
+        // The top layer depends on the transforms and the nested trees, so it is not cached.
+        if (!m_isNested || m_isImported || m_nodes.empty()) {
+            return false;
+        }
+
+        // Build voxel and convert to the flattened nodes as exportTree does.
+        // The top layer copies the converted nodes as they are.
+        if (!m_treelets.empty()) {
+            buildVoxel(ctxt);
+        }
+
+        m_threadedNodes.resize(1);
+        m_threadedNodes[0].clear();
+
+        std::vector<int> indices;
+        convert(
+            m_threadedNodes[0],
+            0,
+            indices);
+
+        SbvhCacheParam info[1];
+        info[0].bbox = getBoundingbox();
+        info[0].maxDepth = m_maxDepth;
+
+        writer.add(SbvhCacheNodes, m_threadedNodes[0]);
+        writer.add(SbvhCacheParams, info, sizeof(info));
+
+        return true;
+#else
+        // The reference indices for the leaves can't be restored with the nodes.
+        return false;
+#endif
+    }
+
+    bool sbvh::importCache(
+        const context& ctxt,
+        hitable** list,
+        uint32_t num,
+        const AccelCache::Reader& reader)
+    {
+#if (SBVH_TRIANGLE_NUM == 1)
+        if (!m_isNested || m_isImported) {
+            return false;
+        }
+
+        uint32_t nodeNum = 0;
+        uint32_t infoNum = 0;
+
+        const auto nodes = reader.get<ThreadedSbvhNode>(SbvhCacheNodes, nodeNum);
+        const auto info = reader.get<SbvhCacheParam>(SbvhCacheParams, infoNum);
+
+        if (!nodes || nodeNum == 0 || infoNum != 1) {
+            return false;
+        }
+
+        // NOTE
+        // The nodes are copied from the mapped memory as they are,
+        // because the top layer gathers the nested nodes into its own list.
+        // The triangle indices in the nodes are not offset, because the hash of the cache includes them.
+        m_threadedNodes.resize(1);
+        m_threadedNodes[0].assign(nodes, nodes + nodeNum);
+
+        setBoundingBox(info[0].bbox);
+        m_maxDepth = info[0].maxDepth;
+
+        m_isImported = true;
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
     static inline void _drawAABB(
         const aten::ThreadedSbvhNode* node,
         aten::hitable::FuncDrawAABB func,
@@ -1476,7 +2005,15 @@ namespace aten
         const auto& toplayer = m_bvh.getNodes()[0];
 
         AT_ASSERT(m_threadedNodes[0].size() == toplayer.size());
-        
-        memcpy(&m_threadedNodes[0][0], &toplayer[0], toplayer.size() * sizeof(ThreadedSbvhNode));
+
+        if (m_bvh.isRestructured()) {
+            memcpy(&m_threadedNodes[0][0], &toplayer[0], toplayer.size() * sizeof(ThreadedSbvhNode));
+        }
+        else {
+            // Copy only the re-fitted nodes.
+            for (auto idx : m_bvh.getRefittedNodes()) {
+                memcpy(&m_threadedNodes[0][idx], &toplayer[idx], sizeof(ThreadedSbvhNode));
+            }
+        }
     }
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "accelerator/threaded_bvh.h"
+#include "accelerator/triangle_batch.h"
 #include "scene/context.h"
 
 #define SBVH_TRIANGLE_NUM    (1)
@@ -106,6 +107,38 @@ namespace aten
             bool enableLod,
             Intersection& isect) const override;
 
+        /**
+         * @brief Test if a ray is occluded by any object.
+         */
+        virtual bool occluded(
+            const context& ctxt,
+            const ray& r,
+            real t_min, real t_max) const override;
+
+        /**
+         * @brief Return the value of the build settings which change the built structure tree.
+         */
+        virtual uint32_t getCacheSettings() const override;
+
+        /**
+         * @brief Register the flattened nodes to the cache writer. Only the nested tree can be cached.
+         */
+        virtual bool exportCache(
+            const context& ctxt,
+            hitable** list,
+            uint32_t num,
+            AccelCache::Writer& writer) override;
+
+        /**
+         * @brief Restore the flattened nodes from the cache instead of building them.
+         * The voxels are also restored, because they are stored in the flattened nodes.
+         */
+        virtual bool importCache(
+            const context& ctxt,
+            hitable** list,
+            uint32_t num,
+            const AccelCache::Reader& reader) override;
+
         /**
          * @brief Export the built structure data.
          */
@@ -197,13 +230,41 @@ namespace aten
             int offset,
             std::vector<int>& indices) const;
 
+        /**
+         * @brief Test if a ray hits a object from the top layer.
+         * @param [in] isAnyHit If true, terminate at the first hit for the occlusion test.
+         */
+        bool onHit(
+            const context& ctxt,
+            const ray& r,
+            real t_min, real t_max,
+            bool enableLod,
+            bool isAnyHit,
+            Intersection& isect) const;
+
         bool hit(
             const context& ctxt,
             int exid,
             const ray& r,
             real t_min, real t_max,
             Intersection& isect,
-            bool enableLod) const;
+            bool enableLod,
+            bool isAnyHit = false) const;
+
+        /**
+         * @brief Build the triangle batches for the small sub trees in the bottom layers.
+         */
+        void buildTriangleBatch(const context& ctxt);
+
+        /**
+         * @brief Collect the triangles in the sub tree of the specified node.
+         * @return If the sub tree has triangles more than the batch can contain, return false.
+         */
+        bool collectTriangles(
+            const context& ctxt,
+            const std::vector<ThreadedSbvhNode>& nodes,
+            int nodeid,
+            std::vector<const AT_NAME::face*>& triangles) const;
 
         /**
          * @brief Temporary description of sbvh node.
@@ -243,6 +304,10 @@ namespace aten
 
             bool leaf{ true };
             bool isTreeletRoot{ false };
+
+            // References which are newly created by splitting this node.
+            int createdRefStart{ -1 };
+            int createdRefNum{ 0 };
         };
 
         // 分割情報.
@@ -279,6 +344,7 @@ namespace aten
          * @brief Find a potential object split, but it does not split.
          * ざっくり分割テスト.
          * @param [in, out] node The node which we want to split.
+         * @param [in] refs References list which the node refers.
          * @param [out] cost Cost to split.
          * @param [out] leftBB AABB of the potential left child nodes.
          * @param [out] rightBB AABB of the potential right child nodes.
@@ -287,6 +353,7 @@ namespace aten
          */
         void findObjectSplit(
             SBVHNode& node,
+            const std::vector<Reference>& refs,
             real& cost,
             aabb& leftBB,
             aabb& rightBB,
@@ -297,6 +364,7 @@ namespace aten
          * @brief Find a potential spatial split, but it does not split.
          * より詳細分割テスト.
          * @param [in, out] node The node which we want to split.
+         * @param [in] refs References list which the node refers.
          * @param [out] leftCount Count of triangles in the left child nodes.
          * @param [out] rightCount Count of triangles in the right child nodes.
          * @param [out] leftBB AABB of the potential left child nodes.
@@ -306,6 +374,7 @@ namespace aten
         */
         void findSpatialSplit(
             SBVHNode& node,
+            const std::vector<Reference>& refs,
             real& cost,
             int& leftCount,
             int& rightCount,
@@ -318,6 +387,7 @@ namespace aten
          * @biref Do the binned sah split actually with the result of findSpatialSplit.
          * より詳細分割テストに基づいて実際に分割する.
          * @param [in, out] node The node which we want to split.
+         * @param [in, out] refs References list which the node refers. The split references are appended.
          * @param [in] splitPlane Position of the axis along which the split will run.
          * @param [in] axis Axis (xyz) along which the split will run.
          * @param [in] splitCost Cost to split.
@@ -330,6 +400,7 @@ namespace aten
          */
         void spatialSort(
             SBVHNode& node,
+            std::vector<Reference>& refs,
             real splitPlane,
             int axis,
             real splitCost,
@@ -344,6 +415,7 @@ namespace aten
          * @biref Do the binned sah split actually with the result of findObjectSplit.
          * ざっくり分割テストに基づいて実際に分割する.
          * @param [in, out] node The node which we want to split.
+         * @param [in] refs References list which the node refers.
          * @param [in] Index of the bin to split.
          * @param [in] axis Axis (xyz) along which the split will run.
          * @param [out] leftList Triangle indices list for the left children.
@@ -351,11 +423,40 @@ namespace aten
          */
         void objectSort(
             SBVHNode& node,
+            const std::vector<Reference>& refs,
             int splitBin,
             int axis,
             std::vector<uint32_t>& leftList,
             std::vector<uint32_t>& rightList);
 
+        /**
+         * @brief Build the nodes from the first node in the specified nodes list.
+         * @param [in, out] nodes Nodes list. The first node is the root and the created nodes are appended.
+         * @param [in, out] refs References list which the nodes refer.
+         * @param [in] rootSurfaceArea Surface area of the whole tree's AABB.
+         * @param [in] subTreeThreshold If the node has references less than this, the node is not built but stored to subTreeRoots.
+         * @param [out] subTreeRoots Node indices of the sub trees which are deferred to build.
+         */
+        void buildNodes(
+            std::vector<SBVHNode>& nodes,
+            std::vector<Reference>& refs,
+            real rootSurfaceArea,
+            uint32_t subTreeThreshold,
+            std::vector<uint32_t>* subTreeRoots);
+
+        /**
+         * @brief Build the deferred sub trees in parallel and merge them to the tree.
+         */
+        void buildSubTrees(
+            real rootSurfaceArea,
+            const std::vector<uint32_t>& subTreeRoots);
+
+        /**
+         * @brief Renumber the nodes and the references in the same order as the serial build.
+         * @param [in] triNum Count of the triangles which are the initial references.
+         */
+        void reorderAsSerialBuild(uint32_t triNum);
+
         /**
          * @brief Convert the tree to the linear list.
          * @param [out] indices Node indices list.
@@ -383,6 +484,12 @@ namespace aten
         // ノード当たりの最大三角形数.
         uint32_t m_maxTriangles{ SBVH_TRIANGLE_NUM };
 
+        // Sub tree which has references less than this is not worth to build in parallel.
+        static const uint32_t MinSubTreeRefNum = 1024;
+
+        // Bin the references in parallel if the node has references more than this.
+        static const uint32_t ParallelBinningThreshold = 64 * 1024;
+
         uint32_t m_refIndexNum{ 0 };
 
         int m_offsetTriIdx{ 0 };
@@ -397,6 +504,12 @@ namespace aten
         std::vector<std::vector<ThreadedSbvhNode>> m_threadedNodes;
         std::vector<int> m_refIndices;
 
+        // Triangles which are tested together in the small sub trees.
+        TriangleBatch m_triBatch;
+
+        // Index of the triangle batch per node. If it is empty, the triangle batch is disabled.
+        std::vector<std::vector<int>> m_listTriBatchIdx;
+
         uint32_t m_maxDepth{ 0 };
 
         // Description for the treelet root.
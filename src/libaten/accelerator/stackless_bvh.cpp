@@ -208,13 +208,23 @@ namespace aten {
         return hit(ctxt, 0, m_listStacklessBvhNode, r, t_min, t_max, isect);
     }
 
+    bool StacklessBVH::occluded(
+        const context& ctxt,
+        const ray& r,
+        real t_min, real t_max) const
+    {
+        Intersection isect;
+        return hit(ctxt, 0, m_listStacklessBvhNode, r, t_min, t_max, isect, true);
+    }
+
     bool StacklessBVH::hit(
         const context& ctxt,
         int exid,
         const std::vector<std::vector<StacklessBvhNode>>& listStacklessBvhNode,
         const ray& r,
         real t_min, real t_max,
-        Intersection& isect) const
+        Intersection& isect,
+        bool isAnyHit/*= false*/) const
     {
         real hitt = AT_MATH_INF;
 
@@ -247,10 +257,20 @@ namespace aten {
 
                     aten::ray transformedRay;
 
+                    // Range of the ray in the local coordinate.
+                    real localTmin = t_min;
+                    real localTmax = t_max;
+
                     if (mtxid >= 0) {
                         const auto& mtxW2L = m_mtxs[mtxid * 2 + 1];
 
-                        transformedRay = mtxW2L.applyRay(r);
+                        if (isAnyHit) {
+                            // The occlusion test needs the exact range in the local coordinate.
+                            transformedRay = mtxW2L.applyRay(r, localTmin, localTmax);
+                        }
+                        else {
+                            transformedRay = mtxW2L.applyRay(r);
+                        }
                     }
                     else {
                         transformedRay = r;
@@ -261,13 +281,13 @@ namespace aten {
                         (int)node->exid,
                         listStacklessBvhNode,
                         transformedRay,
-                        t_min, t_max,
-                        isectTmp);
+                        localTmin, localTmax,
+                        isectTmp,
+                        isAnyHit);
                 }
                 else if (node->primid >= 0) {
                     // Hit test for a primitive.
-                    auto prim = ctxt.getTriangle((int)node->primid);
-                    isHit = prim->hit(ctxt, r, t_min, t_max, isectTmp);
+                    isHit = ctxt.hitTriangle((int)node->primid, r, t_min, t_max, isectTmp);
                     if (isHit) {
                         isectTmp.objid = s->id();
                     }
@@ -282,6 +302,11 @@ namespace aten {
                         isect = isectTmp;
                         t_max = isect.t;
                     }
+
+                    if (isAnyHit) {
+                        // Any hit is enough for the occlusion test.
+                        return true;
+                    }
                 }
             }
             else {
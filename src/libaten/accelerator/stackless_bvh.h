@@ -56,6 +56,11 @@ namespace aten {
             return hit(ctxt, r, t_min, t_max, isect);
         }
 
+        virtual bool occluded(
+            const context& ctxt,
+            const ray& r,
+            real t_min, real t_max) const override;
+
         std::vector<std::vector<StacklessBvhNode>>& getNodes()
         {
             return m_listStacklessBvhNode;
@@ -97,7 +102,8 @@ namespace aten {
             const std::vector<std::vector<StacklessBvhNode>>& listGpuBvhNode,
             const ray& r,
             real t_min, real t_max,
-            Intersection& isect) const;
+            Intersection& isect,
+            bool isAnyHit = false) const;
 
     private:
         bvh m_bvh;
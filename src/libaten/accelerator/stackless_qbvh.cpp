@@ -501,13 +501,23 @@ namespace aten
         return hit(ctxt, 0, m_listQbvhNode, r, t_min, t_max, isect);
     }
 
+    bool StacklessQbvh::occluded(
+        const context& ctxt,
+        const ray& r,
+        real t_min, real t_max) const
+    {
+        Intersection isect;
+        return hit(ctxt, 0, m_listQbvhNode, r, t_min, t_max, isect, true);
+    }
+
     bool StacklessQbvh::hit(
         const context& ctxt,
         int exid,
         const std::vector<std::vector<StacklessQbvhNode>>& listQbvhNode,
         const ray& r,
         real t_min, real t_max,
-        Intersection& isect) const
+        Intersection& isect,
+        bool isAnyHit/*= false*/) const
     {
         int nodeid = 0;
         uint32_t bitstack = 0;
@@ -542,10 +552,20 @@ namespace aten
 
                     aten::ray transformedRay;
 
+                    // Range of the ray in the local coordinate.
+                    real localTmin = t_min;
+                    real localTmax = t_max;
+
                     if (mtxid >= 0) {
                         const auto& mtxW2L = m_mtxs[mtxid * 2 + 1];
 
-                        transformedRay = mtxW2L.applyRay(r);
+                        if (isAnyHit) {
+                            // The occlusion test needs the exact range in the local coordinate.
+                            transformedRay = mtxW2L.applyRay(r, localTmin, localTmax);
+                        }
+                        else {
+                            transformedRay = mtxW2L.applyRay(r);
+                        }
                     }
                     else {
                         transformedRay = r;
@@ -556,12 +576,12 @@ namespace aten
                         (int)pnode->exid,
                         listQbvhNode,
                         transformedRay,
-                        t_min, t_max,
-                        isectTmp);
+                        localTmin, localTmax,
+                        isectTmp,
+                        isAnyHit);
                 }
                 else if (pnode->primid >= 0) {
-                    auto f = ctxt.getTriangle((int)pnode->primid);
-                    isHit = f->hit(ctxt, r, t_min, t_max, isectTmp);
+                    isHit = ctxt.hitTriangle((int)pnode->primid, r, t_min, t_max, isectTmp);
 
                     if (isHit) {
                         isectTmp.objid = s->id();
@@ -577,6 +597,11 @@ namespace aten
                         isect = isectTmp;
                         t_max = isect.t;
                     }
+
+                    if (isAnyHit) {
+                        // Any hit is enough for the occlusion test.
+                        return true;
+                    }
                 }
             }
             else {
@@ -88,6 +88,11 @@ namespace aten {
             return hit(ctxt, r, t_min, t_max, isect);
         }
 
+        virtual bool occluded(
+            const context& ctxt,
+            const ray& r,
+            real t_min, real t_max) const override;
+
         std::vector<std::vector<StacklessQbvhNode>>& getNodes()
         {
             return m_listQbvhNode;
@@ -146,7 +151,8 @@ namespace aten {
             const std::vector<std::vector<StacklessQbvhNode>>& listQbvhNode,
             const ray& r,
             real t_min, real t_max,
-            Intersection& isect) const;
+            Intersection& isect,
+            bool isAnyHit = false) const;
 
     private:
         bvh m_bvh;
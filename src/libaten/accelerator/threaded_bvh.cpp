@@ -348,13 +348,23 @@ namespace aten
         return hit(ctxt, 0, m_listThreadedBvhNode, r, t_min, t_max, isect);
     }
 
+    bool ThreadedBVH::occluded(
+        const context& ctxt,
+        const ray& r,
+        real t_min, real t_max) const
+    {
+        Intersection isect;
+        return hit(ctxt, 0, m_listThreadedBvhNode, r, t_min, t_max, isect, true);
+    }
+
     bool ThreadedBVH::hit(
         const context& ctxt,
         int exid,
         const std::vector<std::vector<ThreadedBvhNode>>& listThreadedBvhNode,
         const ray& r,
         real t_min, real t_max,
-        Intersection& isect) const
+        Intersection& isect,
+        bool isAnyHit/*= false*/) const
     {
         real hitt = AT_MATH_INF;
 
@@ -386,10 +396,20 @@ namespace aten
 
                     aten::ray transformedRay;
 
+                    // Range of the ray in the local coordinate.
+                    real localTmin = t_min;
+                    real localTmax = t_max;
+
                     if (mtxid >= 0) {
                         const auto& mtxW2L = m_mtxs[mtxid * 2 + 1];
 
-                        transformedRay = mtxW2L.applyRay(r);
+                        if (isAnyHit) {
+                            // The occlusion test needs the exact range in the local coordinate.
+                            transformedRay = mtxW2L.applyRay(r, localTmin, localTmax);
+                        }
+                        else {
+                            transformedRay = mtxW2L.applyRay(r);
+                        }
                     }
                     else {
                         transformedRay = r;
@@ -404,8 +424,9 @@ namespace aten
                         exid,
                         listThreadedBvhNode,
                         transformedRay,
-                        t_min, t_max,
-                        isectTmp);
+                        localTmin, localTmax,
+                        isectTmp,
+                        isAnyHit);
 
                     if (isHit) {
                         isectTmp.objid = s->id();
@@ -413,8 +434,7 @@ namespace aten
                 }
                 else if (node->primid >= 0) {
                     // Hit test for a primitive.
-                    auto prim = ctxt.getTriangle((int)node->primid);
-                    isHit = prim->hit(ctxt, r, t_min, t_max, isectTmp);
+                    isHit = ctxt.hitTriangle((int)node->primid, r, t_min, t_max, isectTmp);
                     if (isHit) {
                         // Set dummy to return if ray hit.
                         isectTmp.objid = s ? s->id() : 1;
@@ -430,6 +450,11 @@ namespace aten
                         isect = isectTmp;
                         t_max = isect.t;
                     }
+
+                    if (isAnyHit) {
+                        // Any hit is enough for the occlusion test.
+                        return true;
+                    }
                 }
             }
             else {
@@ -459,6 +484,18 @@ namespace aten
         m_mtxs.clear();
         ctxt.copyMatricesAndUpdateTransformableMatrixIdx(m_mtxs);
 
+        if (m_bvh.getUpdateStatistics().rotationNum == 0
+            && !m_listThreadedBvhNode.empty()
+            && !m_listThreadedBvhNode[0].empty())
+        {
+            // The structure of the tree is not changed, so the traversal order and the hit/miss links are still valid.
+            refitTopLayer();
+            return;
+        }
+
+        m_isRestructured = true;
+        m_refittedNodes.clear();
+
         auto root = m_bvh.getRoot();
         std::vector<ThreadedBvhNodeEntry> threadedBvhNodeEntries;
         registerBvhNodeToLinearList(ctxt, root, threadedBvhNodeEntries);
@@ -521,6 +558,36 @@ namespace aten
         setOrder(threadedBvhNodeEntries, listParentId, m_listThreadedBvhNode[0]);
     }
 
+    void ThreadedBVH::refitTopLayer()
+    {
+        m_isRestructured = false;
+
+        auto& threadedBvhNodes = m_listThreadedBvhNode[0];
+        const auto& refittedNodes = m_bvh.m_refittedNodes;
+
+        const int num = (int)refittedNodes.size();
+        m_refittedNodes.resize(num);
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for if (num > (int)bvh::ParallelRefitThreshold)
+#endif
+        for (int i = 0; i < num; i++) {
+            auto node = refittedNodes[i];
+
+            int idx = node->getTraversalOrder();
+            AT_ASSERT(0 <= idx && idx < (int)threadedBvhNodes.size());
+
+            auto& gpunode = threadedBvhNodes[idx];
+
+            const auto& bbox = node->getBoundingbox();
+
+            gpunode.boxmax = aten::vec4(bbox.maxPos(), 0);
+            gpunode.boxmin = aten::vec4(bbox.minPos(), 0);
+
+            m_refittedNodes[i] = idx;
+        }
+    }
+
     void ThreadedBVH::registerBvhNodeToLinearList(
         const context& ctxt,
         bvhnode* node,
@@ -579,4 +646,67 @@ namespace aten
         registerBvhNodeToLinearList(ctxt, node->getLeft(), nodes);
         registerBvhNodeToLinearList(ctxt, node->getRight(), nodes);
     }
+
+    // Sections in the cache file for threaded bvh.
+    enum ThreadedBvhCacheSection : uint32_t {
+        ThreadedBvhCacheNodes = 0,
+        ThreadedBvhCacheBox = 1,
+    };
+
+    uint32_t ThreadedBVH::getCacheSettings() const
+    {
+        // The nodes are restored as they are, so the layout of the node is also taken into account.
+        return ((uint32_t)sizeof(ThreadedBvhNode) << 8) | (uint32_t)m_bvh.getBuildMode();
+    }
+
+    bool ThreadedBVH::exportCache(
+        const context& ctxt,
+        hitable** list,
+        uint32_t num,
+        AccelCache::Writer& writer)
+    {
+        // The top layer depends on the transforms and the nested trees, so it is not cached.
+        if (!m_isNested || m_listThreadedBvhNode.empty()) {
+            return false;
+        }
+
+        const auto& bbox = getBoundingbox();
+        const aabb box[] = { bbox };
+
+        writer.add(ThreadedBvhCacheNodes, m_listThreadedBvhNode[0]);
+        writer.add(ThreadedBvhCacheBox, box, sizeof(box));
+
+        return true;
+    }
+
+    bool ThreadedBVH::importCache(
+        const context& ctxt,
+        hitable** list,
+        uint32_t num,
+        const AccelCache::Reader& reader)
+    {
+        if (!m_isNested) {
+            return false;
+        }
+
+        uint32_t nodeNum = 0;
+        uint32_t boxNum = 0;
+
+        const auto nodes = reader.get<ThreadedBvhNode>(ThreadedBvhCacheNodes, nodeNum);
+        const auto box = reader.get<aabb>(ThreadedBvhCacheBox, boxNum);
+
+        if (!nodes || nodeNum == 0 || boxNum != 1) {
+            return false;
+        }
+
+        // NOTE
+        // The nodes are copied from the mapped memory as they are,
+        // because the top layer gathers the nested nodes into its own list.
+        m_listThreadedBvhNode.resize(1);
+        m_listThreadedBvhNode[0].assign(nodes, nodes + nodeNum);
+
+        setBoundingBox(box[0]);
+
+        return true;
+    }
 }
@@ -84,6 +84,14 @@ namespace aten
             return hit(ctxt, r, t_min, t_max, isect);
         }
 
+        /**
+         * @brief Test if a ray is occluded by any object.
+         */
+        virtual bool occluded(
+            const context& ctxt,
+            const ray& r,
+            real t_min, real t_max) const override;
+
         /**
          * @brief Draw all node's AABB in the structure tree.
          */
@@ -94,11 +102,62 @@ namespace aten
             m_bvh.drawAABB(func, mtxL2W);
         }
 
+        /**
+         * @brief Return the value of the build settings which change the built structure tree.
+         */
+        virtual uint32_t getCacheSettings() const override;
+
+        /**
+         * @brief Register the flattened nodes to the cache writer. Only the nested tree can be cached.
+         */
+        virtual bool exportCache(
+            const context& ctxt,
+            hitable** list,
+            uint32_t num,
+            AccelCache::Writer& writer) override;
+
+        /**
+         * @brief Restore the flattened nodes from the cache instead of building them.
+         * The underlying tree is not restored, so drawAABB and update are not available for the restored tree.
+         */
+        virtual bool importCache(
+            const context& ctxt,
+            hitable** list,
+            uint32_t num,
+            const AccelCache::Reader& reader) override;
+
         /**
          * @brief Update the structure tree.
+         * If the structure of the tree is not changed by the rotations,
+         * only the boxes of the re-fitted nodes are updated in the flattened nodes.
          */
         virtual void update(const context& ctxt) override;
 
+        /**
+         * @brief Return whether the flattened nodes were re-built in the last update.
+         * If not, only the nodes which getRefittedNodes returns were changed.
+         */
+        bool isRestructured() const
+        {
+            return m_isRestructured;
+        }
+
+        /**
+         * @brief Return the indices of the top layer nodes which were re-fitted in the last update.
+         */
+        const std::vector<uint32_t>& getRefittedNodes() const
+        {
+            return m_refittedNodes;
+        }
+
+        /**
+         * @brief Return the underlying tree.
+         */
+        bvh& getBvh()
+        {
+            return m_bvh;
+        }
+
         /**
          * @brief Return all nodes.
          */
@@ -199,7 +258,13 @@ namespace aten
             const std::vector<std::vector<ThreadedBvhNode>>& listThreadedBvhNode,
             const ray& r,
             real t_min, real t_max,
-            Intersection& isect) const;
+            Intersection& isect,
+            bool isAnyHit = false) const;
+
+        /**
+         * @brief Copy the boxes of the re-fitted nodes to the flattened nodes of the top layer.
+         */
+        void refitTopLayer();
 
         /**
          * @brief Convert the tree to the linear list.
@@ -222,5 +287,11 @@ namespace aten
         std::vector<accelerator*> m_nestedBvh;
 
         std::map<int, accelerator*> m_mapNestedBvh;
+
+        // Flag whether the flattened nodes were re-built in the last update.
+        bool m_isRestructured{ true };
+
+        // Indices of the top layer nodes which were re-fitted in the last update.
+        std::vector<uint32_t> m_refittedNodes;
     };
 }
@@ -0,0 +1,339 @@
+#include "accelerator/triangle_batch.h"
+#include "geometry/face.h"
+
+// NOTE
+// Watertight Ray/Triangle Intersection.
+// http://jcgt.org/published/0002/01/05/paper.pdf
+
+namespace aten
+{
+    WatertightRay::WatertightRay(const ray& r)
+    {
+        // Calculate dimension where ray direction is maximal.
+        const auto dx = aten::abs(r.dir.x);
+        const auto dy = aten::abs(r.dir.y);
+        const auto dz = aten::abs(r.dir.z);
+
+        kz = (dx > dy ? (dx > dz ? 0 : 2) : (dy > dz ? 1 : 2));
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+
+        // Swap kx and ky dimension to preserve winding direction of triangles.
+        if (r.dir[kz] < real(0)) {
+            std::swap(kx, ky);
+        }
+
+        // Calculate shear constants.
+        Sx = r.dir[kx] / r.dir[kz];
+        Sy = r.dir[ky] / r.dir[kz];
+        Sz = real(1) / r.dir[kz];
+
+        org = r.org;
+    }
+
+    bool TriangleBatch::isBatchable(const hitable* item)
+    {
+        return (dynamic_cast<const AT_NAME::face*>(item) != nullptr);
+    }
+
+    int TriangleBatch::add(
+        const context& ctxt,
+        const AT_NAME::face* const* triangles,
+        int num)
+    {
+        AT_ASSERT(0 < num && num <= MaxTriangleNum);
+
+        Batch batch;
+        memset(batch.pos, 0, sizeof(batch.pos));
+
+        for (int i = 0; i < num; i++) {
+            const auto tri = triangles[i];
+            const auto& param = tri->getParam();
+
+            for (int v = 0; v < 3; v++) {
+                const auto pos = ctxt.getVertexPosition(param.idx[v]);
+
+                batch.pos[v][0][i] = (float)pos.x;
+                batch.pos[v][1][i] = (float)pos.y;
+                batch.pos[v][2][i] = (float)pos.z;
+            }
+
+            batch.triangles[i] = tri;
+        }
+
+        for (int i = num; i < MaxTriangleNum; i++) {
+            batch.triangles[i] = nullptr;
+        }
+
+        batch.num = num;
+
+        m_batches.push_back(batch);
+
+        return (int)m_batches.size() - 1;
+    }
+
+    // Test the triangles one by one.
+    static int intersectScalar(
+        const float pos[3][3][TriangleBatch::MaxTriangleNum],
+        int num,
+        const WatertightRay& r,
+        real t_min, real t_max,
+        float* resultT, float* resultA, float* resultB)
+    {
+        int mask = 0;
+
+        for (int i = 0; i < num; i++) {
+            // Calculate vertices relative to ray origin.
+            const real Akx = pos[0][r.kx][i] - r.org[r.kx];
+            const real Aky = pos[0][r.ky][i] - r.org[r.ky];
+            const real Akz = pos[0][r.kz][i] - r.org[r.kz];
+            const real Bkx = pos[1][r.kx][i] - r.org[r.kx];
+            const real Bky = pos[1][r.ky][i] - r.org[r.ky];
+            const real Bkz = pos[1][r.kz][i] - r.org[r.kz];
+            const real Ckx = pos[2][r.kx][i] - r.org[r.kx];
+            const real Cky = pos[2][r.ky][i] - r.org[r.ky];
+            const real Ckz = pos[2][r.kz][i] - r.org[r.kz];
+
+            // Perform shear and scale of vertices.
+            const real Ax = Akx - r.Sx * Akz;
+            const real Ay = Aky - r.Sy * Akz;
+            const real Bx = Bkx - r.Sx * Bkz;
+            const real By = Bky - r.Sy * Bkz;
+            const real Cx = Ckx - r.Sx * Ckz;
+            const real Cy = Cky - r.Sy * Ckz;
+
+            // Calculate scaled barycentric coordinates.
+            const real U = Cx * By - Cy * Bx;
+            const real V = Ax * Cy - Ay * Cx;
+            const real W = Bx * Ay - By * Ax;
+
+            // Perform edge tests.
+            if ((U < real(0) || V < real(0) || W < real(0))
+                && (U > real(0) || V > real(0) || W > real(0)))
+            {
+                continue;
+            }
+
+            const real det = U + V + W;
+
+            if (det == real(0)) {
+                continue;
+            }
+
+            // Calculate scaled z-coordinates of vertices and use them to calculate the hit distance.
+            const real T = U * (r.Sz * Akz) + V * (r.Sz * Bkz) + W * (r.Sz * Ckz);
+
+            const real rcpDet = real(1) / det;
+            const real t = T * rcpDet;
+
+            if (t < t_min || t > t_max) {
+                continue;
+            }
+
+            resultT[i] = (float)t;
+            resultA[i] = (float)(V * rcpDet);
+            resultB[i] = (float)(W * rcpDet);
+
+            mask |= (1 << i);
+        }
+
+        return mask;
+    }
+
+#ifdef AT_ENABLE_SIMD
+    // Test 4 triangles from the specified offset with SSE.
+    static inline int intersectSSE(
+        const float pos[3][3][TriangleBatch::MaxTriangleNum],
+        int offset,
+        const WatertightRay& r,
+        real t_min, real t_max,
+        float* resultT, float* resultA, float* resultB)
+    {
+        const auto zero = _mm_setzero_ps();
+
+        const auto ox = _mm_set1_ps(r.org[r.kx]);
+        const auto oy = _mm_set1_ps(r.org[r.ky]);
+        const auto oz = _mm_set1_ps(r.org[r.kz]);
+
+        const auto Sx = _mm_set1_ps(r.Sx);
+        const auto Sy = _mm_set1_ps(r.Sy);
+        const auto Sz = _mm_set1_ps(r.Sz);
+
+        // Calculate vertices relative to ray origin.
+        const auto Akz = _mm_sub_ps(_mm_loadu_ps(&pos[0][r.kz][offset]), oz);
+        const auto Bkz = _mm_sub_ps(_mm_loadu_ps(&pos[1][r.kz][offset]), oz);
+        const auto Ckz = _mm_sub_ps(_mm_loadu_ps(&pos[2][r.kz][offset]), oz);
+
+        // Perform shear and scale of vertices.
+        const auto Ax = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(&pos[0][r.kx][offset]), ox), _mm_mul_ps(Sx, Akz));
+        const auto Ay = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(&pos[0][r.ky][offset]), oy), _mm_mul_ps(Sy, Akz));
+        const auto Bx = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(&pos[1][r.kx][offset]), ox), _mm_mul_ps(Sx, Bkz));
+        const auto By = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(&pos[1][r.ky][offset]), oy), _mm_mul_ps(Sy, Bkz));
+        const auto Cx = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(&pos[2][r.kx][offset]), ox), _mm_mul_ps(Sx, Ckz));
+        const auto Cy = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(&pos[2][r.ky][offset]), oy), _mm_mul_ps(Sy, Ckz));
+
+        // Calculate scaled barycentric coordinates.
+        const auto U = _mm_sub_ps(_mm_mul_ps(Cx, By), _mm_mul_ps(Cy, Bx));
+        const auto V = _mm_sub_ps(_mm_mul_ps(Ax, Cy), _mm_mul_ps(Ay, Cx));
+        const auto W = _mm_sub_ps(_mm_mul_ps(Bx, Ay), _mm_mul_ps(By, Ax));
+
+        // Perform edge tests.
+        const auto hasNeg = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(U, zero), _mm_cmplt_ps(V, zero)), _mm_cmplt_ps(W, zero));
+        const auto hasPos = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(U, zero), _mm_cmpgt_ps(V, zero)), _mm_cmpgt_ps(W, zero));
+        auto valid = _mm_andnot_ps(_mm_and_ps(hasNeg, hasPos), _mm_cmpeq_ps(zero, zero));
+
+        const auto det = _mm_add_ps(_mm_add_ps(U, V), W);
+        valid = _mm_and_ps(valid, _mm_cmpneq_ps(det, zero));
+
+        // Calculate scaled z-coordinates of vertices and use them to calculate the hit distance.
+        const auto T = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(U, _mm_mul_ps(Sz, Akz)), _mm_mul_ps(V, _mm_mul_ps(Sz, Bkz))),
+            _mm_mul_ps(W, _mm_mul_ps(Sz, Ckz)));
+
+        const auto rcpDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+        const auto t = _mm_mul_ps(T, rcpDet);
+
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(t, _mm_set1_ps(t_min)));
+        valid = _mm_and_ps(valid, _mm_cmple_ps(t, _mm_set1_ps(t_max)));
+
+        _mm_storeu_ps(resultT + offset, t);
+        _mm_storeu_ps(resultA + offset, _mm_mul_ps(V, rcpDet));
+        _mm_storeu_ps(resultB + offset, _mm_mul_ps(W, rcpDet));
+
+        return _mm_movemask_ps(valid) << offset;
+    }
+
+    // Test 8 triangles with AVX2.
+    AT_SIMD_TARGET_AVX2 static int intersectAVX2(
+        const float pos[3][3][TriangleBatch::MaxTriangleNum],
+        const WatertightRay& r,
+        real t_min, real t_max,
+        float* resultT, float* resultA, float* resultB)
+    {
+        const auto zero = _mm256_setzero_ps();
+
+        const auto ox = _mm256_set1_ps(r.org[r.kx]);
+        const auto oy = _mm256_set1_ps(r.org[r.ky]);
+        const auto oz = _mm256_set1_ps(r.org[r.kz]);
+
+        const auto Sx = _mm256_set1_ps(r.Sx);
+        const auto Sy = _mm256_set1_ps(r.Sy);
+        const auto Sz = _mm256_set1_ps(r.Sz);
+
+        // Calculate vertices relative to ray origin.
+        const auto Akz = _mm256_sub_ps(_mm256_loadu_ps(pos[0][r.kz]), oz);
+        const auto Bkz = _mm256_sub_ps(_mm256_loadu_ps(pos[1][r.kz]), oz);
+        const auto Ckz = _mm256_sub_ps(_mm256_loadu_ps(pos[2][r.kz]), oz);
+
+        // Perform shear and scale of vertices.
+        const auto Ax = _mm256_fnmadd_ps(Sx, Akz, _mm256_sub_ps(_mm256_loadu_ps(pos[0][r.kx]), ox));
+        const auto Ay = _mm256_fnmadd_ps(Sy, Akz, _mm256_sub_ps(_mm256_loadu_ps(pos[0][r.ky]), oy));
+        const auto Bx = _mm256_fnmadd_ps(Sx, Bkz, _mm256_sub_ps(_mm256_loadu_ps(pos[1][r.kx]), ox));
+        const auto By = _mm256_fnmadd_ps(Sy, Bkz, _mm256_sub_ps(_mm256_loadu_ps(pos[1][r.ky]), oy));
+        const auto Cx = _mm256_fnmadd_ps(Sx, Ckz, _mm256_sub_ps(_mm256_loadu_ps(pos[2][r.kx]), ox));
+        const auto Cy = _mm256_fnmadd_ps(Sy, Ckz, _mm256_sub_ps(_mm256_loadu_ps(pos[2][r.ky]), oy));
+
+        // Calculate scaled barycentric coordinates.
+        const auto U = _mm256_sub_ps(_mm256_mul_ps(Cx, By), _mm256_mul_ps(Cy, Bx));
+        const auto V = _mm256_sub_ps(_mm256_mul_ps(Ax, Cy), _mm256_mul_ps(Ay, Cx));
+        const auto W = _mm256_sub_ps(_mm256_mul_ps(Bx, Ay), _mm256_mul_ps(By, Ax));
+
+        // Perform edge tests.
+        const auto hasNeg = _mm256_or_ps(
+            _mm256_or_ps(_mm256_cmp_ps(U, zero, _CMP_LT_OQ), _mm256_cmp_ps(V, zero, _CMP_LT_OQ)),
+            _mm256_cmp_ps(W, zero, _CMP_LT_OQ));
+        const auto hasPos = _mm256_or_ps(
+            _mm256_or_ps(_mm256_cmp_ps(U, zero, _CMP_GT_OQ), _mm256_cmp_ps(V, zero, _CMP_GT_OQ)),
+            _mm256_cmp_ps(W, zero, _CMP_GT_OQ));
+        auto valid = _mm256_andnot_ps(_mm256_and_ps(hasNeg, hasPos), _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ));
+
+        const auto det = _mm256_add_ps(_mm256_add_ps(U, V), W);
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ));
+
+        // Calculate scaled z-coordinates of vertices and use them to calculate the hit distance.
+        const auto T = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(U, _mm256_mul_ps(Sz, Akz)), _mm256_mul_ps(V, _mm256_mul_ps(Sz, Bkz))),
+            _mm256_mul_ps(W, _mm256_mul_ps(Sz, Ckz)));
+
+        const auto rcpDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+        const auto t = _mm256_mul_ps(T, rcpDet);
+
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(t_min), _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(t_max), _CMP_LE_OQ));
+
+        _mm256_storeu_ps(resultT, t);
+        _mm256_storeu_ps(resultA, _mm256_mul_ps(V, rcpDet));
+        _mm256_storeu_ps(resultB, _mm256_mul_ps(W, rcpDet));
+
+        return _mm256_movemask_ps(valid);
+    }
+#endif
+
+    bool TriangleBatch::hit(
+        int batchIdx,
+        const ray& r,
+        real t_min, real t_max,
+        Intersection& isect,
+        bool isAnyHit/*= false*/) const
+    {
+        const auto& batch = m_batches[batchIdx];
+
+        const WatertightRay wr(r);
+
+        float resultT[MaxTriangleNum];
+        float resultA[MaxTriangleNum];
+        float resultB[MaxTriangleNum];
+
+        int mask = 0;
+
+#ifdef AT_ENABLE_SIMD
+        const auto simdType = SimdUtil::getType();
+
+        if (simdType == SimdType::AVX2) {
+            mask = intersectAVX2(batch.pos, wr, t_min, t_max, resultT, resultA, resultB);
+        }
+        else if (simdType == SimdType::SSE) {
+            mask = intersectSSE(batch.pos, 0, wr, t_min, t_max, resultT, resultA, resultB);
+            if (batch.num > 4) {
+                mask |= intersectSSE(batch.pos, 4, wr, t_min, t_max, resultT, resultA, resultB);
+            }
+        }
+        else
+#endif
+        {
+            mask = intersectScalar(batch.pos, batch.num, wr, t_min, t_max, resultT, resultA, resultB);
+        }
+
+        // Ignore the empty slots.
+        mask &= (1 << batch.num) - 1;
+
+        int closest = -1;
+
+        for (int i = 0; i < batch.num; i++) {
+            if ((mask & (1 << i)) && resultT[i] < isect.t) {
+                isect.t = resultT[i];
+                isect.a = resultA[i];
+                isect.b = resultB[i];
+
+                closest = i;
+
+                if (isAnyHit) {
+                    break;
+                }
+            }
+        }
+
+        if (closest < 0) {
+            return false;
+        }
+
+        // Same as face::hit.
+        const auto tri = batch.triangles[closest];
+
+        isect.objid = tri->getId();
+        isect.primid = tri->getId();
+        isect.mtrlid = tri->getParam().mtrlid;
+
+        return true;
+    }
+}
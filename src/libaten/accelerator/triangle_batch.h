@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+
+#include "scene/context.h"
+#include "scene/hitable.h"
+#include "math/ray.h"
+#include "misc/simd.h"
+
+namespace aten
+{
+    /**
+     * @brief Triangles in the leaves of the acceleration structure which are tested together.
+     * The vertex positions are copied as structure of arrays so that the triangles are tested in one SIMD pass
+     * without fetching the vertices from the context.
+     */
+    class TriangleBatch {
+    public:
+        static const int MaxTriangleNum = 8;
+
+        TriangleBatch() {}
+        ~TriangleBatch() {}
+
+    public:
+        /**
+         * @brief Register the triangles as one batch.
+         * @return Index of the batch.
+         */
+        int add(
+            const context& ctxt,
+            const AT_NAME::face* const* triangles,
+            int num);
+
+        void clear()
+        {
+            m_batches.clear();
+        }
+
+        uint32_t getBatchNum() const
+        {
+            return (uint32_t)m_batches.size();
+        }
+
+        /**
+         * @brief Test if a ray hits any triangle in the batch, and find the closest one.
+         * @param[in] isAnyHit If true, return at the first hit for the occlusion test.
+         * The result is as same as face::hit, so objid and primid are the index of the triangle.
+         */
+        bool hit(
+            int batchIdx,
+            const ray& r,
+            real t_min, real t_max,
+            Intersection& isect,
+            bool isAnyHit = false) const;
+
+        /**
+         * @brief Return whether the item can be put into the batch.
+         */
+        static bool isBatchable(const hitable* item);
+
+    private:
+        struct Batch {
+            // Vertex positions / [vertex][axis][triangle].
+            float pos[3][3][MaxTriangleNum];
+
+            const AT_NAME::face* triangles[MaxTriangleNum];
+            int num{ 0 };
+        };
+
+        std::vector<Batch> m_batches;
+    };
+
+    /**
+     * @brief Ray which is transformed for the watertight ray/triangle intersection.
+     */
+    struct WatertightRay {
+        int kx, ky, kz;
+        real Sx, Sy, Sz;
+        vec3 org;
+
+        WatertightRay(const ray& r);
+    };
+}
@@ -11,6 +11,7 @@
 #include "filter/nlm.h"
 #include "filter/bilateral.h"
 #include "filter/atrous.h"
+#include "filter/atrous_filter.h"
 #include "filter/taa.h"
 
 #include "filter/PracticalNoiseReduction/PracticalNoiseReduction.h"
@@ -41,10 +42,13 @@
 #include "math/mat4.h"
 #include "math/quaternion.h"
 #include "math/aabb.h"
+#include "math/alias_table.h"
+#include "math/half.h"
 
 #include "misc/color.h"
 #include "misc/timer.h"
 #include "misc/omputil.h"
+#include "misc/simd.h"
 #include "misc/value.h"
 #include "misc/stream.h"
 #include "misc/thread.h"
@@ -78,6 +82,7 @@
 #include "scene/AcceleratedScene.h"
 #include "scene/instance.h"
 
+#include "accelerator/accel_cache.h"
 #include "accelerator/accelerator.h"
 #include "accelerator/bvh.h"
 #include "accelerator/qbvh.h"
@@ -85,6 +90,7 @@
 #include "accelerator/threaded_bvh.h"
 #include "accelerator/stackless_bvh.h"
 #include "accelerator/stackless_qbvh.h"
+#include "accelerator/triangle_batch.h"
 
 #include "accelerator/GpuPayloadDefs.h"
 
@@ -107,6 +113,8 @@
 
 #include "renderer/renderer.h"
 #include "renderer/film.h"
+#include "renderer/accumulator.h"
+#include "renderer/splat_film.h"
 #include "renderer/background.h"
 #include "renderer/envmap.h"
 #include "renderer/raytracing.h"
@@ -116,6 +124,7 @@
 #include "renderer/aov.h"
 #include "renderer/bdpt.h"
 #include "renderer/directlight.h"
+#include "renderer/sorted_pathtracing.h"
 
 #include "posteffect/BloomEffect.h"
 
@@ -0,0 +1,273 @@
+#include "filter/atrous_filter.h"
+#include "misc/color.h"
+#include "misc/timer.h"
+
+// NOTE
+// Edge-Avoiding A-Trous Wavelet Transform for fast Global Illumination Filtering
+// https://jo.dreggn.org/home/2010_atrous.pdf
+// Spatiotemporal Variance-Guided Filtering
+// https://research.nvidia.com/publication/2017-07_Spatiotemporal-Variance-Guided-Filtering%3A
+
+namespace aten {
+    // h = [1/16, 1/4, 3/8, 1/4, 1/16]
+    static const real kernel[5] = {
+        real(1) / real(16), real(1) / real(4), real(3) / real(8), real(1) / real(4), real(1) / real(16),
+    };
+
+    // 3x3 gaussian to smooth the variance.
+    static const real gaussian[3] = {
+        real(1) / real(4), real(1) / real(2), real(1) / real(4),
+    };
+
+    static const real epsilon = real(1e-4);
+
+    void ATrousFilter::setFeatures(const Destination& dst)
+    {
+        m_nmlDepth = dst.geominfo.nml_depth;
+        m_albedo = dst.geominfo.albedo_vis;
+        m_ids = dst.geominfo.ids;
+        m_variance = dst.variance;
+
+        m_depthMax = dst.geominfo.depthMax;
+        m_isNormalized = dst.geominfo.needNormalize;
+
+        m_sampleNum = std::max<uint32_t>(dst.sample, 1);
+    }
+
+    void ATrousFilter::prepareFeatures(
+        const vec4* src,
+        uint32_t width, uint32_t height)
+    {
+        const int num = width * height;
+
+        m_features.resize(num);
+        m_colors[0].resize(num);
+        m_colors[1].resize(num);
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+        for (int i = 0; i < num; i++) {
+            auto& f = m_features[i];
+
+            f.nml = vec3(0, 0, 1);
+            f.depth = real(1);
+            f.albedo = vec3(1);
+            f.id = -1;
+            f.isBackground = false;
+
+            if (m_nmlDepth) {
+                const auto& v = m_nmlDepth->image()[i];
+
+                if (m_isNormalized) {
+                    // [0, 1] -> [-1, 1]
+                    f.nml = vec3(v) * real(2) - real(1);
+
+                    // [0, 1] -> [-d, d]
+                    f.depth = (v.w * real(2) - real(1)) * m_depthMax;
+                }
+                else {
+                    f.nml = vec3(v);
+                    f.depth = v.w;
+                }
+
+                f.depth = aten::abs(f.depth);
+
+                // The depth is clamped to the max if the ray doesn't hit anything.
+                f.isBackground = !(f.depth < m_depthMax * real(0.9999));
+
+                f.nml = length(f.nml) > real(0) ? normalize(f.nml) : vec3(0, 0, 1);
+            }
+
+            if (m_albedo) {
+                const auto& v = m_albedo->image()[i];
+
+                // Keep the color as is where the albedo is black, not to amplify the noise.
+                f.albedo.x = v.x > epsilon ? v.x : real(1);
+                f.albedo.y = v.y > epsilon ? v.y : real(1);
+                f.albedo.z = v.z > epsilon ? v.z : real(1);
+            }
+
+            if (m_ids) {
+                f.id = (int)m_ids->image()[i].x;
+            }
+
+            const vec3 clr = vec3(src[i]) / f.albedo;
+
+            real var = real(0);
+
+            if (m_variance) {
+                const vec3 v = vec3(m_variance->image()[i]) / (f.albedo * f.albedo);
+                var = std::max(color::luminance(v), real(0)) / m_sampleNum;
+            }
+
+            m_colors[0][i] = vec4(clr, var);
+        }
+
+        if (!m_variance) {
+            // Estimate the variance of the luminance from the 3x3 neighbours.
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+            for (int y = 0; y < (int)height; y++) {
+                for (int x = 0; x < (int)width; x++) {
+                    real sum = real(0);
+                    real sum2 = real(0);
+                    int cnt = 0;
+
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dx = -1; dx <= 1; dx++) {
+                            const int xx = x + dx;
+                            const int yy = y + dy;
+
+                            if (0 <= xx && xx < (int)width && 0 <= yy && yy < (int)height) {
+                                const auto lum = color::luminance(vec3(m_colors[0][yy * width + xx]));
+                                sum += lum;
+                                sum2 += lum * lum;
+                                cnt++;
+                            }
+                        }
+                    }
+
+                    sum /= cnt;
+                    sum2 /= cnt;
+
+                    m_colors[1][y * width + x].w = std::max(sum2 - sum * sum, real(0));
+                }
+            }
+
+            for (int i = 0; i < num; i++) {
+                m_colors[0][i].w = m_colors[1][i].w;
+            }
+        }
+    }
+
+    void ATrousFilter::filter(
+        uint32_t width, uint32_t height,
+        int step)
+    {
+        const auto& src = m_colors[0];
+        auto& dst = m_colors[1];
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+        for (int y = 0; y < (int)height; y++) {
+            for (int x = 0; x < (int)width; x++) {
+                const int pos = y * width + x;
+
+                const auto& center = m_features[pos];
+                const auto& centerClr = src[pos];
+
+                if (center.isBackground) {
+                    dst[pos] = centerClr;
+                    continue;
+                }
+
+                // Smooth the variance to make the weight stable.
+                real var = real(0);
+                real varWeight = real(0);
+
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        const int xx = x + dx;
+                        const int yy = y + dy;
+
+                        if (0 <= xx && xx < (int)width && 0 <= yy && yy < (int)height) {
+                            const real w = gaussian[dx + 1] * gaussian[dy + 1];
+                            var += w * src[yy * width + xx].w;
+                            varWeight += w;
+                        }
+                    }
+                }
+
+                const real stddev = aten::sqrt(var / varWeight);
+
+                const real centerLum = color::luminance(vec3(centerClr));
+
+                const real colorScale = real(1) / (m_colorSigma * stddev + epsilon);
+                const real depthScale = real(1) / (m_depthSigma * step * std::max(center.depth, epsilon) + epsilon);
+
+                vec3 sum = vec3(0);
+                real sumWeight = real(0);
+                real sumVar = real(0);
+
+                for (int dy = -2; dy <= 2; dy++) {
+                    const int yy = y + dy * step;
+
+                    if (yy < 0 || yy >= (int)height) {
+                        continue;
+                    }
+
+                    for (int dx = -2; dx <= 2; dx++) {
+                        const int xx = x + dx * step;
+
+                        if (xx < 0 || xx >= (int)width) {
+                            continue;
+                        }
+
+                        const int p = yy * width + xx;
+
+                        const auto& f = m_features[p];
+                        const auto& clr = src[p];
+
+                        if (f.isBackground || f.id != center.id) {
+                            continue;
+                        }
+
+                        const real w_n = aten::pow(std::max(dot(center.nml, f.nml), real(0)), m_normalSigma);
+                        const real w_z = aten::exp(-aten::abs(center.depth - f.depth) * depthScale);
+                        const real w_l = aten::exp(-aten::abs(centerLum - color::luminance(vec3(clr))) * colorScale);
+
+                        const real weight = kernel[dx + 2] * kernel[dy + 2] * w_n * w_z * w_l;
+
+                        sum += weight * vec3(clr);
+                        sumWeight += weight;
+                        sumVar += weight * weight * clr.w;
+                    }
+                }
+
+                // The center pixel is always accumulated, so the sum of the weights is not zero.
+                dst[pos] = vec4(
+                    sum / sumWeight,
+                    sumVar / (sumWeight * sumWeight));
+            }
+        }
+
+        std::swap(m_colors[0], m_colors[1]);
+    }
+
+    void ATrousFilter::operator()(
+        const vec4* src,
+        uint32_t width, uint32_t height,
+        vec4* dst)
+    {
+        AT_ASSERT(!m_nmlDepth || (m_nmlDepth->width() == width && m_nmlDepth->height() == height));
+        AT_ASSERT(!m_albedo || (m_albedo->width() == width && m_albedo->height() == height));
+        AT_ASSERT(!m_ids || (m_ids->width() == width && m_ids->height() == height));
+        AT_ASSERT(!m_variance || (m_variance->width() == width && m_variance->height() == height));
+
+        timer timer;
+        timer.begin();
+
+        prepareFeatures(src, width, height);
+
+        for (int i = 0; i < m_iterationNum; i++) {
+            filter(width, height, 1 << i);
+        }
+
+        const int num = width * height;
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+        for (int i = 0; i < num; i++) {
+            // Multiply the albedo again.
+            auto clr = vec3(m_colors[0][i]) * m_features[i].albedo;
+            dst[i] = vec4(clr, 1);
+        }
+
+        auto elapsed = timer.end();
+        AT_PRINTF("ATrous %f[ms]\n", elapsed);
+    }
+}
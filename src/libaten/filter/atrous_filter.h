@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vector>
+
+#include "visualizer/visualizer.h"
+#include "renderer/renderer.h"
+
+namespace aten {
+    /**
+     * @brief Edge avoiding a-trous filter on the CPU.
+     * The edges are detected with the AOV films (normal, depth, albedo, ids) and the variance film in Destination,
+     * so this works without GL as same as ATrousDenoiser.
+     * The color is divided by the albedo before filtering, and multiplied after filtering to keep the textures.
+     * The weight of the color is normalized with the standard deviation, which is filtered together with the color.
+     */
+    class ATrousFilter : public visualizer::PreProc {
+    public:
+        ATrousFilter() {}
+        virtual ~ATrousFilter() {}
+
+    public:
+        /**
+         * @brief Specify the films which guide the filter.
+         * The films which are null in the destination are not used.
+         * The destination has to be alive until the filter is applied.
+         */
+        void setFeatures(const Destination& dst);
+
+        virtual void operator()(
+            const vec4* src,
+            uint32_t width, uint32_t height,
+            vec4* dst) override final;
+
+        void setParam(
+            int iterationNum,
+            real colorSigma,
+            real normalSigma,
+            real depthSigma)
+        {
+            m_iterationNum = iterationNum;
+            m_colorSigma = colorSigma;
+            m_normalSigma = normalSigma;
+            m_depthSigma = depthSigma;
+        }
+
+        virtual void setParam(Values& values) override final
+        {
+            m_iterationNum = values.get("iteration", m_iterationNum);
+            m_colorSigma = values.get("color", m_colorSigma);
+            m_normalSigma = values.get("normal", m_normalSigma);
+            m_depthSigma = values.get("depth", m_depthSigma);
+        }
+
+    private:
+        struct Pixel {
+            vec3 nml;
+            real depth;
+            vec3 albedo;
+            int id;
+            bool isBackground;
+        };
+
+        void prepareFeatures(
+            const vec4* src,
+            uint32_t width, uint32_t height);
+
+        void filter(
+            uint32_t width, uint32_t height,
+            int step);
+
+    private:
+        const Film* m_nmlDepth{ nullptr };
+        const Film* m_albedo{ nullptr };
+        const Film* m_ids{ nullptr };
+        const Film* m_variance{ nullptr };
+
+        real m_depthMax{ real(1) };
+        bool m_isNormalized{ true };
+
+        // Sample count to convert the variance of the samples to the variance of the pixel.
+        uint32_t m_sampleNum{ 1 };
+
+        int m_iterationNum{ 5 };
+        real m_colorSigma{ real(4) };
+        real m_normalSigma{ real(128) };
+        // Tolerance of the depth difference relative to the depth.
+        real m_depthSigma{ real(0.05) };
+
+        std::vector<Pixel> m_features;
+
+        // Color without albedo / rgb : color, a : variance of luminance.
+        std::vector<vec4> m_colors[2];
+    };
+}
@@ -1,5 +1,7 @@
 #include <vector>
+#ifndef __AT_HEADLESS__
 #include "visualizer/atengl.h"
+#endif
 #include "filter/bilateral.h"
 #include "misc/timer.h"
 
@@ -185,6 +187,7 @@ namespace aten {
         AT_PRINTF("Bilateral %f[ms]\n", elapsed);
     }
 
+#ifndef __AT_HEADLESS__
     /////////////////////////////////////////////////////////
 
     void BilateralFilterShader::prepareRender(
@@ -234,4 +237,5 @@ namespace aten {
             CALL_GL_API(glUniform2f(hTexel, 1.0f / m_width, 1.0f / m_height));
         }
     }
+#endif
 }
@@ -1,5 +1,8 @@
 #include <array>
+#include <vector>
+#ifndef __AT_HEADLESS__
 #include "visualizer/atengl.h"
+#endif
 #include "filter/nlm.h"
 #include "misc/timer.h"
 
@@ -135,6 +138,166 @@ namespace aten {
         }
     }
 
+    // NOTE
+    // The patch distance for the neighbour offset d is the box filtered image of the squared difference between
+    // the image and the image shifted by d. So, iterating the offsets in the outer loop,
+    // the distances of all pixels are computed with the separable box filter instead of comparing the patches per pixel.
+    // The result is same as doNonLocalMeanFilter except the rounding errors.
+    static void doFastNonLocalMeanFilter(
+        const vec4* imgSrc,
+        int imgW, int imgH,
+        vec4* imgDst,
+        real param_h,
+        real sigma)
+    {
+        param_h = std::max(real(0.0001), param_h);
+        sigma = std::max(real(0.0001), sigma);
+
+        const int width = imgW;
+        const int height = imgH;
+
+        // Pad the image with the clamped edge to skip clamping the coordinates.
+        const int pad = kHalfKernel + kHalfSupport;
+        const int padW = width + 2 * pad;
+        const int padH = height + 2 * pad;
+
+        // Padded image as structure of arrays.
+        std::vector<real> padded[3];
+        for (int c = 0; c < 3; c++) {
+            padded[c].resize(padW * padH);
+        }
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+        for (int y = 0; y < padH; y++) {
+            const int sy = std::min(std::max(y - pad, 0), height - 1);
+
+            for (int x = 0; x < padW; x++) {
+                const int sx = std::min(std::max(x - pad, 0), width - 1);
+
+                const auto& p = imgSrc[sy * width + sx];
+
+                padded[0][y * padW + x] = p.r;
+                padded[1][y * padW + x] = p.g;
+                padded[2][y * padW + x] = p.b;
+            }
+        }
+
+        // Squared difference which is box filtered horizontally.
+        // The rows include the half kernel above and below the image to filter vertically.
+        const int rowNum = height + 2 * kHalfKernel;
+        std::vector<real> horizontal(rowNum * width);
+
+        // Accumulated weighted colors and weights.
+        std::vector<real> sum[3];
+        for (int c = 0; c < 3; c++) {
+            sum[c].resize(width * height, real(0));
+        }
+        std::vector<real> sumWeight(width * height, real(0));
+
+        const real normalize = real(1) / real(3 * kKernel * kKernel);
+        const real threshold = 2 * sigma * sigma;
+        const real invH2 = real(1) / (param_h * param_h);
+
+        const int diffNum = width + 2 * kHalfKernel;
+
+        for (int dy = -kHalfSupport; dy <= kHalfSupport; dy++) {
+            for (int dx = -kHalfSupport; dx <= kHalfSupport; dx++) {
+#ifdef ENABLE_OMP
+#pragma omp parallel
+#endif
+                {
+                    std::vector<real> diff(diffNum);
+                    std::vector<real> dist(width);
+
+#ifdef ENABLE_OMP
+#pragma omp for
+#endif
+                    for (int row = 0; row < rowNum; row++) {
+                        // Row in the padded image.
+                        const int py = row - kHalfKernel + pad;
+
+                        // Squared difference from the half kernel left to the half kernel right of the image.
+                        const real* focus[3];
+                        const real* target[3];
+                        for (int c = 0; c < 3; c++) {
+                            focus[c] = &padded[c][py * padW + kHalfSupport];
+                            target[c] = &padded[c][(py + dy) * padW + kHalfSupport + dx];
+                        }
+
+                        for (int x = 0; x < diffNum; x++) {
+                            const real dr = focus[0][x] - target[0][x];
+                            const real dg = focus[1][x] - target[1][x];
+                            const real db = focus[2][x] - target[2][x];
+                            diff[x] = dr * dr + dg * dg + db * db;
+                        }
+
+                        // Box filter with the running sum.
+                        auto dst = &horizontal[row * width];
+
+                        real runningSum = 0;
+                        for (int x = 0; x < kKernel - 1; x++) {
+                            runningSum += diff[x];
+                        }
+
+                        for (int x = 0; x < width; x++) {
+                            runningSum += diff[x + kKernel - 1];
+                            dst[x] = runningSum;
+                            runningSum -= diff[x];
+                        }
+                    }
+
+#ifdef ENABLE_OMP
+#pragma omp for
+#endif
+                    for (int y = 0; y < height; y++) {
+                        // Box filter vertically.
+                        std::fill(dist.begin(), dist.end(), real(0));
+
+                        for (int k = 0; k < kKernel; k++) {
+                            const auto src = &horizontal[(y + k) * width];
+                            for (int x = 0; x < width; x++) {
+                                dist[x] += src[x];
+                            }
+                        }
+
+                        const int py = y + pad + dy;
+
+                        const real* pixel[3];
+                        real* dstSum[3];
+                        for (int c = 0; c < 3; c++) {
+                            pixel[c] = &padded[c][py * padW + pad + dx];
+                            dstSum[c] = &sum[c][y * width];
+                        }
+
+                        auto dstWeight = &sumWeight[y * width];
+
+                        for (int x = 0; x < width; x++) {
+                            // NOTE
+                            // Z(p) = sum(exp(-max(|v(p) - v(q)|^2 - 2σ^2, 0) / h^2))
+                            const real dist2 = dist[x] * normalize;
+                            const real weight = aten::exp(-std::max(dist2 - threshold, real(0)) * invH2);
+
+                            dstSum[0][x] += weight * pixel[0][x];
+                            dstSum[1][x] += weight * pixel[1][x];
+                            dstSum[2][x] += weight * pixel[2][x];
+                            dstWeight[x] += weight;
+                        }
+                    }
+                }
+            }
+        }
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+        for (int i = 0; i < width * height; i++) {
+            const real w = sumWeight[i];
+            imgDst[i] = vec4(sum[0][i] / w, sum[1][i] / w, sum[2][i] / w, 1);
+        }
+    }
+
     void NonLocalMeanFilter::operator()(
         const vec4* src,
         uint32_t width, uint32_t height,
@@ -143,16 +306,26 @@ namespace aten {
         timer timer;
         timer.begin();
 
-        doNonLocalMeanFilter(
-            src,
-            width, height,
-            dst,
-            m_param_h, m_sigma);
+        if (m_mode == Mode::Fast) {
+            doFastNonLocalMeanFilter(
+                src,
+                width, height,
+                dst,
+                m_param_h, m_sigma);
+        }
+        else {
+            doNonLocalMeanFilter(
+                src,
+                width, height,
+                dst,
+                m_param_h, m_sigma);
+        }
 
         auto elapsed = timer.end();
         AT_PRINTF("NML %f[ms]\n", elapsed);
     }
 
+#ifndef __AT_HEADLESS__
     /////////////////////////////////////////////////////////
 
     void NonLocalMeanFilterShader::prepareRender(
@@ -178,4 +351,5 @@ namespace aten {
             CALL_GL_API(glUniform2f(hTexel, 1.0f / m_width, 1.0f / m_height));
         }
     }
+#endif
 }
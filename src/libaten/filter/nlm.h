@@ -6,6 +6,14 @@
 namespace aten {
     class NonLocalMeanFilter : public visualizer::PreProc {
     public:
+        /**
+         * @brief Ways to compute the patch distances.
+         */
+        enum class Mode {
+            Naive,  ///< Compare the patches per pixel and per neighbour.
+            Fast,   ///< Box filter the squared difference images per neighbour offset.
+        };
+
         NonLocalMeanFilter() {}
         NonLocalMeanFilter(real param_h, real sigma)
         {
@@ -32,9 +40,21 @@ namespace aten {
             m_sigma = values.get("sigma", m_sigma);
         }
 
+        void setMode(Mode mode)
+        {
+            m_mode = mode;
+        }
+
+        Mode getMode() const
+        {
+            return m_mode;
+        }
+
     private:
         real m_param_h{ real(0.2) };
         real m_sigma{ real(0.2) };
+
+        Mode m_mode{ Mode::Fast };
     };
 
     class NonLocalMeanFilterShader : public Blitter {
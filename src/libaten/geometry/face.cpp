@@ -9,32 +9,12 @@
 
 namespace AT_NAME
 {
-    void face::resetIdWhenAnyTriangleLeave(AT_NAME::face* tri)
-    {
-        tri->m_id = tri->m_listItem.currentIndex();
-    }
-
     face::face()
     {
-        m_listItem.init(this, resetIdWhenAnyTriangleLeave);
     }
 
     face::~face()
     {
-        m_listItem.leave();
-    }
-
-    face* face::create(
-        const context& ctxt,
-        const aten::PrimitiveParamter& param)
-    {
-        face* f = new face();
-
-        f->param = param;
-
-        f->build(ctxt, param.mtrlid, param.gemoid);
-
-        return f;
     }
 
     bool face::hit(
@@ -43,27 +23,7 @@ namespace AT_NAME
         real t_min, real t_max,
         aten::Intersection& isect) const
     {
-        const auto& v0 = ctxt.getVertex(param.idx[0]);
-        const auto& v1 = ctxt.getVertex(param.idx[1]);
-        const auto& v2 = ctxt.getVertex(param.idx[2]);
-
-        bool isHit = hit(
-            &param, 
-            v0.pos, v1.pos, v2.pos,
-            r, 
-            t_min, t_max, 
-            &isect);
-
-        if (isHit) {
-            // Temporary, notify triangle id to the parent object.
-            isect.objid = m_id;
-
-            isect.primid = m_id;
-
-            isect.mtrlid = param.mtrlid;
-        }
-
-        return isHit;
+        return ctxt.hitTriangle(m_id, r, t_min, t_max, isect);
     }
 
     bool face::hit(
@@ -79,7 +39,8 @@ namespace AT_NAME
 
         const auto res = intersectTriangle(r, v0, v1, v2);
 
-        if (res.isIntersect) {
+        // The range is needed for the occlusion test which doesn't compare the distance with the other hits.
+        if (res.isIntersect && res.t <= t_max) {
             if (res.t < isect->t) {
                 isect->t = res.t;
 
@@ -99,6 +60,8 @@ namespace AT_NAME
         aten::hitrecord& rec,
         const aten::Intersection& isect) const
     {
+        const auto& param = getParam();
+
         const auto& v0 = ctxt.getVertex(param.idx[0]);
         const auto& v1 = ctxt.getVertex(param.idx[1]);
         const auto& v2 = ctxt.getVertex(param.idx[2]);
@@ -147,25 +110,27 @@ namespace AT_NAME
         int mtrlid, 
         int geomid)
     {
-        const auto& v0 = ctxt.getVertex(param.idx[0]);
-        const auto& v1 = ctxt.getVertex(param.idx[1]);
-        const auto& v2 = ctxt.getVertex(param.idx[2]);
+        auto& param = m_ctxt->getTriangleParam(m_id);
+
+        const auto v0 = ctxt.getVertexPosition(param.idx[0]);
+        const auto v1 = ctxt.getVertexPosition(param.idx[1]);
+        const auto v2 = ctxt.getVertexPosition(param.idx[2]);
 
         aten::vec3 vmax = aten::vec3(
-            std::max(v0.pos.x, std::max(v1.pos.x, v2.pos.x)),
-            std::max(v0.pos.y, std::max(v1.pos.y, v2.pos.y)),
-            std::max(v0.pos.z, std::max(v1.pos.z, v2.pos.z)));
+            std::max(v0.x, std::max(v1.x, v2.x)),
+            std::max(v0.y, std::max(v1.y, v2.y)),
+            std::max(v0.z, std::max(v1.z, v2.z)));
 
         aten::vec3 vmin = aten::vec3(
-            std::min(v0.pos.x, std::min(v1.pos.x, v2.pos.x)),
-            std::min(v0.pos.y, std::min(v1.pos.y, v2.pos.y)),
-            std::min(v0.pos.z, std::min(v1.pos.z, v2.pos.z)));
+            std::min(v0.x, std::min(v1.x, v2.x)),
+            std::min(v0.y, std::min(v1.y, v2.y)),
+            std::min(v0.z, std::min(v1.z, v2.z)));
 
         setBoundingBox(aten::aabb(vmin, vmax));
 
         // 三角形の面積 = ２辺の外積の長さ / 2;
-        auto e0 = v1.pos - v0.pos;
-        auto e1 = v2.pos - v0.pos;
+        auto e0 = v1 - v0;
+        auto e1 = v2 - v0;
         param.area = real(0.5) * cross(e0, e1).length();
 
         param.mtrlid = mtrlid;
@@ -196,6 +161,8 @@ namespace AT_NAME
         real b = aten::sqrt(r0) * r1;
 #endif
 
+        const auto& param = getParam();
+
         const auto& v0 = ctxt.getVertex(param.idx[0]);
         const auto& v1 = ctxt.getVertex(param.idx[1]);
         const auto& v2 = ctxt.getVertex(param.idx[2]);
@@ -225,17 +192,19 @@ namespace AT_NAME
 
     int face::geomid() const
     {
-        return param.gemoid;
+        return getParam().gemoid;
     }
 
     aabb face::computeAABB(const context& ctxt) const
     {
-        const auto& v0 = ctxt.getVertex(param.idx[0]);
-        const auto& v1 = ctxt.getVertex(param.idx[1]);
-        const auto& v2 = ctxt.getVertex(param.idx[2]);
+        const auto& param = getParam();
+
+        const auto v0 = ctxt.getVertexPosition(param.idx[0]);
+        const auto v1 = ctxt.getVertexPosition(param.idx[1]);
+        const auto v2 = ctxt.getVertexPosition(param.idx[2]);
 
-        auto vmin = aten::min(aten::min(v0.pos, v1.pos), v2.pos);
-        auto vmax = aten::max(aten::max(v0.pos, v1.pos), v2.pos);
+        auto vmin = aten::min(aten::min(v0, v1), v2);
+        auto vmax = aten::max(aten::max(v0, v1), v2);
 
         aabb ret(vmin, vmax);
 
@@ -12,6 +12,11 @@
 
 namespace AT_NAME
 {
+    /**
+     * @brief Triangle in the context.
+     * The parameter (indices, material, area) is stored in the flat array in the context,
+     * and the face is the handle to it which is used as the hitable.
+     */
     class face : public aten::hitable {
         friend class context;
 
@@ -64,12 +69,12 @@ namespace AT_NAME
 
         const aten::PrimitiveParamter& getParam() const
         {
-            return param;
+            return m_ctxt->getTriangleParam(m_id);
         }
 
         void setParam(const aten::PrimitiveParamter& p)
         {
-            param = p;
+            m_ctxt->getTriangleParam(m_id) = p;
         }
 
         int getId() const
@@ -78,22 +83,10 @@ namespace AT_NAME
         }
 
     private:
-        static void resetIdWhenAnyTriangleLeave(AT_NAME::face* tri);
+        // Context which has the parameter.
+        aten::context* m_ctxt{ nullptr };
 
-        static face* create(
-            const aten::context& ctxt,
-            const aten::PrimitiveParamter& param);
-
-        void addToDataList(aten::DataList<AT_NAME::face>& list)
-        {
-            list.add(&m_listItem);
-            m_id = m_listItem.currentIndex();
-        }
-    
-    private:
-        aten::PrimitiveParamter param;
+        // Index in the context.
         int m_id{ -1 };
-
-        aten::DataList<AT_NAME::face>::ListItem m_listItem;
     };
 }
@@ -47,8 +47,12 @@ namespace AT_NAME
 
         m_param.primnum = m_triangles;
 
+        if (hasEmissiveMaterial()) {
+            buildAreaDistribution(ctxt);
+        }
+
         m_accel->asNested();
-        m_accel->build(ctxt, (hitable**)&tmp[0], (uint32_t)tmp.size(), &bbox);
+        m_accel->buildWithCache(ctxt, (hitable**)&tmp[0], (uint32_t)tmp.size(), &bbox);
 
         bbox = m_accel->getBoundingbox();
 
@@ -74,6 +78,113 @@ namespace AT_NAME
         }
 
         m_param.primnum = m_triangles;
+
+        if (hasEmissiveMaterial()) {
+            buildAreaDistribution(ctxt);
+        }
+    }
+
+    bool object::hasEmissiveMaterial() const
+    {
+        for (const auto& s : m_shapes) {
+            const auto mtrl = s->getMaterial();
+            if (mtrl && mtrl->isEmissive()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void object::buildAreaDistribution(const context& ctxt) const
+    {
+        if (m_isAreaDistBuilt.load(std::memory_order_acquire)) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_areaDistMutex);
+
+        if (m_isAreaDistBuilt.load(std::memory_order_relaxed)) {
+            // Built by the other thread.
+            return;
+        }
+
+        m_faces.clear();
+        m_faces.reserve(m_triangles);
+
+        for (const auto& s : m_shapes) {
+            m_faces.insert(m_faces.end(), s->faces.begin(), s->faces.end());
+        }
+
+        m_areaVectors.resize(m_faces.size());
+
+        std::vector<real> areas(m_faces.size());
+
+        for (uint32_t i = 0; i < (uint32_t)m_faces.size(); i++) {
+            const auto& faceParam = m_faces[i]->getParam();
+
+            const auto v0 = ctxt.getVertexPosition(faceParam.idx[0]);
+            const auto v1 = ctxt.getVertexPosition(faceParam.idx[1]);
+            const auto v2 = ctxt.getVertexPosition(faceParam.idx[2]);
+
+            auto e0 = v1 - v0;
+            auto e1 = v2 - v0;
+
+            m_areaVectors[i] = cross(e0, e1);
+            areas[i] = real(0.5) * length(m_areaVectors[i]);
+        }
+
+        m_areaDist.build(areas);
+
+        m_isAreaDistBuilt.store(true, std::memory_order_release);
+    }
+
+    bool object::buildAreaDistribution(
+        const aten::mat4& mtxL2W,
+        aten::AliasTable& areaDist) const
+    {
+        AT_ASSERT(hasAreaDistribution());
+
+        areaDist.clear();
+
+        // Columns of the upper 3x3 matrix.
+        const aten::vec3 c0(mtxL2W.m00, mtxL2W.m10, mtxL2W.m20);
+        const aten::vec3 c1(mtxL2W.m01, mtxL2W.m11, mtxL2W.m21);
+        const aten::vec3 c2(mtxL2W.m02, mtxL2W.m12, mtxL2W.m22);
+
+        // If the columns are orthogonal and have the same length, the transform scales all areas equally.
+        {
+            const real l0 = squared_length(c0);
+            const real l1 = squared_length(c1);
+            const real l2 = squared_length(c2);
+
+            const real eps = real(1e-4) * std::max(l0, std::max(l1, l2));
+
+            if (aten::abs(l0 - l1) <= eps && aten::abs(l1 - l2) <= eps
+                && aten::abs(dot(c0, c1)) <= eps
+                && aten::abs(dot(c1, c2)) <= eps
+                && aten::abs(dot(c2, c0)) <= eps)
+            {
+                return false;
+            }
+        }
+
+        // NOTE
+        // cross(M * e0, M * e1) = cof(M) * cross(e0, e1).
+        // The columns of the cofactor matrix are (c1 x c2, c2 x c0, c0 x c1).
+        const auto cof0 = cross(c1, c2);
+        const auto cof1 = cross(c2, c0);
+        const auto cof2 = cross(c0, c1);
+
+        std::vector<real> areas(m_areaVectors.size());
+
+        for (uint32_t i = 0; i < (uint32_t)m_areaVectors.size(); i++) {
+            const auto& n = m_areaVectors[i];
+            areas[i] = real(0.5) * length(n.x * cof0 + n.y * cof1 + n.z * cof2);
+        }
+
+        areaDist.build(areas);
+
+        return true;
     }
 
     bool object::hit(
@@ -93,6 +204,14 @@ namespace AT_NAME
         return isHit;
     }
 
+    bool object::occluded(
+        const context& ctxt,
+        const aten::ray& r,
+        real t_min, real t_max) const
+    {
+        return m_accel->occluded(ctxt, r, t_min, t_max);
+    }
+
     void object::evalHitResult(
         const context& ctxt,
         const aten::ray& r,
@@ -102,29 +221,26 @@ namespace AT_NAME
     {
         auto f = ctxt.getTriangle(isect.primid);
 
-        auto& vtxs = ctxt.getVertices();
-
         const auto& faceParam = f->getParam();
 
-        const auto& v0 = vtxs[faceParam.idx[0]];
-        const auto& v1 = vtxs[faceParam.idx[1]];
-        const auto& v2 = vtxs[faceParam.idx[2]];
+        const auto v0 = ctxt.getVertexPosition(faceParam.idx[0]);
+        const auto v1 = ctxt.getVertexPosition(faceParam.idx[1]);
 
         //face::evalHitResult(v0, v1, v2, &rec, &isect);
         f->evalHitResult(ctxt, r, rec, isect);
 
         real orignalLen = 0;
         {
-            const auto& p0 = v0.pos;
-            const auto& p1 = v1.pos;
+            const auto& p0 = v0;
+            const auto& p1 = v1;
 
             orignalLen = length(p1.v - p0.v);
         }
 
         real scaledLen = 0;
         {
-            auto p0 = mtxL2W.apply(v0.pos);
-            auto p1 = mtxL2W.apply(v1.pos);
+            auto p0 = mtxL2W.apply(v0);
+            auto p1 = mtxL2W.apply(v1);
 
             scaledLen = length(p1.v - p0.v);
         }
@@ -143,31 +259,32 @@ namespace AT_NAME
         const aten::mat4& mtxL2W, 
         aten::sampler* sampler) const
     {
-        auto r = sampler->nextSample();
-        int shapeidx = (int)(r * (m_shapes.size() - 1));
-        auto& objshape = m_shapes[shapeidx];
+        // Used as a light at first.
+        buildAreaDistribution(ctxt);
 
-        r = sampler->nextSample();
-        int faceidx = (int)(r * (objshape->faces.size() - 1));
-        auto f = objshape->faces[faceidx];
+        AT_ASSERT(m_areaDist.size() > 0);
+
+        auto r = sampler->nextSample();
+        int faceidx = m_areaDist.sample(r);
+        auto f = m_faces[faceidx];
 
         const auto& faceParam = f->getParam();
 
-        const auto& v0 = ctxt.getVertex(faceParam.idx[0]);
-        const auto& v1 = ctxt.getVertex(faceParam.idx[1]);
+        const auto v0 = ctxt.getVertexPosition(faceParam.idx[0]);
+        const auto v1 = ctxt.getVertexPosition(faceParam.idx[1]);
 
         real orignalLen = 0;
         {
-            const auto& p0 = v0.pos;
-            const auto& p1 = v1.pos;
+            const auto& p0 = v0;
+            const auto& p1 = v1;
 
             orignalLen = (p1 - p0).length();
         }
 
         real scaledLen = 0;
         {
-            auto p0 = mtxL2W.apply(v0.pos);
-            auto p1 = mtxL2W.apply(v1.pos);
+            auto p0 = mtxL2W.apply(v0);
+            auto p1 = mtxL2W.apply(v1);
 
             scaledLen = length(p1.v - p0.v);
         }
@@ -179,9 +296,29 @@ namespace AT_NAME
 
         f->getSamplePosNormalArea(ctxt, result, sampler);
 
+        // NOTE
+        // The triangle is chosen in proportion to the area, so the pdf of the position on the object is 1 / (total area).
         result->area = area;
     }
 
+    void object::getSamplePosNormalArea(
+        const context& ctxt,
+        aten::hitable::SamplePosNormalPdfResult* result,
+        const aten::AliasTable& areaDist,
+        aten::sampler* sampler) const
+    {
+        AT_ASSERT(hasAreaDistribution());
+        AT_ASSERT(areaDist.size() == m_faces.size());
+
+        auto r = sampler->nextSample();
+        int faceidx = areaDist.sample(r);
+        auto f = m_faces[faceidx];
+
+        f->getSamplePosNormalArea(ctxt, result, sampler);
+
+        result->area = areaDist.getSum();
+    }
+
     void object::drawForGBuffer(
         aten::hitable::FuncPreDraw func,
         const context& ctxt,
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <memory>
+#include <atomic>
+#include <mutex>
 
 #include "types.h"
 #include "material/material.h"
 #include "math/mat4.h"
+#include "math/alias_table.h"
 #include "geometry/face.h"
 #include "geometry/objshape.h"
 #include "geometry/transformable.h"
@@ -30,6 +33,11 @@ namespace AT_NAME
             real t_min, real t_max,
             aten::Intersection& isect) const override final;
 
+        virtual bool occluded(
+            const aten::context& ctxt,
+            const aten::ray& r,
+            real t_min, real t_max) const override final;
+
         virtual void evalHitResult(
             const aten::context& ctxt,
             const aten::ray& r,
@@ -79,12 +87,51 @@ namespace AT_NAME
 
         void build(const aten::context& ctxt);
 
+        /**
+         * @brief Sample the position on the triangles in proportion to the area.
+         * result->area is the total area, so the pdf of the sample position is 1 / area.
+         */
         virtual void getSamplePosNormalArea(
             const aten::context& ctxt,
             aten::hitable::SamplePosNormalPdfResult* result,
             const aten::mat4& mtxL2W, 
             aten::sampler* sampler) const override final;
 
+        /**
+         * @brief Sample the position on the triangles with the area distribution which is built by buildAreaDistribution.
+         * The area distribution in the local coordinate has to be built.
+         */
+        void getSamplePosNormalArea(
+            const aten::context& ctxt,
+            aten::hitable::SamplePosNormalPdfResult* result,
+            const aten::AliasTable& areaDist,
+            aten::sampler* sampler) const;
+
+        /**
+         * @brief Build the area distribution of the triangles in the local coordinate to sample them as a light, if it isn't built yet.
+         * The object which has the emissive material builds it in build(), and the others build it at the first use as a light.
+         * It is safe to call from the rendering threads.
+         */
+        void buildAreaDistribution(const aten::context& ctxt) const;
+
+        /**
+         * @brief Return whether the area distribution in the local coordinate is built.
+         */
+        bool hasAreaDistribution() const
+        {
+            return m_isAreaDistBuilt.load(std::memory_order_acquire);
+        }
+
+        /**
+         * @brief Build the area distribution of the triangles in the transformed coordinate.
+         * The area distribution in the local coordinate has to be built.
+         * @return If the transform keeps the area ratio between the triangles, return false without building,
+         * because the distribution in the local coordinate is available as it is.
+         */
+        bool buildAreaDistribution(
+            const aten::mat4& mtxL2W,
+            aten::AliasTable& areaDist) const;
+
         void appendShape(objshape* shape)
         {
             m_shapes.push_back(std::shared_ptr<objshape>(shape));
@@ -101,9 +148,27 @@ namespace AT_NAME
             return m_shapes[idx].get();
         }
 
+    private:
+        bool hasEmissiveMaterial() const;
+
     private:
         std::vector<std::shared_ptr<objshape>> m_shapes;
 
+        // NOTE
+        // The area distribution costs about 40 bytes per triangle, so it is built only for the object which is used as a light.
+
+        // All triangles in order of the shapes.
+        mutable std::vector<AT_NAME::face*> m_faces;
+
+        // Cross product of the triangle edges in the local coordinate, which is twice the area vector.
+        mutable std::vector<aten::vec3> m_areaVectors;
+
+        // Distribution of the triangles by the area in the local coordinate.
+        mutable aten::AliasTable m_areaDist;
+
+        mutable std::atomic<bool> m_isAreaDistBuilt{ false };
+        mutable std::mutex m_areaDistMutex;
+
         std::shared_ptr<aten::accelerator> m_accel;
         uint32_t m_triangles{ 0 };
     };
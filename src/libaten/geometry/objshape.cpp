@@ -4,7 +4,9 @@
 #include "math/intersect.h"
 #include "accelerator/accelerator.h"
 #include "geometry/vertex.h"
+#ifndef __AT_HEADLESS__
 #include "visualizer/window.h"
+#endif
 
 namespace AT_NAME
 {
@@ -37,6 +39,7 @@ namespace AT_NAME
 
         m_aabb.init(boxmin, boxmax);
 
+#ifndef __AT_HEADLESS__
         // For rasterize rendering.
         if (window::isInitialized())
         {
@@ -53,6 +56,7 @@ namespace AT_NAME
 
             m_ib.init((uint32_t)idx.size(), &idx[0]);
         }
+#endif
     }
 
     void objshape::addFace(face* f)
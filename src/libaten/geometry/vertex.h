@@ -22,4 +22,38 @@ namespace aten
         vec4 pos;
         vec4 nml;
     };
+
+    /**
+     * @brief Formats of the vertices which the context holds.
+     */
+    enum class VertexFormat {
+        Full,       ///< aten::vertex as is.
+        Packed,     ///< Float position, octahedral encoded normal and half float texture coordinate.
+        Quantized,  ///< Same as Packed, but the position is quantized to 16bit in the bounds of the vertex block.
+    };
+
+    /**
+     * @brief Vertex for VertexFormat::Packed.
+     */
+    struct PackedVertex {
+        float pos[3];
+
+        // Octahedral encoded normal (15bit per axis) and uv.z in the lowest 2 bits.
+        uint32_t nml;
+
+        // Half float texture coordinate.
+        uint16_t uv[2];
+    };
+
+    /**
+     * @brief Vertex for VertexFormat::Quantized.
+     */
+    struct QuantizedVertex {
+        // Position which is normalized in the bounds of the vertex block.
+        uint16_t pos[3];
+
+        // Same as PackedVertex.
+        uint16_t nml[2];
+        uint16_t uv[2];
+    };
 }
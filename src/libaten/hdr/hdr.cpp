@@ -84,4 +84,134 @@ namespace aten
 
         return true;
     }
+
+    // NOTE
+    // OpenEXR file layout
+    // https://www.openexr.com/documentation/openexrfilelayout.pdf
+
+    static void writeEXRAttrib(
+        std::vector<uint8_t>& dst,
+        const char* name,
+        const char* type,
+        const void* value,
+        int size)
+    {
+        dst.insert(dst.end(), name, name + strlen(name) + 1);
+        dst.insert(dst.end(), type, type + strlen(type) + 1);
+
+        const auto* p = reinterpret_cast<const uint8_t*>(&size);
+        dst.insert(dst.end(), p, p + sizeof(size));
+
+        p = reinterpret_cast<const uint8_t*>(value);
+        dst.insert(dst.end(), p, p + size);
+    }
+
+    bool EXRExporter::save(
+        const std::string& filename,
+        const vec4* image,
+        const int width, const int height)
+    {
+        FILE *fp = fopen(filename.c_str(), "wb");
+        if (fp == NULL) {
+            AT_PRINTF("Error: %s\n", filename.c_str());
+            return false;
+        }
+
+        std::vector<uint8_t> header;
+
+        // Magic number and version (2, single part scanline).
+        {
+            const int32_t magic = 20000630;
+            const int32_t version = 2;
+
+            const auto* p = reinterpret_cast<const uint8_t*>(&magic);
+            header.insert(header.end(), p, p + sizeof(magic));
+
+            p = reinterpret_cast<const uint8_t*>(&version);
+            header.insert(header.end(), p, p + sizeof(version));
+        }
+
+        // The channels have to be sorted by the name.
+        static const char* channels[] = { "B", "G", "R" };
+        static const int channelIdx[] = { 2, 1, 0 };
+        static const int channelNum = AT_COUNTOF(channels);
+
+        {
+            std::vector<uint8_t> chlist;
+
+            for (int i = 0; i < channelNum; i++) {
+                chlist.insert(chlist.end(), channels[i], channels[i] + 2);
+
+                // pixel type (FLOAT), pLinear, reserved, xSampling, ySampling.
+                const int32_t pixelType = 2;
+                const uint8_t reserved[4] = { 0, 0, 0, 0 };
+                const int32_t sampling[2] = { 1, 1 };
+
+                const auto* p = reinterpret_cast<const uint8_t*>(&pixelType);
+                chlist.insert(chlist.end(), p, p + sizeof(pixelType));
+                chlist.insert(chlist.end(), reserved, reserved + sizeof(reserved));
+
+                p = reinterpret_cast<const uint8_t*>(sampling);
+                chlist.insert(chlist.end(), p, p + sizeof(sampling));
+            }
+            chlist.push_back(0);
+
+            writeEXRAttrib(header, "channels", "chlist", &chlist[0], (int)chlist.size());
+        }
+
+        {
+            const uint8_t compression = 0;  // NO_COMPRESSION
+            const int32_t window[4] = { 0, 0, width - 1, height - 1 };
+            const uint8_t lineOrder = 0;    // INCREASING_Y
+            const float aspect = 1.0f;
+            const float center[2] = { 0.0f, 0.0f };
+            const float screenWidth = 1.0f;
+
+            writeEXRAttrib(header, "compression", "compression", &compression, sizeof(compression));
+            writeEXRAttrib(header, "dataWindow", "box2i", window, sizeof(window));
+            writeEXRAttrib(header, "displayWindow", "box2i", window, sizeof(window));
+            writeEXRAttrib(header, "lineOrder", "lineOrder", &lineOrder, sizeof(lineOrder));
+            writeEXRAttrib(header, "pixelAspectRatio", "float", &aspect, sizeof(aspect));
+            writeEXRAttrib(header, "screenWindowCenter", "v2f", center, sizeof(center));
+            writeEXRAttrib(header, "screenWindowWidth", "float", &screenWidth, sizeof(screenWidth));
+        }
+
+        // End of the header.
+        header.push_back(0);
+
+        fwrite(&header[0], 1, header.size(), fp);
+
+        // Offset table.
+        // Each scanline is y coordinate, size of the data, and the channels.
+        const int32_t lineDataSize = width * channelNum * sizeof(float);
+        const uint64_t lineSize = sizeof(int32_t) * 2 + lineDataSize;
+
+        uint64_t offset = header.size() + sizeof(uint64_t) * height;
+
+        for (int y = 0; y < height; y++) {
+            fwrite(&offset, sizeof(offset), 1, fp);
+            offset += lineSize;
+        }
+
+        std::vector<float> line(width * channelNum);
+
+        for (int32_t y = 0; y < height; y++) {
+            // EXR is top to bottom, the image is bottom to top.
+            const vec4* src = &image[(height - 1 - y) * width];
+
+            for (int c = 0; c < channelNum; c++) {
+                for (int x = 0; x < width; x++) {
+                    line[c * width + x] = (float)src[x][channelIdx[c]];
+                }
+            }
+
+            fwrite(&y, sizeof(y), 1, fp);
+            fwrite(&lineDataSize, sizeof(lineDataSize), 1, fp);
+            fwrite(&line[0], sizeof(float), line.size(), fp);
+        }
+
+        fclose(fp);
+
+        return true;
+    }
 }
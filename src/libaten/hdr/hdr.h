@@ -14,4 +14,16 @@ namespace aten
             const vec4* image,
             const int width, const int height);
     };
-}
\ No newline at end of file
+
+    /**
+     * @brief Export the image as OpenEXR.
+     * The image is written as uncompressed scanlines with 32bit float RGB channels.
+     */
+    class EXRExporter {
+    public:
+        static bool save(
+            const std::string& filename,
+            const vec4* image,
+            const int width, const int height);
+    };
+}
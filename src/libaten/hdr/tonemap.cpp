@@ -1,6 +1,8 @@
 #include <tuple>
 #include <vector>
+#ifndef __AT_HEADLESS__
 #include "visualizer/atengl.h"
+#endif
 #include "hdr/tonemap.h"
 #include "misc/omputil.h"
 
@@ -140,6 +142,7 @@ namespace aten
         }
     }
 
+#ifndef __AT_HEADLESS__
     //////////////////////////////////////////////////////////
 
     void TonemapPostProc::prepareRender(
@@ -164,4 +167,5 @@ namespace aten
         auto hMaxL = getHandle("l_max");
         CALL_GL_API(::glUniform1f(hMaxL, l_max));
     }
+#endif
 }
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "light/ibl.h"
+#include "sampler/xorshift.h"
+#include "misc/timer.h"
 
 // NOTE
 // http://www.cs.virginia.edu/~gfx/courses/2007/ImageSynthesis/assignments/envsample.pdf
@@ -34,11 +36,13 @@ namespace AT_NAME {
         // 　pdfU_00 = a, pdfU_01 = b, ...
         // 　pdfU_10 = h, pdfU_11 = i, ...
 
-        real totalWeight = 0;
-
-        m_cdfU.resize(height);
+        std::vector<real> weights(width * height);
+        std::vector<real> rowWeights(height);
 
-        for (uint32_t y = 0; y < height; y++) {
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+        for (int y = 0; y < (int)height; y++) {
             // NOTE
             // 正距円筒は、緯度方向については極ほど歪むので、その補正.
             // 緯度方向は [0, pi].
@@ -46,11 +50,7 @@ namespace AT_NAME {
             // sin(0) = 0 で scale値がゼロになるのを避けるため.
             real scale = aten::sin(AT_MATH_PI * (real)(y + 0.5) / height);
 
-            // v方向のpdf.
-            real pdfV = 0;
-
-            // u方向のpdf.
-            std::vector<real>& pdfU = m_cdfU[y];
+            real rowWeight = 0;
 
             for (uint32_t x = 0; x < width; x++) {
                 real u = (real)(x + 0.5) / width;
@@ -59,14 +59,58 @@ namespace AT_NAME {
                 auto clr = envmap->sample(u, v);
                 const auto illum = AT_NAME::color::luminance(clr);
 
-                m_avgIllum += illum * scale;
-                totalWeight += scale;
+                weights[y * width + x] = illum * scale;
+                rowWeight += illum * scale;
+            }
+
+            rowWeights[y] = rowWeight;
+        }
+
+        real totalWeight = 0;
+
+        for (uint32_t y = 0; y < height; y++) {
+            real scale = aten::sin(AT_MATH_PI * (real)(y + 0.5) / height);
+
+            m_avgIllum += rowWeights[y];
+            totalWeight += scale * width;
+        }
+
+        m_avgIllum /= totalWeight;
+
+        m_cdfV.clear();
+        m_cdfU.clear();
+        m_aliasV.clear();
+        m_aliasU.clear();
+
+        if (m_sampling == Sampling::Alias) {
+            buildAliasTable(weights, width, height);
+        }
+        else {
+            buildCdf(weights, width, height);
+        }
+    }
+
+    void ImageBasedLight::buildCdf(
+        const std::vector<real>& weights,
+        uint32_t width, uint32_t height)
+    {
+        m_cdfU.resize(height);
+
+        for (uint32_t y = 0; y < height; y++) {
+            // v方向のpdf.
+            real pdfV = 0;
+
+            // u方向のpdf.
+            std::vector<real>& pdfU = m_cdfU[y];
+
+            for (uint32_t x = 0; x < width; x++) {
+                const auto w = weights[y * width + x];
 
                 // １列分の合計値を計算.
-                pdfV += illum * scale;
+                pdfV += w;
 
                 // まずはpdfを貯める.
-                pdfU.push_back(illum * scale);
+                pdfU.push_back(w);
             }
 
             // まずはpdfを貯める.
@@ -113,8 +157,56 @@ namespace AT_NAME {
                 }
             }
         }
+    }
 
-        m_avgIllum /= totalWeight;
+    void ImageBasedLight::buildAliasTable(
+        const std::vector<real>& weights,
+        uint32_t width, uint32_t height)
+    {
+        // NOTE
+        // p(x, y) = p(y) * p(x | y)
+        // p(y) is chosen with the marginal table, and p(x | y) is chosen with the table of the row.
+
+        m_aliasU.resize(width * height);
+
+        std::vector<real> rowWeights(height);
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+        for (int y = 0; y < (int)height; y++) {
+            rowWeights[y] = aten::AliasTable::build(
+                &weights[y * width],
+                width,
+                &m_aliasU[y * width]);
+        }
+
+        m_aliasV.build(rowWeights);
+
+        m_totalWeight = m_aliasV.getSum();
+    }
+
+    real ImageBasedLight::computePdfByAliasTable(real illum, real v) const
+    {
+        auto envmap = getEnvMap();
+
+        auto width = envmap->getTexture()->width();
+        auto height = envmap->getTexture()->height();
+
+        // NOTE
+        // p(w) = p(u, v) * (w * h) / (2π^2 * sin(θ))
+        // p(u, v) = illum * sin(θ) / totalWeight, so sin(θ) is cancelled.
+        const auto pi2 = AT_MATH_PI * AT_MATH_PI;
+
+        if (m_totalWeight > real(0)) {
+            return illum * (width * height) / (2 * pi2 * m_totalWeight);
+        }
+
+        // All texels are black, and they are chosen uniformly.
+        auto y = aten::clamp<int>((int)(v * height), 0, (int)height - 1);
+        auto theta = AT_MATH_PI * (y + real(0.5)) / height;
+
+        return real(1) / (2 * pi2 * aten::sin(theta));
     }
 
     real ImageBasedLight::samplePdf(const aten::ray& r) const
@@ -122,6 +214,13 @@ namespace AT_NAME {
         auto envmap = getEnvMap();
 
         auto clr = envmap->sample(r);
+
+        if (m_sampling == Sampling::Alias) {
+            auto uv = AT_NAME::envmap::convertDirectionToUV(r.dir);
+            const auto illum = AT_NAME::color::luminance(clr);
+
+            return computePdfByAliasTable(illum, uv.y);
+        }
         
         auto pdf = samplePdf(clr, m_avgIllum);
 
@@ -210,6 +309,31 @@ namespace AT_NAME {
         const auto r1 = sampler->nextSample();
         const auto r2 = sampler->nextSample();
 
+        if (m_sampling == Sampling::Alias) {
+            auto width = envmap->getTexture()->width();
+            auto height = envmap->getTexture()->height();
+
+            const auto y = m_aliasV.sample(r1);
+            const auto x = aten::AliasTable::sample(&m_aliasU[y * width], width, r2);
+
+            real u = (real)(x + 0.5) / width;
+            real v = (real)(y + 0.5) / height;
+
+            // u, v -> direction.
+            result.dir = AT_NAME::envmap::convertUVToDirection(u, v);
+
+            result.le = envmap->sample(u, v);
+            result.intensity = real(1);
+            result.finalColor = result.le * result.intensity;
+
+            result.pdf = computePdfByAliasTable(AT_NAME::color::luminance(result.le), v);
+
+            result.pos = aten::vec3();
+            result.nml = aten::vec3();
+
+            return std::move(result);
+        }
+
         real pdfU, pdfV;
         real cdfU, cdfV;
 
@@ -226,7 +350,7 @@ namespace AT_NAME {
         // p(w) = p(u, v) * (w * h) / (2π^2 * sin(θ))
         auto pi2 = AT_MATH_PI * AT_MATH_PI;
         auto theta = AT_MATH_PI * v;
-        result.pdf = (pdfU * pdfV) * ((width * height) / (pi2 * aten::sin(theta)));
+        result.pdf = (pdfU * pdfV) * ((width * height) / (2 * pi2 * aten::sin(theta)));
 
         // u, v -> direction.
         result.dir = AT_NAME::envmap::convertUVToDirection(u, v);
@@ -308,4 +432,62 @@ namespace AT_NAME {
 
         return std::move(result);
     }
-}
\ No newline at end of file
+
+    void ImageBasedLight::benchmark(
+        const aten::context& ctxt,
+        AT_NAME::envmap* envmap,
+        uint32_t sampleNum)
+    {
+        static const Sampling samplings[] = {
+            Sampling::Cdf,
+            Sampling::Alias,
+        };
+        static const char* names[] = {
+            "Cdf",
+            "Alias",
+        };
+
+        const aten::vec3 org(0);
+        const aten::vec3 nml(0, 1, 0);
+
+        for (int i = 0; i < AT_COUNTOF(samplings); i++) {
+            ImageBasedLight ibl;
+            ibl.m_sampling = samplings[i];
+            ibl.setEnvMap(envmap);
+
+            uint32_t tableSize = 0;
+            if (samplings[i] == Sampling::Alias) {
+                tableSize = (uint32_t)(ibl.m_aliasU.size() * sizeof(aten::AliasTable::Bucket)
+                    + ibl.m_aliasV.size() * (sizeof(aten::AliasTable::Bucket) + sizeof(real)));
+            }
+            else {
+                tableSize = (uint32_t)(ibl.m_cdfV.size() * sizeof(real));
+                for (const auto& cdfU : ibl.m_cdfU) {
+                    tableSize += (uint32_t)(cdfU.size() * sizeof(real));
+                }
+            }
+
+            aten::XorShift rnd(0);
+
+            // Accumulate to avoid that the sampling is optimized away.
+            real sum = 0;
+
+            aten::timer timer;
+            timer.begin();
+
+            for (uint32_t n = 0; n < sampleNum; n++) {
+                auto res = ibl.sample(ctxt, org, nml, &rnd);
+                sum += res.pdf;
+            }
+
+            auto elapsed = timer.end();
+
+            AT_PRINTF("IBL sampling [%s] : %.3f [Msamples/s] (%.3f [ms]) table %d [bytes] (%f)\n",
+                names[i],
+                elapsed > 0 ? sampleNum / (elapsed * real(1000)) : real(0),
+                elapsed,
+                tableSize,
+                sum / sampleNum);
+        }
+    }
+}
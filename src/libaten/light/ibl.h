@@ -4,6 +4,7 @@
 #include "light/light.h"
 #include "renderer/envmap.h"
 #include "misc/color.h"
+#include "math/alias_table.h"
 
 namespace AT_NAME {
     class ImageBasedLight : public Light {
@@ -30,7 +31,42 @@ namespace AT_NAME {
 
         virtual ~ImageBasedLight() {}
 
+        /**
+         * @brief How to sample the texel of the environment map.
+         */
+        enum class Sampling {
+            Cdf,    ///< Binary search in the marginal and the conditional cdfs.
+            Alias,  ///< Marginal and conditional alias tables in the flat arrays. O(1).
+        };
+
     public:
+        /**
+         * @brief Change how to sample the texel. Only the tables for the specified sampling are kept.
+         */
+        void setSampling(Sampling sampling)
+        {
+            if (m_sampling != sampling) {
+                m_sampling = sampling;
+
+                if (m_param.envmap.ptr) {
+                    preCompute();
+                }
+            }
+        }
+
+        Sampling getSampling() const
+        {
+            return m_sampling;
+        }
+
+        /**
+         * @brief Measure the sampling speed per sampling method, and print them.
+         */
+        static void benchmark(
+            const aten::context& ctxt,
+            AT_NAME::envmap* envmap,
+            uint32_t sampleNum);
+
         void setEnvMap(AT_NAME::envmap* envmap)
         {
             if (m_param.envmap.ptr != envmap) {
@@ -83,9 +119,28 @@ namespace AT_NAME {
     private:
         void preCompute();
 
+        void buildCdf(const std::vector<real>& weights, uint32_t width, uint32_t height);
+        void buildAliasTable(const std::vector<real>& weights, uint32_t width, uint32_t height);
+
+        /**
+         * @brief Return the pdf of the direction which is sampled with the alias tables.
+         */
+        real computePdfByAliasTable(real illum, real v) const;
+
     private:
+        Sampling m_sampling{ Sampling::Alias };
+
         real m_avgIllum{ real(0) };
 
+        // Alias table to choose the row (v) in proportion to the sum of the row.
+        aten::AliasTable m_aliasV;
+
+        // Alias tables to choose the texel (u) in the row. The tables of all rows are stored in one array.
+        std::vector<aten::AliasTable::Bucket> m_aliasU;
+
+        // Sum of the weights of all texels.
+        real m_totalWeight{ real(0) };
+
         // v方向のcdf(cumulative distribution function = 累積分布関数 = sum of pdf).
         std::vector<real> m_cdfV;
 
@@ -0,0 +1,735 @@
+#include <algorithm>
+#include <limits>
+
+#include "light/light_bvh.h"
+#include "geometry/transformable.h"
+#include "misc/color.h"
+#include "sampler/xorshift.h"
+
+namespace AT_NAME {
+    // Keep the remapped random number less than 1.
+    static const real OneMinusEpsilon = real(1) - std::numeric_limits<real>::epsilon();
+
+    // Bin count to find the split of the node.
+    static const int BinNum = 12;
+
+    // Bit trail has 64 bits, so the depth of the hierarchy has to be less than 64.
+    // Over this depth, we split the node at the median to bound the depth.
+    static const int MaxBinnedSplitDepth = 32;
+
+    // cos(a - b) which is clamped to 1 if a < b.
+    static inline real cosSubClamped(real sinA, real cosA, real sinB, real cosB)
+    {
+        if (cosA > cosB) {
+            return real(1);
+        }
+        return cosA * cosB + sinA * sinB;
+    }
+
+    // sin(a - b) which is clamped to 0 if a < b.
+    static inline real sinSubClamped(real sinA, real cosA, real sinB, real cosB)
+    {
+        if (cosA > cosB) {
+            return real(0);
+        }
+        return sinA * cosB - cosA * sinB;
+    }
+
+    static inline real safeSqrt(real f)
+    {
+        return aten::sqrt(std::max(f, real(0)));
+    }
+
+    static inline real safeAcos(real f)
+    {
+        return aten::acos(aten::clamp<real>(f, -1, 1));
+    }
+
+    // Rotate the vector around the axis (Rodrigues' rotation formula).
+    static inline aten::vec3 rotate(
+        const aten::vec3& v,
+        const aten::vec3& axis,
+        real theta)
+    {
+        const auto c = aten::cos(theta);
+        const auto s = aten::sin(theta);
+
+        return v * c + cross(axis, v) * s + axis * dot(axis, v) * (real(1) - c);
+    }
+
+    real LightBounds::importance(const aten::vec3& org, const aten::vec3& nml) const
+    {
+        if (phi <= real(0)) {
+            return real(0);
+        }
+
+        const auto center = bbox.getCenter();
+        const auto radius = bbox.getDiagonalLenght() * real(0.5);
+
+        // Clamp the distance not to get the infinite importance inside the bounds.
+        auto dist2 = squared_length(org - center);
+        auto clampedDist2 = std::max(dist2, radius * radius);
+        clampedDist2 = std::max(clampedDist2, real(AT_MATH_EPSILON));
+
+        auto wi = (dist2 > real(0) ? normalize(org - center) : axis);
+
+        // Angle between the emission axis and the direction to the shading point.
+        auto cosThetaW = dot(axis, wi);
+        if (isTwoSided) {
+            cosThetaW = aten::abs(cosThetaW);
+        }
+        const auto sinThetaW = safeSqrt(real(1) - cosThetaW * cosThetaW);
+
+        // Angle which the bounds subtends from the shading point.
+        real cosThetaB = real(-1);
+        if (dist2 > radius * radius) {
+            cosThetaB = safeSqrt(real(1) - radius * radius / dist2);
+        }
+        const auto sinThetaB = safeSqrt(real(1) - cosThetaB * cosThetaB);
+
+        // Minimum angle between the emitters and the shading point.
+        const auto sinThetaO = safeSqrt(real(1) - cosThetaO * cosThetaO);
+        const auto cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+        const auto sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+        const auto cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+
+        if (cosThetaP <= cosThetaE) {
+            // The shading point is out of the emission.
+            return real(0);
+        }
+
+        auto ret = phi * cosThetaP / clampedDist2;
+
+        if (squared_length(nml) > real(0)) {
+            // Minimum angle between the normal at the shading point and the bounds.
+            const auto cosThetaI = aten::abs(dot(wi, nml));
+            const auto sinThetaI = safeSqrt(real(1) - cosThetaI * cosThetaI);
+            const auto cosThetaIP = cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+
+            ret *= cosThetaIP;
+        }
+
+        return std::max(ret, real(0));
+    }
+
+    LightBounds LightBounds::merge(const LightBounds& a, const LightBounds& b)
+    {
+        if (a.phi <= real(0)) {
+            return b;
+        }
+        else if (b.phi <= real(0)) {
+            return a;
+        }
+
+        LightBounds ret;
+
+        ret.bbox = aten::aabb::merge(a.bbox, b.bbox);
+        ret.phi = a.phi + b.phi;
+        ret.cosThetaE = std::min(a.cosThetaE, b.cosThetaE);
+        ret.isTwoSided = a.isTwoSided || b.isTwoSided;
+
+        // Merge the cones of the normals.
+        ret.axis = a.axis;
+        ret.cosThetaO = real(-1);
+
+        const auto thetaA = safeAcos(a.cosThetaO);
+        const auto thetaB = safeAcos(b.cosThetaO);
+        const auto thetaD = safeAcos(dot(a.axis, b.axis));
+
+        if (std::min(thetaD + thetaB, AT_MATH_PI) <= thetaA) {
+            // a covers b.
+            ret.axis = a.axis;
+            ret.cosThetaO = a.cosThetaO;
+        }
+        else if (std::min(thetaD + thetaA, AT_MATH_PI) <= thetaB) {
+            // b covers a.
+            ret.axis = b.axis;
+            ret.cosThetaO = b.cosThetaO;
+        }
+        else {
+            const auto thetaO = (thetaA + thetaD + thetaB) * real(0.5);
+            const auto rotAxis = cross(a.axis, b.axis);
+
+            // If the cone is larger than the sphere or the axes are opposite, the cone covers the whole sphere.
+            if (thetaO < AT_MATH_PI && squared_length(rotAxis) > real(0)) {
+                ret.axis = normalize(rotate(a.axis, normalize(rotAxis), thetaO - thetaA));
+                ret.cosThetaO = aten::cos(thetaO);
+            }
+        }
+
+        return ret;
+    }
+
+    // Cost to split the node (Surface Area Orientation Heuristic).
+    static real computeCost(
+        const LightBounds& bounds,
+        const aten::aabb& parentBox,
+        int axis)
+    {
+        const auto thetaO = safeAcos(bounds.cosThetaO);
+        const auto thetaE = safeAcos(bounds.cosThetaE);
+        const auto thetaW = std::min(thetaO + thetaE, AT_MATH_PI);
+        const auto sinThetaO = safeSqrt(real(1) - bounds.cosThetaO * bounds.cosThetaO);
+
+        // Solid angle measure of the orientation bounds.
+        const auto omega = AT_MATH_PI_2 * (real(1) - bounds.cosThetaO)
+            + AT_MATH_PI_HALF * (real(2) * thetaW * sinThetaO
+                - aten::cos(thetaO - real(2) * thetaW)
+                - real(2) * thetaO * sinThetaO
+                + bounds.cosThetaO);
+
+        // Avoid thin nodes.
+        const auto size = parentBox.size();
+        const auto maxSize = std::max(std::max(size.x, size.y), size.z);
+        const auto kr = (size[axis] > real(0) ? maxSize / size[axis] : real(1));
+
+        return bounds.phi * omega * kr * bounds.bbox.computeSurfaceArea();
+    }
+
+    // Compute the cone which bounds the normals of the triangles of the light object in the world coordinate.
+    // The normals are flipped to the side of the largest triangle, because the emitters are two sided.
+    static bool computeNormalCone(
+        const aten::context& ctxt,
+        const aten::transformable* obj,
+        aten::vec3& axis,
+        real& cosThetaO)
+    {
+        if (!obj) {
+            return false;
+        }
+
+        aten::mat4 mtxL2W;
+        aten::mat4 mtxW2L;
+        obj->getMatrices(mtxL2W, mtxW2L);
+
+        // The instance has the triangles in the object which it refers.
+        auto polygons = obj;
+        if (obj->getType() == aten::GeometryType::Instance) {
+            polygons = (const aten::transformable*)obj->getHasObject();
+        }
+
+        std::vector<aten::PrimitiveParamter> triangles;
+
+        if (polygons) {
+            polygons->collectTriangles(triangles);
+        }
+
+        // Normals whose length is twice of the area of the triangle.
+        std::vector<aten::vec3> normals;
+        normals.reserve(triangles.size());
+
+        int largest = -1;
+        real maxArea = real(0);
+
+        for (const auto& tri : triangles) {
+            aten::vec3 p[3];
+
+            for (int i = 0; i < 3; i++) {
+                const auto v = ctxt.getVertexPosition(tri.idx[i]);
+                p[i] = mtxL2W.apply(aten::vec3(v.x, v.y, v.z));
+            }
+
+            const auto n = cross(p[1] - p[0], p[2] - p[0]);
+            const auto area = length(n);
+
+            if (area > real(0)) {
+                if (area > maxArea) {
+                    maxArea = area;
+                    largest = (int)normals.size();
+                }
+
+                normals.push_back(n);
+            }
+        }
+
+        if (largest < 0) {
+            return false;
+        }
+
+        const auto ref = normals[largest];
+
+        aten::vec3 sum(real(0));
+
+        for (auto& n : normals) {
+            if (dot(n, ref) < real(0)) {
+                n = -n;
+            }
+            sum += n;
+        }
+
+        if (squared_length(sum) <= real(0)) {
+            return false;
+        }
+
+        axis = normalize(sum);
+        cosThetaO = real(1);
+
+        for (const auto& n : normals) {
+            cosThetaO = std::min(cosThetaO, dot(axis, normalize(n)));
+        }
+
+        cosThetaO = aten::clamp<real>(cosThetaO, -1, 1);
+
+        return true;
+    }
+
+    static bool computeLightBounds(
+        const aten::context& ctxt,
+        const Light* light,
+        LightBounds& bounds)
+    {
+        const auto& param = light->param();
+        const auto lum = aten::color::luminance(param.le.v);
+
+        if (lum <= real(0)) {
+            return false;
+        }
+
+        switch (param.type) {
+        case aten::LightType::Area:
+        {
+            auto obj = light->getLightObject();
+            if (!obj) {
+                return false;
+            }
+
+            // Only to get the area of the light object, so the sampled position is not used.
+            aten::XorShift rnd(0);
+            aten::hitable::SamplePosNormalPdfResult res;
+            res.area = real(0);
+
+            light->getSamplePosNormalArea(ctxt, &res, &rnd);
+
+            bounds.bbox = obj->getBoundingbox();
+            bounds.phi = lum * res.area * AT_MATH_PI;
+
+            // The area light is hit from the both sides, so it emits to the both sides of the surface.
+            bounds.isTwoSided = true;
+
+            // Lambertian emitter spreads over the hemisphere around each normal.
+            bounds.cosThetaE = real(0);
+
+            if (!computeNormalCone(
+                ctxt,
+                static_cast<const aten::transformable*>(obj),
+                bounds.axis, bounds.cosThetaO))
+            {
+                // The object which doesn't have the triangles (e.g. sphere) emits to all directions.
+                bounds.axis = aten::vec3(0, 0, 1);
+                bounds.cosThetaO = real(-1);
+            }
+        }
+            break;
+        case aten::LightType::Point:
+            bounds.bbox = aten::aabb(param.pos.v, param.pos.v);
+            bounds.axis = aten::vec3(0, 0, 1);
+            bounds.phi = lum * real(4) * AT_MATH_PI;
+            bounds.cosThetaO = real(-1);
+            bounds.cosThetaE = real(0);
+            break;
+        case aten::LightType::Spot:
+        {
+            // Spotlight angles are full angles of the cones.
+            const auto thetaInner = param.innerAngle * real(0.5);
+            const auto thetaOuter = param.outerAngle * real(0.5);
+
+            bounds.bbox = aten::aabb(param.pos.v, param.pos.v);
+            bounds.axis = normalize(param.dir.v);
+            bounds.phi = lum * AT_MATH_PI_2 * (real(1) - real(0.5) * (aten::cos(thetaInner) + aten::cos(thetaOuter)));
+            bounds.cosThetaO = aten::cos(thetaInner);
+            bounds.cosThetaE = aten::cos(thetaOuter - thetaInner);
+        }
+            break;
+        default:
+            AT_ASSERT(false);
+            return false;
+        }
+
+        return bounds.phi > real(0);
+    }
+
+    void LightBVH::build(
+        const aten::context& ctxt,
+        const std::vector<Light*>& lights)
+    {
+        clear();
+
+        std::vector<LightRef> refs;
+        refs.reserve(lights.size());
+
+        for (auto light : lights) {
+            if (light->isInfinite()) {
+                addInfiniteLight(light);
+                continue;
+            }
+
+            m_registeredLightNum++;
+
+            LightBounds bounds;
+            if (!computeLightBounds(ctxt, light, bounds)) {
+                // The light which has no power is never selected.
+                continue;
+            }
+
+            LightRef ref;
+            ref.bounds = bounds;
+            ref.centroid = bounds.bbox.getCenter();
+            ref.lightIdx = (int)m_lights.size();
+
+            refs.push_back(ref);
+
+            m_lights.push_back(light);
+            m_lightInfos[light] = LightInfo();
+        }
+
+        if (!refs.empty()) {
+            m_nodes.reserve(refs.size() * 2 - 1);
+            buildNode(&refs[0], (uint32_t)refs.size(), 0, 0);
+        }
+    }
+
+    void LightBVH::addInfiniteLight(Light* light)
+    {
+        AT_ASSERT(light->isInfinite());
+
+        if (m_lightInfos.find(light) != m_lightInfos.end()) {
+            return;
+        }
+
+        m_infiniteLights.push_back(light);
+
+        LightInfo info;
+        info.isInfinite = true;
+        m_lightInfos[light] = info;
+
+        m_registeredLightNum++;
+    }
+
+    void LightBVH::clear()
+    {
+        m_nodes.clear();
+        m_lights.clear();
+        m_infiniteLights.clear();
+        m_lightInfos.clear();
+        m_registeredLightNum = 0;
+    }
+
+    int LightBVH::buildNode(
+        LightRef* refs,
+        uint32_t num,
+        uint64_t bitTrail,
+        int depth)
+    {
+        AT_ASSERT(num > 0);
+        AT_ASSERT(depth < 64);
+
+        const int nodeIdx = (int)m_nodes.size();
+        m_nodes.push_back(LightBVHNode());
+
+        if (num == 1) {
+            auto& node = m_nodes[nodeIdx];
+            node.bounds = refs[0].bounds;
+            node.childOrLightIdx = refs[0].lightIdx;
+            node.isLeaf = true;
+
+            m_lightInfos[m_lights[refs[0].lightIdx]].bitTrail = bitTrail;
+
+            return nodeIdx;
+        }
+
+        aten::aabb bbox;
+        aten::aabb centroidBox;
+
+        for (uint32_t i = 0; i < num; i++) {
+            bbox.expand(refs[i].bounds.bbox);
+            centroidBox.expand(refs[i].centroid);
+        }
+
+        uint32_t leftNum = 0;
+
+        if (depth < MaxBinnedSplitDepth) {
+            struct Bin {
+                LightBounds bounds;
+                uint32_t num{ 0 };
+            };
+
+            const auto& centroidMin = centroidBox.minPos();
+            const auto& centroidMax = centroidBox.maxPos();
+
+            real bestCost = AT_MATH_INF;
+            int bestAxis = -1;
+            int bestBin = -1;
+
+            for (int dim = 0; dim < 3; dim++) {
+                const auto extent = centroidMax[dim] - centroidMin[dim];
+                if (extent <= real(0)) {
+                    continue;
+                }
+
+                const auto scale = BinNum / extent;
+
+                Bin bins[BinNum];
+
+                for (uint32_t i = 0; i < num; i++) {
+                    auto idx = (int)((refs[i].centroid[dim] - centroidMin[dim]) * scale);
+                    idx = aten::clamp<int>(idx, 0, BinNum - 1);
+
+                    bins[idx].bounds = LightBounds::merge(bins[idx].bounds, refs[i].bounds);
+                    bins[idx].num++;
+                }
+
+                // Evaluate the cost at each bin boundary.
+                for (int i = 0; i < BinNum - 1; i++) {
+                    Bin left;
+                    Bin right;
+
+                    for (int n = 0; n <= i; n++) {
+                        left.bounds = LightBounds::merge(left.bounds, bins[n].bounds);
+                        left.num += bins[n].num;
+                    }
+                    for (int n = i + 1; n < BinNum; n++) {
+                        right.bounds = LightBounds::merge(right.bounds, bins[n].bounds);
+                        right.num += bins[n].num;
+                    }
+
+                    if (left.num == 0 || right.num == 0) {
+                        continue;
+                    }
+
+                    auto cost = computeCost(left.bounds, bbox, dim) + computeCost(right.bounds, bbox, dim);
+
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = dim;
+                        bestBin = i;
+                    }
+                }
+            }
+
+            if (bestAxis >= 0) {
+                const auto minPos = centroidMin[bestAxis];
+                const auto scale = BinNum / (centroidMax[bestAxis] - minPos);
+
+                auto mid = std::partition(
+                    refs, refs + num,
+                    [&](const LightRef& ref) {
+                    auto idx = (int)((ref.centroid[bestAxis] - minPos) * scale);
+                    return aten::clamp<int>(idx, 0, BinNum - 1) <= bestBin;
+                });
+
+                leftNum = (uint32_t)(mid - refs);
+            }
+        }
+
+        if (leftNum == 0 || leftNum == num) {
+            // Split at the median along the longest axis.
+            const auto size = centroidBox.size();
+            const int axis = (size.x >= size.y && size.x >= size.z
+                ? 0
+                : size.y >= size.z ? 1 : 2);
+
+            leftNum = num / 2;
+
+            std::nth_element(
+                refs, refs + leftNum, refs + num,
+                [axis](const LightRef& a, const LightRef& b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+        }
+
+        // The first child follows the node immediately.
+        buildNode(refs, leftNum, bitTrail, depth + 1);
+        const int secondIdx = buildNode(refs + leftNum, num - leftNum, bitTrail | ((uint64_t)1 << depth), depth + 1);
+
+        // NOTE
+        // Nodes might be reallocated while building the children.
+        auto& node = m_nodes[nodeIdx];
+        node.bounds = LightBounds::merge(m_nodes[nodeIdx + 1].bounds, m_nodes[secondIdx].bounds);
+        node.childOrLightIdx = secondIdx;
+        node.isLeaf = false;
+
+        return nodeIdx;
+    }
+
+    real LightBVH::computeInfiniteLightSelectPdf() const
+    {
+        // Treat the hierarchy as one light, and select it or one of the infinite lights uniformly.
+        const auto num = m_infiniteLights.size();
+
+        if (num == 0) {
+            return real(0);
+        }
+
+        return num / real(num + (m_nodes.empty() ? 0 : 1));
+    }
+
+    template <typename FUNC_IMPORTANCE>
+    Light* LightBVH::sample(
+        real u,
+        real& selectPdf,
+        FUNC_IMPORTANCE funcImportance) const
+    {
+        selectPdf = real(0);
+
+        u = aten::clamp<real>(u, real(0), OneMinusEpsilon);
+
+        const auto pInfinite = computeInfiniteLightSelectPdf();
+
+        if (u < pInfinite) {
+            const auto num = (uint32_t)m_infiniteLights.size();
+            auto idx = std::min((uint32_t)(u / pInfinite * num), num - 1);
+
+            selectPdf = pInfinite / num;
+            return m_infiniteLights[idx];
+        }
+
+        if (m_nodes.empty()) {
+            return nullptr;
+        }
+
+        u = std::min((u - pInfinite) / (real(1) - pInfinite), OneMinusEpsilon);
+
+        real pmf = real(1) - pInfinite;
+        int nodeIdx = 0;
+
+        for (;;) {
+            const auto& node = m_nodes[nodeIdx];
+
+            if (node.isLeaf) {
+                if (nodeIdx > 0 || funcImportance(node.bounds) > real(0)) {
+                    selectPdf = pmf;
+                    return m_lights[node.childOrLightIdx];
+                }
+                return nullptr;
+            }
+
+            const int leftIdx = nodeIdx + 1;
+            const int rightIdx = node.childOrLightIdx;
+
+            const auto leftImportance = funcImportance(m_nodes[leftIdx].bounds);
+            const auto rightImportance = funcImportance(m_nodes[rightIdx].bounds);
+
+            if (leftImportance <= real(0) && rightImportance <= real(0)) {
+                return nullptr;
+            }
+
+            // Select the child and remap the random number to reuse it.
+            const auto p = leftImportance / (leftImportance + rightImportance);
+
+            if (u < p) {
+                u = std::min(u / p, OneMinusEpsilon);
+                pmf *= p;
+                nodeIdx = leftIdx;
+            }
+            else {
+                u = std::min((u - p) / (real(1) - p), OneMinusEpsilon);
+                pmf *= real(1) - p;
+                nodeIdx = rightIdx;
+            }
+        }
+
+        return nullptr;
+    }
+
+    template <typename FUNC_IMPORTANCE>
+    real LightBVH::samplePdf(
+        const Light* light,
+        FUNC_IMPORTANCE funcImportance) const
+    {
+        auto it = m_lightInfos.find(light);
+        if (it == m_lightInfos.end()) {
+            return real(0);
+        }
+
+        const auto& info = it->second;
+
+        const auto pInfinite = computeInfiniteLightSelectPdf();
+
+        if (info.isInfinite) {
+            return pInfinite / m_infiniteLights.size();
+        }
+
+        real pmf = real(1) - pInfinite;
+
+        if (m_nodes[0].isLeaf) {
+            return funcImportance(m_nodes[0].bounds) > real(0) ? pmf : real(0);
+        }
+
+        // Follow the bit trail from the root to the leaf.
+        auto bitTrail = info.bitTrail;
+        int nodeIdx = 0;
+
+        while (!m_nodes[nodeIdx].isLeaf) {
+            const auto& node = m_nodes[nodeIdx];
+
+            const int leftIdx = nodeIdx + 1;
+            const int rightIdx = node.childOrLightIdx;
+
+            const auto leftImportance = funcImportance(m_nodes[leftIdx].bounds);
+            const auto rightImportance = funcImportance(m_nodes[rightIdx].bounds);
+
+            const auto sum = leftImportance + rightImportance;
+            if (sum <= real(0)) {
+                return real(0);
+            }
+
+            if (bitTrail & 1) {
+                pmf *= rightImportance / sum;
+                nodeIdx = rightIdx;
+            }
+            else {
+                pmf *= leftImportance / sum;
+                nodeIdx = leftIdx;
+            }
+
+            bitTrail >>= 1;
+        }
+
+        return pmf;
+    }
+
+    Light* LightBVH::sample(
+        const aten::vec3& org,
+        const aten::vec3& nml,
+        real u,
+        real& selectPdf) const
+    {
+        return sample(
+            u, selectPdf,
+            [&](const LightBounds& bounds) {
+            return bounds.importance(org, nml);
+        });
+    }
+
+    Light* LightBVH::sample(
+        real u,
+        real& selectPdf) const
+    {
+        return sample(
+            u, selectPdf,
+            [](const LightBounds& bounds) {
+            return bounds.phi;
+        });
+    }
+
+    real LightBVH::samplePdf(
+        const Light* light,
+        const aten::vec3& org,
+        const aten::vec3& nml) const
+    {
+        return samplePdf(
+            light,
+            [&](const LightBounds& bounds) {
+            return bounds.importance(org, nml);
+        });
+    }
+
+    real LightBVH::samplePdf(const Light* light) const
+    {
+        return samplePdf(
+            light,
+            [](const LightBounds& bounds) {
+            return bounds.phi;
+        });
+    }
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+
+#include "light/light.h"
+#include "math/aabb.h"
+#include "scene/context.h"
+
+// NOTE
+// Importance Sampling of Many Lights with Adaptive Tree Splitting.
+// http://www.aconty.com/pdf/many-lights-hpg2018.pdf
+// pbrt-v4 BVHLightSampler.
+// https://pbr-book.org/4ed/Light_Sources/Light_Sampling#BVHLightSampling
+
+namespace AT_NAME {
+    /**
+     * @brief Bounds of the lights to estimate how much the lights contribute to a shading point.
+     */
+    struct LightBounds {
+        aten::aabb bbox;            ///< Spatial bounds.
+        aten::vec3 axis;            ///< Principal direction of the emission.
+        real phi{ real(0) };        ///< Emitted power.
+        real cosThetaO{ real(1) };  ///< Cosine of the angle which bounds the surface normals of the emitters around the axis.
+        real cosThetaE{ real(1) };  ///< Cosine of the angle to which the emission spreads beyond the normals.
+        bool isTwoSided{ false };   ///< Whether the emitters emit to the both sides.
+
+        /**
+         * @brief Return the conservative importance of the bounds at the specified point.
+         * @param[in] org Shading point.
+         * @param[in] nml Normal at the shading point. If it is zero vector, the normal is not considered.
+         */
+        real importance(const aten::vec3& org, const aten::vec3& nml) const;
+
+        /**
+         * @brief Return the bounds which covers both of the specified bounds.
+         */
+        static LightBounds merge(const LightBounds& a, const LightBounds& b);
+    };
+
+    /**
+     * @brief Hierarchy of the lights to select a light based on the power and the estimated contribution.
+     * @note Infinite lights (directional light, IBL) are not put into the hierarchy and they are selected uniformly.
+     */
+    class LightBVH {
+    public:
+        LightBVH() {}
+        ~LightBVH() {}
+
+    public:
+        /**
+         * @brief Build the hierarchy from the specified lights.
+         */
+        void build(
+            const aten::context& ctxt,
+            const std::vector<Light*>& lights);
+
+        /**
+         * @brief Add the infinite light without rebuilding the hierarchy.
+         */
+        void addInfiniteLight(Light* light);
+
+        /**
+         * @brief Clear the hierarchy.
+         */
+        void clear();
+
+        /**
+         * @brief Return the number of the lights which are registered in the hierarchy, including the infinite lights.
+         */
+        uint32_t getLightNum() const
+        {
+            return m_registeredLightNum;
+        }
+
+        /**
+         * @brief Select a light according to the estimated contribution to the specified shading point.
+         * @param[in] org Shading point.
+         * @param[in] nml Normal at the shading point.
+         * @param[in] u Random number in [0, 1].
+         * @param[out] selectPdf Probability to select the returned light.
+         * @return Selected light. If no light can contribute to the shading point, return nullptr.
+         */
+        Light* sample(
+            const aten::vec3& org,
+            const aten::vec3& nml,
+            real u,
+            real& selectPdf) const;
+
+        /**
+         * @brief Select a light according to the power only.
+         * @note This is for the case which has no shading point (e.g. the starting point of the light sub-path).
+         */
+        Light* sample(
+            real u,
+            real& selectPdf) const;
+
+        /**
+         * @brief Return the probability that "sample" selects the specified light at the specified shading point.
+         */
+        real samplePdf(
+            const Light* light,
+            const aten::vec3& org,
+            const aten::vec3& nml) const;
+
+        /**
+         * @brief Return the probability that "sample" which doesn't have the shading point selects the specified light.
+         */
+        real samplePdf(const Light* light) const;
+
+    private:
+        struct LightBVHNode {
+            LightBounds bounds;
+
+            // For the interior node, the index of the second child. The first child follows the node immediately.
+            // For the leaf node, the index of the light in m_lights.
+            int childOrLightIdx{ -1 };
+
+            bool isLeaf{ false };
+        };
+
+        struct LightRef {
+            LightBounds bounds;
+            aten::vec3 centroid;
+            int lightIdx;
+        };
+
+        struct LightInfo {
+            uint64_t bitTrail{ 0 };
+            bool isInfinite{ false };
+        };
+
+        int buildNode(
+            LightRef* refs,
+            uint32_t num,
+            uint64_t bitTrail,
+            int depth);
+
+        real computeInfiniteLightSelectPdf() const;
+
+        template <typename FUNC_IMPORTANCE>
+        Light* sample(
+            real u,
+            real& selectPdf,
+            FUNC_IMPORTANCE funcImportance) const;
+
+        template <typename FUNC_IMPORTANCE>
+        real samplePdf(
+            const Light* light,
+            FUNC_IMPORTANCE funcImportance) const;
+
+    private:
+        std::vector<LightBVHNode> m_nodes;
+
+        std::vector<Light*> m_lights;
+        std::vector<Light*> m_infiniteLights;
+
+        std::unordered_map<const Light*, LightInfo> m_lightInfos;
+
+        uint32_t m_registeredLightNum{ 0 };
+    };
+}
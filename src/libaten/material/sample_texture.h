@@ -30,7 +30,15 @@ namespace AT_NAME {
             const auto ctxt = aten::context::getPinnedContext();
             auto tex = ctxt->getTexture(texid);
             if (tex) {
-                ret = tex->at(u, v);
+                const auto footprint = aten::texture::getFootprint();
+
+                if (lod == 0 && footprint > real(0)) {
+                    // Isotropic footprint of the ray.
+                    ret = tex->at(u, v, footprint, real(0), real(0), footprint);
+                }
+                else {
+                    ret = tex->at(u, v, real(lod));
+                }
             }
         }
 
@@ -0,0 +1,113 @@
+#include <algorithm>
+
+#include "math/alias_table.h"
+#include "math/math.h"
+
+namespace aten
+{
+    void AliasTable::build(const real* weights, uint32_t num)
+    {
+        clear();
+
+        if (num == 0) {
+            return;
+        }
+
+        m_buckets.resize(num);
+        m_pdf.resize(num);
+
+        m_sum = build(weights, num, &m_buckets[0]);
+
+        for (uint32_t i = 0; i < num; i++) {
+            m_pdf[i] = m_sum > real(0) ? weights[i] / m_sum : real(1) / num;
+        }
+    }
+
+    real AliasTable::build(
+        const real* weights,
+        uint32_t num,
+        Bucket* buckets)
+    {
+        AT_ASSERT(num > 0);
+
+        // NOTE
+        // Accumulate in double to keep the precision for the large number of the weights.
+        double sum = 0.0;
+        for (uint32_t i = 0; i < num; i++) {
+            AT_ASSERT(weights[i] >= real(0));
+            sum += weights[i];
+        }
+
+        std::vector<double> scaled(num);
+
+        for (uint32_t i = 0; i < num; i++) {
+            // If all weights are zero, fall back to the uniform distribution.
+            scaled[i] = sum > 0.0 ? weights[i] * num / sum : 1.0;
+
+            buckets[i].prob = real(1);
+            buckets[i].alias = i;
+        }
+
+        // Split into the buckets which are less than the average and the others.
+        std::vector<uint32_t> small;
+        std::vector<uint32_t> large;
+
+        for (uint32_t i = 0; i < num; i++) {
+            if (scaled[i] < 1.0) {
+                small.push_back(i);
+            }
+            else {
+                large.push_back(i);
+            }
+        }
+
+        // Fill the small bucket with the large one.
+        while (!small.empty() && !large.empty()) {
+            const auto s = small.back();
+            small.pop_back();
+
+            const auto l = large.back();
+
+            buckets[s].prob = (real)scaled[s];
+            buckets[s].alias = l;
+
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        // The remaining buckets are full, except the numerical error.
+        for (auto i : large) {
+            buckets[i].prob = real(1);
+        }
+        for (auto i : small) {
+            buckets[i].prob = real(1);
+        }
+
+        return (real)sum;
+    }
+
+    uint32_t AliasTable::sample(
+        const Bucket* buckets,
+        uint32_t num,
+        real r)
+    {
+        AT_ASSERT(num > 0);
+
+        // Choose the bucket with the integer part, and choose the index in the bucket with the fractional part.
+        const real u = r * num;
+        uint32_t idx = std::min((uint32_t)u, num - 1);
+        const real frac = aten::clamp(u - idx, real(0), real(1));
+
+        const auto& bucket = buckets[idx];
+
+        if (frac >= bucket.prob) {
+            idx = bucket.alias;
+        }
+
+        return idx;
+    }
+}
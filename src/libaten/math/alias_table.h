@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+
+#include "defs.h"
+#include "types.h"
+
+namespace aten
+{
+    /**
+     * @brief Discrete distribution which is sampled in O(1) with the alias method (Walker/Vose).
+     */
+    class AliasTable {
+    public:
+        AliasTable() {}
+        ~AliasTable() {}
+
+        /**
+         * @brief Bucket of the alias table.
+         */
+        struct Bucket {
+            // Probability to choose this index instead of the alias in the bucket.
+            real prob;
+            uint32_t alias;
+        };
+
+    public:
+        /**
+         * @brief Build the table from the non-negative weights.
+         * The weights don't need to be normalized.
+         */
+        void build(const real* weights, uint32_t num);
+
+        void build(const std::vector<real>& weights)
+        {
+            build(weights.empty() ? nullptr : &weights[0], (uint32_t)weights.size());
+        }
+
+        void clear()
+        {
+            m_buckets.clear();
+            m_pdf.clear();
+            m_sum = real(0);
+        }
+
+        /**
+         * @brief Sample the index in proportion to the weight.
+         * @param[in] r Random number in [0, 1).
+         * @param[out] pdf If it is not null, the probability to choose the returned index.
+         */
+        int sample(real r, real* pdf = nullptr) const
+        {
+            AT_ASSERT(!m_buckets.empty());
+
+            auto idx = sample(&m_buckets[0], size(), r);
+
+            if (pdf) {
+                *pdf = m_pdf[idx];
+            }
+
+            return (int)idx;
+        }
+
+        /**
+         * @brief Return the probability to choose the specified index.
+         */
+        real getPdf(uint32_t idx) const
+        {
+            AT_ASSERT(idx < size());
+            return m_pdf[idx];
+        }
+
+        /**
+         * @brief Return the sum of the weights.
+         */
+        real getSum() const
+        {
+            return m_sum;
+        }
+
+        uint32_t size() const
+        {
+            return (uint32_t)m_buckets.size();
+        }
+
+        /**
+         * @brief Build the buckets into the specified memory.
+         * This is for the users which keep many tables in one array.
+         * If all weights are zero, the buckets are built as the uniform distribution.
+         * @return Sum of the weights.
+         */
+        static real build(
+            const real* weights,
+            uint32_t num,
+            Bucket* buckets);
+
+        /**
+         * @brief Sample the index from the buckets which are built by build.
+         */
+        static uint32_t sample(
+            const Bucket* buckets,
+            uint32_t num,
+            real r);
+
+    private:
+        std::vector<Bucket> m_buckets;
+
+        // Normalized weights.
+        std::vector<real> m_pdf;
+
+        real m_sum{ real(0) };
+    };
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace aten
+{
+    /**
+     * @brief Convert 32bit float to 16bit half float with rounding to nearest.
+     */
+    inline uint16_t convertFloatToHalf(float f)
+    {
+        uint32_t x;
+        memcpy(&x, &f, sizeof(x));
+
+        const uint32_t sign = (x >> 16) & 0x8000;
+        const int32_t exp = (int32_t)((x >> 23) & 0xff) - 127 + 15;
+        uint32_t mant = x & 0x7fffff;
+
+        if (((x >> 23) & 0xff) == 0xff) {
+            // Inf or NaN.
+            return (uint16_t)(sign | 0x7c00 | (mant ? 0x200 : 0));
+        }
+        else if (exp >= 31) {
+            // Overflow.
+            return (uint16_t)(sign | 0x7c00);
+        }
+        else if (exp <= 0) {
+            // Denormalized or underflow.
+            if (exp < -10) {
+                return (uint16_t)sign;
+            }
+
+            mant |= 0x800000;
+            const uint32_t shift = 14 - exp;
+
+            uint32_t half = mant >> shift;
+            if ((mant >> (shift - 1)) & 0x01) {
+                half++;
+            }
+
+            return (uint16_t)(sign | half);
+        }
+
+        uint32_t half = sign | (exp << 10) | (mant >> 13);
+
+        // Round. If it carries, the exponent is incremented correctly.
+        if (mant & 0x1000) {
+            half++;
+        }
+
+        return (uint16_t)half;
+    }
+
+    /**
+     * @brief Convert 16bit half float to 32bit float.
+     */
+    inline float convertHalfToFloat(uint16_t h)
+    {
+        const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+        int32_t exp = (h >> 10) & 0x1f;
+        uint32_t mant = h & 0x3ff;
+
+        uint32_t x = 0;
+
+        if (exp == 0) {
+            if (mant == 0) {
+                x = sign;
+            }
+            else {
+                // Denormalized.
+                exp = 1;
+                while (!(mant & 0x400)) {
+                    mant <<= 1;
+                    exp--;
+                }
+                mant &= 0x3ff;
+
+                x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+            }
+        }
+        else if (exp == 31) {
+            x = sign | 0x7f800000 | (mant << 13);
+        }
+        else {
+            x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+        }
+
+        float f;
+        memcpy(&f, &x, sizeof(f));
+
+        return f;
+    }
+}
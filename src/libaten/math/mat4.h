@@ -213,6 +213,23 @@ namespace aten {
             return std::move(transformdRay);
         }
 
+        /**
+         * @brief Transform the ray, and scale the range of the ray into the transformed coordinate.
+         * The direction of the transformed ray is normalized, so the distance along it is scaled by the transform.
+         */
+        inline ray applyRay(const ray& r, real& t_min, real& t_max) const
+        {
+            vec3 dir = applyXYZ(r.dir);
+
+            const auto scale = length(dir);
+            t_min *= scale;
+            t_max *= scale;
+
+            ray transformdRay(apply(r.org), dir);
+
+            return std::move(transformdRay);
+        }
+
         mat4& invert();
 
         inline AT_DEVICE_API mat4& transpose()
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "defs.h"
+#include "types.h"
+
+namespace AT_NAME {
+    /**
+     * @brief Read only file which is mapped to the memory.
+     * The contents are paged in on demand, so they can be used without reading the whole file.
+     */
+    class MappedFile {
+    public:
+        MappedFile() {}
+        ~MappedFile()
+        {
+            close();
+        }
+
+        MappedFile(const MappedFile& rhs) = delete;
+        const MappedFile& operator=(const MappedFile& rhs) = delete;
+
+    public:
+        /**
+         * @brief Map the whole file to the memory.
+         * @return If the file doesn't exist or can't be mapped, return false.
+         */
+        bool open(const char* path);
+
+        /**
+         * @brief Unmap the file. The pointer which data returns is not available after this.
+         */
+        void close();
+
+        bool isOpened() const
+        {
+            return (m_data != nullptr);
+        }
+
+        const void* data() const
+        {
+            return m_data;
+        }
+
+        size_t size() const
+        {
+            return m_size;
+        }
+
+    private:
+        const void* m_data{ nullptr };
+        size_t m_size{ 0 };
+    };
+}
@@ -27,4 +27,15 @@ namespace aten {
 #endif
         return idx;
     }
-}
\ No newline at end of file
+
+    int OMPUtil::getParallelThreadNum(uint32_t itemNum, uint32_t threshold)
+    {
+        int threadNum = 1;
+#ifdef ENABLE_OMP
+        if (itemNum >= threshold && !omp_in_parallel()) {
+            threadNum = omp_get_max_threads();
+        }
+#endif
+        return threadNum;
+    }
+}
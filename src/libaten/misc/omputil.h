@@ -19,6 +19,12 @@ namespace aten {
 
         static int getThreadIdx();
 
+        /**
+         * @brief Return the count of threads to process the specified count of items in parallel.
+         * If the count of items is less than the threshold or we are already in the parallel region, return 1.
+         */
+        static int getParallelThreadNum(uint32_t itemNum, uint32_t threshold);
+
     private:
         static uint32_t g_threadnum;
     };
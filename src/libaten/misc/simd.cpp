@@ -0,0 +1,56 @@
+#include "misc/simd.h"
+
+#if defined(AT_ENABLE_SIMD) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace aten {
+    SimdType SimdUtil::g_maxType = SimdType::AVX2;
+
+    static SimdType detectSimdType()
+    {
+#if !defined(AT_ENABLE_SIMD)
+        return SimdType::Scalar;
+#elif defined(_MSC_VER)
+        int info[4];
+
+        __cpuid(info, 0);
+        const int maxId = info[0];
+
+        __cpuid(info, 1);
+        const bool hasFma = (info[2] & (1 << 12)) != 0;
+        const bool hasOsxsave = (info[2] & (1 << 27)) != 0;
+        const bool hasAvx = (info[2] & (1 << 28)) != 0;
+
+        bool hasAvx2 = false;
+        if (maxId >= 7) {
+            __cpuidex(info, 7, 0);
+            hasAvx2 = (info[1] & (1 << 5)) != 0;
+        }
+
+        // Check whether OS saves the YMM registers.
+        bool isYmmEnabled = false;
+        if (hasOsxsave && hasAvx) {
+            isYmmEnabled = (_xgetbv(0) & 0x6) == 0x6;
+        }
+
+        // SSE2 is always available on x64.
+        return (hasAvx2 && hasFma && isYmmEnabled ? SimdType::AVX2 : SimdType::SSE);
+#else
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return SimdType::AVX2;
+        }
+
+        // SSE2 is always available on x64.
+        return SimdType::SSE;
+#endif
+    }
+
+    SimdType SimdUtil::getSupportedType()
+    {
+        static const SimdType type = detectSimdType();
+        return type;
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "types.h"
+#include "defs.h"
+
+// SIMD kernels are available only for float on x64.
+#if !defined(TYPE_DOUBLE) && !defined(__CUDACC__) && (defined(__x86_64__) || defined(_M_X64))
+#define AT_ENABLE_SIMD
+#include <immintrin.h>
+#endif
+
+// To compile AVX2 kernels without enabling AVX2 for the whole build.
+// MSVC doesn't need any option to use AVX2 intrinsics.
+#if defined(AT_ENABLE_SIMD) && !defined(_MSC_VER)
+#define AT_SIMD_TARGET_AVX2    __attribute__((target("avx2,fma")))
+#else
+#define AT_SIMD_TARGET_AVX2
+#endif
+
+namespace aten {
+    /**
+     * @brief Instruction set of SIMD kernels.
+     */
+    enum class SimdType {
+        Scalar,
+        SSE,
+        AVX2,
+    };
+
+    class SimdUtil {
+    private:
+        SimdUtil() {}
+        ~SimdUtil() {}
+
+    public:
+        /**
+         * @brief Return the instruction set which the running CPU supports.
+         */
+        static SimdType getSupportedType();
+
+        /**
+         * @brief Limit the instruction set to use (e.g. to compare the kernels).
+         */
+        static void setMaxType(SimdType type)
+        {
+            g_maxType = type;
+        }
+
+        /**
+         * @brief Return the instruction set to use.
+         */
+        static SimdType getType()
+        {
+            auto supported = getSupportedType();
+            return (supported < g_maxType ? supported : g_maxType);
+        }
+
+    private:
+        static SimdType g_maxType;
+    };
+}
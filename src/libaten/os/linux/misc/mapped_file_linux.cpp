@@ -0,0 +1,51 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "defs.h"
+#include "misc/mapped_file.h"
+
+namespace AT_NAME {
+    bool MappedFile::open(const char* path)
+    {
+        close();
+
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+
+        auto size = (size_t)st.st_size;
+
+        void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        // The mapping is kept after the descriptor is closed.
+        ::close(fd);
+
+        if (p == MAP_FAILED) {
+            return false;
+        }
+
+        m_data = p;
+        m_size = size;
+
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if (m_data) {
+            ::munmap(const_cast<void*>(m_data), m_size);
+        }
+
+        m_data = nullptr;
+        m_size = 0;
+    }
+}
@@ -0,0 +1,60 @@
+#include "defs.h"
+#include "misc/mapped_file.h"
+
+namespace AT_NAME {
+    bool MappedFile::open(const char* path)
+    {
+        close();
+
+        HANDLE file = ::CreateFileA(
+            path,
+            GENERIC_READ,
+            FILE_SHARE_READ,
+            NULL,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            NULL);
+
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER size;
+        if (!::GetFileSizeEx(file, &size) || size.QuadPart <= 0) {
+            ::CloseHandle(file);
+            return false;
+        }
+
+        HANDLE mapping = ::CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+        void* p = nullptr;
+
+        if (mapping) {
+            p = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+            // The view is kept after the handles are closed.
+            ::CloseHandle(mapping);
+        }
+
+        ::CloseHandle(file);
+
+        if (!p) {
+            return false;
+        }
+
+        m_data = p;
+        m_size = (size_t)size.QuadPart;
+
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if (m_data) {
+            ::UnmapViewOfFile(m_data);
+        }
+
+        m_data = nullptr;
+        m_size = 0;
+    }
+}
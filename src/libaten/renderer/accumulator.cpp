@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <string.h>
+#include "renderer/accumulator.h"
+#include "sampler/samplerinterface.h"
+
+namespace aten
+{
+    // NOTE
+    // File layout of the checkpoint.
+    //  Header
+    //  Pixel x width x height
+    //  uint32_t x randomNum (scramble table of the sampler)
+
+    static const uint32_t CheckpointMagic = 0x43415441;    // 'ATAC'
+    static const uint32_t CheckpointVersion = 2;
+
+    struct CheckpointHeader {
+        uint32_t magic;
+        uint32_t version;
+        int32_t width;
+        int32_t height;
+        uint32_t passNum;
+        uint32_t randomNum;
+
+        uint32_t split;
+        uint32_t partitionIdx;
+        uint32_t partitionNum;
+        uint32_t tileSize;
+    };
+
+    void Accumulator::init(int w, int h)
+    {
+        m_width = w;
+        m_height = h;
+        m_pixels.resize(m_width * m_height);
+
+        clear();
+    }
+
+    void Accumulator::clear()
+    {
+        if (!m_pixels.empty()) {
+            memset(&m_pixels[0], 0, m_pixels.size() * sizeof(Pixel));
+        }
+        m_passNum = 0;
+    }
+
+    void Accumulator::setPartition(
+        Split split,
+        uint32_t index,
+        uint32_t num,
+        uint32_t tileSize/*= 32*/)
+    {
+        AT_ASSERT(num > 0);
+        AT_ASSERT(index < num);
+
+        m_partition.split = split;
+        m_partition.index = index;
+        m_partition.num = std::max(num, 1U);
+        m_partition.tileSize = std::max(tileSize, 1U);
+    }
+
+    bool Accumulator::merge(const Accumulator& rhs)
+    {
+        if (m_width != rhs.m_width || m_height != rhs.m_height) {
+            AT_PRINTF("Size is not matched (%d x %d) (%d x %d)\n", m_width, m_height, rhs.m_width, rhs.m_height);
+            return false;
+        }
+
+        if (m_partition.split != rhs.m_partition.split
+            || m_partition.num != rhs.m_partition.num)
+        {
+            AT_PRINTF("Partition is not matched\n");
+            return false;
+        }
+
+        // The pixels which are not rendered in the process have no samples,
+        // so simply summing up is same as weighting by the sample count.
+        for (size_t i = 0; i < m_pixels.size(); i++) {
+            auto& dst = m_pixels[i];
+            const auto& src = rhs.m_pixels[i];
+
+            for (int c = 0; c < 3; c++) {
+                dst.sum[c] += src.sum[c];
+                dst.sum2[c] += src.sum2[c];
+            }
+
+            dst.validNum += src.validNum;
+            dst.sampleNum += src.sampleNum;
+        }
+
+        if (m_partition.split == Split::Pass) {
+            m_passNum += rhs.m_passNum;
+        }
+        else {
+            m_passNum = std::max(m_passNum, rhs.m_passNum);
+        }
+
+        return true;
+    }
+
+    void Accumulator::add(
+        int pos,
+        const vec3& sum,
+        const vec3& sum2,
+        uint32_t validNum,
+        uint32_t sampleNum)
+    {
+        auto& p = m_pixels[pos];
+
+        for (int i = 0; i < 3; i++) {
+            p.sum[i] += sum[i];
+            p.sum2[i] += sum2[i];
+        }
+
+        p.validNum += validNum;
+        p.sampleNum += sampleNum;
+    }
+
+    vec3 Accumulator::getMean(int pos) const
+    {
+        const auto& p = m_pixels[pos];
+
+        if (p.validNum == 0) {
+            return vec3(0);
+        }
+
+        return vec3(
+            (real)(p.sum[0] / p.validNum),
+            (real)(p.sum[1] / p.validNum),
+            (real)(p.sum[2] / p.validNum));
+    }
+
+    vec3 Accumulator::getVariance(int pos) const
+    {
+        const auto& p = m_pixels[pos];
+
+        if (p.validNum == 0) {
+            return vec3(0);
+        }
+
+        vec3 ret;
+
+        for (int i = 0; i < 3; i++) {
+            auto mean = p.sum[i] / p.validNum;
+            auto var = p.sum2[i] / p.validNum - mean * mean;
+            ret[i] = (real)std::max(var, 0.0);
+        }
+
+        return ret;
+    }
+
+    bool Accumulator::save(const std::string& path) const
+    {
+        const auto tmpPath = path + ".tmp";
+
+        FILE* fp = fopen(tmpPath.c_str(), "wb");
+        if (fp == NULL) {
+            AT_PRINTF("Error: %s\n", tmpPath.c_str());
+            return false;
+        }
+
+        const auto& random = getRandom();
+
+        CheckpointHeader header;
+        {
+            header.magic = CheckpointMagic;
+            header.version = CheckpointVersion;
+            header.width = m_width;
+            header.height = m_height;
+            header.passNum = m_passNum;
+            header.randomNum = (uint32_t)random.size();
+
+            header.split = (uint32_t)m_partition.split;
+            header.partitionIdx = m_partition.index;
+            header.partitionNum = m_partition.num;
+            header.tileSize = m_partition.tileSize;
+        }
+
+        bool isOk = (fwrite(&header, sizeof(header), 1, fp) == 1);
+
+        if (isOk && !m_pixels.empty()) {
+            isOk = (fwrite(&m_pixels[0], sizeof(Pixel), m_pixels.size(), fp) == m_pixels.size());
+        }
+        if (isOk && !random.empty()) {
+            isOk = (fwrite(&random[0], sizeof(uint32_t), random.size(), fp) == random.size());
+        }
+
+        isOk = (fclose(fp) == 0) && isOk;
+
+        if (!isOk) {
+            AT_PRINTF("Failed to write %s\n", tmpPath.c_str());
+            remove(tmpPath.c_str());
+            return false;
+        }
+
+        // NOTE
+        // rename replaces the existing file atomically on POSIX.
+        // Only if it fails (rename doesn't overwrite the existing file on Windows), remove the previous checkpoint.
+        if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+            remove(path.c_str());
+
+            if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+                AT_PRINTF("Failed to rename %s\n", tmpPath.c_str());
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool Accumulator::load(const std::string& path)
+    {
+        FILE* fp = fopen(path.c_str(), "rb");
+        if (fp == NULL) {
+            AT_PRINTF("Error: %s\n", path.c_str());
+            return false;
+        }
+
+        CheckpointHeader header;
+
+        if (fread(&header, sizeof(header), 1, fp) != 1
+            || header.magic != CheckpointMagic
+            || header.version != CheckpointVersion
+            || header.width <= 0 || header.height <= 0
+            || header.split > (uint32_t)Split::Pass
+            || header.partitionIdx >= header.partitionNum)
+        {
+            AT_PRINTF("Invalid checkpoint %s\n", path.c_str());
+            fclose(fp);
+            return false;
+        }
+
+        std::vector<Pixel> pixels(header.width * header.height);
+        std::vector<uint32_t> random(header.randomNum);
+
+        bool isOk = (fread(&pixels[0], sizeof(Pixel), pixels.size(), fp) == pixels.size());
+
+        if (isOk && !random.empty()) {
+            isOk = (fread(&random[0], sizeof(uint32_t), random.size(), fp) == random.size());
+        }
+
+        fclose(fp);
+
+        if (!isOk) {
+            AT_PRINTF("Checkpoint is truncated %s\n", path.c_str());
+            return false;
+        }
+
+        m_width = header.width;
+        m_height = header.height;
+        m_passNum = header.passNum;
+        m_pixels = std::move(pixels);
+
+        m_partition.split = (Split)header.split;
+        m_partition.index = header.partitionIdx;
+        m_partition.num = header.partitionNum;
+        m_partition.tileSize = std::max(header.tileSize, 1U);
+
+        if (!random.empty()) {
+            setRandom(random);
+        }
+
+        return true;
+    }
+}
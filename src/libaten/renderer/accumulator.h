@@ -0,0 +1,188 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "types.h"
+#include "math/vec3.h"
+
+namespace aten
+{
+    /**
+     * @brief Accumulate the samples over the multiple render passes.
+     * The sum, the sum of squares and the sample count are kept per pixel,
+     * so the mean and the variance are always computed from all samples so far.
+     * The state can be saved to the file and restored with the sampler state to resume rendering.
+     * The frame can be also split among the processes, and the partial results are merged into one.
+     */
+    class Accumulator {
+    public:
+        /**
+         * @brief How the frame is split among the processes.
+         */
+        enum class Split : uint32_t {
+            None,   ///< Render all pixels and all passes.
+            Tile,   ///< Render the tiles which are assigned to the process.
+            Pass,   ///< Render the passes which are assigned to the process.
+        };
+
+        Accumulator() {}
+        Accumulator(int w, int h)
+        {
+            init(w, h);
+        }
+        ~Accumulator() {}
+
+    public:
+        void init(int w, int h);
+
+        void clear();
+
+        /**
+         * @brief Assign the part of the frame to this process.
+         * The tiles or the passes are assigned to the processes in round robin.
+         * With Split::Pass, the sampler sequences of the passes never overlap among the processes.
+         * @param[in] index Index of this process.
+         * @param[in] num Count of the processes.
+         * @param[in] tileSize Size of the tile with Split::Tile.
+         */
+        void setPartition(
+            Split split,
+            uint32_t index,
+            uint32_t num,
+            uint32_t tileSize = 32);
+
+        /**
+         * @brief Return whether the pixel is rendered in this process.
+         */
+        bool isAssigned(int x, int y) const
+        {
+            if (m_partition.split != Split::Tile) {
+                return true;
+            }
+
+            const auto tileSize = m_partition.tileSize;
+            const auto tileX = (m_width + tileSize - 1) / tileSize;
+
+            const auto tileIdx = (y / tileSize) * tileX + (x / tileSize);
+
+            return (tileIdx % m_partition.num) == m_partition.index;
+        }
+
+        /**
+         * @brief Return the index of the frame to initialize the sampler in the next pass.
+         */
+        uint32_t getFrameIndex() const
+        {
+            if (m_partition.split == Split::Pass) {
+                return m_passNum * m_partition.num + m_partition.index + 1;
+            }
+            return m_passNum + 1;
+        }
+
+        /**
+         * @brief Add the partial result of the other process.
+         * The result is weighted by the sample count per pixel, so it is same as rendering in one process.
+         * The merged accumulator is for resolving the image, and can't be resumed.
+         */
+        bool merge(const Accumulator& rhs);
+
+        /**
+         * @brief Add the samples of the pixel in the current pass.
+         * @param[in] sum Sum of the valid samples.
+         * @param[in] sum2 Sum of squares of the valid samples.
+         * @param[in] validNum Count of the valid samples.
+         * @param[in] sampleNum Count of all samples including the invalid samples.
+         */
+        void add(
+            int pos,
+            const vec3& sum,
+            const vec3& sum2,
+            uint32_t validNum,
+            uint32_t sampleNum);
+
+        /**
+         * @brief Finish the current pass.
+         */
+        void endPass()
+        {
+            m_passNum++;
+        }
+
+        vec3 getMean(int pos) const;
+
+        vec3 getVariance(int pos) const;
+
+        uint32_t getSampleNum(int pos) const
+        {
+            return m_pixels[pos].sampleNum;
+        }
+
+        /**
+         * @brief Return the count of the finished passes.
+         */
+        uint32_t getPassNum() const
+        {
+            return m_passNum;
+        }
+
+        Split getSplit() const
+        {
+            return m_partition.split;
+        }
+
+        uint32_t getPartitionIndex() const
+        {
+            return m_partition.index;
+        }
+
+        uint32_t getPartitionNum() const
+        {
+            return m_partition.num;
+        }
+
+        uint32_t width() const
+        {
+            return m_width;
+        }
+
+        uint32_t height() const
+        {
+            return m_height;
+        }
+
+        /**
+         * @brief Save the accumulated samples and the sampler state to the file.
+         * The file is written to the temporary file at first and renamed,
+         * so the previous checkpoint is not broken even if the process is killed while saving.
+         */
+        bool save(const std::string& path) const;
+
+        /**
+         * @brief Restore the accumulated samples and the sampler state from the file.
+         * The scramble table of the sampler is overwritten with the saved one, so call this after aten::initSampler.
+         */
+        bool load(const std::string& path);
+
+    private:
+        struct Pixel {
+            // Accumulate as double not to lose the precision in the long rendering.
+            double sum[3];
+            double sum2[3];
+            uint32_t validNum;
+            uint32_t sampleNum;
+        };
+
+        std::vector<Pixel> m_pixels;
+        int m_width{ 0 };
+        int m_height{ 0 };
+
+        uint32_t m_passNum{ 0 };
+
+        struct Partition {
+            Split split{ Split::None };
+            uint32_t index{ 0 };
+            uint32_t num{ 1 };
+            uint32_t tileSize{ 32 };
+        } m_partition;
+    };
+}
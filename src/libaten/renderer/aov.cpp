@@ -76,9 +76,7 @@ namespace aten
                             vec3 dirToLight = normalize(sampleres.dir);
                             aten::ray shadowRay(rec.p, dirToLight);
 
-                            hitrecord tmpRec;
-
-                            if (scene->hitLight(ctxt, light, posLight, shadowRay, AT_MATH_EPSILON, AT_MATH_INF, tmpRec)) {
+                            if (scene->hitLight(ctxt, light, posLight, shadowRay, AT_MATH_EPSILON, AT_MATH_INF)) {
                                 path.visibility = 1;
                             }
                         }
@@ -130,58 +128,58 @@ namespace aten
 
         real depthNorm = 1 / dst.geominfo.depthMax;
 
-        for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                int pos = y * width + x;
-
-                XorShift rnd((y * height * 4 + x * 4) + 1);
-
-                real u = real(x + 0.5) / real(width);
-                real v = real(y + 0.5) / real(height);
+        renderTiles(
+            width, height,
+            [&](int x, int y, int threadIdx) {
+            int pos = y * width + x;
 
-                auto camsample = camera->sample(u, v, &rnd);
+            XorShift rnd((y * height * 4 + x * 4) + 1);
 
-                auto path = radiance(ctxt, camsample.r, scene, &rnd);
+            real u = real(x + 0.5) / real(width);
+            real v = real(y + 0.5) / real(height);
 
-                if (dst.geominfo.nml_depth) {
-                    if (dst.geominfo.needNormalize) {
-                        // [-1, 1] -> [0, 1]
-                        auto normal = (path.normal + real(1)) * real(0.5);
+            auto camsample = camera->sample(u, v, &rnd);
 
-                        // [-∞, ∞] -> [-d, d]
-                        real depth = std::min(aten::abs(path.depth), dst.geominfo.depthMax);
-                        depth *= path.depth < 0 ? -1 : 1;
+            auto path = radiance(ctxt, camsample.r, scene, &rnd);
 
-                        if (dst.geominfo.needNormalize) {
-                            // [-d, d] -> [-1, 1]
-                            depth *= depthNorm;
+            if (dst.geominfo.nml_depth) {
+                if (dst.geominfo.needNormalize) {
+                    // [-1, 1] -> [0, 1]
+                    auto normal = (path.normal + real(1)) * real(0.5);
 
-                            // [-1, 1] -> [0, 1]
-                            depth = (depth + 1) * real(0.5);
-                        }
-
-                        dst.geominfo.nml_depth->put(x, y, vec4(normal, depth));
-                    }
-                    else {
-                        dst.geominfo.nml_depth->put(x, y, vec4(path.normal, path.depth));
-                    }
-                }
-                if (dst.geominfo.albedo_vis) {
-                    auto albedo = path.albedo;
+                    // [-∞, ∞] -> [-d, d]
+                    real depth = std::min(aten::abs(path.depth), dst.geominfo.depthMax);
+                    depth *= path.depth < 0 ? -1 : 1;
 
                     if (dst.geominfo.needNormalize) {
-                        // TODO
-                        albedo.x = std::min<real>(albedo.x, 1);
-                        albedo.y = std::min<real>(albedo.y, 1);
-                        albedo.z = std::min<real>(albedo.z, 1);
+                        // [-d, d] -> [-1, 1]
+                        depth *= depthNorm;
+
+                        // [-1, 1] -> [0, 1]
+                        depth = (depth + 1) * real(0.5);
                     }
 
-                    dst.geominfo.albedo_vis->put(x, y, vec4(albedo, path.visibility));
+                    dst.geominfo.nml_depth->put(x, y, vec4(normal, depth));
                 }
-                if (dst.geominfo.ids) {
-                    dst.geominfo.ids->put(x, y, vec4(path.shapeid, path.mtrlid, 0, 0));
+                else {
+                    dst.geominfo.nml_depth->put(x, y, vec4(path.normal, path.depth));
                 }
             }
-        }
+            if (dst.geominfo.albedo_vis) {
+                auto albedo = path.albedo;
+
+                if (dst.geominfo.needNormalize) {
+                    // TODO
+                    albedo.x = std::min<real>(albedo.x, 1);
+                    albedo.y = std::min<real>(albedo.y, 1);
+                    albedo.z = std::min<real>(albedo.z, 1);
+                }
+
+                dst.geominfo.albedo_vis->put(x, y, vec4(albedo, path.visibility));
+            }
+            if (dst.geominfo.ids) {
+                dst.geominfo.ids->put(x, y, vec4(path.shapeid, path.mtrlid, 0, 0));
+            }
+        });
     }
 }
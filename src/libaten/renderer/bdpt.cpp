@@ -231,6 +231,7 @@ namespace aten
         const context& ctxt,
         std::vector<Vertex>& vs,
         aten::Light* light,
+        real lightSelectPdf,
         sampler* sampler,
         scene* scene,
         camera* camera) const
@@ -246,7 +247,8 @@ namespace aten
         auto pdfOnLight = real(1) / res.area;
 
         // 確率密度の積を保持（面積測度に関する確率密度）.
-        auto totalAreaPdf = pdfOnLight;
+        // Include the probability to select the light.
+        auto totalAreaPdf = pdfOnLight * lightSelectPdf;
 
         // 光源上に生成された頂点を頂点リストに追加.
         vs.push_back(Vertex(
@@ -578,6 +580,7 @@ namespace aten
     }
 
     real BDPT::computeMISWeight(
+        Scratch& scratch,
         camera* camera,
         real totalAreaPdf,
         const std::vector<Vertex>& eye_vs,
@@ -597,7 +600,8 @@ namespace aten
         const auto& beginEye = eye_vs[0];
         const real areaPdf_x0 = beginEye.totalAreaPdf;
 
-        std::vector<const Vertex*> vs(numEyeVtx + numLightVtx);
+        auto& vs = scratch.vs;
+        vs.resize(numEyeVtx + numLightVtx);
 
         // 頂点を一列に並べる。
         // vs[0] = y0, vs[1] = y1, ... vs[k-1] = x1, vs[k] = x0
@@ -616,7 +620,8 @@ namespace aten
         const int k = numLightVtx + numEyeVtx - 1;
 
         // pi1/pi を計算.
-        std::vector<real> pi1_pi(numLightVtx + numEyeVtx);
+        auto& pi1_pi = scratch.pi1_pi;
+        pi1_pi.resize(numLightVtx + numEyeVtx);
         {
             {
                 const auto* vtx = vs[0];
@@ -642,7 +647,8 @@ namespace aten
         }
 
         // pを求める
-        std::vector<real> p(numEyeVtx + numLightVtx + 1);
+        auto& p = scratch.p;
+        p.resize(numEyeVtx + numLightVtx + 1);
         {
             // 真ん中にtotalAreaPdfをセット.
             p[numLightVtx] = totalAreaPdf;
@@ -688,7 +694,7 @@ namespace aten
         const context& ctxt,
         int x, 
         int y,
-        std::vector<Result>& result,
+        Scratch& scratch,
         const std::vector<Vertex>& eye_vs,
         const std::vector<Vertex>& light_vs,
         scene* scene,
@@ -734,15 +740,16 @@ namespace aten
                 const vec3 lightEndToEyeEnd = eye_end.pos - light_end.pos;
                 ray r(light_end.pos, normalize(lightEndToEyeEnd));
 
-                hitrecord rec;
-                Intersection isect;
-                bool isHit = scene->hit(ctxt, r, AT_MATH_EPSILON, AT_MATH_INF, rec, isect);
-
                 if (eye_end.objType == ObjectType::Lens) {
                     if (camera->isPinhole()) {
                         break;
                     }
                     else {
+                        // レンズとの接続では、レンズ上の位置を求めるため最近傍の交差が必要.
+                        hitrecord rec;
+                        Intersection isect;
+                        scene->hit(ctxt, r, AT_MATH_EPSILON, AT_MATH_INF, rec, isect);
+
                         // lightサブパスを直接レンズにつなげる.
                         vec3 posOnLens;
                         vec3 posOnObjectplane;
@@ -791,8 +798,10 @@ namespace aten
                     }
                     else {
                         // 端点同士が別の物体で遮蔽されるかどうかを判定する。遮蔽されていたら処理終わり.
-                        const real len = length(eye_end.pos - rec.p);
-                        if (len >= AT_MATH_EPSILON) {
+                        // NOTE
+                        // eyeサブパスの端点自体に当たらないように、距離を位置の誤差分だけ短くする.
+                        const real len = length(eye_end.pos - r.org);
+                        if (scene->occluded(ctxt, r, AT_MATH_EPSILON, len - scene->getRayEpsilon())) {
                             continue;
                         }
 
@@ -839,6 +848,7 @@ namespace aten
 
                 // MIS.
                 const real misWeight = computeMISWeight(
+                    scratch,
                     camera,
                     totalAreaPdf,
                     eye_vs, numEyeVtx,
@@ -855,7 +865,7 @@ namespace aten
                 //    * lightサブパススループット.
                 //    / パスのサンプリング確率密度の総計.
                 const vec3 contrib = misWeight * throughput * eyeThroughput * lightThroughput / totalAreaPdf;
-                result.push_back(Result(
+                scratch.result.push_back(Result(
                     contrib,
                     targetX, targetY,
                     numEyeVtx <= 1 ? false : true));
@@ -863,6 +873,39 @@ namespace aten
         }
     }
 
+    void BDPT::genLightPathPool(
+        const context& ctxt,
+        uint32_t sampleIdx,
+        uint32_t seed,
+        scene* scene,
+        camera* camera)
+    {
+        const int num = (int)m_lightPaths.size();
+
+#if defined(ENABLE_OMP) && !defined(BDPT_DEBUG)
+#pragma omp parallel for
+#endif
+        for (int i = 0; i < num; i++) {
+            auto& lightPath = m_lightPaths[i];
+
+            // Not to correlate with the eye sub-path of the pixel which has the same index.
+            auto scramble = (aten::getRandom(i) ^ 0x9e3779b9) * 0x1fe3434f;
+
+            CMJ rnd;
+            rnd.init(seed, sampleIdx, scramble);
+
+            lightPath.vs.clear();
+            lightPath.res = Result(vec3(), -1, -1, false);
+
+            real lightSelectPdf = 1;
+            auto light = scene->sampleLightByPower(&rnd, lightSelectPdf);
+
+            if (light) {
+                lightPath.res = genLightPath(ctxt, lightPath.vs, light, lightSelectPdf, &rnd, scene, camera);
+            }
+        }
+    }
+
     void BDPT::onRender(
         const context& ctxt,
         Destination& dst,
@@ -886,143 +929,173 @@ namespace aten
         }
         */
 
-        auto threadnum = OMPUtil::getThreadNum();
+        // The light sub-paths are splatted to the other pixels, so the image is shared by all threads.
+        m_film.init(m_width, m_height, isDeterministic());
 
-        std::vector<std::vector<vec4>> image(threadnum);
+        auto threadnum = (int)OMPUtil::getThreadNum();
 
-        for (int i = 0; i < threadnum; i++) {
-            image[i].resize(m_width * m_height);
-        }
+        auto time = timer::getSystemTime();
 
 #if defined(ENABLE_OMP) && !defined(BDPT_DEBUG)
-#pragma omp parallel
+        const int threadNum = threadnum;
+#else
+        const int threadNum = 1;
 #endif
-        {
-            auto idx = OMPUtil::getThreadIdx();
 
-            auto time = timer::getSystemTime();
+        if (m_scratch.size() < (size_t)threadnum) {
+            m_scratch.resize(threadnum);
+        }
 
-#if defined(ENABLE_OMP) && !defined(BDPT_DEBUG)
-#pragma omp for
-#endif
-            for (int y = 0; y < m_height; y++) {
-                for (int x = 0; x < m_width; x++) {
-                    int pos = y * m_width + x;
-
-                    for (uint32_t i = 0; i < samples; i++) {
-                        auto scramble = aten::getRandom(pos) * 0x1fe3434f;
-
-                        //XorShift rnd(scramble + time.milliSeconds);
-                        //Halton rnd(scramble + time.milliSeconds);
-                        //Sobol rnd(scramble + time.milliSeconds);
-                        //WangHash rnd(scramble + time.milliSeconds);
-                        CMJ rnd;
-                        rnd.init(time.milliSeconds, i, scramble);
-
-                        std::vector<Result> result;
-
-                        std::vector<Vertex> eyevs;
-                        std::vector<Vertex> lightvs;
-
-                        auto eyeRes = genEyePath(ctxt, eyevs, x, y, &rnd, scene, camera);
-                        
-#if 0
-                        if (eyeRes.isTerminate) {
-                            int pos = eyeRes.y * m_width + eyeRes.x;
-                            image[idx][pos] += vec4(eyeRes.contrib, 1);
-                        }
-#else
-                        auto lightNum = scene->lightNum();
-                        for (uint32_t n = 0; n < lightNum; n++) {
-                            auto light = scene->getLight(n);
-                            auto lightRes = genLightPath(ctxt, lightvs, light, &rnd, scene, camera);
-
-                            if (eyeRes.isTerminate) {
-                                const real misWeight = computeMISWeight(
-                                    camera,
-                                    eyevs[eyevs.size() - 1].totalAreaPdf,
-                                    eyevs,
-                                    (const int)eyevs.size(),   // num_eye_vertex
-                                    lightvs,
-                                    0);                         // num_light_vertex
-
-                                const vec3 contrib = misWeight * eyeRes.contrib;
-                                result.push_back(Result(contrib, eyeRes.x, eyeRes.y, true));
-                            }
-
-                            if (lightRes.isTerminate) {
-                                const real misWeight = computeMISWeight(
-                                    camera,
-                                    lightvs[lightvs.size() - 1].totalAreaPdf,
-                                    eyevs,
-                                    0,                            // num_eye_vertex
-                                    lightvs,
-                                    (const int)lightvs.size());    // num_light_vertex
-
-                                const vec3 contrib = misWeight * lightRes.contrib;
-                                result.push_back(Result(contrib, lightRes.x, lightRes.y, false));
-                            }
-
-                            combine(
-                                ctxt, 
-                                x, y,
-                                result, 
-                                eyevs,
-                                lightvs,
-                                scene,
-                                camera);
-
-#if 1
-                            for (int i = 0; i < (int)result.size(); i++) {
-                                const auto& res = result[i];
-
-                                // TODO
-                                // FIXME
-                                // I have to research why contribute value is invalid.
-                                if (isInvalidColor(res.contrib)) {
-                                    //AT_PRINTF("Invalid(%d/%d[%d])\n", x, y, i);
-                                    continue;
-                                }
-
-                                const int pos = res.y * m_width + res.x;
-
-                                if (res.isStartFromPixel) {
-                                    image[idx][pos] += vec4(res.contrib, 1);
-                                }
-                                else {
-                                    // 得られたサンプルについて、サンプルが現在の画素（x,y)から発射されたeyeサブパスを含むものだった場合
-                                    // Ixy のモンテカルロ推定値はsamples[i].valueそのものなので、そのまま足す。その後、下の画像出力時に発射された回数の総計（iteration_per_thread * num_threads)で割る.
-                                    //
-                                    // 得られたサンプルについて、現在の画素から発射されたeyeサブパスを含むものではなかった場合（lightサブパスが別の画素(x',y')に到達した場合）は
-                                    // Ix'y' のモンテカルロ推定値を新しく得たわけだが、この場合、画像全体に対して光源側からサンプルを生成し、たまたまx'y'にヒットしたと考えるため
-                                    // このようなサンプルについては最終的に光源から発射した回数の総計で割って、画素への寄与とする必要がある.
-                                    image[idx][pos] += vec4(res.contrib * divPixelProb, 1);
-                                }
-                            }
-#endif
+        const auto seed = getFrameSeed(time.milliSeconds);
 
-                        }
-#endif
-                    }
+        const uint32_t lightPathNum = m_lightPathNum > 0
+            ? m_lightPathNum
+            : std::max<uint32_t>(m_width * m_height / 4, 1);
+
+        if (m_enableLightPathReuse) {
+            m_lightPaths.resize(lightPathNum);
+        }
+
+        auto renderSample = [&](int x, int y, uint32_t i, int idx) {
+            int pos = y * m_width + x;
+
+            auto scramble = aten::getRandom(pos) * 0x1fe3434f;
+
+            //XorShift rnd(scramble + time.milliSeconds);
+            //Halton rnd(scramble + time.milliSeconds);
+            //Sobol rnd(scramble + time.milliSeconds);
+            //WangHash rnd(scramble + time.milliSeconds);
+            CMJ rnd;
+            rnd.init(seed, i, scramble);
+
+            auto& scratch = m_scratch[idx];
+
+            auto& result = scratch.result;
+            auto& eyevs = scratch.eyevs;
+
+            result.clear();
+            eyevs.clear();
+
+            auto eyeRes = genEyePath(ctxt, eyevs, x, y, &rnd, scene, camera);
+
+            // The light sub-path which the eye sub-path connects to.
+            const std::vector<Vertex>* lightvs = nullptr;
+            Result lightRes(vec3(), -1, -1, false);
+
+            if (m_enableLightPathReuse) {
+                auto lightPathIdx = std::min<uint32_t>((uint32_t)(rnd.nextSample() * lightPathNum), lightPathNum - 1);
+                const auto& lightPath = m_lightPaths[lightPathIdx];
+
+                if (!lightPath.vs.empty()) {
+                    lightvs = &lightPath.vs;
+                    lightRes = lightPath.res;
+                }
+            }
+            else {
+                // Select one light according to the power, instead of tracing the light sub-paths from all lights.
+                real lightSelectPdf = 1;
+                auto light = scene->sampleLightByPower(&rnd, lightSelectPdf);
+
+                if (light) {
+                    scratch.lightvs.clear();
+                    lightRes = genLightPath(ctxt, scratch.lightvs, light, lightSelectPdf, &rnd, scene, camera);
+                    lightvs = &scratch.lightvs;
                 }
             }
-        }
 
-        std::vector<vec4> tmp(m_width * m_height);
+            if (!lightvs) {
+                return;
+            }
 
-        for (int i = 0; i < threadnum; i++) {
-            auto& img = image[i];
-            for (int y = 0; y < m_height; y++) {
-                for (int x = 0; x < m_width; x++) {
-                    int pos = y * m_width + x;
+            if (eyeRes.isTerminate) {
+                const real misWeight = computeMISWeight(
+                    scratch,
+                    camera,
+                    eyevs[eyevs.size() - 1].totalAreaPdf,
+                    eyevs,
+                    (const int)eyevs.size(),   // num_eye_vertex
+                    *lightvs,
+                    0);                         // num_light_vertex
+
+                const vec3 contrib = misWeight * eyeRes.contrib;
+                result.push_back(Result(contrib, eyeRes.x, eyeRes.y, true));
+            }
 
-                    auto clr = img[pos] / samples;
-                    clr.w = 1;
+            if (lightRes.isTerminate) {
+                const real misWeight = computeMISWeight(
+                    scratch,
+                    camera,
+                    (*lightvs)[lightvs->size() - 1].totalAreaPdf,
+                    eyevs,
+                    0,                            // num_eye_vertex
+                    *lightvs,
+                    (const int)lightvs->size());    // num_light_vertex
+
+                const vec3 contrib = misWeight * lightRes.contrib;
+                result.push_back(Result(contrib, lightRes.x, lightRes.y, false));
+            }
+
+            combine(
+                ctxt, 
+                x, y,
+                scratch, 
+                eyevs,
+                *lightvs,
+                scene,
+                camera);
+
+            for (int i = 0; i < (int)result.size(); i++) {
+                const auto& res = result[i];
 
-                    tmp[pos] += clr;
+                // TODO
+                // FIXME
+                // I have to research why contribute value is invalid.
+                if (isInvalidColor(res.contrib)) {
+                    //AT_PRINTF("Invalid(%d/%d[%d])\n", x, y, i);
+                    continue;
                 }
+
+                const int pos = res.y * m_width + res.x;
+
+                if (res.isStartFromPixel) {
+                    m_film.add(pos, res.contrib);
+                }
+                else {
+                    // 得られたサンプルについて、サンプルが現在の画素（x,y)から発射されたeyeサブパスを含むものだった場合
+                    // Ixy のモンテカルロ推定値はsamples[i].valueそのものなので、そのまま足す。その後、下の画像出力時に発射された回数の総計（iteration_per_thread * num_threads)で割る.
+                    //
+                    // 得られたサンプルについて、現在の画素から発射されたeyeサブパスを含むものではなかった場合（lightサブパスが別の画素(x',y')に到達した場合）は
+                    // Ix'y' のモンテカルロ推定値を新しく得たわけだが、この場合、画像全体に対して光源側からサンプルを生成し、たまたまx'y'にヒットしたと考えるため
+                    // このようなサンプルについては最終的に光源から発射した回数の総計で割って、画素への寄与とする必要がある.
+                    // NOTE
+                    // With the light path reuse, each light sub-path is used by (pixel count / pool size) eye sub-paths on average,
+                    // so the weight per light sub-path is still 1 / pool size in expectation.
+                    m_film.add(pos, res.contrib * divPixelProb);
+                }
+            }
+        };
+
+        // Process the pixels in [sampleBegin, sampleEnd) samples.
+        auto render = [&](uint32_t sampleBegin, uint32_t sampleEnd) {
+            auto renderPixel = [&](int x, int y, int idx) {
+                for (uint32_t i = sampleBegin; i < sampleEnd; i++) {
+                    renderSample(x, y, i, idx);
+                }
+            };
+
+            renderTiles(m_width, m_height, renderPixel, threadNum);
+        };
+
+        if (m_enableLightPathReuse) {
+            // The pool is shared by all pixels in one sample iteration.
+            for (uint32_t i = 0; i < samples; i++) {
+                genLightPathPool(ctxt, i, seed, scene, camera);
+                render(i, i + 1);
             }
         }
+        else {
+            render(0, samples);
+        }
 
 #if defined(ENABLE_OMP) && !defined(BDPT_DEBUG)
 #pragma omp parallel for
@@ -1031,8 +1104,7 @@ namespace aten
             for (int x = 0; x < m_width; x++) {
                 int pos = y * m_width + x;
 
-                auto clr = tmp[pos];
-                clr.w = 1;
+                auto clr = vec4(m_film.get(pos) / (real)samples, 1);
 
                 dst.buffer->put(x, y, clr);
             }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "renderer/renderer.h"
+#include "renderer/splat_film.h"
 #include "scene/scene.h"
 #include "camera/camera.h"
 #include "sampler/sampler.h"
@@ -19,6 +20,18 @@ namespace aten
             scene* scene,
             camera* camera) override;
 
+        /**
+         * @brief Enable to share the light sub-paths among the eye sub-paths.
+         * The light sub-paths are traced once per sample iteration into the pool,
+         * and each eye sub-path connects to the light sub-path which is randomly selected from the pool.
+         * @param[in] lightPathNum Count of the light sub-paths in the pool. If it is zero, a quarter of the pixel count.
+         */
+        void enableLightPathReuse(bool enable, uint32_t lightPathNum = 0)
+        {
+            m_enableLightPathReuse = enable;
+            m_lightPathNum = lightPathNum;
+        }
+
     private:
         enum ObjectType {
             Light,
@@ -90,6 +103,31 @@ namespace aten
             {}
         };
 
+        /**
+         * @brief Work buffers per thread.
+         * They are cleared but not freed per sample, so no allocation happens once they are warmed up.
+         */
+        struct Scratch {
+            std::vector<Vertex> eyevs;
+            std::vector<Vertex> lightvs;
+            std::vector<Result> result;
+
+            // For computeMISWeight.
+            std::vector<const Vertex*> vs;
+            std::vector<real> pi1_pi;
+            std::vector<real> p;
+        };
+
+        /**
+         * @brief Light sub-path in the pool for the light path reuse.
+         */
+        struct LightPath {
+            std::vector<Vertex> vs;
+
+            // The light sub-path which hits the lens.
+            Result res{ vec3(), -1, -1, false };
+        };
+
         Result genEyePath(
             const context& ctxt,
             std::vector<Vertex>& vs,
@@ -102,6 +140,7 @@ namespace aten
             const context& ctxt,
             std::vector<Vertex>& vs,
             aten::Light* light,
+            real lightSelectPdf,
             sampler* sampler,
             scene* scene,
             camera* camera) const;
@@ -114,6 +153,7 @@ namespace aten
             const int next_idx) const;
 
         real computeMISWeight(
+            Scratch& scratch,
             camera* camera,
             real totalAreaPdf,
             const std::vector<Vertex>& eye_vs,
@@ -125,12 +165,22 @@ namespace aten
             const context& ctxt,
             int x, 
             int y,
-            std::vector<Result>& result,
+            Scratch& scratch,
             const std::vector<Vertex>& eye_vs,
             const std::vector<Vertex>& light_vs,
             scene* scene,
             camera* camera) const;
 
+        /**
+         * @brief Trace the light sub-paths into the pool.
+         */
+        void genLightPathPool(
+            const context& ctxt,
+            uint32_t sampleIdx,
+            uint32_t seed,
+            scene* scene,
+            camera* camera);
+
         static inline real russianRoulette(const Vertex& vtx);
 
     private:
@@ -138,5 +188,13 @@ namespace aten
 
         int m_width;
         int m_height;
+
+        std::vector<Scratch> m_scratch;
+
+        SplatFilm m_film;
+
+        bool m_enableLightPathReuse{ false };
+        uint32_t m_lightPathNum{ 0 };
+        std::vector<LightPath> m_lightPaths;
     };
 }
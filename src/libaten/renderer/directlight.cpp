@@ -142,13 +142,18 @@ namespace aten
         }
         else
         {
-            int lightNum = scene->lightNum();
-
-            for (int i = 0; i < lightNum; i++) {
-                auto light = scene->getLight(i);
-
-                auto sampleres = light->sample(ctxt, path.rec.p, sampler);
-
+            // Select one light according to the estimated contribution, instead of evaluating all lights.
+            real lightSelectPdf = 1;
+            LightSampleResult sampleres;
+
+            auto light = scene->sampleLight(
+                ctxt,
+                path.rec.p,
+                orienting_normal,
+                sampler,
+                lightSelectPdf, sampleres);
+
+            if (light) {
                 const vec3& posLight = sampleres.pos;
                 const vec3& nmlLight = sampleres.nml;
                 real pdfLight = sampleres.pdf;
@@ -161,9 +166,7 @@ namespace aten
                 auto bsdf = mtrl->bsdf(orienting_normal, path.ray.dir, dirToLight, path.rec.u, path.rec.v);
                 auto pdfb = mtrl->pdf(orienting_normal, path.ray.dir, dirToLight, path.rec.u, path.rec.v);
 
-                hitrecord tmpRec;
-
-                if (scene->hitLight(ctxt, light, posLight, shadowRay, AT_MATH_EPSILON, AT_MATH_INF, tmpRec)) {
+                if (scene->hitLight(ctxt, light, posLight, shadowRay, AT_MATH_EPSILON, AT_MATH_INF)) {
                     // Shadow ray hits the light.
                     auto cosShadow = dot(orienting_normal, dirToLight);
 
@@ -172,8 +175,8 @@ namespace aten
 
                     if (light->isSingular() || light->isInfinite()) {
                         if (pdfLight > real(0) && cosShadow >= 0) {
-                            auto misW = pdfLight / (pdfb + pdfLight);
-                            path.contrib += (misW * bsdf * path.throughput * emit * cosShadow / pdfLight);
+                            auto misW = (pdfLight * lightSelectPdf) / (pdfb + pdfLight * lightSelectPdf);
+                            path.contrib += (misW * bsdf * path.throughput * emit * cosShadow / pdfLight) / lightSelectPdf;
                         }
                     }
                     else {
@@ -186,64 +189,73 @@ namespace aten
                             if (pdfb > real(0) && pdfLight > real(0)) {
                                 pdfb = pdfb * cosLight / dist2;
 
-                                auto misW = pdfLight / (pdfb + pdfLight);
+                                auto misW = (pdfLight * lightSelectPdf) / (pdfb + pdfLight * lightSelectPdf);
 
-                                path.contrib += (misW * (bsdf * path.throughput * emit * G) / pdfLight);
+                                path.contrib += (misW * (bsdf * path.throughput * emit * G) / pdfLight) / lightSelectPdf;
                             }
                         }
                     }
+                }
+            }
 
-                    if (!light->isSingular())
-                    {
-                        auto sampling = mtrl->sample(path.ray, orienting_normal, path.rec.normal, sampler, path.rec.u, path.rec.v);
+            // Implicit connection by sampling bsdf.
+            {
+                auto sampling = mtrl->sample(path.ray, orienting_normal, path.rec.normal, sampler, path.rec.u, path.rec.v);
 
-                        auto nextDir = normalize(sampling.dir);
-                        pdfb = sampling.pdf;
-                        bsdf = sampling.bsdf;
+                auto nextDir = normalize(sampling.dir);
+                auto pdfb = sampling.pdf;
+                auto bsdf = sampling.bsdf;
 
-                        auto c = dot(orienting_normal, nextDir);
-                        vec3 throughput(1, 1, 1);
+                auto c = dot(orienting_normal, nextDir);
+                vec3 throughput(1, 1, 1);
 
-                        if (pdfb > 0 && c > 0) {
-                            throughput *= bsdf * c / pdfb;
-                        }
+                if (pdfb > 0 && c > 0) {
+                    throughput *= bsdf * c / pdfb;
+                }
+                else {
+                    return false;
+                }
+
+                ray nextRay = aten::ray(path.rec.p, nextDir);
 
-                        ray nextRay = aten::ray(path.rec.p, nextDir);
+                hitrecord tmpRec;
+                aten::Intersection tmpIsect;
 
-                        aten::Intersection tmpIsect;
+                if (scene->hit(ctxt, nextRay, AT_MATH_EPSILON, AT_MATH_INF, tmpRec, tmpIsect)) {
+                    auto tmpmtrl = ctxt.getMaterial(tmpRec.mtrlid);
 
-                        if (scene->hit(ctxt, nextRay, AT_MATH_EPSILON, AT_MATH_INF, tmpRec, tmpIsect)) {
-                            auto tmpmtrl = ctxt.getMaterial(tmpRec.mtrlid);
+                    // Implicit conection to light.
+                    if (tmpmtrl->isEmissive()) {
+                        auto cosLight = dot(orienting_normal, -nextRay.dir);
+                        auto dist2 = squared_length(tmpRec.p - nextRay.org);
 
-                            // Implicit conection to light.
-                            if (tmpmtrl->isEmissive()) {
-                                auto cosLight = dot(orienting_normal, -nextRay.dir);
-                                auto dist2 = squared_length(tmpRec.p - nextRay.org);
+                        if (cosLight >= 0) {
+                            auto hitLight = scene->findAreaLight(ctxt.getTransformable(tmpIsect.objid));
+                            auto hitLightSelectPdf = scene->computeLightSelectPdf(hitLight, path.rec.p, orienting_normal);
 
-                                if (cosLight >= 0) {
-                                    auto pdfLight = 1 / tmpRec.area;
+                            auto pdfLight = hitLightSelectPdf / tmpRec.area;
 
-                                    pdfLight = pdfLight * dist2 / cosLight;
+                            pdfLight = pdfLight * dist2 / cosLight;
 
-                                    auto misW = pdfb / (pdfLight + pdfb);
+                            auto misW = pdfb / (pdfLight + pdfb);
 
-                                    auto emit = mtrl->color();
+                            auto emit = tmpmtrl->color();
 
-                                    path.contrib += throughput * misW * emit;
-                                }
-                            }
-                        }
-                        else {
-                            auto ibl = scene->getIBL();
-                            if (ibl) {
-                                auto pdfLight = ibl->samplePdf(nextRay);
-                                auto misW = pdfb / (pdfLight + pdfb);
-                                auto emit = ibl->getEnvMap()->sample(nextRay);
-                                path.contrib += throughput * misW * emit;
-                            }
+                            path.contrib += path.throughput * throughput * misW * emit;
                         }
                     }
                 }
+                else {
+                    auto ibl = scene->getIBL();
+                    if (ibl) {
+                        auto pdfLight = ibl->samplePdf(nextRay);
+                        pdfLight *= scene->computeLightSelectPdf(ibl, path.rec.p, orienting_normal);
+
+                        auto misW = pdfb / (pdfLight + pdfb);
+                        auto emit = ibl->getEnvMap()->sample(nextRay);
+                        path.contrib += path.throughput * throughput * misW * emit;
+                    }
+                }
             }
 
             return false;
@@ -294,82 +306,78 @@ namespace aten
         }
 
 
-#if defined(ENABLE_OMP) && !defined(RELEASE_DEBUG)
-#pragma omp parallel
-#endif
-        {
-            auto idx = OMPUtil::getThreadIdx();
-
-            auto time = timer::getSystemTime();
+        auto time = timer::getSystemTime();
 
 #if defined(ENABLE_OMP) && !defined(RELEASE_DEBUG)
-#pragma omp for
+        const int threadNum = 0;
+#else
+        const int threadNum = 1;
 #endif
-            for (int y = 0; y < height; y++) {
-                for (int x = 0; x < width; x++) {
-                    int pos = y * width + x;
 
-                    vec3 col = vec3(0);
-                    vec3 col2 = vec3(0);
-                    uint32_t cnt = 0;
+        renderTiles(
+            width, height,
+            [&](int x, int y, int threadIdx) {
+            int pos = y * width + x;
 
-                    for (uint32_t i = 0; i < samples; i++) {
-                        auto scramble = aten::getRandom(pos) * 0x1fe3434f;
+            vec3 col = vec3(0);
+            vec3 col2 = vec3(0);
+            uint32_t cnt = 0;
 
-                        //XorShift rnd(scramble + time.milliSeconds);
-                        //Halton rnd(scramble + time.milliSeconds);
-                        Sobol rnd(scramble + time.milliSeconds);
-                        //WangHash rnd(scramble + time.milliSeconds);
+            for (uint32_t i = 0; i < samples; i++) {
+                auto scramble = aten::getRandom(pos) * 0x1fe3434f;
 
-                        real u = real(x + rnd.nextSample()) / real(width);
-                        real v = real(y + rnd.nextSample()) / real(height);
+                //XorShift rnd(scramble + time.milliSeconds);
+                //Halton rnd(scramble + time.milliSeconds);
+                Sobol rnd(scramble + getFrameSeed(time.milliSeconds));
+                //WangHash rnd(scramble + time.milliSeconds);
 
-                        auto camsample = camera->sample(u, v, &rnd);
+                real u = real(x + rnd.nextSample()) / real(width);
+                real v = real(y + rnd.nextSample()) / real(height);
 
-                        auto ray = camsample.r;
+                auto camsample = camera->sample(u, v, &rnd);
 
-                        auto path = radiance(
-                            ctxt,
-                            &rnd,
-                            m_maxDepth,
-                            ray,
-                            camera,
-                            camsample,
-                            scene);
+                auto ray = camsample.r;
 
-                        if (isInvalidColor(path.contrib)) {
-                            AT_PRINTF("Invalid(%d/%d[%d])\n", x, y, i);
-                            continue;
-                        }
+                auto path = radiance(
+                    ctxt,
+                    &rnd,
+                    m_maxDepth,
+                    ray,
+                    camera,
+                    camsample,
+                    scene);
+
+                if (isInvalidColor(path.contrib)) {
+                    AT_PRINTF("Invalid(%d/%d[%d])\n", x, y, i);
+                    continue;
+                }
 
-                        auto pdfOnImageSensor = camsample.pdfOnImageSensor;
-                        auto pdfOnLens = camsample.pdfOnLens;
+                auto pdfOnImageSensor = camsample.pdfOnImageSensor;
+                auto pdfOnLens = camsample.pdfOnLens;
 
-                        auto s = camera->getSensitivity(
-                            camsample.posOnImageSensor,
-                            camsample.posOnLens);
+                auto s = camera->getSensitivity(
+                    camsample.posOnImageSensor,
+                    camsample.posOnLens);
 
-                        auto c = path.contrib * s / (pdfOnImageSensor * pdfOnLens);
+                auto c = path.contrib * s / (pdfOnImageSensor * pdfOnLens);
 
-                        col += c;
-                        col2 += c * c;
-                        cnt++;
+                col += c;
+                col2 += c * c;
+                cnt++;
 
-                        if (path.isTerminate) {
-                            break;
-                        }
-                    }
+                if (path.isTerminate) {
+                    break;
+                }
+            }
 
-                    col /= (real)cnt;
+            col /= (real)cnt;
 
-                    dst.buffer->put(x, y, vec4(col, 1));
+            dst.buffer->put(x, y, vec4(col, 1));
 
-                    if (dst.variance) {
-                        col2 /= (real)cnt;
-                        dst.variance->put(x, y, vec4(col2 - col * col, real(1)));
-                    }
-                }
+            if (dst.variance) {
+                col2 /= (real)cnt;
+                dst.variance->put(x, y, vec4(col2 - col * col, real(1)));
             }
-        }
+        }, threadNum);
     }
 }
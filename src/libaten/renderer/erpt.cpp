@@ -178,68 +178,59 @@ namespace aten
             m_rrDepth = m_maxDepth - 1;
         }
 
-        auto threadNum = OMPUtil::getThreadNum();
+        // The energy is deposited to the other pixels, so the image is shared by all threads.
+        m_film.init(width, height, isDeterministic());
 
         vec3 sumI = vec3(0, 0, 0);
 
         auto time = timer::getSystemTime();
+        auto seed = getFrameSeed(time.milliSeconds);
 
         // edを計算.
-        std::vector<vec3> tmpSumI(threadNum);
+        // Sum per row, and sum the rows in order not to depend on the thread scheduling.
+        std::vector<vec3> tmpSumI(height);
 
 #ifdef ENABLE_OMP
-#pragma omp parallel for
+#pragma omp parallel for schedule(dynamic, 1)
 #endif
         for (int y = 0; y < height; y++) {
-            auto idx = OMPUtil::getThreadIdx();
-
             for (int x = 0; x < width; x++) {
                 int pos = y * width + x;
 
                 auto scramble = aten::getRandom(pos) * 0x1fe3434f;
-                XorShift rnd(scramble + time.milliSeconds);
+                XorShift rnd(scramble + seed);
                 ERPTSampler X(&rnd);
 
                 auto path = genPath(ctxt, scene, &X, x, y, width, height, camera, false);
 
-                tmpSumI[idx] += path.contrib;
+                tmpSumI[y] += path.contrib;
             }
         }
 
-        for (uint32_t i = 0; i < threadNum; i++) {
-            sumI += tmpSumI[i];
+        for (int y = 0; y < height; y++) {
+            sumI += tmpSumI[y];
         }
 
         const real ed = color::luminance(sumI / (real)(width * height)) / (real)mutation;
 
-        std::vector<std::vector<vec3>> acuumImage(threadNum);
-
 #ifdef ENABLE_OMP
-#pragma omp parallel for
+#pragma omp parallel for schedule(dynamic, 1)
 #endif
         for (int y = 0; y < height; y++) {
             AT_PRINTF("Rendering (%f)%%\n", 100.0 * y / (height - 1));
 
-            auto idx = OMPUtil::getThreadIdx();
-
-            auto& image = acuumImage[idx];
-            if (image.empty()) {
-                image.resize(width * height);
-                memset(&image[0], 0, sizeof(vec3) * width * height);
-            }
-
             for (int x = 0; x < width; x++) {
                 auto pos = y * width + x;
                 auto scramble = aten::getRandom(pos) * 0x1fe3434f;
 
                 for (uint32_t i = 0; i < samples; i++) {
-                    
+                
 
                     // TODO
                     // sobol や halton sequence はステップ数が多すぎてオーバーフローしてしまう...
                     //XorShift rnd((y * height * 4 + x * 4) * samples + i + 1 + time.milliSeconds);
                     CMJ rnd;
-                    rnd.init(time.milliSeconds, i, scramble);
+                    rnd.init(seed, i, scramble);
                     ERPTSampler X(&rnd);
 
                     // 現在のスクリーン上のある点からのパスによる放射輝度を求める.
@@ -248,7 +239,7 @@ namespace aten
                     // パスが光源に直接ヒットしてた場合、エネルギー分配しないで、そのまま画像に送る.
                     if (newSample.isTerminate) {
                         int pos = newSample.y * width + newSample.x;
-                        image[pos] += newSample.contrib / (real)samples;
+                        m_film.add(pos, newSample.contrib);
                         continue;
                     }
 
@@ -261,7 +252,9 @@ namespace aten
                         const int numChains = (int)std::floor(r + illum / (mutation * ed));;
 
                         // 周囲に分配するエネルギー.
-                        const vec3 depositValue = (e / illum * ed) / (real)samples;
+                        // NOTE
+                        // Divided by the sample count in resolving the film.
+                        const vec3 depositValue = e / illum * ed;
 
                         for (int nc = 0; nc < numChains; nc++) {
                             ERPTSampler Y = X;
@@ -317,11 +310,11 @@ namespace aten
                                     if (!Ypath.isTerminate) {
                                         // 論文とは異なるが、光源に直接ヒットしたときは分配しないでみる.
                                         int pos = Ypath.y * width + Ypath.x;
-                                        image[pos] += depositValue;
+                                        m_film.add(pos, depositValue);
                                     }
 #else
                                     int pos = Ypath.y * width + Ypath.x;
-                                    image[pos] += depositValue;
+                                    m_film.add(pos, depositValue);
 #endif
                                 }
                             }
@@ -331,11 +324,6 @@ namespace aten
             }
         }
 
-        for (uint32_t n = 0; n < threadNum; n++) {
-            auto& image = acuumImage[n];
-            for (int i = 0; i < width * height; i++) {
-                dst.buffer->add(i, vec4(image[i], 1));
-            }
-        }
+        m_film.resolve(dst.buffer, real(1) / samples);
     }
 }
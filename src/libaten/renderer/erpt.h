@@ -1,6 +1,7 @@
 #pragma once
 
 #include "renderer/pathtracing.h"
+#include "renderer/splat_film.h"
 #include "scene/scene.h"
 #include "camera/camera.h"
 #include "scene/context.h"
@@ -34,5 +35,8 @@ namespace aten
             int width, int height,
             camera* camera,
             bool willImagePlaneMutation);
+
+    private:
+        SplatFilm m_film;
     };
 }
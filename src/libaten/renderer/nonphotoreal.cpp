@@ -31,9 +31,7 @@ namespace aten
             vec3 dirToLight = normalize(sampleres.dir);
             aten::ray shadowRay(p, dirToLight);
 
-            hitrecord tmpRec;
-
-            if (scene->hitLight(ctxt, light, posLight, shadowRay, AT_MATH_EPSILON, AT_MATH_INF, tmpRec)) {
+            if (scene->hitLight(ctxt, light, posLight, shadowRay, AT_MATH_EPSILON, AT_MATH_INF)) {
                 cosShadow = dot(normal, dirToLight);
             }
         }
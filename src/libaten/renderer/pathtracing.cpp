@@ -1,6 +1,7 @@
 #include "renderer/pathtracing.h"
 #include "misc/omputil.h"
 #include "misc/timer.h"
+#include "misc/color.h"
 #include "renderer/nonphotoreal.h"
 #include "sampler/xorshift.h"
 #include "sampler/halton.h"
@@ -10,6 +11,7 @@
 #include "sampler/bluenoiseSampler.h"
 
 #include "material/lambert.h"
+#include "geometry/transformable.h"
 
 //#define Deterministic_Path_Termination
 
@@ -26,6 +28,76 @@ namespace aten
     // NOTE
     // https://www.slideshare.net/shocker_0x15/ss-52688052
 
+    // Width of the ray cone at the hit point in the uv space of the hit triangle.
+    // The uv scale comes from the ratio of the uv area and the world area of the triangle.
+    static real computeTextureFootprint(
+        const context& ctxt,
+        real spreadAngle,
+        const ray& r,
+        const hitrecord& rec,
+        const Intersection& isect)
+    {
+        if (spreadAngle <= real(0) || isect.primid < 0 || isect.objid < 0) {
+            return real(0);
+        }
+
+        auto obj = ctxt.getTransformable(isect.objid);
+        if (!obj) {
+            return real(0);
+        }
+
+        mat4 mtxL2W;
+        mat4 mtxW2L;
+        obj->getMatrices(mtxL2W, mtxW2L);
+
+        const auto& param = ctxt.getTriangleParam(isect.primid);
+
+        vec3 p[3];
+        vec3 uv[3];
+
+        for (int i = 0; i < 3; i++) {
+            const auto vtx = ctxt.getVertex(param.idx[i]);
+            p[i] = mtxL2W.apply(vec3(vtx.pos.x, vtx.pos.y, vtx.pos.z));
+            uv[i] = vec3(vtx.uv.x, vtx.uv.y, real(0));
+        }
+
+        const auto n = cross(p[1] - p[0], p[2] - p[0]);
+        const auto worldArea = length(n);
+        const auto uvArea = aten::abs(cross(uv[1] - uv[0], uv[2] - uv[0]).z);
+
+        if (worldArea <= real(0) || uvArea <= real(0)) {
+            return real(0);
+        }
+
+        // The footprint is elongated on the grazing surface.
+        const auto cosTheta = aten::abs(dot(n / worldArea, r.dir));
+        if (cosTheta <= real(0)) {
+            return real(0);
+        }
+
+        const auto coneWidth = spreadAngle * length(rec.p - r.org);
+
+        return coneWidth * aten::sqrt(uvArea / worldArea) / cosTheta;
+    }
+
+    // Angle between the rays through the adjacent pixels.
+    // The camera which needs the sampler (e.g. thin lens) is not supported, and the top mip level is sampled.
+    static real computePixelSpreadAngle(
+        camera* camera,
+        int width, int height)
+    {
+        if (!camera->isPinhole() || width <= 0 || height <= 0) {
+            return real(0);
+        }
+
+        const auto r0 = camera->sample(real(0.5), real(0.5), nullptr).r;
+        const auto r1 = camera->sample(real(0.5) + real(1) / width, real(0.5), nullptr).r;
+
+        const auto c = aten::clamp(dot(r0.dir, r1.dir), real(-1), real(1));
+
+        return aten::acos(c);
+    }
+
     PathTracing::Path PathTracing::radiance(
         const context& ctxt,
         sampler* sampler,
@@ -49,7 +121,18 @@ namespace aten
             Intersection isect;
 
             if (scene->hit(ctxt, path.ray, AT_MATH_EPSILON, AT_MATH_INF, path.rec, isect)) {
+                path.objid = isect.objid;
+
+                // Select the mip level of the textures at the primary hit.
+                if (depth == 0) {
+                    texture::setFootprint(computeTextureFootprint(ctxt, m_pixelSpreadAngle, path.ray, path.rec, isect));
+                }
+
                 willContinue = shade(ctxt, sampler, scene, cam, camsample, depth, path);
+
+                if (depth == 0) {
+                    texture::setFootprint(real(0));
+                }
             }
             else {
                 shadeMiss(scene, depth, path);
@@ -150,7 +233,11 @@ namespace aten
                     auto dist2 = aten::squared_length(path.rec.p - path.ray.org);
 
                     if (cosLight >= 0) {
-                        auto pdfLight = 1 / path.rec.area;
+                        // Probability that the explicit connection at the previous bounce selects this light.
+                        auto light = scene->findAreaLight(ctxt.getTransformable(path.objid));
+                        auto lightSelectPdf = scene->computeLightSelectPdf(light, path.prevPos, path.prevNml);
+
+                        auto pdfLight = lightSelectPdf / path.rec.area;
 
                         // Convert pdf area to sradian.
                         // http://www.slideshare.net/h013/edubpt-v100
@@ -236,9 +323,7 @@ namespace aten
                 auto shadowRayDir = normalize(tmp);
                 aten::ray shadowRay(shadowRayOrg, shadowRayDir);
 
-                hitrecord tmpRec;
-
-                if (scene->hitLight(ctxt, light, posLight, shadowRay, AT_MATH_EPSILON, AT_MATH_INF, tmpRec)) {
+                if (scene->hitLight(ctxt, light, posLight, shadowRay, AT_MATH_EPSILON, AT_MATH_INF)) {
                     // Shadow ray hits the light.
                     auto cosShadow = dot(orienting_normal, dirToLight);
 
@@ -257,7 +342,7 @@ namespace aten
                             // singular light の場合は、finalColor に距離の除算が含まれている.
                             // inifinite light の場合は、無限遠方になり、pdfLightに含まれる距離成分と打ち消しあう？.
                             // （打ち消しあうので、pdfLightには距離成分は含んでいない）.
-                            auto misW = pdfLight / (pdfb + pdfLight);
+                            auto misW = (pdfLight * lightSelectPdf) / (pdfb + pdfLight * lightSelectPdf);
                             path.contrib += (misW * bsdf * emit * cosShadow / pdfLight) / lightSelectPdf;
                         }
                     }
@@ -274,7 +359,8 @@ namespace aten
                                 // p31 - p35
                                 pdfb = pdfb * cosLight / dist2;
 
-                                auto misW = pdfLight / (pdfb + pdfLight);
+                                // Include the light selection pdf to match the implicit connection.
+                                auto misW = (pdfLight * lightSelectPdf) / (pdfb + pdfLight * lightSelectPdf);
 
                                 path.contrib += (misW * (bsdf * emit * G) / pdfLight) / lightSelectPdf;
                             }
@@ -297,9 +383,7 @@ namespace aten
                 vec3 dirToLight = normalize(sampleres.dir);
                 aten::ray shadowRay(path.rec.p, dirToLight);
 
-                hitrecord tmpRec;
-
-                if (scene->hitLight(ctxt, m_virtualLight, posLight, shadowRay, AT_MATH_EPSILON, AT_MATH_INF, tmpRec)) {
+                if (scene->hitLight(ctxt, m_virtualLight, posLight, shadowRay, AT_MATH_EPSILON, AT_MATH_INF)) {
                     auto cosShadow = dot(orienting_normal, dirToLight);
                     auto dist2 = squared_length(sampleres.dir);
                     auto dist = aten::sqrt(dist2);
@@ -380,6 +464,9 @@ namespace aten
 
         path.pdfb = pdfb;
 
+        path.prevPos = path.rec.p;
+        path.prevNml = orienting_normal;
+
         // Make next ray.
         path.ray = aten::ray(path.rec.p, nextDir);
 
@@ -400,6 +487,8 @@ namespace aten
             }
             else {
                 auto pdfLight = ibl->samplePdf(path.ray);
+                pdfLight *= scene->computeLightSelectPdf(ibl, path.prevPos, path.prevNml);
+
                 auto misW = path.pdfb / (pdfLight + path.pdfb);
                 auto emit = ibl->getEnvMap()->sample(path.ray);
                 path.contrib += path.throughput * misW * emit;
@@ -413,6 +502,73 @@ namespace aten
 
     static uint32_t frame = 0;
 
+    bool PathTracing::renderSample(
+        const context& ctxt,
+        int x, int y,
+        int width, int height,
+        uint32_t sampleIdx,
+        uint32_t maxDepth,
+        scene* scene,
+        camera* camera,
+        vec3& contrib,
+        bool& isTerminate)
+    {
+        int pos = y * width + x;
+
+        auto scramble = aten::getRandom(pos) * 0x1fe3434f;
+
+        //XorShift rnd(scramble + t.milliSeconds);
+        //Halton rnd(scramble + t.milliSeconds);
+        //Sobol rnd;
+        //WangHash rnd(scramble + t.milliSeconds);
+#if 1
+        CMJ rnd;
+        rnd.init(m_frame, sampleIdx, scramble);
+#else
+        // Experimental
+        BlueNoiseSampler rnd;
+        for (auto tex : m_noisetex) {
+            rnd.registerNoiseTexture(tex);
+        }
+        rnd.init(x, y, m_frame, m_maxDepth, 1);
+#endif
+
+        real u = real(x + rnd.nextSample()) / real(width);
+        real v = real(y + rnd.nextSample()) / real(height);
+
+        auto camsample = camera->sample(u, v, &rnd);
+
+        auto ray = camsample.r;
+
+        auto path = radiance(
+            ctxt,
+            &rnd,
+            maxDepth,
+            ray,
+            camera,
+            camsample,
+            scene);
+
+        if (isInvalidColor(path.contrib)) {
+            AT_PRINTF("Invalid(%d/%d[%d])\n", x, y, sampleIdx);
+            isTerminate = false;
+            return false;
+        }
+
+        isTerminate = path.isTerminate;
+
+        auto pdfOnImageSensor = camsample.pdfOnImageSensor;
+        auto pdfOnLens = camsample.pdfOnLens;
+
+        auto s = camera->getSensitivity(
+            camsample.posOnImageSensor,
+            camsample.posOnLens);
+
+        contrib = path.contrib * s / (pdfOnImageSensor * pdfOnLens);
+
+        return true;
+    }
+
     void PathTracing::onRender(
         const context& ctxt,
         Destination& dst,
@@ -421,6 +577,9 @@ namespace aten
     {
         frame++;
 
+        // The sequence depends on the pass in the accumulator, so the resumed rendering is as same as the continuous one.
+        m_frame = dst.accumulator ? dst.accumulator->getFrameIndex() : getFrameSeed(frame);
+
         int width = dst.width;
         int height = dst.height;
         uint32_t samples = dst.sample;
@@ -433,6 +592,8 @@ namespace aten
             m_rrDepth = m_maxDepth - 1;
         }
 
+        m_pixelSpreadAngle = computePixelSpreadAngle(camera, width, height);
+
 #ifdef Deterministic_Path_Termination
         // For DeterministicPathTermination.
         std::vector<uint32_t> depths;
@@ -446,108 +607,223 @@ namespace aten
         auto time = timer::getSystemTime();
 
 #if defined(ENABLE_OMP) && !defined(RELEASE_DEBUG)
-#pragma omp parallel
+        const int threadNum = 0;
+#else
+        const int threadNum = 1;
 #endif
-        {
-            auto idx = OMPUtil::getThreadIdx();
 
-            auto t = timer::getSystemTime();
+        auto accum = dst.accumulator;
 
-#if defined(ENABLE_OMP) && !defined(RELEASE_DEBUG)
-#pragma omp for
-#endif
-            for (int y = 0; y < height; y++) {
-                for (int x = 0; x < width; x++) {
-                    int pos = y * width + x;
+        if (dst.adaptive.enable) {
+            if (accum) {
+                // The sample count per pixel varies, so the samples can't be accumulated per pass.
+                AT_PRINTF("Adaptive sampling doesn't support the accumulator. Render with the fixed sample count\n");
+            }
+            else {
+                renderAdaptively(ctxt, dst, scene, camera, threadNum);
+                return;
+            }
+        }
+
+        renderTiles(
+            width, height,
+            [&](int x, int y, int threadIdx) {
+            if (accum && !accum->isAssigned(x, y)) {
+                return;
+            }
 
-                    vec3 col = vec3(0);
-                    vec3 col2 = vec3(0);
-                    uint32_t cnt = 0;
+            vec3 col = vec3(0);
+            vec3 col2 = vec3(0);
+            uint32_t cnt = 0;
+            uint32_t sampleNum = 0;
 
 #ifdef RELEASE_DEBUG
-                    if (x == BREAK_X && y == BREAK_Y) {
-                        DEBUG_BREAK();
-                    }
+            if (x == BREAK_X && y == BREAK_Y) {
+                DEBUG_BREAK();
+            }
 #endif
 
-                    for (uint32_t i = 0; i < samples; i++) {
-                        auto scramble = aten::getRandom(pos) * 0x1fe3434f;
-
-                        //XorShift rnd(scramble + t.milliSeconds);
-                        //Halton rnd(scramble + t.milliSeconds);
-                        //Sobol rnd;
-                        //WangHash rnd(scramble + t.milliSeconds);
-#if 1
-                        CMJ rnd;
-                        rnd.init(frame, i, scramble);
+            for (uint32_t i = 0; i < samples; i++) {
+#ifdef Deterministic_Path_Termination
+                auto maxDepth = depths[i];
 #else
-                        // Experimental
-                        BlueNoiseSampler rnd;
-                        for (auto tex : m_noisetex) {
-                            rnd.registerNoiseTexture(tex);
-                        }
-                        rnd.init(x, y, frame, m_maxDepth, 1);
+                auto maxDepth = m_maxDepth;
 #endif
 
-                        real u = real(x + rnd.nextSample()) / real(width);
-                        real v = real(y + rnd.nextSample()) / real(height);
+                vec3 c;
+                bool isTerminate = false;
 
-                        auto camsample = camera->sample(u, v, &rnd);
+                if (renderSample(ctxt, x, y, width, height, i, maxDepth, scene, camera, c, isTerminate)) {
+                    col += c;
+                    col2 += c * c;
+                    cnt++;
+                }
 
-                        auto ray = camsample.r;
+                sampleNum++;
 
-#ifdef Deterministic_Path_Termination
-                        auto maxDepth = depths[i];
-                        auto path = radiance(
-                            &sampler,
-                            maxDepth,
-                            ray,
-                            camera,
-                            camsample,
-                            scene);
-#else
+                if (isTerminate) {
+                    break;
+                }
+            }
 
-                        auto path = radiance(
-                            ctxt,
-                            &rnd,
-                            ray, 
-                            camera,
-                            camsample,
-                            scene);
-#endif
+            if (accum) {
+                int pos = y * width + x;
 
-                        if (isInvalidColor(path.contrib)) {
-                            AT_PRINTF("Invalid(%d/%d[%d])\n", x, y, i);
-                            continue;
-                        }
+                accum->add(pos, col, col2, cnt, sampleNum);
 
-                        auto pdfOnImageSensor = camsample.pdfOnImageSensor;
-                        auto pdfOnLens = camsample.pdfOnLens;
+                dst.buffer->put(x, y, vec4(accum->getMean(pos), 1));
 
-                        auto s = camera->getSensitivity(
-                            camsample.posOnImageSensor,
-                            camsample.posOnLens);
+                if (dst.variance) {
+                    dst.variance->put(x, y, vec4(accum->getVariance(pos), real(1)));
+                }
 
-                        auto c = path.contrib * s / (pdfOnImageSensor * pdfOnLens);
+                return;
+            }
 
-                        col += c;
-                        col2 += c * c;
-                        cnt++;
+            col /= (real)cnt;
 
-                        if (path.isTerminate) {
-                            break;
-                        }
+            dst.buffer->put(x, y, vec4(col, 1));
+
+            if (dst.variance) {
+                col2 /= (real)cnt;
+                dst.variance->put(x, y, vec4(col2 - col * col, real(1)));
+            }
+        }, threadNum);
+
+        if (accum) {
+            accum->endPass();
+        }
+    }
+
+    void PathTracing::renderAdaptively(
+        const context& ctxt,
+        Destination& dst,
+        scene* scene,
+        camera* camera,
+        int threadNum)
+    {
+        // NOTE
+        // "sample" is treated as the average sample count per pixel, and the total sample count is the budget.
+        // At first, all pixels are sampled "minSample" times.
+        // And then, the pixels which are not converged yet are sampled "samplePerRound" times per round,
+        // until the budget is exhausted or all pixels converge.
+
+        const int width = dst.width;
+        const int height = dst.height;
+        const uint32_t pixelNum = width * height;
+
+        const auto& param = dst.adaptive;
+
+        const uint32_t maxSample = (param.maxSample > 0 ? param.maxSample : dst.sample * 4);
+        const uint32_t minSample = std::min(std::max(param.minSample, 1U), maxSample);
+        const uint32_t samplePerRound = std::max(param.samplePerRound, 1U);
+
+        const uint64_t budget = (uint64_t)pixelNum * dst.sample;
+
+        std::vector<vec3> sum(pixelNum);
+        std::vector<vec3> sum2(pixelNum);
+        std::vector<uint32_t> validCnt(pixelNum, 0);
+        std::vector<uint32_t> sampleCnt(pixelNum, 0);
+        std::vector<uint8_t> isActive(pixelNum, 1);
+
+        uint64_t usedSample = 0;
+        uint32_t roundSample = minSample;
+
+        for (;;) {
+            renderTiles(
+                width, height,
+                [&](int x, int y, int threadIdx) {
+                int pos = y * width + x;
+
+                if (!isActive[pos]) {
+                    return;
+                }
+
+                const auto num = std::min(roundSample, maxSample - sampleCnt[pos]);
+
+                for (uint32_t i = 0; i < num; i++) {
+                    vec3 c;
+                    bool isTerminate = false;
+
+                    if (renderSample(ctxt, x, y, width, height, sampleCnt[pos], m_maxDepth, scene, camera, c, isTerminate)) {
+                        sum[pos] += c;
+                        sum2[pos] += c * c;
+                        validCnt[pos]++;
+                    }
+
+                    sampleCnt[pos]++;
+
+                    if (isTerminate) {
+                        // The result never changes (e.g. the ray hits the light directly).
+                        isActive[pos] = 0;
+                        break;
                     }
+                }
+            }, threadNum);
+
+            // Estimate the relative error of the pixels, and stop sampling the converged pixels.
+            usedSample = 0;
+            uint32_t activeNum = 0;
 
-                    col /= (real)cnt;
+            for (uint32_t pos = 0; pos < pixelNum; pos++) {
+                usedSample += sampleCnt[pos];
+
+                if (!isActive[pos]) {
+                    continue;
+                }
 
-                    dst.buffer->put(x, y, vec4(col, 1));
+                const auto n = validCnt[pos];
 
-                    if (dst.variance) {
-                        col2 /= (real)cnt;
-                        dst.variance->put(x, y, vec4(col2 - col * col, real(1)));
+                if (sampleCnt[pos] >= maxSample) {
+                    isActive[pos] = 0;
+                }
+                else if (n >= minSample) {
+                    auto mean = sum[pos] / (real)n;
+                    auto var = sum2[pos] / (real)n - mean * mean;
+
+                    // Standard error of the mean relative to the luminance of the pixel.
+                    auto lum = color::luminance(mean);
+                    auto err = aten::sqrt(std::max(color::luminance(var), real(0)) / n);
+
+                    if (err <= param.threshold * std::max(lum, real(1e-3))) {
+                        isActive[pos] = 0;
                     }
                 }
+
+                activeNum += isActive[pos];
+            }
+
+            if (activeNum == 0 || usedSample >= budget) {
+                break;
+            }
+
+            // Distribute the remaining budget to the active pixels.
+            auto remaining = budget - usedSample;
+            roundSample = (uint32_t)std::min<uint64_t>(samplePerRound, remaining / activeNum);
+
+            if (roundSample == 0) {
+                break;
+            }
+        }
+
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                int pos = y * width + x;
+
+                const auto n = std::max(validCnt[pos], 1U);
+
+                auto col = sum[pos] / (real)n;
+
+                dst.buffer->put(x, y, vec4(col, 1));
+
+                if (dst.variance) {
+                    auto col2 = sum2[pos] / (real)n;
+                    dst.variance->put(x, y, vec4(col2 - col * col, real(1)));
+                }
+
+                if (param.sampleCount) {
+                    param.sampleCount->put(x, y, vec4(vec3((real)sampleCnt[pos]), real(1)));
+                }
             }
         }
     }
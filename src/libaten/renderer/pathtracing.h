@@ -44,6 +44,13 @@ namespace aten
             hitrecord rec;
             const material* prevMtrl{ nullptr };
 
+            // Object which the ray hits.
+            int objid{ -1 };
+
+            // Shading point and normal at the previous bounce to compute the light selection pdf.
+            vec3 prevPos;
+            vec3 prevNml;
+
             aten::ray ray;
 
             bool isTerminate{ false };
@@ -89,6 +96,33 @@ namespace aten
             int depth,
             Path& path);
 
+        /**
+         * @brief Trace one sample from the specified pixel.
+         * @param[out] contrib Contribution of the sample which is weighted by the camera sensitivity.
+         * @param[out] isTerminate Whether the pixel doesn't need more samples (e.g. the ray hits the light directly).
+         * @return If the sample is invalid, return false.
+         */
+        bool renderSample(
+            const context& ctxt,
+            int x, int y,
+            int width, int height,
+            uint32_t sampleIdx,
+            uint32_t maxDepth,
+            scene* scene,
+            camera* camera,
+            vec3& contrib,
+            bool& isTerminate);
+
+        /**
+         * @brief Render with adaptive sampling which spends the sample budget on the pixels which are not converged.
+         */
+        void renderAdaptively(
+            const context& ctxt,
+            Destination& dst,
+            scene* scene,
+            camera* camera,
+            int threadNum);
+
     protected:
         uint32_t m_maxDepth{ 1 };
 
@@ -97,6 +131,12 @@ namespace aten
 
         uint32_t m_startDepth{ 0 };
 
+        // Index of the pass to initialize the sampler.
+        uint32_t m_frame{ 0 };
+
+        // Angle between the rays through the adjacent pixels to compute the texture footprint at the primary hit.
+        real m_pixelSpreadAngle{ 0 };
+
         PointLight* m_virtualLight{ nullptr };
         vec3 m_lightDir;
 
@@ -6,6 +6,7 @@
 #include "misc/color.h"
 #include "misc/omputil.h"
 #include "misc/timer.h"
+#include "math/alias_table.h"
 
 namespace aten
 {
@@ -17,11 +18,9 @@ namespace aten
         int modify_time{ 0 };
         real value;
 
-        PrimarySample()
-        {
-            // TODO
-            value = aten::drand48();
-        }
+        // NOTE
+        // The value is initialized with the sampler of the chain, not to depend on the global random state.
+        PrimarySample() : value(real(0)) {}
     };
 
     // Kelemen MLTにおいて、パス生成に使う各種乱数はprimary spaceからもってくる.
@@ -34,7 +33,7 @@ namespace aten
         MLTSampler(sampler* rnd)
         {
             m_rnd = rnd;
-            u.resize(128);
+            expand(128);
         }
         ~MLTSampler() {}
 
@@ -49,6 +48,16 @@ namespace aten
         void clearStack();
 
     private:
+        void expand(size_t size)
+        {
+            auto cur = u.size();
+            u.resize(size);
+
+            for (size_t i = cur; i < size; i++) {
+                u[i].value = m_rnd->nextSample();
+            }
+        }
+
         inline real Mutate(const real x);
 
     public:
@@ -92,7 +101,7 @@ namespace aten
     {
         if (u.size() <= usedRandCoords) {
             // expand.
-            u.resize((uint32_t)(u.size() * 1.5));
+            expand((uint32_t)(u.size() * 1.5));
         }
 
         if (u[usedRandCoords].modify_time < globalTime) {
@@ -214,88 +223,93 @@ namespace aten
             m_rrDepth = m_maxDepth - 1;
         }
 
-        auto threadNum = OMPUtil::getThreadNum();
-
-        std::vector<std::vector<vec3>> acuumImage(threadNum);
+        // The paths are splatted to any pixels, so the image is shared by all chains.
+        m_film.init(width, height, isDeterministic());
 
         auto time = timer::getSystemTime();
+        auto seed = getFrameSeed(time.milliSeconds);
+
+        // たくさんパスを生成する.
+        // このパスからMLTで使う最初のパスを得る。(Markov Chain Monte Carloであった）.
+        // NOTE
+        // The seed paths are generated once in parallel and shared by all chains.
+        // Only the luminance is kept per seed path. The selected seed path is regenerated in the chain from its own random sequence,
+        // so the chain also starts from the primary samples of the seed path.
+        int bootstrapNum = dst.bootstrapNum > 0 ? (int)dst.bootstrapNum : width * height;
+        if (bootstrapNum <= 0) {
+            bootstrapNum = 1;
+        }
+
+        auto getSeedPathRandom = [&](int idx) {
+            return seed + idx * 0x9e3779b9;
+        };
+
+        auto genSeedPath = [&](MLTSampler& mlt) {
+            mlt.largeStep = 1;
+            mlt.init();
+
+            return genPath(ctxt, scene, &mlt, -1, -1, width, height, camera);
+        };
+
+        std::vector<real> seedI(bootstrapNum);
 
 #ifdef ENABLE_OMP
 #pragma omp parallel for
 #endif
-        for (int mi = 0; mi < mltNum; mi++) {
-            auto idx = OMPUtil::getThreadIdx();
-
-            auto& image = acuumImage[idx];
-            if (image.empty()) {
-                image.resize(width * height);
-                memset(&image[0], 0, sizeof(vec3) * width * height);
-            }
-
-            // TODO
-            // sobol や halton sequence はステップ数が多すぎてオーバーフローしてしまう...
-            //XorShift rnd(4 * mltNum + mi + 1 + time.milliSeconds);
-            CMJ rnd;
-            rnd.init(time.milliSeconds, mi, 4 * mltNum + mi + 1);
+        for (int i = 0; i < bootstrapNum; i++) {
+            XorShift rnd(getSeedPathRandom(i));
             MLTSampler mlt(&rnd);
 
-            // たくさんパスを生成する.
-            // このパスからMLTで使う最初のパスを得る。(Markov Chain Monte Carloであった）.
+            auto path = genSeedPath(mlt);
 
-            // 適当に多めの数.
-            int seedPathMax = width * height;
-            if (seedPathMax <= 0) {
-                seedPathMax = 1;
-            }
+            seedI[i] = isInvalidColor(path.contrib) ? real(0) : color::luminance(path.contrib);
+        }
 
-            std::vector<Path> seedPaths(seedPathMax);
+        // 最初のパスを求める.
+        // 輝度値に基づく重点サンプリングによって選んでいる.
+        AliasTable seedTable;
+        seedTable.build(seedI);
 
-            real sumI = 0.0;
-            mlt.largeStep = 1;
+        const real sumI = seedTable.getSum();
 
-            for (int i = 0; i < seedPathMax; i++) {
-                mlt.init();
+        if (sumI <= real(0)) {
+            // No path carries energy.
+            return;
+        }
 
-                // gen path.
-                seedPaths[i] = genPath(ctxt, scene, &mlt, -1, -1, width, height, camera);
-                const auto& sample = seedPaths[i];
+        const real b = sumI / bootstrapNum;
 
-                // まずは生成するだけなので、すべてacceptする.
-                mlt.globalTime++;
+#ifdef ENABLE_OMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+        for (int mi = 0; mi < mltNum; mi++) {
+            // TODO
+            // sobol や halton sequence はステップ数が多すぎてオーバーフローしてしまう...
+            //XorShift rnd(4 * mltNum + mi + 1 + time.milliSeconds);
+            CMJ rnd;
+            rnd.init(seed, mi, 4 * mltNum + mi + 1);
 
-                // 生成のみなのでスタックを空にする?
-                mlt.clearStack();
+            const auto selectedPath = seedTable.sample(rnd.nextSample());
 
-                // sum I.
-                sumI += color::luminance(sample.contrib);
-            }
+            // Restore the primary samples of the selected seed path, and mutate them with the sampler of the chain.
+            XorShift seedRnd(getSeedPathRandom(selectedPath));
+            MLTSampler mlt(&seedRnd);
 
-            // 最初のパスを求める.
-            // 輝度値に基づく重点サンプリングによって選んでいる.
-            int selecetdPath = 0;
-            {
-                auto cost = rnd.nextSample() * sumI;
-                real accumlatedImportance = 0;
+            Path oldPath = genSeedPath(mlt);
 
-                for (int i = 0; i < seedPathMax; i++) {
-                    const auto& path = seedPaths[i];
-                    accumlatedImportance += color::luminance(path.contrib);
+            // まずは生成するだけなので、すべてacceptする.
+            mlt.globalTime++;
 
-                    if (accumlatedImportance >= cost) {
-                        selecetdPath = i;
-                        break;
-                    }
-                }
-            }
+            // 生成のみなのでスタックを空にする?
+            mlt.clearStack();
+
+            mlt.m_rnd = &rnd;
 
-            const real b = sumI / seedPathMax;
             const real p_large = 0.5;
             const int M = mutation;
             int accept = 0;
             int reject = 0;
 
-            Path oldPath = seedPaths[selecetdPath];
-
             for (int i = 0; i < M; i++) {
                 mlt.largeStep = rnd.nextSample() < p_large ? 1 : 0;
 
@@ -309,16 +323,18 @@ namespace aten
 
                 real a = std::min(real(1.0), I / oldI);
 
-                const real newPath_W = (a + mlt.largeStep) / (I / b + p_large) / M;
-                const real oldPath_W = (real(1.0) - a) / (oldI / b + p_large) / M;
+                // NOTE
+                // Divided by M and mltNum in resolving the film.
+                const real newPath_W = (a + mlt.largeStep) / (I / b + p_large);
+                const real oldPath_W = (real(1.0) - a) / (oldI / b + p_large);
 
                 int newPos = newPath.y * width + newPath.x;
                 vec3 newV = newPath_W * newPath.contrib * newPath.weight;
-                image[newPos] += newV;
+                m_film.add(newPos, newV);
 
                 int oldPos = oldPath.y * width + oldPath.x;
                 vec3 oldV = oldPath_W * oldPath.contrib * oldPath.weight;
-                image[oldPos] += oldV;
+                m_film.add(oldPos, oldV);
 
                 auto r = rnd.nextSample();
 
@@ -351,11 +367,6 @@ namespace aten
             }
         }
 
-        for (uint32_t n = 0; n < threadNum; n++) {
-            auto& image = acuumImage[n];
-            for (int i = 0; i < width * height; i++) {
-                dst.buffer->add(i, vec4(image[i] / real(mltNum), real(1)));
-            }
-        }
+        m_film.resolve(dst.buffer, real(1) / ((real)mutation * mltNum));
     }
 }
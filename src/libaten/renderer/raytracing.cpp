@@ -72,9 +72,7 @@ namespace aten
 
                         aten::ray shadowRay(rec.p, dirToLight);
 
-                        hitrecord tmpRec;
-
-                        if (scene->hitLight(ctxt, light, sampleres.pos, shadowRay, AT_MATH_EPSILON, AT_MATH_INF, tmpRec)) {
+                        if (scene->hitLight(ctxt, light, sampleres.pos, shadowRay, AT_MATH_EPSILON, AT_MATH_INF)) {
                             auto lightColor = sampleres.finalColor;
 
                             if (light->isInfinite()) {
@@ -131,32 +129,24 @@ namespace aten
 
         uint32_t sample = 1;
 
-#ifdef ENABLE_OMP
-#pragma omp parallel
-#endif
-        {
-#ifdef ENABLE_OMP
-#pragma omp for
-#endif
-            for (int y = 0; y < height; y++) {
-                for (int x = 0; x < width; x++) {
-                    //if (x == 419 && y == 107) {
-                    //if (x == 408 && y == 112) {
-                    if (x == 378 && y == 480 - 355) {
-                        int xxx = 0;
-                    }
-                    int pos = y * width + x;
+        renderTiles(
+            width, height,
+            [&](int x, int y, int threadIdx) {
+            //if (x == 419 && y == 107) {
+            //if (x == 408 && y == 112) {
+            if (x == 378 && y == 480 - 355) {
+                int xxx = 0;
+            }
+            int pos = y * width + x;
 
-                    real u = (real(x) + real(0.5)) / real(width - 1);
-                    real v = (real(y) + real(0.5)) / real(height - 1);
+            real u = (real(x) + real(0.5)) / real(width - 1);
+            real v = (real(y) + real(0.5)) / real(height - 1);
 
-                    auto camsample = camera->sample(u, v, nullptr);
+            auto camsample = camera->sample(u, v, nullptr);
 
-                    auto col = radiance(ctxt, camsample.r, scene);
+            auto col = radiance(ctxt, camsample.r, scene);
 
-                    dst.buffer->put(x, y, vec4(col, 1));
-                }
-            }
-        }
+            dst.buffer->put(x, y, vec4(col, 1));
+        });
     }
 }
@@ -5,9 +5,12 @@
 #include "math/vec4.h"
 #include "renderer/background.h"
 #include "renderer/film.h"
+#include "renderer/accumulator.h"
+#include "renderer/tile_scheduler.h"
 #include "scene/context.h"
 #include "scene/scene.h"
 #include "camera/camera.h"
+#include "misc/omputil.h"
 
 namespace aten
 {
@@ -20,9 +23,16 @@ namespace aten
         uint32_t sample{ 1 };
         uint32_t mutation{ 1 };
         uint32_t mltNum{ 1 };
+        uint32_t bootstrapNum{ 0 };     ///< Count of the seed paths to start the chains of PSSMLT. If it is zero, width x height.
         Film* buffer{ nullptr };
         Film* variance{ nullptr };
 
+        /**
+         * If specified, the samples are accumulated over the passes and "buffer" and "variance" are resolved from all samples.
+         * "sample" is the sample count per pixel in one pass. Not supported with the adaptive sampling, which is ignored if both are specified.
+         */
+        Accumulator* accumulator{ nullptr };
+
         struct {
             Film* nml_depth{ nullptr };        ///< Normal and Depth / rgb : normal, a : depth
             Film* albedo_vis{ nullptr };    ///< Albedo and Visibility / rgb : albedo, a : visibility
@@ -30,6 +40,15 @@ namespace aten
             real depthMax{ 1 };
             bool needNormalize{ true };
         } geominfo;
+
+        struct {
+            bool enable{ false };           ///< If true, "sample" is treated as the average sample count per pixel.
+            uint32_t minSample{ 4 };        ///< Sample count per pixel before estimating the error.
+            uint32_t maxSample{ 0 };        ///< Max sample count per pixel. If it is zero, 4 times "sample".
+            uint32_t samplePerRound{ 4 };   ///< Sample count per pixel in one round.
+            real threshold{ real(0.01) };   ///< Relative error to stop sampling the pixel.
+            Film* sampleCount{ nullptr };   ///< Sample count per pixel / rgb : sample count
+        } adaptive;
     };
 
     class Renderer {
@@ -54,6 +73,45 @@ namespace aten
             m_bg = bg;
         }
 
+        void setTileSize(int tileSize)
+        {
+            m_tileSize = std::max(tileSize, 1);
+        }
+
+        void setTileOrder(TileScheduler::Order order)
+        {
+            m_tileOrder = order;
+        }
+
+        /**
+         * @brief Enable to measure the elapsed time per tile, and print the statistics after rendering.
+         */
+        void enableTileTiming(bool enable)
+        {
+            m_enableTileTiming = enable;
+        }
+
+        const TileScheduler& getTileScheduler() const
+        {
+            return m_tileScheduler;
+        }
+
+        /**
+         * @brief Make the result depend only on the seed, the pixel and the sample index.
+         * The result is bit-identical regardless of the count of the threads, the order of the tiles
+         * and the previous renderings. Otherwise, the sequences vary per rendering (e.g. with the time).
+         */
+        void setDeterministic(bool enable, uint32_t seed = 0)
+        {
+            m_isDeterministic = enable;
+            m_seed = seed;
+        }
+
+        bool isDeterministic() const
+        {
+            return m_isDeterministic;
+        }
+
     protected:
         virtual void onRender(
             const context& ctxt,
@@ -79,6 +137,45 @@ namespace aten
             return m_bg;
         }
 
+        /**
+         * @brief Process all pixels in parallel per tile.
+         * @param[in] func Function to process the pixel. The arguments are the pixel position and the index of the thread.
+         * @param[in] threadNum Count of the worker threads. If it is zero, use all threads.
+         */
+        void renderTiles(
+            int width, int height,
+            std::function<void(int, int, int)> func,
+            int threadNum = 0)
+        {
+            if (threadNum <= 0) {
+                threadNum = OMPUtil::getThreadNum();
+            }
+
+            m_tileScheduler.init(width, height, m_tileSize, m_tileOrder, threadNum);
+            m_tileScheduler.enableTiming(m_enableTileTiming);
+
+            m_tileScheduler.run([&](const Tile& tile, int threadIdx) {
+                for (int y = tile.y; y < tile.y + tile.height; y++) {
+                    for (int x = tile.x; x < tile.x + tile.width; x++) {
+                        func(x, y, threadIdx);
+                    }
+                }
+            });
+
+            if (m_enableTileTiming) {
+                m_tileScheduler.printStatistics();
+            }
+        }
+
+        /**
+         * @brief Return the seed to vary the sequences per rendering.
+         * @param[in] variable Seed which varies per rendering. This is used if not deterministic.
+         */
+        uint32_t getFrameSeed(uint32_t variable) const
+        {
+            return m_isDeterministic ? m_seed : variable;
+        }
+
         static inline bool isInvalidColor(const vec3& v)
         {
             bool b = isInvalid(v);
@@ -93,5 +190,13 @@ namespace aten
 
     private:
         background* m_bg{ nullptr };
+
+        bool m_isDeterministic{ false };
+        uint32_t m_seed{ 0 };
+
+        TileScheduler m_tileScheduler;
+        int m_tileSize{ 32 };
+        TileScheduler::Order m_tileOrder{ TileScheduler::Order::Morton };
+        bool m_enableTileTiming{ false };
     };
 }
@@ -1,21 +1,119 @@
+#include <algorithm>
+
 #include "renderer/sorted_pathtracing.h"
+#include "renderer/nonphotoreal.h"
 #include "misc/omputil.h"
 #include "misc/timer.h"
-#include "sampler/xorshift.h"
-#include "sampler/halton.h"
-#include "sampler/sobolproxy.h"
 
 namespace aten
 {
+    static uint32_t frame = 0;
+
+    // Interleave the lower 9 bits with two zeros.
+    static inline uint32_t separateBy2(uint32_t v)
+    {
+        v &= 0x000001ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+
+    static const uint32_t RadixBits = 10;
+
+    // Stable LSD radix sort by the specified count of bits above the lower 32 bit.
+    // The keys are short, so it is much faster than the comparison sort.
+    static void sortKeysByRadix(
+        std::vector<uint64_t>& keys,
+        std::vector<uint64_t>& work,
+        uint32_t keyBits)
+    {
+        const uint32_t num = (uint32_t)keys.size();
+
+        work.resize(num);
+
+        uint32_t counts[1 << RadixBits];
+
+        for (uint32_t shift = 0; shift < keyBits; shift += RadixBits) {
+            const uint32_t bits = std::min(RadixBits, keyBits - shift);
+            const uint32_t bucketNum = 1 << bits;
+            const uint32_t mask = bucketNum - 1;
+
+            std::fill(counts, counts + bucketNum, 0);
+
+            for (uint32_t i = 0; i < num; i++) {
+                counts[(keys[i] >> (32 + shift)) & mask]++;
+            }
+
+            uint32_t offset = 0;
+            for (uint32_t b = 0; b < bucketNum; b++) {
+                auto c = counts[b];
+                counts[b] = offset;
+                offset += c;
+            }
+
+            for (uint32_t i = 0; i < num; i++) {
+                work[counts[(keys[i] >> (32 + shift)) & mask]++] = keys[i];
+            }
+
+            keys.swap(work);
+        }
+    }
+
+    void SortedPathTracing::Paths::resize(uint32_t num)
+    {
+        contrib.resize(num);
+        throughput.resize(num);
+        pdfb.resize(num);
+
+        rays.resize(num);
+        recs.resize(num);
+        objids.resize(num);
+
+        prevMtrls.resize(num);
+        prevPos.resize(num);
+        prevNml.resize(num);
+
+        camWeights.resize(num);
+
+        samplers.resize(num);
+
+        isHit.resize(num);
+        isAlive.resize(num);
+        needWrite.resize(num);
+        isTerminate.resize(num);
+    }
+
+    void SortedPathTracing::ShadowRays::resize(uint32_t num)
+    {
+        rays.resize(num);
+        lights.resize(num);
+        lightPos.resize(num);
+        contrib.resize(num);
+        isActive.resize(num);
+    }
+
+    void SortedPathTracing::beginStage()
+    {
+        if (m_enableStageTiming) {
+            m_stageTimer.begin();
+        }
+    }
+
+    void SortedPathTracing::endStage(Stage stage)
+    {
+        if (m_enableStageTiming) {
+            m_stageTimes[stage] += m_stageTimer.end();
+        }
+    }
+
     void SortedPathTracing::makePaths(
         int width, int height,
-        int sample,
-        Path* paths,
-        ray* rays,
+        uint32_t sample,
         camera* camera)
     {
-
-        auto time = timer::getSystemTime();
+        auto& paths = m_paths;
 
 #ifdef ENABLE_OMP
 #pragma omp parallel for
@@ -24,204 +122,308 @@ namespace aten
             for (int x = 0; x < width; x++) {
                 uint32_t idx = y * width + x;
 
-                auto& path = paths[idx];
+                paths.isAlive[idx] = false;
+                paths.needWrite[idx] = false;
 
-                if (!path.isTerminate) {
-                    auto scramble = aten::getRandom(idx) * 0x1fe3434f;
+                if (paths.isTerminate[idx]) {
+                    continue;
+                }
 
-                    if (path.sampler) {
-                        path.sampler->init(scramble + time.milliSeconds);
-                        //path.sampler->init(scramble + time.milliSeconds);
-                    }
-                    else {
-                        path.sampler = new Sobol(scramble + time.milliSeconds);
-                        //path.sampler = new XorShift(scramble + time.milliSeconds);
-                    }
+                auto scramble = aten::getRandom(idx) * 0x1fe3434f;
 
-                    sampler* sampler = path.sampler;
+                auto& rnd = paths.samplers[idx];
+                rnd.init(getFrameSeed(frame), sample, scramble);
 
-                    real u = real(x + sampler->nextSample()) / real(width);
-                    real v = real(y + sampler->nextSample()) / real(height);
+                real u = real(x + rnd.nextSample()) / real(width);
+                real v = real(y + rnd.nextSample()) / real(height);
 
-                    path.camsample = camera->sample(u, v, sampler);
-                    path.camSensitivity = camera->getSensitivity(
-                        path.camsample.posOnImageSensor,
-                        path.camsample.posOnLens);
+                auto camsample = camera->sample(u, v, &rnd);
 
-                    rays[idx] = path.camsample.r;
+                auto s = camera->getSensitivity(
+                    camsample.posOnImageSensor,
+                    camsample.posOnLens);
 
-                    path.x = x;
-                    path.y = y;
+                paths.camWeights[idx] = s / (camsample.pdfOnImageSensor * camsample.pdfOnLens);
 
-                    path.isAlive = true;
-                    path.needWrite = true;
+                paths.rays[idx] = camsample.r;
 
-                    path.contrib = vec3(0);
-                    path.throughput = vec3(1);
-                }
+                paths.contrib[idx] = vec3(0);
+                paths.throughput[idx] = vec3(1);
+                paths.pdfb[idx] = real(1);
+                paths.prevMtrls[idx] = nullptr;
+                paths.objids[idx] = -1;
+
+                paths.isAlive[idx] = true;
+                paths.needWrite[idx] = true;
             }
         }
+
+        // Primary rays are already coherent in raster order.
+        m_activeQueue.clear();
+
+        const uint32_t num = width * height;
+
+        for (uint32_t i = 0; i < num; i++) {
+            if (paths.isAlive[i]) {
+                m_activeQueue.push_back(i);
+            }
+        }
+    }
+
+    void SortedPathTracing::sortRays()
+    {
+        // NOTE
+        // Sort by the octant of the direction and then by the Morton code of the origin.
+        // The rays which start from the near points to the similar direction visit the similar nodes.
+
+        const auto& rays = m_paths.rays;
+        const int num = (int)m_activeQueue.size();
+
+        if (num <= 1) {
+            return;
+        }
+
+        vec3 boxmin = rays[m_activeQueue[0]].org;
+        vec3 boxmax = boxmin;
+
+        for (int i = 1; i < num; i++) {
+            const auto& org = rays[m_activeQueue[i]].org;
+            boxmin = aten::min(boxmin, org);
+            boxmax = aten::max(boxmax, org);
+        }
+
+        const auto size = boxmax - boxmin;
+        const vec3 scale(
+            size.x > real(0) ? real(511) / size.x : real(0),
+            size.y > real(0) ? real(511) / size.y : real(0),
+            size.z > real(0) ? real(511) / size.z : real(0));
+
+        m_sortKeys.resize(num);
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+        for (int i = 0; i < num; i++) {
+            auto idx = m_activeQueue[i];
+            const auto& ray = rays[idx];
+
+            uint32_t octant = (ray.dir.x < real(0) ? 1 : 0)
+                | (ray.dir.y < real(0) ? 2 : 0)
+                | (ray.dir.z < real(0) ? 4 : 0);
+
+            auto p = (ray.org - boxmin) * scale;
+
+            uint32_t morton = separateBy2((uint32_t)p.x)
+                | (separateBy2((uint32_t)p.y) << 1)
+                | (separateBy2((uint32_t)p.z) << 2);
+
+            uint64_t key = (octant << 27) | morton;
+
+            m_sortKeys[i] = (key << 32) | idx;
+        }
+
+        // 3 bits of the octant and 27 bits of the Morton code.
+        sortKeysByRadix(m_sortKeys, m_sortWork, 30);
+
+        for (int i = 0; i < num; i++) {
+            m_activeQueue[i] = (uint32_t)(m_sortKeys[i] & 0xffffffff);
+        }
     }
 
     void SortedPathTracing::hitPaths(
-        Path* paths,
-        const ray* rays,
-        int numPath,
+        const context& ctxt,
         scene* scene)
     {
+        auto& paths = m_paths;
+        const int num = (int)m_activeQueue.size();
+
 #ifdef ENABLE_OMP
-#pragma omp parallel for
+#pragma omp parallel for schedule(dynamic, 64)
 #endif
-        for (int i = 0; i < numPath; i++) {
-            auto& path = paths[i];
-            const auto& ray = rays[i];
+        for (int i = 0; i < num; i++) {
+            auto idx = m_activeQueue[i];
 
-            path.isHit = false;
+            paths.recs[idx] = hitrecord();
 
-            if (path.isAlive) {
-                // 初期化.
-                path.rec = hitrecord();
-                path.ray = ray;
+            Intersection isect;
+            paths.isHit[idx] = scene->hit(ctxt, paths.rays[idx], AT_MATH_EPSILON, AT_MATH_INF, paths.recs[idx], isect);
 
-                Intersection isect;
-                path.isHit = scene->hit(ray, AT_MATH_EPSILON, AT_MATH_INF, path.rec, isect);
+            if (paths.isHit[idx]) {
+                paths.objids[idx] = isect.objid;
             }
         }
     }
 
-    int SortedPathTracing::compactionPaths(
-        Path* paths,
-        int numPath,
-        uint32_t* hitIds)
+    void SortedPathTracing::compactionPaths()
     {
-        int cnt = 0;
+        m_hitQueue.clear();
+        m_missQueue.clear();
 
-        for (int i = 0; i < numPath; i++) {
-            const auto& path = paths[i];
-            if (path.isAlive && path.isHit) {
-                hitIds[cnt++] = i;
+        // Keep the order of the active queue to keep the coherence.
+        for (auto idx : m_activeQueue) {
+            if (m_paths.isHit[idx]) {
+                m_hitQueue.push_back(idx);
+            }
+            else {
+                m_missQueue.push_back(idx);
             }
         }
-
-        return cnt;
     }
 
     void SortedPathTracing::shadeMiss(
         scene* scene,
-        int depth,
-        Path* paths,
-        int numPath,
-        vec4* dst)
+        int depth)
     {
+        auto& paths = m_paths;
+        const int num = (int)m_missQueue.size();
+
 #ifdef ENABLE_OMP
 #pragma omp parallel for
 #endif
-        for (int i = 0; i < numPath; i++) {
-            auto& path = paths[i];
+        for (int i = 0; i < num; i++) {
+            auto idx = m_missQueue[i];
 
-            if (path.isAlive && !path.isHit) {
-                PathTracing::shadeMiss(scene, depth, path);
+            PathTracing::Path path;
+            path.contrib = paths.contrib[idx];
+            path.throughput = paths.throughput[idx];
+            path.pdfb = paths.pdfb[idx];
+            path.prevPos = paths.prevPos[idx];
+            path.prevNml = paths.prevNml[idx];
+            path.ray = paths.rays[idx];
 
-                auto idx = path.y * m_width + path.x;
-                dst[idx] += path.camSensitivity * vec4(path.contrib, 1);
+            PathTracing::shadeMiss(scene, depth, path);
 
-                path.isAlive = false;
-                path.needWrite = false;
+            if (depth < (int)m_startDepth && !path.isTerminate) {
+                path.contrib = vec3(0);
             }
+
+            paths.contrib[idx] = path.contrib;
+            paths.isTerminate[idx] |= path.isTerminate;
+            paths.isAlive[idx] = false;
+        }
+    }
+
+    void SortedPathTracing::sortByMaterial()
+    {
+        const auto& recs = m_paths.recs;
+        const int num = (int)m_hitQueue.size();
+
+        m_sortKeys.resize(num);
+
+        uint32_t maxMtrlId = 0;
+
+        for (int i = 0; i < num; i++) {
+            auto idx = m_hitQueue[i];
+            uint64_t mtrlid = (uint32_t)recs[idx].mtrlid;
+            m_sortKeys[i] = (mtrlid << 32) | idx;
+
+            maxMtrlId = std::max(maxMtrlId, (uint32_t)mtrlid);
+        }
+
+        uint32_t keyBits = 0;
+        while (keyBits < 32 && (maxMtrlId >> keyBits) > 0) {
+            keyBits++;
+        }
+
+        // The sort is stable, so the paths with the same material keep the order of the sorted rays.
+        sortKeysByRadix(m_sortKeys, m_sortWork, keyBits);
+
+        for (int i = 0; i < num; i++) {
+            m_hitQueue[i] = (uint32_t)(m_sortKeys[i] & 0xffffffff);
         }
     }
 
     void SortedPathTracing::shade(
-        uint32_t sample,
+        const context& ctxt,
         uint32_t depth,
-        Path* paths,
-        ray* rays,
-        ShadowRay* shadowRays,
-        uint32_t* hitIds,
-        int numHit,
-        camera* cam,
         scene* scene)
     {
-        uint32_t rrDepth = m_rrDepth;
+        auto& paths = m_paths;
+        auto& shadowRays = m_shadowRays;
+
+        const uint32_t rrDepth = m_rrDepth;
+        const int num = (int)m_hitQueue.size();
 
 #ifdef ENABLE_OMP
-#pragma omp parallel for
+#pragma omp parallel for schedule(dynamic, 64)
 #endif
-        for (int i = 0; i < numHit; i++) {
-            auto idx = hitIds[i];
-
-            shadowRays[idx].isActive = false;
+        for (int i = 0; i < num; i++) {
+            auto idx = m_hitQueue[i];
 
-            auto& path = paths[idx];
+            shadowRays.isActive[idx] = false;
 
-            if (!path.isAlive) {
-                continue;
-            }
+            auto sampler = &paths.samplers[idx];
 
-            auto sampler = path.sampler;
-            bool willContinue = true;
+            const auto& rec = paths.recs[idx];
+            const auto& ray = paths.rays[idx];
+            auto& contrib = paths.contrib[idx];
+            auto& throughput = paths.throughput[idx];
 
-            uint32_t rrDepth = m_rrDepth;
+            auto mtrl = ctxt.getMaterial(rec.mtrlid);
 
-            // 交差位置の法線.
-            // 物体からのレイの入出を考慮.
-            vec3 orienting_normal = dot(path.rec.normal, path.ray.dir) < 0.0 ? path.rec.normal : -path.rec.normal;
+            bool isBackfacing = dot(rec.normal, -ray.dir) < real(0);
 
-            auto mtrl = material::getMaterial(path.rec.mtrlid);
+            vec3 orienting_normal = rec.normal;
 
-            // Apply normal map.
-            mtrl->applyNormalMap(orienting_normal, orienting_normal, path.rec.u, path.rec.v);
+            bool willContinue = true;
 
             // Implicit conection to light.
             if (mtrl->isEmissive()) {
-                if (depth == 0) {
-                    // Ray hits the light directly.
-                    path.contrib = mtrl->color();
-                    path.isTerminate = true;
-                    willContinue = false;
-                }
-                else if (path.prevMtrl && path.prevMtrl->isSingular()) {
-                    auto emit = mtrl->color();
-                    path.contrib += path.throughput * emit;
-                    willContinue = false;
-                }
-                else {
-                    auto cosLight = dot(orienting_normal, -path.ray.dir);
-                    auto dist2 = squared_length(path.rec.p - path.ray.org);
+                if (!isBackfacing) {
+                    real weight = 1.0f;
 
-                    if (cosLight >= 0) {
-                        auto pdfLight = 1 / path.rec.area;
+                    auto prevMtrl = paths.prevMtrls[idx];
 
-                        // Convert pdf area to sradian.
-                        // http://www.slideshare.net/h013/edubpt-v100
-                        // p31 - p35
-                        pdfLight = pdfLight * dist2 / cosLight;
+                    if (depth > 0 && !(prevMtrl && prevMtrl->isSingularOrTranslucent())) {
+                        auto cosLight = dot(orienting_normal, -ray.dir);
+                        auto dist2 = aten::squared_length(rec.p - ray.org);
 
-                        auto misW = path.pdfb / (pdfLight + path.pdfb);
+                        if (cosLight >= 0) {
+                            // Probability that the explicit connection at the previous bounce selects this light.
+                            auto light = scene->findAreaLight(ctxt.getTransformable(paths.objids[idx]));
+                            auto lightSelectPdf = scene->computeLightSelectPdf(light, paths.prevPos[idx], paths.prevNml[idx]);
 
-                        auto emit = mtrl->color();
+                            auto pdfLight = lightSelectPdf / rec.area;
 
-                        path.contrib += path.throughput * misW * emit;
+                            // Convert pdf area to sradian.
+                            pdfLight = pdfLight * dist2 / cosLight;
 
-                        // When ray hit the light, tracing will finish.
-                        willContinue = false;
+                            weight = paths.pdfb[idx] / (pdfLight + paths.pdfb[idx]);
+                        }
                     }
+
+                    contrib += throughput * weight * mtrl->color();
                 }
+
+                paths.isTerminate[idx] = true;
+                willContinue = false;
             }
+            else {
+                if (!mtrl->isTranslucent() && isBackfacing) {
+                    orienting_normal = -orienting_normal;
+                }
 
-            if (!willContinue) {
-                path.isAlive = false;
-                continue;
+                // Apply normal map.
+                mtrl->applyNormalMap(orienting_normal, orienting_normal, rec.u, rec.v);
+
+                // Non-Photo-Real.
+                if (mtrl->isNPR()) {
+                    contrib = shadeNPR(ctxt, mtrl, rec.p, orienting_normal, rec.u, rec.v, scene, sampler);
+                    paths.isTerminate[idx] = true;
+                    willContinue = false;
+                }
             }
 
             // Explicit conection to light.
-            if (!mtrl->isSingular())
+            // The shadow ray is traced in the next stage, and the contribution is added if the light is visible.
+            if (willContinue && !mtrl->isSingularOrTranslucent())
             {
                 real lightSelectPdf = 1;
                 LightSampleResult sampleres;
 
                 auto light = scene->sampleLight(
-                    path.rec.p,
+                    ctxt,
+                    rec.p,
                     orienting_normal,
                     sampler,
                     lightSelectPdf, sampleres);
@@ -231,34 +433,26 @@ namespace aten
                     const vec3& nmlLight = sampleres.nml;
                     real pdfLight = sampleres.pdf;
 
-                    auto lightobj = sampleres.obj;
-
                     vec3 dirToLight = normalize(sampleres.dir);
-                    shadowRays[idx] = ShadowRay(path.rec.p, dirToLight);
 
                     auto cosShadow = dot(orienting_normal, dirToLight);
 
-                    auto bsdf = mtrl->bsdf(orienting_normal, path.ray.dir, dirToLight, path.rec.u, path.rec.v);
-                    auto pdfb = mtrl->pdf(orienting_normal, path.ray.dir, dirToLight, path.rec.u, path.rec.v);
+                    auto bsdf = mtrl->bsdf(orienting_normal, ray.dir, dirToLight, rec.u, rec.v);
+                    auto pdfb = mtrl->pdf(orienting_normal, ray.dir, dirToLight, rec.u, rec.v);
 
-                    bsdf *= path.throughput;
+                    bsdf *= throughput;
 
                     // Get light color.
                     auto emit = sampleres.finalColor;
 
-                    path.lightPos = posLight;
-                    path.targetLight = light;
-                    path.lightcontrib = vec3(0);
+                    vec3 lightContrib(0);
+                    bool isValid = false;
 
                     if (light->isSingular() || light->isInfinite()) {
-                        if (pdfLight > real(0)) {
-                            // TODO
-                            // ジオメトリタームの扱いについて.
-                            // singular light の場合は、finalColor に距離の除算が含まれている.
-                            // inifinite light の場合は、無限遠方になり、pdfLightに含まれる距離成分と打ち消しあう？.
-                            // （打ち消しあうので、pdfLightには距離成分は含んでいない）.
-                            auto misW = pdfLight / (pdfb + pdfLight);
-                            path.lightcontrib  = (misW * bsdf * emit * cosShadow / pdfLight) / lightSelectPdf;
+                        if (pdfLight > real(0) && cosShadow >= 0) {
+                            auto misW = (pdfLight * lightSelectPdf) / (pdfb + pdfLight * lightSelectPdf);
+                            lightContrib = (misW * bsdf * emit * cosShadow / pdfLight) / lightSelectPdf;
+                            isValid = true;
                         }
                     }
                     else {
@@ -270,29 +464,41 @@ namespace aten
 
                             if (pdfb > real(0) && pdfLight > real(0)) {
                                 // Convert pdf from steradian to area.
-                                // http://www.slideshare.net/h013/edubpt-v100
-                                // p31 - p35
                                 pdfb = pdfb * cosLight / dist2;
 
-                                auto misW = pdfLight / (pdfb + pdfLight);
+                                auto misW = (pdfLight * lightSelectPdf) / (pdfb + pdfLight * lightSelectPdf);
 
-                                path.lightcontrib = (misW * (bsdf * emit * G) / pdfLight) / lightSelectPdf;
+                                lightContrib = (misW * (bsdf * emit * G) / pdfLight) / lightSelectPdf;
+                                isValid = true;
                             }
                         }
                     }
+
+                    if (isValid) {
+                        auto shadowRayOrg = rec.p + AT_MATH_EPSILON * orienting_normal;
+                        auto tmp = rec.p + dirToLight - shadowRayOrg;
+                        auto shadowRayDir = normalize(tmp);
+
+                        shadowRays.rays[idx] = aten::ray(shadowRayOrg, shadowRayDir);
+                        shadowRays.lights[idx] = light;
+                        shadowRays.lightPos[idx] = posLight;
+                        shadowRays.contrib[idx] = lightContrib;
+                        shadowRays.isActive[idx] = true;
+                    }
                 }
             }
 
             real russianProb = real(1);
 
-            if (depth > rrDepth) {
-                auto t = normalize(path.throughput);
+            if (willContinue && depth > rrDepth) {
+                auto t = normalize(throughput);
                 auto p = std::max(t.r, std::max(t.g, t.b));
 
                 russianProb = sampler->nextSample();
 
                 if (russianProb >= p) {
-                    path.contrib = vec3();
+                    contrib = vec3();
+                    shadowRays.isActive[idx] = false;
                     willContinue = false;
                 }
                 else {
@@ -300,204 +506,233 @@ namespace aten
                 }
             }
 
-            auto sampling = mtrl->sample(path.ray, orienting_normal, path.rec.normal, sampler, path.rec.u, path.rec.v);
+            if (willContinue) {
+                auto sampling = mtrl->sample(ray, orienting_normal, rec.normal, sampler, rec.u, rec.v);
 
-            auto nextDir = normalize(sampling.dir);
-            auto pdfb = sampling.pdf;
-            auto bsdf = sampling.bsdf;
+                auto nextDir = normalize(sampling.dir);
+                auto pdfb = sampling.pdf;
+                auto bsdf = sampling.bsdf;
 
-            real c = 1;
-            if (!mtrl->isSingular()) {
-                // TODO
-                // AMDのはabsしているが....
-                //c = aten::abs(dot(orienting_normal, nextDir));
-                c = dot(orienting_normal, nextDir);
-            }
-
-            if (pdfb > 0 && c > 0) {
-                path.throughput *= bsdf * c / pdfb;
-                path.throughput /= russianProb;
-            }
-            else {
-                willContinue = false;
-            }
+                real c = 1;
+                if (!mtrl->isSingular()) {
+                    c = aten::abs(dot(orienting_normal, nextDir));
+                }
 
-            path.prevMtrl = mtrl;
+                if (pdfb > 0 && c > 0) {
+                    throughput *= bsdf * c / pdfb;
+                    throughput /= russianProb;
 
-            path.pdfb = pdfb;
+                    paths.prevMtrls[idx] = mtrl;
+                    paths.pdfb[idx] = pdfb;
+                    paths.prevPos[idx] = rec.p;
+                    paths.prevNml[idx] = orienting_normal;
 
-            // Make next ray.
-            rays[idx] = aten::ray(path.rec.p, nextDir);
+                    // Make next ray.
+                    paths.rays[idx] = aten::ray(rec.p, nextDir);
+                }
+                else {
+                    willContinue = false;
+                }
+            }
 
-            if (!willContinue) {
-                path.isAlive = false;
+            if (depth < m_startDepth && !paths.isTerminate[idx]) {
+                contrib = vec3(0);
+                shadowRays.isActive[idx] = false;
             }
+
+            paths.isAlive[idx] = willContinue;
         }
     }
 
     void SortedPathTracing::hitShadowRays(
-        const Path* paths,
-        ShadowRay* shadowrays,
-        int numRay,
+        const context& ctxt,
         scene* scene)
     {
+        auto& paths = m_paths;
+        auto& shadowRays = m_shadowRays;
+
+        // The shadow rays are traced in the material sorted order of the shading points.
+        const int num = (int)m_hitQueue.size();
+
 #ifdef ENABLE_OMP
-#pragma omp parallel for
+#pragma omp parallel for schedule(dynamic, 64)
 #endif
-        for (int i = 0; i < numRay; i++) {
-            auto& shadowRay = shadowrays[i];
-
-            if (shadowRay.isActive) {
-                const auto& path = paths[i];
-
-                hitrecord rec;
-                shadowRay.isActive = scene->hitLight(
-                    path.targetLight,
-                    path.lightPos,
-                    shadowRay,
-                    AT_MATH_EPSILON, AT_MATH_INF, rec);
+        for (int i = 0; i < num; i++) {
+            auto idx = m_hitQueue[i];
+
+            if (!shadowRays.isActive[idx]) {
+                continue;
             }
-        }
-    }
 
-    void SortedPathTracing::evalExplicitLight(
-        Path* paths,
-        const ShadowRay* shadowRays,
-        uint32_t* hitIds,
-        int numHit)
-    {
-#ifdef ENABLE_OMP
-#pragma omp parallel for
-#endif
-        for (int i = 0; i < numHit; i++) {
-            auto idx = hitIds[i];
+            if (scene->hitLight(
+                ctxt,
+                shadowRays.lights[idx],
+                shadowRays.lightPos[idx],
+                shadowRays.rays[idx],
+                AT_MATH_EPSILON, AT_MATH_INF))
+            {
+                paths.contrib[idx] += shadowRays.contrib[idx];
+            }
 
-            auto& path = paths[idx];
+            shadowRays.isActive[idx] = false;
+        }
 
-            const auto& shadowRay = shadowRays[idx];
+        // Alive paths go to the next bounce.
+        m_activeQueue.clear();
 
-            if (shadowRay.isActive) {
-                path.contrib += path.lightcontrib;
+        for (auto idx : m_hitQueue) {
+            if (paths.isAlive[idx]) {
+                m_activeQueue.push_back(idx);
             }
         }
     }
 
-    void SortedPathTracing::gather(
-        Path* paths,
-        int numPath,
-        vec4* dst)
+    void SortedPathTracing::gather(int width, int height)
     {
+        auto& paths = m_paths;
+
 #ifdef ENABLE_OMP
 #pragma omp parallel for
 #endif
-        for (int i = 0; i < numPath; i++) {
-            auto& path = paths[i];
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                uint32_t idx = y * width + x;
+
+                if (!paths.needWrite[idx]) {
+                    continue;
+                }
+
+                paths.needWrite[idx] = false;
+
+                if (isInvalidColor(paths.contrib[idx])) {
+                    AT_PRINTF("Invalid(%d/%d)\n", x, y);
+                    continue;
+                }
 
-            if (path.needWrite) {
-                dst[i] += path.camSensitivity * vec4(path.contrib, 1);
+                auto c = paths.contrib[idx] * paths.camWeights[idx];
 
-                path.needWrite = false;
+                m_tmpbuffer[idx] += vec4(c, 1);
+                m_tmpbuffer2[idx] += c * c;
             }
         }
     }
 
-    void SortedPathTracing::render(
+    void SortedPathTracing::onRender(
+        const context& ctxt,
         Destination& dst,
         scene* scene,
         camera* camera)
     {
-        m_width = dst.width;
-        m_height = dst.height;
+        frame++;
 
-        if (m_tmpbuffer.size() == 0) {
-            m_tmpbuffer.resize(m_width * m_height);
-        }
-        
-        vec4* color = &m_tmpbuffer[0];
-        memset(color, 0, m_tmpbuffer.size() * sizeof(vec4));
+        const int width = dst.width;
+        const int height = dst.height;
+        const uint32_t pixelNum = width * height;
 
-        m_samples = dst.sample;
         m_maxDepth = dst.maxDepth;
         m_rrDepth = dst.russianRouletteDepth;
+        m_startDepth = dst.startDepth;
 
         if (m_rrDepth > m_maxDepth) {
             m_rrDepth = m_maxDepth - 1;
         }
 
-        std::vector<Path> paths(m_width * m_height);
-        std::vector<ray> rays(m_width * m_height);
-        std::vector<ShadowRay> shadowRays(m_width * m_height);
-        std::vector<uint32_t> hitIds(m_width * m_height);
+        m_paths.resize(pixelNum);
+        m_shadowRays.resize(pixelNum);
+
+        m_tmpbuffer.resize(pixelNum);
+        m_tmpbuffer2.resize(pixelNum);
+
+        std::fill(m_tmpbuffer.begin(), m_tmpbuffer.end(), vec4(0));
+        std::fill(m_tmpbuffer2.begin(), m_tmpbuffer2.end(), vec3(0));
+        std::fill(m_paths.isTerminate.begin(), m_paths.isTerminate.end(), 0);
+        std::fill(m_shadowRays.isActive.begin(), m_shadowRays.isActive.end(), 0);
+
+        for (auto& t : m_stageTimes) {
+            t = real(0);
+        }
 
-        for (uint32_t i = 0; i < m_samples; i++) {
-            makePaths(
-                m_width, m_height, i,
-                &paths[0],
-                &rays[0],
-                camera);
+        for (uint32_t i = 0; i < dst.sample; i++) {
+            beginStage();
+            makePaths(width, height, i, camera);
+            endStage(Stage::Generate);
 
             uint32_t depth = 0;
 
-            while (depth < m_maxDepth) {
-                hitPaths(
-                    &paths[0],
-                    &rays[0],
-                    (int)paths.size(),
-                    scene);
+            while (depth < m_maxDepth && !m_activeQueue.empty()) {
+                if (m_enableRaySort && depth > 0) {
+                    beginStage();
+                    sortRays();
+                    endStage(Stage::SortRay);
+                }
 
-                auto numHit = compactionPaths(
-                    &paths[0],
-                    (int)paths.size(),
-                    &hitIds[0]);
+                beginStage();
+                hitPaths(ctxt, scene);
+                compactionPaths();
+                endStage(Stage::Intersect);
 
-                shadeMiss(
-                    scene, depth,
-                    &paths[0], (int)paths.size(), color);
+                beginStage();
+                shadeMiss(scene, depth);
+                endStage(Stage::ShadeMiss);
 
-                if (numHit == 0) {
+                if (m_hitQueue.empty()) {
                     break;
                 }
 
-                shade(
-                    i,
-                    depth,
-                    &paths[0],
-                    &rays[0],
-                    &shadowRays[0],
-                    &hitIds[0],
-                    numHit,
-                    camera,
-                    scene);
-
-                hitShadowRays(&paths[0], &shadowRays[0], shadowRays.size(), scene);
-
-                evalExplicitLight(
-                    &paths[0],
-                    &shadowRays[0],
-                    &hitIds[0],
-                    numHit);
+                if (m_enableMaterialSort) {
+                    beginStage();
+                    sortByMaterial();
+                    endStage(Stage::SortMaterial);
+                }
+
+                beginStage();
+                shade(ctxt, depth, scene);
+                endStage(Stage::Shade);
+
+                beginStage();
+                hitShadowRays(ctxt, scene);
+                endStage(Stage::Shadow);
 
                 depth++;
             }
 
-            gather(&paths[0], (int)paths.size(), color);
+            gather(width, height);
         }
 
 #ifdef ENABLE_OMP
 #pragma omp parallel for
 #endif
-        for (int y = 0; y < m_height; y++) {
-            for (int x = 0; x < m_width; x++) {
-                auto pos = y * m_width + x;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                auto pos = y * width + x;
 
-                auto& clr = color[pos];
+                const auto& sum = m_tmpbuffer[pos];
+                const auto n = std::max(sum.w, real(1));
 
-                clr.r /= clr.w;
-                clr.g /= clr.w;
-                clr.b /= clr.w;
-                clr.w = 1;
+                auto col = vec3(sum.x, sum.y, sum.z) / n;
+
+                dst.buffer->put(x, y, vec4(col, 1));
+
+                if (dst.variance) {
+                    auto col2 = m_tmpbuffer2[pos] / n;
+                    dst.variance->put(x, y, vec4(col2 - col * col, real(1)));
+                }
+            }
+        }
 
-                dst.buffer->put(x, y, clr);
+        if (m_enableStageTiming) {
+            static const char* names[] = {
+                "Generate",
+                "SortRay",
+                "Intersect",
+                "ShadeMiss",
+                "SortMaterial",
+                "Shade",
+                "Shadow",
+            };
+
+            for (int i = 0; i < Stage::Num; i++) {
+                AT_PRINTF("%s : %.3f[ms]\n", names[i], m_stageTimes[i]);
             }
         }
     }
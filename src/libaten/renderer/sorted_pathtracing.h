@@ -1,124 +1,182 @@
 #pragma once
 
 #include "renderer/pathtracing.h"
+#include "sampler/cmj.h"
+#include "misc/timer.h"
 #include "math/vec4.h"
 
 namespace aten
 {
+    /**
+     * @brief Wavefront path tracer.
+     * All paths of one sample per pixel are processed together stage by stage (generate, intersect, shade, shadow),
+     * and each stage runs in parallel over the queue of the paths.
+     * Before intersecting, the rays are sorted by the direction and the origin to traverse the acceleration structure coherently.
+     * Before shading, the hit paths are sorted by the material to evaluate the same material successively.
+     */
     class SortedPathTracing : public PathTracing {
     public:
         SortedPathTracing() {}
         ~SortedPathTracing() {}
 
-        virtual void render(
+        /**
+         * @brief Stages of the wavefront.
+         */
+        enum Stage {
+            Generate,
+            SortRay,
+            Intersect,
+            ShadeMiss,
+            SortMaterial,
+            Shade,
+            Shadow,
+            Num,
+        };
+
+        /**
+         * @brief Enable to sort the rays by the direction and the origin before intersecting.
+         */
+        void enableRaySort(bool enable)
+        {
+            m_enableRaySort = enable;
+        }
+
+        /**
+         * @brief Enable to sort the hit paths by the material before shading.
+         */
+        void enableMaterialSort(bool enable)
+        {
+            m_enableMaterialSort = enable;
+        }
+
+        /**
+         * @brief Enable to measure the elapsed time per stage, and print them after rendering.
+         */
+        void enableStageTiming(bool enable)
+        {
+            m_enableStageTiming = enable;
+        }
+
+        /**
+         * @brief Return the elapsed time [ms] of the specified stage in the last rendering.
+         */
+        real getStageTime(Stage stage) const
+        {
+            return m_stageTimes[stage];
+        }
+
+    protected:
+        virtual void onRender(
+            const context& ctxt,
             Destination& dst,
             scene* scene,
             camera* camera) override final;
 
     private:
-        struct Path : public PathTracing::Path {
-            CameraSampleResult camsample;
-            real camSensitivity;
-
-            uint32_t x, y;
-            aten::sampler* sampler{ nullptr };
-
-            vec3 lightcontrib;
-            vec3 lightPos;
-            Light* targetLight;
-            
-            struct {
-                uint32_t isHit        : 1;
-                uint32_t isAlive    : 1;
-                uint32_t needWrite    : 1;
-            };
-
-            Path()
-            {
-                isHit = false;
-                isAlive = true;
-                needWrite = true;
-            }
+        // Path states as structure of arrays. All arrays are indexed by the pixel.
+        struct Paths {
+            std::vector<vec3> contrib;
+            std::vector<vec3> throughput;
+            std::vector<real> pdfb;
+
+            std::vector<aten::ray> rays;
+            std::vector<hitrecord> recs;
+            std::vector<int> objids;
+
+            std::vector<const material*> prevMtrls;
+            std::vector<vec3> prevPos;
+            std::vector<vec3> prevNml;
+
+            // Camera sensitivity divided by the pdf of the camera sample.
+            std::vector<real> camWeights;
+
+            std::vector<CMJ> samplers;
+
+            std::vector<uint8_t> isHit;
+            std::vector<uint8_t> isAlive;
+
+            // Whether the contribution of the current sample needs to be written.
+            std::vector<uint8_t> needWrite;
+
+            // Whether the pixel doesn't need more samples.
+            std::vector<uint8_t> isTerminate;
+
+            void resize(uint32_t num);
         };
 
-        struct ShadowRay : aten::ray {
-            ShadowRay() : ray()
-            {
-                isActive = true;
-            }
-            ShadowRay(const vec3& o, const vec3& d) : ray(o, d)
-            {
-                isActive = true;
-            }
-
-            struct {
-                uint32_t isActive : 1;
-            };
+        // Shadow rays as structure of arrays. All arrays are indexed by the pixel.
+        struct ShadowRays {
+            std::vector<aten::ray> rays;
+            std::vector<const Light*> lights;
+            std::vector<vec3> lightPos;
+
+            // Contribution which is added if the shadow ray reaches the light.
+            std::vector<vec3> contrib;
+
+            std::vector<uint8_t> isActive;
+
+            void resize(uint32_t num);
         };
 
         void makePaths(
             int width, int height,
-            int sample,
-            Path* paths,
-            ray* rays,
+            uint32_t sample,
             camera* camera);
 
+        void sortRays();
+
         void hitPaths(
-            Path* paths,
-            const ray* rays,
-            int numPath,
+            const context& ctxt,
             scene* scene);
 
-        int compactionPaths(
-            Path* paths,
-            int numPath,
-            uint32_t* hitIds);
+        void compactionPaths();
 
         void shadeMiss(
             scene* scene,
-            int depth,
-            Path* paths,
-            int numPath,
-            vec4* dst);
+            int depth);
+
+        void sortByMaterial();
 
         void shade(
-            uint32_t sample,
+            const context& ctxt,
             uint32_t depth,
-            Path* paths,
-            ray* rays,
-            ShadowRay* shadowRays,
-            uint32_t* hitIds,
-            int numHit,
-            camera* cam,
             scene* scene);
 
         void hitShadowRays(
-            const Path* paths,
-            ShadowRay* shadowrays,
-            int numRay,
+            const context& ctxt,
             scene* scene);
 
-        void evalExplicitLight(
-            Path* paths,
-            const ShadowRay* shadowRays,
-            uint32_t* hitIds,
-            int numHit);
+        void gather(int width, int height);
 
-        void gather(
-            Path* paths,
-            int numPath,
-            vec4* dst);
+        void beginStage();
+        void endStage(Stage stage);
 
     private:
-        uint32_t m_maxDepth{ 1 };
+        Paths m_paths;
+        ShadowRays m_shadowRays;
+
+        // Queue of the alive paths.
+        std::vector<uint32_t> m_activeQueue;
 
-        // Depth to compute russinan roulette.
-        uint32_t m_rrDepth{ 1 };
+        // Queues of the paths which hit or miss the objects.
+        std::vector<uint32_t> m_hitQueue;
+        std::vector<uint32_t> m_missQueue;
 
-        uint32_t m_samples{ 1 };
+        // Sort keys with the path index in the lower 32 bit.
+        std::vector<uint64_t> m_sortKeys;
+        std::vector<uint64_t> m_sortWork;
 
+        // Accumulated contribution / rgb : sum, a : sample count.
         std::vector<vec4> m_tmpbuffer;
-        int m_width{ 0 };
-        int m_height{ 0 };
+
+        // Accumulated squared contribution to compute the variance.
+        std::vector<vec3> m_tmpbuffer2;
+
+        bool m_enableRaySort{ true };
+        bool m_enableMaterialSort{ true };
+
+        bool m_enableStageTiming{ false };
+        timer m_stageTimer;
+        real m_stageTimes[Stage::Num]{};
     };
 }
@@ -0,0 +1,121 @@
+#include <math.h>
+#include "renderer/splat_film.h"
+#include "misc/omputil.h"
+
+namespace aten
+{
+    // NOTE
+    // In the deterministic mode, the values are accumulated as the 64bit fixed point integers.
+    // The integer addition is associative, so the sum doesn't depend on the order of the accumulation among the threads.
+    static const int FixedPointFracBits = 28;
+    static const double FixedPointScale = (double)(1LL << FixedPointFracBits);
+
+    static inline int64_t toFixedPoint(real v)
+    {
+        return (int64_t)llround((double)v * FixedPointScale);
+    }
+
+    static inline real fromFixedPoint(int64_t v)
+    {
+        return (real)((double)v / FixedPointScale);
+    }
+
+    void SplatFilm::init(int w, int h, bool isDeterministic)
+    {
+        bool isAllocated = (m_width == w && m_height == h && m_isDeterministic == isDeterministic);
+
+        m_width = w;
+        m_height = h;
+        m_isDeterministic = isDeterministic;
+
+        if (!isAllocated) {
+            const auto num = m_width * m_height * 3;
+
+            if (m_isDeterministic) {
+                m_fixedValues.reset(new std::atomic<int64_t>[num]);
+                m_values.reset();
+            }
+            else {
+                m_values.reset(new std::atomic<real>[num]);
+                m_fixedValues.reset();
+            }
+        }
+
+        clear();
+    }
+
+    void SplatFilm::clear()
+    {
+        const auto num = m_width * m_height * 3;
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+        for (int i = 0; i < num; i++) {
+            if (m_isDeterministic) {
+                m_fixedValues[i].store(0, std::memory_order_relaxed);
+            }
+            else {
+                m_values[i].store(real(0), std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void SplatFilm::add(int pos, const vec3& v)
+    {
+        AT_ASSERT(0 <= pos && pos < m_width * m_height);
+
+        const auto idx = pos * 3;
+
+        for (int i = 0; i < 3; i++) {
+            if (v[i] == real(0)) {
+                continue;
+            }
+
+            if (m_isDeterministic) {
+                m_fixedValues[idx + i].fetch_add(toFixedPoint(v[i]), std::memory_order_relaxed);
+            }
+            else {
+                // NOTE
+                // fetch_add for the floating point atomic is not available before C++20.
+                auto& dst = m_values[idx + i];
+                auto cur = dst.load(std::memory_order_relaxed);
+                while (!dst.compare_exchange_weak(cur, cur + v[i], std::memory_order_relaxed)) {}
+            }
+        }
+    }
+
+    vec3 SplatFilm::get(int pos) const
+    {
+        const auto idx = pos * 3;
+
+        vec3 ret;
+
+        for (int i = 0; i < 3; i++) {
+            if (m_isDeterministic) {
+                ret[i] = fromFixedPoint(m_fixedValues[idx + i].load(std::memory_order_relaxed));
+            }
+            else {
+                ret[i] = m_values[idx + i].load(std::memory_order_relaxed);
+            }
+        }
+
+        return ret;
+    }
+
+    void SplatFilm::resolve(Film* dst, real scale) const
+    {
+        AT_ASSERT(dst->width() == m_width);
+        AT_ASSERT(dst->height() == m_height);
+
+        const auto num = m_width * m_height;
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+        for (int i = 0; i < num; i++) {
+            auto v = get(i) * scale;
+            dst->add(i, vec4(v, 1));
+        }
+    }
+}
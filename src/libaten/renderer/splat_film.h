@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include "types.h"
+#include "math/vec3.h"
+#include "math/vec4.h"
+#include "renderer/film.h"
+
+namespace aten
+{
+    /**
+     * @brief Film which is shared by all threads to splat the contributions to any pixels.
+     * The contributions are accumulated with the atomic operations, so the memory doesn't depend on the count of the threads.
+     * In the deterministic mode, the contributions are accumulated as the fixed point integers,
+     * so the result doesn't depend on the order of the accumulation.
+     */
+    class SplatFilm {
+    public:
+        SplatFilm() {}
+        ~SplatFilm() {}
+
+        SplatFilm(const SplatFilm& rhs) = delete;
+        const SplatFilm& operator=(const SplatFilm& rhs) = delete;
+
+    public:
+        /**
+         * @brief Allocate the film and clear it.
+         * The memory is kept if the size and the mode are not changed.
+         */
+        void init(int w, int h, bool isDeterministic);
+
+        void clear();
+
+        /**
+         * @brief Add the contribution to the pixel. This is thread safe.
+         * In the deterministic mode, the value has to be in [-2^34, 2^34] per channel.
+         */
+        void add(int x, int y, const vec3& v)
+        {
+            add(y * m_width + x, v);
+        }
+
+        void add(int pos, const vec3& v);
+
+        vec3 get(int pos) const;
+
+        /**
+         * @brief Add the accumulated values to the film (Film::add) in parallel.
+         * @param[in] scale Scale which is multiplied to the accumulated values.
+         */
+        void resolve(Film* dst, real scale) const;
+
+        uint32_t width() const
+        {
+            return m_width;
+        }
+
+        uint32_t height() const
+        {
+            return m_height;
+        }
+
+    private:
+        int m_width{ 0 };
+        int m_height{ 0 };
+
+        bool m_isDeterministic{ false };
+
+        // rgb per pixel.
+        std::unique_ptr<std::atomic<real>[]> m_values;
+        std::unique_ptr<std::atomic<int64_t>[]> m_fixedValues;
+    };
+}
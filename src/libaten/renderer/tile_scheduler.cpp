@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <cmath>
+
+#include "renderer/tile_scheduler.h"
+#include "misc/omputil.h"
+#include "math/math.h"
+#include "misc/timer.h"
+
+namespace aten
+{
+    // Interleave the lower 16 bits with zero.
+    static inline uint32_t separateBy1(uint32_t v)
+    {
+        v &= 0x0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    }
+
+    static inline uint32_t computeMortonCode(uint32_t x, uint32_t y)
+    {
+        return separateBy1(x) | (separateBy1(y) << 1);
+    }
+
+    void TileScheduler::init(
+        int width, int height,
+        int tileSize,
+        Order order,
+        int threadNum)
+    {
+        AT_ASSERT(width > 0 && height > 0);
+
+        tileSize = std::max(tileSize, 1);
+        threadNum = std::max(threadNum, 1);
+
+        const int tileNumX = (width + tileSize - 1) / tileSize;
+        const int tileNumY = (height + tileSize - 1) / tileSize;
+
+        m_tiles.clear();
+        m_tiles.reserve(tileNumX * tileNumY);
+
+        for (int ty = 0; ty < tileNumY; ty++) {
+            for (int tx = 0; tx < tileNumX; tx++) {
+                Tile tile;
+                tile.x = tx * tileSize;
+                tile.y = ty * tileSize;
+                tile.width = std::min(tileSize, width - tile.x);
+                tile.height = std::min(tileSize, height - tile.y);
+                tile.idx = (uint32_t)m_tiles.size();
+
+                m_tiles.push_back(tile);
+            }
+        }
+
+        // Sort the tiles in the specified order.
+        std::vector<uint32_t> sorted(m_tiles.size());
+        for (uint32_t i = 0; i < (uint32_t)sorted.size(); i++) {
+            sorted[i] = i;
+        }
+
+        if (order == Order::Morton) {
+            std::vector<uint32_t> codes(m_tiles.size());
+            for (uint32_t i = 0; i < (uint32_t)codes.size(); i++) {
+                codes[i] = computeMortonCode(i % tileNumX, i / tileNumX);
+            }
+
+            std::sort(
+                sorted.begin(), sorted.end(),
+                [&](uint32_t a, uint32_t b) {
+                return codes[a] < codes[b];
+            });
+        }
+        else if (order == Order::Spiral) {
+            // Sort by the ring around the center tile, and then by the angle in the ring.
+            const real centerX = (tileNumX - 1) * real(0.5);
+            const real centerY = (tileNumY - 1) * real(0.5);
+
+            std::vector<std::pair<real, real>> keys(m_tiles.size());
+            for (uint32_t i = 0; i < (uint32_t)keys.size(); i++) {
+                const real dx = (i % tileNumX) - centerX;
+                const real dy = (i / tileNumX) - centerY;
+
+                keys[i].first = std::floor(std::max(aten::abs(dx), aten::abs(dy)));
+                keys[i].second = std::atan2(dy, dx);
+            }
+
+            std::sort(
+                sorted.begin(), sorted.end(),
+                [&](uint32_t a, uint32_t b) {
+                return keys[a] < keys[b];
+            });
+        }
+
+        // Distribute the contiguous ranges of the sorted tiles to the threads to keep the locality.
+        m_queues.clear();
+        for (int i = 0; i < threadNum; i++) {
+            m_queues.push_back(std::unique_ptr<TileQueue>(new TileQueue()));
+        }
+
+        const uint32_t tileNum = (uint32_t)sorted.size();
+
+        for (int i = 0; i < threadNum; i++) {
+            const auto start = (uint32_t)(((uint64_t)tileNum * i) / threadNum);
+            const auto end = (uint32_t)(((uint64_t)tileNum * (i + 1)) / threadNum);
+
+            m_queues[i]->tiles.assign(sorted.begin() + start, sorted.begin() + end);
+        }
+
+        m_tileTimes.clear();
+        m_tileTimes.resize(m_tiles.size());
+
+        m_threadStats.clear();
+        m_threadStats.resize(threadNum);
+    }
+
+    bool TileScheduler::next(int threadIdx, Tile& tile)
+    {
+        const int threadNum = (int)m_queues.size();
+
+        AT_ASSERT(threadIdx < threadNum);
+
+        // Take the tile from the front of the own queue.
+        {
+            auto& queue = *m_queues[threadIdx];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+
+            if (!queue.tiles.empty()) {
+                tile = m_tiles[queue.tiles.front()];
+                queue.tiles.pop_front();
+                return true;
+            }
+        }
+
+        // Steal the tile from the back of the other queue, which is far from the tile the owner processes now.
+        for (int i = 1; i < threadNum; i++) {
+            auto& queue = *m_queues[(threadIdx + i) % threadNum];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+
+            if (!queue.tiles.empty()) {
+                tile = m_tiles[queue.tiles.back()];
+                queue.tiles.pop_back();
+
+                m_threadStats[threadIdx].stolenTileNum++;
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void TileScheduler::run(std::function<void(const Tile&, int)> func)
+    {
+        const int threadNum = (int)m_queues.size();
+
+#ifdef ENABLE_OMP
+#pragma omp parallel num_threads(threadNum) if(threadNum > 1)
+#endif
+        {
+            const int threadIdx = OMPUtil::getThreadIdx();
+
+            auto& stats = m_threadStats[threadIdx];
+
+            Tile tile;
+
+            while (next(threadIdx, tile)) {
+                timer t;
+
+                if (m_enableTiming) {
+                    t.begin();
+                }
+
+                func(tile, threadIdx);
+
+                if (m_enableTiming) {
+                    auto elapsed = t.end();
+
+                    m_tileTimes[tile.idx].elapsed = elapsed;
+                    m_tileTimes[tile.idx].threadIdx = threadIdx;
+
+                    stats.elapsed += elapsed;
+                }
+
+                stats.tileNum++;
+            }
+        }
+    }
+
+    void TileScheduler::printStatistics() const
+    {
+        if (m_tiles.empty()) {
+            return;
+        }
+
+        real minTime = m_tileTimes[0].elapsed;
+        real maxTime = real(0);
+        real sumTime = real(0);
+
+        for (const auto& t : m_tileTimes) {
+            minTime = std::min(minTime, t.elapsed);
+            maxTime = std::max(maxTime, t.elapsed);
+            sumTime += t.elapsed;
+        }
+
+        AT_PRINTF("Tiles (%d) : min %.3f[ms] max %.3f[ms] avg %.3f[ms]\n",
+            (int)m_tiles.size(),
+            minTime, maxTime,
+            sumTime / m_tiles.size());
+
+        real maxThreadTime = real(0);
+
+        for (int i = 0; i < (int)m_threadStats.size(); i++) {
+            const auto& stats = m_threadStats[i];
+
+            AT_PRINTF("  Thread[%d] : %.3f[ms] tiles %d (stolen %d)\n",
+                i, stats.elapsed, stats.tileNum, stats.stolenTileNum);
+
+            maxThreadTime = std::max(maxThreadTime, stats.elapsed);
+        }
+
+        // Ratio of the slowest thread to the average. 1 is the ideal.
+        const real avgThreadTime = sumTime / m_threadStats.size();
+        if (avgThreadTime > real(0)) {
+            AT_PRINTF("  Imbalance : %.3f\n", maxThreadTime / avgThreadTime);
+        }
+    }
+
+    bool TileScheduler::exportTileTime(const char* path) const
+    {
+        FILE* fp = fopen(path, "wt");
+        if (!fp) {
+            AT_ASSERT(false);
+            return false;
+        }
+
+        fprintf(fp, "x,y,width,height,thread,ms\n");
+
+        for (uint32_t i = 0; i < (uint32_t)m_tiles.size(); i++) {
+            const auto& tile = m_tiles[i];
+            const auto& t = m_tileTimes[i];
+
+            fprintf(fp, "%d,%d,%d,%d,%d,%f\n",
+                tile.x, tile.y, tile.width, tile.height,
+                t.threadIdx, t.elapsed);
+        }
+
+        fclose(fp);
+
+        return true;
+    }
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+#include "types.h"
+
+namespace aten
+{
+    /**
+     * @brief Rectangle region of the screen which is rendered as one unit of the work.
+     */
+    struct Tile {
+        int x{ 0 };
+        int y{ 0 };
+        int width{ 0 };
+        int height{ 0 };
+
+        uint32_t idx{ 0 };  ///< Index of the tile in the screen (in raster order).
+    };
+
+    /**
+     * @brief Scheduler to distribute the tiles to the worker threads.
+     * Each thread has its own queue of the tiles.
+     * If the queue of a thread becomes empty, the thread steals the tile from the queues of the other threads.
+     */
+    class TileScheduler {
+    public:
+        /**
+         * @brief Order to process the tiles.
+         */
+        enum class Order {
+            Scanline,   ///< Raster order.
+            Morton,     ///< Z-order curve to keep the locality of the neighbouring tiles.
+            Spiral,     ///< From the center of the screen to the outside.
+        };
+
+        TileScheduler() {}
+        ~TileScheduler() {}
+
+        TileScheduler(const TileScheduler& rhs) = delete;
+        const TileScheduler& operator=(const TileScheduler& rhs) = delete;
+
+    public:
+        /**
+         * @brief Split the screen into the tiles and distribute them to the threads.
+         * @param[in] width Screen width.
+         * @param[in] height Screen height.
+         * @param[in] tileSize Width and height of the tile.
+         * @param[in] order Order to process the tiles.
+         * @param[in] threadNum Count of the worker threads.
+         */
+        void init(
+            int width, int height,
+            int tileSize,
+            Order order,
+            int threadNum);
+
+        /**
+         * @brief Get the next tile which the specified thread processes.
+         * @return If all tiles have been already processed, return false.
+         */
+        bool next(int threadIdx, Tile& tile);
+
+        /**
+         * @brief Process all tiles in parallel.
+         * @param[in] func Function to process the tile. The arguments are the tile and the index of the thread.
+         */
+        void run(std::function<void(const Tile&, int)> func);
+
+        void enableTiming(bool enable)
+        {
+            m_enableTiming = enable;
+        }
+
+        /**
+         * @brief Print the statistics of the elapsed time per tile and thread to see the load imbalance.
+         */
+        void printStatistics() const;
+
+        /**
+         * @brief Export the elapsed time per tile as csv (x, y, width, height, thread, milliseconds).
+         */
+        bool exportTileTime(const char* path) const;
+
+        uint32_t getTileNum() const
+        {
+            return (uint32_t)m_tiles.size();
+        }
+
+        const Tile& getTile(uint32_t idx) const
+        {
+            return m_tiles[idx];
+        }
+
+    private:
+        struct TileQueue {
+            std::mutex mutex;
+            std::deque<uint32_t> tiles;
+        };
+
+        struct TileTime {
+            real elapsed{ real(0) };
+            int threadIdx{ -1 };
+        };
+
+        struct ThreadStatistics {
+            real elapsed{ real(0) };
+            uint32_t tileNum{ 0 };
+            uint32_t stolenTileNum{ 0 };
+        };
+
+        std::vector<Tile> m_tiles;
+        std::vector<std::unique_ptr<TileQueue>> m_queues;
+
+        std::vector<TileTime> m_tileTimes;
+        std::vector<ThreadStatistics> m_threadStats;
+
+        bool m_enableTiming{ false };
+    };
+}
@@ -27,6 +27,12 @@ namespace aten {
     {
         return g_random;
     }
+
+    void setRandom(const std::vector<uint32_t>& random)
+    {
+        g_random = random;
+    }
+
     uint32_t getRandom(uint32_t idx)
     {
         return g_random[idx % g_random.size()];
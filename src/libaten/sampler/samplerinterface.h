@@ -35,6 +35,12 @@ namespace aten {
         bool needInitHalton = false);
 
     const std::vector<uint32_t>& getRandom();
+
+    /**
+     * @brief Replace the scramble table, e.g. to resume rendering with the same sequences.
+     */
+    void setRandom(const std::vector<uint32_t>& random);
+
     uint32_t getRandom(uint32_t idx);
 
     inline real drand48()
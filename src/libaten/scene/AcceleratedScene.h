@@ -44,6 +44,9 @@ namespace aten {
 
                 m_accel.build(ctxt, &m_tmp[0], (uint32_t)m_tmp.size(), &bbox);
             }
+
+            // Build the light hierarchy.
+            scene::build(ctxt);
         }
 
         virtual bool hit(
@@ -67,6 +70,14 @@ namespace aten {
             return isHit;
         }
 
+        virtual bool occluded(
+            const aten::context& ctxt,
+            const aten::ray& r,
+            real t_min, real t_max) const final
+        {
+            return m_accel.occluded(ctxt, r, t_min, t_max);
+        }
+
         ACCEL* getAccel()
         {
             return &m_accel;
@@ -2,22 +2,267 @@
 #include "geometry/face.h"
 #include "material/material_factory.h"
 #include "geometry/transformable.h"
+#include "math/half.h"
 
 namespace aten
 {
     const context* context::s_pinnedCtxt = nullptr;
 
+    context::~context()
+    {
+        for (auto block : m_triangleBlocks) {
+            delete[] block;
+        }
+        m_triangleBlocks.clear();
+        m_triangles.clear();
+    }
+
     void context::build()
     {
-        if (!m_vertices.empty()
+        if (m_vertexNum > 0
             && !m_vb.isInitialized())
         {
-            m_vb.init(
-                sizeof(vertex),
-                m_vertices.size(),
-                0,
-                &m_vertices[0]);
+            if (m_vertexFormat == VertexFormat::Full) {
+                m_vb.init(
+                    sizeof(vertex),
+                    m_vertices.size(),
+                    0,
+                    &m_vertices[0]);
+            }
+            else {
+                // The shaders expect aten::vertex, so decode the vertices only for uploading.
+                std::vector<vertex> vertices;
+                copyVertices(vertices);
+
+                m_vb.init(
+                    sizeof(vertex),
+                    vertices.size(),
+                    0,
+                    &vertices[0]);
+            }
+        }
+    }
+
+    static const uint32_t OctahedralMax = (1 << 15) - 1;
+
+    static inline real signNotZero(real v)
+    {
+        return v >= real(0) ? real(1) : real(-1);
+    }
+
+    // Encode the normal with the octahedral mapping, and store the flag of the texture coordinate (uv.z) in the lowest 2 bits.
+    static inline uint32_t encodeNormal(const vec3& n, real uvFlag)
+    {
+        real u = real(0);
+        real v = real(0);
+
+        const real l1 = aten::abs(n.x) + aten::abs(n.y) + aten::abs(n.z);
+
+        if (l1 > real(0)) {
+            u = n.x / l1;
+            v = n.y / l1;
+
+            if (n.z < real(0)) {
+                const real tu = (real(1) - aten::abs(v)) * signNotZero(u);
+                const real tv = (real(1) - aten::abs(u)) * signNotZero(v);
+                u = tu;
+                v = tv;
+            }
+        }
+
+        const auto qu = (uint32_t)(aten::clamp(u * real(0.5) + real(0.5), real(0), real(1)) * OctahedralMax + real(0.5));
+        const auto qv = (uint32_t)(aten::clamp(v * real(0.5) + real(0.5), real(0), real(1)) * OctahedralMax + real(0.5));
+
+        const uint32_t flag = uvFlag > real(0) ? 1 : (uvFlag < real(0) ? 2 : 0);
+
+        return (qu << 17) | (qv << 2) | flag;
+    }
+
+    static inline vec3 decodeNormal(uint32_t code)
+    {
+        real u = ((code >> 17) & OctahedralMax) / (real)OctahedralMax * real(2) - real(1);
+        real v = ((code >> 2) & OctahedralMax) / (real)OctahedralMax * real(2) - real(1);
+        const real z = real(1) - aten::abs(u) - aten::abs(v);
+
+        if (z < real(0)) {
+            const real tu = (real(1) - aten::abs(v)) * signNotZero(u);
+            const real tv = (real(1) - aten::abs(u)) * signNotZero(v);
+            u = tu;
+            v = tv;
+        }
+
+        return normalize(vec3(u, v, z));
+    }
+
+    static inline real decodeUVFlag(uint32_t code)
+    {
+        const uint32_t flag = code & 0x03;
+        return flag == 1 ? real(1) : (flag == 2 ? real(-1) : real(0));
+    }
+
+    aten::vertex context::decodeVertex(int idx) const
+    {
+        uint32_t nml = 0;
+        const uint16_t* uv = nullptr;
+
+        if (m_vertexFormat == VertexFormat::Packed) {
+            const auto& v = m_packedVertices[idx];
+            nml = v.nml;
+            uv = v.uv;
+        }
+        else {
+            const auto& v = m_quantizedVertices[idx];
+            nml = v.nml[0] | ((uint32_t)v.nml[1] << 16);
+            uv = v.uv;
+        }
+
+        aten::vertex vtx;
+
+        vtx.pos = getVertexPosition(idx);
+        vtx.nml = decodeNormal(nml);
+        vtx.uv = vec3(
+            convertHalfToFloat(uv[0]),
+            convertHalfToFloat(uv[1]),
+            decodeUVFlag(nml));
+
+        return vtx;
+    }
+
+    void context::copyVertices(std::vector<vertex>& dst) const
+    {
+        if (m_vertexFormat == VertexFormat::Full) {
+            std::copy(
+                m_vertices.begin(),
+                m_vertices.end(),
+                std::back_inserter(dst));
+        }
+        else {
+            dst.reserve(dst.size() + m_vertexNum);
+
+            for (uint32_t i = 0; i < m_vertexNum; i++) {
+                dst.push_back(decodeVertex(i));
+            }
+        }
+    }
+
+    void context::compactVertices(VertexFormat format)
+    {
+        // Compacted vertices can't be converted again.
+        AT_ASSERT(m_vertexFormat == VertexFormat::Full);
+
+        if (format == VertexFormat::Full
+            || m_vertexFormat != VertexFormat::Full)
+        {
+            return;
+        }
+
+        const auto prevSize = getVertexMemorySize();
+
+        const uint32_t num = m_vertexNum;
+
+        if (format == VertexFormat::Packed) {
+            m_packedVertices.resize(num);
+
+            for (uint32_t i = 0; i < num; i++) {
+                const auto& src = m_vertices[i];
+                auto& dst = m_packedVertices[i];
+
+                dst.pos[0] = (float)src.pos.x;
+                dst.pos[1] = (float)src.pos.y;
+                dst.pos[2] = (float)src.pos.z;
+
+                dst.nml = encodeNormal(src.nml, src.uv.z);
+
+                dst.uv[0] = convertFloatToHalf((float)src.uv.x);
+                dst.uv[1] = convertFloatToHalf((float)src.uv.y);
+            }
         }
+        else {
+            const uint32_t blockNum = (num + VertexBlockSize - 1) / VertexBlockSize;
+
+            m_vertexBlocks.resize(blockNum);
+            m_quantizedVertices.resize(num);
+
+            for (uint32_t b = 0; b < blockNum; b++) {
+                const uint32_t start = b * VertexBlockSize;
+                const uint32_t end = std::min(start + VertexBlockSize, num);
+
+                vec3 vmin(AT_MATH_INF);
+                vec3 vmax(-AT_MATH_INF);
+
+                for (uint32_t i = start; i < end; i++) {
+                    vmin = aten::min(vmin, vec3(m_vertices[i].pos));
+                    vmax = aten::max(vmax, vec3(m_vertices[i].pos));
+                }
+
+                auto& block = m_vertexBlocks[b];
+                block.origin = vmin;
+                block.scale = (vmax - vmin) / real(0xffff);
+
+                for (uint32_t i = start; i < end; i++) {
+                    const auto& src = m_vertices[i];
+                    auto& dst = m_quantizedVertices[i];
+
+                    for (int a = 0; a < 3; a++) {
+                        real q = real(0);
+                        if (block.scale[a] > real(0)) {
+                            q = (src.pos[a] - block.origin[a]) / block.scale[a];
+                        }
+                        dst.pos[a] = (uint16_t)aten::clamp(q + real(0.5), real(0), real(0xffff));
+                    }
+
+                    const auto nml = encodeNormal(src.nml, src.uv.z);
+                    dst.nml[0] = (uint16_t)(nml & 0xffff);
+                    dst.nml[1] = (uint16_t)(nml >> 16);
+
+                    dst.uv[0] = convertFloatToHalf((float)src.uv.x);
+                    dst.uv[1] = convertFloatToHalf((float)src.uv.y);
+                }
+            }
+        }
+
+        m_vertexFormat = format;
+
+        std::vector<aten::vertex>().swap(m_vertices);
+
+        // Positions might move slightly, so recompute the bounding boxes and areas of the triangles.
+        for (auto f : m_triangles) {
+            const auto& param = m_triParams[f->getId()];
+            f->build(*this, param.mtrlid, param.gemoid);
+        }
+
+        AT_PRINTF("Vertices (%d) : %d[byte] -> %d[byte]\n",
+            num,
+            (int)prevSize,
+            (int)getVertexMemorySize());
+    }
+
+    void context::decompactVertices()
+    {
+        if (m_vertexFormat == VertexFormat::Full) {
+            return;
+        }
+
+        AT_PRINTF("Vertices (%d) are decompacted to modify them\n", m_vertexNum);
+
+        std::vector<aten::vertex> vertices;
+        copyVertices(vertices);
+
+        m_vertices.swap(vertices);
+
+        std::vector<PackedVertex>().swap(m_packedVertices);
+        std::vector<QuantizedVertex>().swap(m_quantizedVertices);
+        std::vector<VertexBlock>().swap(m_vertexBlocks);
+
+        m_vertexFormat = VertexFormat::Full;
+    }
+
+    size_t context::getVertexMemorySize() const
+    {
+        return m_vertices.size() * sizeof(aten::vertex)
+            + m_packedVertices.size() * sizeof(PackedVertex)
+            + m_quantizedVertices.size() * sizeof(QuantizedVertex)
+            + m_vertexBlocks.size() * sizeof(VertexBlock);
     }
 
     AT_NAME::material* context::createMaterial(
@@ -122,61 +367,73 @@ namespace aten
 
     AT_NAME::face* context::createTriangle(const aten::PrimitiveParamter& param)
     {
-        auto f = AT_NAME::face::create(*this, param);
-        AT_ASSERT(f);
-        
-        if (f) {
-            addTriangle(f);
+        const auto idx = (uint32_t)m_triangles.size();
+        const auto posInBlock = idx % TriangleBlockSize;
+
+        if (posInBlock == 0) {
+            m_triangleBlocks.push_back(new AT_NAME::face[TriangleBlockSize]);
         }
 
+        auto f = &m_triangleBlocks.back()[posInBlock];
+
+        f->m_ctxt = this;
+        f->m_id = (int)idx;
+
+        m_triangles.push_back(f);
+        m_triParams.push_back(param);
+
+        f->build(*this, param.mtrlid, param.gemoid);
+
         return f;
     }
 
-    void context::addTriangle(AT_NAME::face* tri)
+    bool context::hitTriangle(
+        int idx,
+        const ray& r,
+        real t_min, real t_max,
+        Intersection& isect) const
     {
-        tri->addToDataList(m_triangles);
-    }
+        const auto& param = m_triParams[idx];
 
-    int context::getTriangleNum() const
-    {
-        return m_triangles.size();
-    }
+        const auto v0 = getVertexPosition(param.idx[0]);
+        const auto v1 = getVertexPosition(param.idx[1]);
+        const auto v2 = getVertexPosition(param.idx[2]);
 
-    const AT_NAME::face* context::getTriangle(int idx) const
-    {
-        AT_ASSERT(0 <= idx && idx < getTriangleNum());
-        return m_triangles[idx];
+        bool isHit = AT_NAME::face::hit(
+            &param,
+            v0, v1, v2,
+            r,
+            t_min, t_max,
+            &isect);
+
+        if (isHit) {
+            // Temporary, notify triangle id to the parent object.
+            isect.objid = idx;
+
+            isect.primid = idx;
+
+            isect.mtrlid = param.mtrlid;
+        }
+
+        return isHit;
     }
 
     void context::copyPrimitiveParameters(std::vector<aten::PrimitiveParamter>& dst) const
     {
-        auto& triangles = m_triangles.getList();
-
-        for (const auto item : triangles) {
-            const auto tri = item->getData();
-            dst.push_back(tri->getParam());
-        }
+        dst.insert(dst.end(), m_triParams.begin(), m_triParams.end());
     }
 
     int context::findTriIdxFromPointer(const void* p) const
     {
-        auto& triangles = m_triangles.getList();
-
-        auto found = std::find_if(
-            triangles.begin(), triangles.end(),
-            [&](const aten::DataList<aten::face>::ListItem* item) {
-            const auto tri = item->getData();
-            return tri == p;
-        });
-
-        int id = -1;
+        const auto tri = (const AT_NAME::face*)p;
 
-        if (found != triangles.end()) {
-            const auto tri = (*found)->getData();
-            id = tri->getId();
+        for (const auto block : m_triangleBlocks) {
+            if (block <= tri && tri < block + TriangleBlockSize) {
+                return tri->getId();
+            }
         }
 
-        return id;
+        return -1;
     }
 
     void context::addTransformable(aten::transformable* t)
@@ -10,6 +10,7 @@
 #include "misc/datalist.h"
 #include "geometry/geomparam.h"
 #include "texture/texture.h"
+#include "math/ray.h"
 
 namespace AT_NAME {
     class face;
@@ -18,46 +19,118 @@ namespace AT_NAME {
 namespace aten
 {
     class transformable;
+    struct Intersection;
 
     class context {
     public:
         context() {}
-        virtual ~context() {}
+        virtual ~context();
+
+        // The context owns the blocks of the triangles, so it is not allowed to copy.
+        context(const context& rhs) = delete;
+        const context& operator=(const context& rhs) = delete;
 
     public:
+        /**
+         * @brief Add the vertex. If the vertices are compacted, they are converted back to the full format at first.
+         */
         void addVertex(const aten::vertex& vtx)
         {
+            decompactVertices();
             m_vertices.push_back(vtx);
+            m_vertexNum++;
         }
 
-        const aten::vertex& getVertex(int idx) const
+        /**
+         * @brief Return the vertex. If the vertices are compacted, the vertex is decoded.
+         */
+        aten::vertex getVertex(int idx) const
         {
-            return m_vertices[idx];
+            if (m_vertexFormat == VertexFormat::Full) {
+                return m_vertices[idx];
+            }
+            return decodeVertex(idx);
         }
 
+        /**
+         * @brief Return the vertex to modify. If the vertices are compacted, they are converted back to the full format at first.
+         */
         aten::vertex& getVertex(int idx)
         {
+            decompactVertices();
             return m_vertices[idx];
         }
 
-        const std::vector<aten::vertex>& getVertices() const
+        /**
+         * @brief Return only the position of the vertex, which is enough for the intersection.
+         */
+        aten::vec4 getVertexPosition(int idx) const
+        {
+            switch (m_vertexFormat) {
+            case VertexFormat::Packed:
+            {
+                const auto& v = m_packedVertices[idx];
+                return aten::vec4(v.pos[0], v.pos[1], v.pos[2], real(0));
+            }
+            case VertexFormat::Quantized:
+            {
+                const auto& v = m_quantizedVertices[idx];
+                const auto& block = m_vertexBlocks[idx / VertexBlockSize];
+                return aten::vec4(
+                    block.origin.x + v.pos[0] * block.scale.x,
+                    block.origin.y + v.pos[1] * block.scale.y,
+                    block.origin.z + v.pos[2] * block.scale.z,
+                    real(0));
+            }
+            default:
+                break;
+            }
+            return m_vertices[idx].pos;
+        }
+
+        /**
+         * @brief Return the vertices as is. If the vertices are compacted, they are converted back to the full format at first.
+         */
+        const std::vector<aten::vertex>& getVertices()
         {
+            decompactVertices();
             return m_vertices;
         }
 
         uint32_t getVertexNum() const
         {
-            return (uint32_t)m_vertices.size();
+            return m_vertexNum;
         }
 
-        void copyVertices(std::vector<vertex>& dst) const
+        /**
+         * @brief Copy the vertices to the destination. If the vertices are compacted, they are decoded.
+         */
+        void copyVertices(std::vector<vertex>& dst) const;
+
+        /**
+         * @brief Convert the vertices to the specified format to reduce the memory.
+         * This has to be called after all vertices and triangles are created and before the acceleration structures are built,
+         * because the bounding boxes and areas of the triangles are recomputed with the converted positions.
+         * If the vertices are modified or added after conversion, they are converted back to the full format.
+         */
+        void compactVertices(VertexFormat format);
+
+        /**
+         * @brief Convert the compacted vertices back to the full format.
+         * The precision which is lost in the compaction is not restored.
+         */
+        void decompactVertices();
+
+        VertexFormat getVertexFormat() const
         {
-            std::copy(
-                m_vertices.begin(),
-                m_vertices.end(),
-                std::back_inserter(dst));
+            return m_vertexFormat;
         }
 
+        /**
+         * @brief Return the memory size [byte] of the vertices on the CPU.
+         */
+        size_t getVertexMemorySize() const;
+
         void build();
 
         const aten::GeomVertexBuffer& getVB() const
@@ -68,6 +141,11 @@ namespace aten
         void release()
         {
             m_vertices.clear();
+            m_packedVertices.clear();
+            m_quantizedVertices.clear();
+            m_vertexBlocks.clear();
+            m_vertexNum = 0;
+            m_vertexFormat = VertexFormat::Full;
             m_vb.clear();
         }
 
@@ -113,11 +191,47 @@ namespace aten
 
         AT_NAME::face* createTriangle(const aten::PrimitiveParamter& param);
 
-        void addTriangle(AT_NAME::face* tri);
+        int getTriangleNum() const
+        {
+            return (int)m_triangles.size();
+        }
+
+        const AT_NAME::face* getTriangle(int idx) const
+        {
+            AT_ASSERT(0 <= idx && idx < getTriangleNum());
+            return m_triangles[idx];
+        }
+
+        const aten::PrimitiveParamter& getTriangleParam(int idx) const
+        {
+            AT_ASSERT(0 <= idx && idx < getTriangleNum());
+            return m_triParams[idx];
+        }
+
+        aten::PrimitiveParamter& getTriangleParam(int idx)
+        {
+            AT_ASSERT(0 <= idx && idx < getTriangleNum());
+            return m_triParams[idx];
+        }
 
-        int getTriangleNum() const;
+        /**
+         * @brief Return the parameters of all triangles, which are indexed by the triangle id.
+         */
+        const std::vector<aten::PrimitiveParamter>& getTriangleParams() const
+        {
+            return m_triParams;
+        }
 
-        const AT_NAME::face* getTriangle(int idx) const;
+        /**
+         * @brief Test if a ray hits the specified triangle.
+         * This reads the flat arrays directly, so it doesn't touch the face object.
+         * objid and primid are the triangle id as same as face::hit.
+         */
+        bool hitTriangle(
+            int idx,
+            const ray& r,
+            real t_min, real t_max,
+            Intersection& isect) const;
 
         void copyPrimitiveParameters(std::vector<aten::PrimitiveParamter>& dst) const;
 
@@ -164,15 +278,43 @@ namespace aten
             return s_pinnedCtxt;
         }
 
+    private:
+        aten::vertex decodeVertex(int idx) const;
+
     private:
         static const context* s_pinnedCtxt;
 
         std::vector<aten::vertex> m_vertices;
 
+        VertexFormat m_vertexFormat{ VertexFormat::Full };
+
+        std::vector<PackedVertex> m_packedVertices;
+        std::vector<QuantizedVertex> m_quantizedVertices;
+
+        // Bounds of the consecutive vertices to dequantize the positions.
+        static const uint32_t VertexBlockSize = 256;
+
+        struct VertexBlock {
+            aten::vec3 origin;
+            aten::vec3 scale;
+        };
+        std::vector<VertexBlock> m_vertexBlocks;
+
+        uint32_t m_vertexNum{ 0 };
+
         aten::GeomVertexBuffer m_vb;
 
         DataList<AT_NAME::material> m_materials;
-        DataList<AT_NAME::face> m_triangles;
+
+        // Triangles are allocated per block to avoid the allocation per triangle.
+        static const uint32_t TriangleBlockSize = 4096;
+        std::vector<AT_NAME::face*> m_triangleBlocks;
+
+        std::vector<AT_NAME::face*> m_triangles;
+
+        // Parameter (index buffer and attributes) of the triangles in order of the triangle id.
+        std::vector<aten::PrimitiveParamter> m_triParams;
+
         DataList<aten::transformable> m_transformables;
         DataList<aten::texture> m_textures;
     };
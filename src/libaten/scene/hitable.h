@@ -90,6 +90,19 @@ namespace aten {
             real t_min, real t_max,
             Intersection& isect) const = 0;
 
+        /**
+         * @brief Test if a ray is occluded by any object between t_min and t_max.
+         * Unlike hit, it doesn't need the closest intersection, so it can terminate at the first hit.
+         */
+        virtual bool occluded(
+            const context& ctxt,
+            const ray& r,
+            real t_min, real t_max) const
+        {
+            Intersection isect;
+            return hit(ctxt, r, t_min, t_max, isect);
+        }
+
         virtual const aabb& getBoundingbox() const
         {
             return m_aabb;
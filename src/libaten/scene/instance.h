@@ -1,6 +1,8 @@
 #pragma once
 
 #include <memory>
+#include <atomic>
+#include <mutex>
 
 #include "types.h"
 #include "accelerator/bvh.h"
@@ -31,6 +33,8 @@ namespace aten
             m_mtxW2L.invert();
 
             setBoundingBox(getTransformedBoundingBox());
+
+            updateAreaDistribution();
         }
 
         instance(
@@ -51,6 +55,8 @@ namespace aten
             m_mtxW2L.invert();
 
             setBoundingBox(getTransformedBoundingBox());
+
+            updateAreaDistribution();
         }
 
         virtual ~instance() {}
@@ -82,6 +88,19 @@ namespace aten
             return isHit;
         }
 
+        virtual bool occluded(
+            const context& ctxt,
+            const ray& r,
+            real t_min, real t_max) const override final
+        {
+            // Transform world to local.
+            // The direction is normalized in the local coordinate, so the range is also scaled.
+            auto transformdRay = m_mtxW2L.applyRay(r, t_min, t_max);
+
+            // Occlusion test in local coordinate.
+            return m_obj->occluded(ctxt, transformdRay, t_min, t_max);
+        }
+
         virtual void evalHitResult(
             const context& ctxt,
             const ray& r,
@@ -90,6 +109,11 @@ namespace aten
         {
             m_obj->evalHitResult(ctxt, r, m_mtxL2W, rec, isect);
 
+            if (m_isAreaDistBuilt.load(std::memory_order_acquire) && m_areaDist.size() > 0) {
+                // Total area in the world coordinate, which is consistent with getSamplePosNormalArea.
+                rec.area = m_areaDist.getSum();
+            }
+
             // Transform local to world.
             rec.p = m_mtxL2W.apply(rec.p);
             rec.normal = normalize(m_mtxL2W.applyXYZ(rec.normal));
@@ -161,6 +185,7 @@ namespace aten
             if (m_isDirty || isForcibly) {
                 updateMatrix();
                 setBoundingBox(getTransformedBoundingBox());
+                updateAreaDistribution();
                 onNotifyChanged();
 
                 m_isDirty = false;
@@ -246,6 +271,23 @@ namespace aten
             m_mtxW2L.invert();
         }
 
+        /**
+         * @brief Build the area distribution of the triangles for this instance, if the transform changes the area ratio.
+         * It is built only if the object is used as a light, otherwise it is built at the first use as a light.
+         */
+        void updateAreaDistribution()
+        {
+            // Nothing is done...
+        }
+
+        /**
+         * @brief Build the area distribution of the triangles for this instance at the first use as a light.
+         */
+        void buildAreaDistribution(const context& ctxt) const
+        {
+            // Nothing is done...
+        }
+
     private:
         std::shared_ptr<OBJ> m_obj;
         std::shared_ptr<OBJ> m_lod;
@@ -259,6 +301,13 @@ namespace aten
         vec3 m_scale{ aten::vec3(1, 1, 1) };
 
         bool m_isDirty{ false };
+
+        // Area distribution of the triangles in the world coordinate.
+        // If it is empty, the distribution which the object has is used.
+        mutable AliasTable m_areaDist;
+
+        mutable std::atomic<bool> m_isAreaDistBuilt{ false };
+        mutable std::mutex m_areaDistMutex;
     };
 
     template<>
@@ -271,6 +320,52 @@ namespace aten
         m_param.shapeid = ctxt.findTransformableIdxFromPointer(obj);
     }
 
+    template<>
+    inline void instance<object>::updateAreaDistribution()
+    {
+        // Called out of rendering, so no lock.
+        m_areaDist.clear();
+        m_isAreaDistBuilt.store(false, std::memory_order_relaxed);
+
+        if (m_obj->hasAreaDistribution()) {
+            m_obj->buildAreaDistribution(m_mtxL2W, m_areaDist);
+            m_isAreaDistBuilt.store(true, std::memory_order_release);
+        }
+    }
+
+    template<>
+    inline void instance<object>::buildAreaDistribution(const context& ctxt) const
+    {
+        if (m_isAreaDistBuilt.load(std::memory_order_acquire)) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_areaDistMutex);
+
+        if (!m_isAreaDistBuilt.load(std::memory_order_relaxed)) {
+            m_obj->buildAreaDistribution(ctxt);
+            m_obj->buildAreaDistribution(m_mtxL2W, m_areaDist);
+            m_isAreaDistBuilt.store(true, std::memory_order_release);
+        }
+    }
+
+    template<>
+    inline void instance<object>::getSamplePosNormalArea(
+        const context& ctxt,
+        aten::hitable::SamplePosNormalPdfResult* result,
+        sampler* sampler) const
+    {
+        // Used as a light at first.
+        buildAreaDistribution(ctxt);
+
+        if (m_areaDist.size() > 0) {
+            m_obj->getSamplePosNormalArea(ctxt, result, m_areaDist, sampler);
+        }
+        else {
+            m_obj->getSamplePosNormalArea(ctxt, result, m_mtxL2W, sampler);
+        }
+    }
+
     template<>
     inline instance<deformable>::instance(deformable* obj, const context& ctxt)
         : transformable(GeometryType::Instance), m_obj(std::move(obj))
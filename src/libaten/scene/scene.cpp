@@ -8,30 +8,55 @@ namespace aten {
         const Light* light,
         const vec3& lightPos,
         const ray& r,
-        real t_min, real t_max,
-        hitrecord& rec)
+        real t_min, real t_max)
     {
-        Intersection isect;
-        bool isHit = this->hit(ctxt, r, t_min, t_max, rec, isect);
+        // NOTE
+        // We only need to know whether something blocks the ray before it reaches the light.
+        // So, use the occlusion test which terminates at the first hit instead of finding the closest hit.
+
+        const auto& param = light->param();
+
+        if (param.attrib.isInfinite) {
+            return !occluded(ctxt, r, t_min, t_max);
+        }
 
         real distToLight = length(lightPos - r.org);
-        real distHitObjToRayOrg = length(rec.p - r.org);
 
-        const auto& param = light->param();
+        if (!param.attrib.isSingular) {
+            // The sampled position is on the light object, so the ray might hit the light object itself around there.
+            // To avoid that the light object occludes itself, shorten the distance by the error of the position.
+            distToLight -= m_rayEpsilon;
+        }
 
-        auto lightobj = param.objid >= 0 ? ctxt.getTransformable(param.objid) : nullptr;
-        auto hitobj = isect.objid >= 0 ? ctxt.getTransformable(isect.objid) : nullptr;
+        return !occluded(ctxt, r, t_min, std::min(t_max, distToLight));
+    }
+
+    void scene::build(const context& ctxt)
+    {
+        // NOTE
+        // The error of the hit position is proportional to the magnitude of its coordinate, not to the ray length.
+        // So, scale the margin by the largest coordinate in the scene.
+        aabb bbox;
+        for (const auto& h : m_list) {
+            bbox = aabb::merge(bbox, h->getBoundingbox());
+        }
+
+        m_rayEpsilon = AT_MATH_EPSILON;
 
-        isHit = scene::hitLight(
-            isHit,
-            param.attrib,
-            lightobj,
-            distToLight,
-            distHitObjToRayOrg,
-            isect.t,
-            hitobj);
+        // The empty box has the infinite coordinates.
+        if (!m_list.empty() && bbox.minPos().x <= bbox.maxPos().x) {
+            const auto& minPos = bbox.minPos();
+            const auto& maxPos = bbox.maxPos();
 
-        return isHit;
+            real extent = real(0);
+            for (int i = 0; i < 3; i++) {
+                extent = std::max(extent, std::max(aten::abs(minPos[i]), aten::abs(maxPos[i])));
+            }
+
+            m_rayEpsilon = std::max(m_rayEpsilon, extent * real(1e-5));
+        }
+
+        m_lightBvh.build(ctxt, m_lights);
     }
 
     Light* scene::sampleLight(
@@ -42,82 +67,76 @@ namespace aten {
         real& selectPdf,
         LightSampleResult& sampleRes)
     {
-#if 1
         Light* light = nullptr;
 
         auto num = m_lights.size();
         if (num > 0) {
             auto r = sampler->nextSample();
-            uint32_t idx = (uint32_t)aten::clamp<real>(r * num, 0, num - 1);
-            light = m_lights[idx];
 
-            sampleRes = light->sample(ctxt, org, nml, sampler);
-            selectPdf = real(1) / num;
+            if (isLightBVHAvailable()) {
+                // Select the light according to the estimated contribution to the shading point.
+                light = m_lightBvh.sample(org, nml, r, selectPdf);
+            }
+            else {
+                uint32_t idx = (uint32_t)aten::clamp<real>(r * num, 0, num - 1);
+                light = m_lights[idx];
+
+                selectPdf = real(1) / num;
+            }
+
+            if (light) {
+                sampleRes = light->sample(ctxt, org, nml, sampler);
+            }
         }
         else {
             selectPdf = 1;
         }
 
         return light;
-#else
-        // Resampled Importance Sampling.
-        // For reducing variance...maybe...
-
-        std::vector<LightSampleResult> samples(m_lights.size());
-        std::vector<real> costs(m_lights.size());
-
-        real sumCost = 0;
-
-        for (int i = 0; i < m_lights.size(); i++) {
-            const auto light = m_lights[i];
-
-            samples[i] = light->sample(org, nml, sampler);
-
-            const auto& lightsample = samples[i];
-
-            vec3 posLight = lightsample.pos;
-            vec3 nmlLight = lightsample.nml;
-            real pdfLight = lightsample.pdf;
-            vec3 dirToLight = normalize(lightsample.dir);
+    }
 
-            auto cosShadow = dot(nml, dirToLight);
-            auto dist2 = squared_length(lightsample.dir);
-            auto dist = aten::sqrt(dist2);
+    Light* scene::sampleLightByPower(
+        sampler* sampler,
+        real& selectPdf)
+    {
+        Light* light = nullptr;
 
-            auto illum = color::luminance(lightsample.finalColor);
+        auto num = m_lights.size();
+        if (num > 0) {
+            auto r = sampler->nextSample();
 
-            if (cosShadow > 0) {
-                if (light->isSingular() || light->isInfinite()) {
-                    costs[i] = illum * cosShadow / pdfLight;
-                }
-                else {
-                    costs[i] = illum * cosShadow / dist2 / pdfLight;
-                }
-                sumCost += costs[i];
+            if (isLightBVHAvailable()) {
+                light = m_lightBvh.sample(r, selectPdf);
             }
             else {
-                costs[i] = 0;
+                uint32_t idx = (uint32_t)aten::clamp<real>(r * num, 0, num - 1);
+                light = m_lights[idx];
+
+                selectPdf = real(1) / num;
             }
         }
+        else {
+            selectPdf = 1;
+        }
 
-        auto r = sampler->nextSample() * sumCost;
-        
-        real sum = 0;
+        return light;
+    }
 
-        for (int i = 0; i < costs.size(); i++) {
-            const auto c = costs[i];
-            sum += c;
+    real scene::computeLightSelectPdf(
+        const Light* light,
+        const vec3& org,
+        const vec3& nml) const
+    {
+        if (!light) {
+            // The emissive object which is not registered as the light is never selected.
+            return real(0);
+        }
 
-            if (r <= sum && c > 0) {
-                auto light = m_lights[i];
-                sampleRes = samples[i];
-                selectPdf = c / sumCost;
-                return light;
-            }
+        if (isLightBVHAvailable()) {
+            return m_lightBvh.samplePdf(light, org, nml);
         }
 
-        return nullptr;
-#endif
+        return real(1) / m_lights.size();
     }
 
     void scene::drawForGBuffer(
@@ -3,11 +3,13 @@
 #include <vector>
 #include <algorithm>
 #include <iterator>
+#include <unordered_map>
 
 #include "accelerator/accelerator.h"
 #include "accelerator/bvh.h"
 #include "light/light.h"
 #include "light/ibl.h"
+#include "light/light_bvh.h"
 #include "scene/context.h"
 
 namespace AT_NAME {
@@ -17,8 +19,7 @@ namespace AT_NAME {
         virtual ~scene() {}
 
     public:
-        virtual void build(const aten::context& ctxt)
-        {}
+        virtual void build(const aten::context& ctxt);
 
         void add(aten::hitable* s)
         {
@@ -43,9 +44,24 @@ namespace AT_NAME {
             return hit(ctxt, r, t_min, t_max, false, rec, isect);
         }
 
+        virtual bool occluded(
+            const aten::context& ctxt,
+            const aten::ray& r,
+            real t_min, real t_max) const = 0;
+
         void addLight(Light* l)
         {
             m_lights.push_back(l);
+
+            auto obj = l->getLightObject();
+            if (obj) {
+                m_areaLights[obj] = l;
+            }
+
+            if (l->isInfinite()) {
+                // Infinite light is not in the light hierarchy, so it can be added without rebuilding.
+                m_lightBvh.addInfiniteLight(l);
+            }
         }
 
         void addImageBasedLight(ImageBasedLight* l)
@@ -80,13 +96,30 @@ namespace AT_NAME {
             return m_ibl;
         }
 
+        /**
+         * @brief Return the area light which has the specified object as the light object.
+         */
+        const Light* findAreaLight(const aten::hitable* obj) const
+        {
+            auto it = m_areaLights.find(obj);
+            return (it != m_areaLights.end() ? it->second : nullptr);
+        }
+
+        /**
+         * @brief Return the distance to stop the occlusion test short of the end point on the surface.
+         * It is scaled to the extent of the scene which is computed in build, so that it exceeds the error of the hit position.
+         */
+        real getRayEpsilon() const
+        {
+            return m_rayEpsilon;
+        }
+
         bool hitLight(
             const aten::context& ctxt,
             const Light* light,
             const aten::vec3& lightPos,
             const aten::ray& r,
-            real t_min, real t_max,
-            aten::hitrecord& rec);
+            real t_min, real t_max);
 
         static inline AT_DEVICE_API bool hitLight(
             bool isHit,
@@ -168,6 +201,23 @@ namespace AT_NAME {
             real& selectPdf,
             aten::LightSampleResult& sampleRes);
 
+        /**
+         * @brief Select a light according to the power only.
+         * @note This is for the case which has no shading point (e.g. the starting point of the light sub-path).
+         */
+        Light* sampleLightByPower(
+            aten::sampler* sampler,
+            real& selectPdf);
+
+        /**
+         * @brief Return the probability that "sampleLight" selects the specified light at the specified shading point.
+         * @note This is for MIS of the path which hits the light implicitly.
+         */
+        real computeLightSelectPdf(
+            const Light* light,
+            const aten::vec3& org,
+            const aten::vec3& nml) const;
+
         void drawForGBuffer(
             aten::hitable::FuncPreDraw func,
             std::function<bool(aten::hitable*)> funcIfDraw,
@@ -178,5 +228,19 @@ namespace AT_NAME {
 
         std::vector<Light*> m_lights;
         ImageBasedLight* m_ibl{ nullptr };
+
+        std::unordered_map<const aten::hitable*, Light*> m_areaLights;
+
+        // Light hierarchy to select the light which contributes to the shading point.
+        LightBVH m_lightBvh;
+
+        real m_rayEpsilon{ AT_MATH_EPSILON };
+
+    private:
+        bool isLightBVHAvailable() const
+        {
+            // If the finite light is added after building the scene, the hierarchy doesn't include it.
+            return !m_lights.empty() && m_lightBvh.getLightNum() == m_lights.size();
+        }
     };
 }
@@ -1,11 +1,16 @@
 #include <string>
+#include <cstring>
 
+#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
 #include "texture/texture.h"
+#ifndef __AT_HEADLESS__
 #include "visualizer/atengl.h"
 #include "visualizer/shader.h"
+#endif
 #include "misc/color.h"
+#include "math/half.h"
 
 namespace aten
 {
@@ -53,15 +58,390 @@ namespace aten
             m_size = height * width;
 
             m_colors.resize(width * height);
+
+            m_levels.clear();
+            m_levels.push_back(Level{ width, height, 0 });
+        }
+    }
+
+    static inline uint32_t getBytesPerChannel(texture::Format format)
+    {
+        switch (format) {
+        case texture::Format::RGBA16F:
+        case texture::Format::RGBA16:
+            return 2;
+        case texture::Format::RGBA8:
+            return 1;
+        default:
+            break;
         }
+        return sizeof(float);
     }
 
+    static inline int wrapCoord(int x, int size, texture::Wrap wrap)
+    {
+        switch (wrap) {
+        case texture::Wrap::Clamp:
+            x = aten::clamp(x, 0, size - 1);
+            break;
+        case texture::Wrap::Mirror:
+        {
+            const int period = size * 2;
+            x %= period;
+            x = x < 0 ? x + period : x;
+            x = x >= size ? period - 1 - x : x;
+        }
+            break;
+        default:
+            x %= size;
+            x = x < 0 ? x + size : x;
+            break;
+        }
+        return x;
+    }
+
+    vec4 texture::fetch(const uint8_t* texels, uint32_t level, int x, int y) const
+    {
+        const auto& lv = m_levels[level];
+
+        x = wrapCoord(x, lv.width, m_wrapU);
+        y = wrapCoord(y, lv.height, m_wrapV);
+
+        const uint32_t pos = lv.offset + y * lv.width + x;
+
+        if (m_format == Format::RGBA32F) {
+            return m_colors[pos];
+        }
+
+        vec4 ret(real(0));
+
+        switch (m_format) {
+        case Format::RGBA16F:
+        {
+            const uint16_t* src = (const uint16_t*)texels + pos * m_channels;
+            for (uint32_t c = 0; c < m_channels; c++) {
+                ret[c] = convertHalfToFloat(src[c]);
+            }
+        }
+            break;
+        case Format::RGBA16:
+        {
+            const uint16_t* src = (const uint16_t*)texels + pos * m_channels;
+            for (uint32_t c = 0; c < m_channels; c++) {
+                ret[c] = src[c] * (real(1) / real(65535));
+            }
+        }
+            break;
+        case Format::RGBA8:
+        {
+            const uint8_t* src = texels + pos * m_channels;
+            for (uint32_t c = 0; c < m_channels; c++) {
+                ret[c] = src[c] * (real(1) / real(255));
+            }
+        }
+            break;
+        default:
+            AT_ASSERT(false);
+            break;
+        }
+
+        return ret;
+    }
+
+    vec4 texture::sampleNearest(uint32_t level, real u, real v) const
+    {
+        const auto& lv = m_levels[level];
+
+        const int x = (int)aten::floor(u * lv.width);
+        const int y = (int)aten::floor(v * lv.height);
+
+        const uint8_t* texels = m_texels.empty() ? nullptr : &m_texels[0];
+
+        return fetch(texels, level, x, y);
+    }
+
+    vec4 texture::sampleBilinear(uint32_t level, real u, real v) const
+    {
+        const auto& lv = m_levels[level];
+
+        // Texel center is at 0.5.
+        const real fx = u * lv.width - real(0.5);
+        const real fy = v * lv.height - real(0.5);
+
+        const real floorX = aten::floor(fx);
+        const real floorY = aten::floor(fy);
+
+        const int x = (int)floorX;
+        const int y = (int)floorY;
+
+        const real tx = fx - floorX;
+        const real ty = fy - floorY;
+
+        const uint8_t* texels = m_texels.empty() ? nullptr : &m_texels[0];
+
+        const auto c00 = fetch(texels, level, x, y);
+        const auto c10 = fetch(texels, level, x + 1, y);
+        const auto c01 = fetch(texels, level, x, y + 1);
+        const auto c11 = fetch(texels, level, x + 1, y + 1);
+
+        const auto c0 = c00 * (real(1) - tx) + c10 * tx;
+        const auto c1 = c01 * (real(1) - tx) + c11 * tx;
+
+        return c0 * (real(1) - ty) + c1 * ty;
+    }
+
+    vec3 texture::at(real u, real v, real lod) const
+    {
+        AT_ASSERT(!m_levels.empty());
+
+        const real maxLevel = real(m_levels.size() - 1);
+        lod = aten::clamp(lod, real(0), maxLevel);
+
+        vec4 clr;
+
+        switch (m_filter) {
+        case Filter::Trilinear:
+        {
+            const uint32_t level = (uint32_t)lod;
+            const real t = lod - level;
+
+            clr = sampleBilinear(level, u, v);
+
+            if (t > real(0) && level + 1 < m_levels.size()) {
+                const auto clr1 = sampleBilinear(level + 1, u, v);
+                clr = clr * (real(1) - t) + clr1 * t;
+            }
+        }
+            break;
+        case Filter::Bilinear:
+            clr = sampleBilinear((uint32_t)(lod + real(0.5)), u, v);
+            break;
+        default:
+            clr = sampleNearest((uint32_t)(lod + real(0.5)), u, v);
+            break;
+        }
+
+        // TODO
+        // Note use alpha channel...
+        uint32_t ch = std::min<uint32_t>(m_channels, 3);
+
+        vec3 ret;
+
+        switch (ch) {
+        case 3:
+            ret[2] = clr[2];
+        case 2:
+            ret[1] = clr[1];
+        case 1:
+            ret[0] = clr[0];
+            break;
+        }
+
+        return std::move(ret);
+    }
+
+    // Each thread shades its own hit point.
+    static thread_local real s_footprint = real(0);
+
+    void texture::setFootprint(real width)
+    {
+        s_footprint = width;
+    }
+
+    real texture::getFootprint()
+    {
+        return s_footprint;
+    }
+
+    real texture::computeLod(
+        real dudx, real dvdx,
+        real dudy, real dvdy) const
+    {
+        // Footprint of the pixel in the top level texels.
+        const real dx = aten::sqrt(
+            dudx * dudx * m_width * m_width
+            + dvdx * dvdx * m_height * m_height);
+        const real dy = aten::sqrt(
+            dudy * dudy * m_width * m_width
+            + dvdy * dvdy * m_height * m_height);
+
+        const real width = std::max(dx, dy);
+
+        if (width <= real(1)) {
+            return real(0);
+        }
+
+        return aten::log(width) / aten::log(real(2));
+    }
+
+    void texture::decode(uint32_t level, std::vector<vec4>& dst) const
+    {
+        AT_ASSERT(level < m_levels.size());
+
+        const auto& lv = m_levels[level];
+
+        dst.resize(lv.width * lv.height);
+
+        const uint8_t* texels = m_texels.empty() ? nullptr : &m_texels[0];
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+        for (int y = 0; y < (int)lv.height; y++) {
+            for (int x = 0; x < (int)lv.width; x++) {
+                dst[y * lv.width + x] = fetch(texels, level, x, y);
+            }
+        }
+    }
+
+    void texture::decodeAll(std::vector<vec4>& dst) const
+    {
+        if (m_format == Format::RGBA32F) {
+            dst = m_colors;
+            return;
+        }
+
+        const auto& last = m_levels.back();
+        dst.resize(last.offset + last.width * last.height);
+
+        std::vector<vec4> tmp;
+
+        for (uint32_t i = 0; i < (uint32_t)m_levels.size(); i++) {
+            decode(i, tmp);
+            std::copy(tmp.begin(), tmp.end(), dst.begin() + m_levels[i].offset);
+        }
+    }
+
+    void texture::encodeAll(const std::vector<vec4>& src)
+    {
+        if (m_format == Format::RGBA32F) {
+            m_colors = src;
+            m_texels.clear();
+            m_texels.shrink_to_fit();
+            return;
+        }
+
+        m_colors.clear();
+        m_colors.shrink_to_fit();
+
+        const uint32_t num = (uint32_t)src.size();
+        m_texels.resize(num * m_channels * getBytesPerChannel(m_format));
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+        for (int i = 0; i < (int)num; i++) {
+            const auto& clr = src[i];
+
+            for (uint32_t c = 0; c < m_channels; c++) {
+                const uint32_t pos = i * m_channels + c;
+
+                switch (m_format) {
+                case Format::RGBA16F:
+                    ((uint16_t*)&m_texels[0])[pos] = convertFloatToHalf((float)clr[c]);
+                    break;
+                case Format::RGBA16:
+                    ((uint16_t*)&m_texels[0])[pos] = (uint16_t)(aten::clamp(clr[c], real(0), real(1)) * real(65535) + real(0.5));
+                    break;
+                case Format::RGBA8:
+                    m_texels[pos] = (uint8_t)(aten::clamp(clr[c], real(0), real(1)) * real(255) + real(0.5));
+                    break;
+                default:
+                    AT_ASSERT(false);
+                    break;
+                }
+            }
+        }
+    }
+
+    void texture::buildMipmap()
+    {
+        AT_ASSERT(!m_levels.empty());
+
+        // Generate from the top level.
+        std::vector<vec4> colors;
+        decode(0, colors);
+
+        m_levels.resize(1);
+
+        uint32_t width = m_width;
+        uint32_t height = m_height;
+
+        while (width > 1 || height > 1) {
+            const uint32_t srcOffset = m_levels.back().offset;
+            const uint32_t srcWidth = width;
+            const uint32_t srcHeight = height;
+
+            width = std::max<uint32_t>(width / 2, 1);
+            height = std::max<uint32_t>(height / 2, 1);
+
+            const uint32_t offset = (uint32_t)colors.size();
+            colors.resize(offset + width * height);
+
+            m_levels.push_back(Level{ width, height, offset });
+
+#ifdef ENABLE_OMP
+#pragma omp parallel for
+#endif
+            for (int y = 0; y < (int)height; y++) {
+                for (int x = 0; x < (int)width; x++) {
+                    // If the size is odd, the last texel is clamped.
+                    const uint32_t x0 = std::min<uint32_t>(x * 2, srcWidth - 1);
+                    const uint32_t x1 = std::min<uint32_t>(x * 2 + 1, srcWidth - 1);
+                    const uint32_t y0 = std::min<uint32_t>(y * 2, srcHeight - 1);
+                    const uint32_t y1 = std::min<uint32_t>(y * 2 + 1, srcHeight - 1);
+
+                    const auto& c00 = colors[srcOffset + y0 * srcWidth + x0];
+                    const auto& c10 = colors[srcOffset + y0 * srcWidth + x1];
+                    const auto& c01 = colors[srcOffset + y1 * srcWidth + x0];
+                    const auto& c11 = colors[srcOffset + y1 * srcWidth + x1];
+
+                    colors[offset + y * width + x] = (c00 + c10 + c01 + c11) * real(0.25);
+                }
+            }
+        }
+
+        encodeAll(colors);
+    }
+
+    void texture::convert(Format format)
+    {
+        if (m_format == format) {
+            return;
+        }
+
+        std::vector<vec4> colors;
+        decodeAll(colors);
+
+        m_format = format;
+
+        encodeAll(colors);
+    }
+
+    uint32_t texture::getMemorySize() const
+    {
+        if (m_format == Format::RGBA32F) {
+            return (uint32_t)(m_colors.size() * sizeof(vec4));
+        }
+        return (uint32_t)m_texels.size();
+    }
+
+#ifndef __AT_HEADLESS__
     bool texture::initAsGLTexture()
     {
         if (m_gltex == 0) {
             AT_VRETURN(m_width > 0, false);
             AT_VRETURN(m_height > 0, false);
-            AT_VRETURN(m_colors.size() > 0, false);
+            AT_VRETURN(m_colors.size() > 0 || m_texels.size() > 0, false);
+
+            // The compact formats are uploaded as RGBA32F.
+            std::vector<vec4> tmp;
+            const vec4* colors = m_colors.data();
+
+            if (m_format != Format::RGBA32F) {
+                decode(0, tmp);
+                colors = &tmp[0];
+            }
 
             CALL_GL_API(::glGenTextures(1, &m_gltex));
             AT_VRETURN(m_gltex > 0, false);
@@ -76,7 +456,7 @@ namespace aten
                 0,
                 GL_RGBA,
                 GL_FLOAT,
-                &m_colors[0]));
+                colors));
 
             CALL_GL_API(::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
             CALL_GL_API(::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
@@ -207,12 +587,55 @@ namespace aten
                 &dst[0]));
         }
     }
+#else
+    // NOTE
+    // There is no GL in the headless build, so the textures are never uploaded.
+
+    bool texture::initAsGLTexture()
+    {
+        return false;
+    }
+
+    bool texture::initAsGLTexture(int width, int height)
+    {
+        m_width = width;
+        m_height = height;
+        return false;
+    }
+
+    void texture::bindAsGLTexture(uint8_t stage, shader* shd) const
+    {
+    }
+
+    void texture::bindAsGLTexture(
+        uint32_t gltex,
+        uint8_t stage, shader* shd)
+    {
+    }
+
+    void texture::releaseAsGLTexture()
+    {
+    }
+
+    void texture::clearAsGLTexture(const aten::vec4& clearColor)
+    {
+    }
+
+    void texture::getDataAsGLTexture(
+        int& width,
+        int& height,
+        int& channel,
+        std::vector<vec4>& dst) const
+    {
+    }
+#endif
 
     bool texture::merge(const texture& rhs)
     {
         AT_VRETURN(m_width == rhs.m_width, false);
         AT_VRETURN(m_height == rhs.m_height, false);
         AT_VRETURN(m_colors.size() == rhs.m_colors.size(), false);
+        AT_VRETURN(m_format == Format::RGBA32F && rhs.m_format == Format::RGBA32F, false);
 
 #ifdef ENABLE_OMP
 #pragma omp parallel for
@@ -232,6 +655,14 @@ namespace aten
     {
         using ScreenShotImageType = TColor<uint8_t, 3>;
 
+        std::vector<vec4> tmp;
+        const vec4* colors = m_colors.data();
+
+        if (m_format != Format::RGBA32F) {
+            decode(0, tmp);
+            colors = &tmp[0];
+        }
+
         std::vector<ScreenShotImageType> dst(m_width * m_height);
 
         static const int bpp = sizeof(ScreenShotImageType);
@@ -244,9 +675,9 @@ namespace aten
             for (int x = 0; x < m_width; x++) {
                 int yy = m_height - 1 - y;
 
-                dst[yy * m_width + x].r() = (uint8_t)aten::clamp(m_colors[y * m_width + x].x * real(255), real(0), real(255));
-                dst[yy * m_width + x].g() = (uint8_t)aten::clamp(m_colors[y * m_width + x].y * real(255), real(0), real(255));
-                dst[yy * m_width + x].b() = (uint8_t)aten::clamp(m_colors[y * m_width + x].z * real(255), real(0), real(255));
+                dst[yy * m_width + x].r() = (uint8_t)aten::clamp(colors[y * m_width + x].x * real(255), real(0), real(255));
+                dst[yy * m_width + x].g() = (uint8_t)aten::clamp(colors[y * m_width + x].y * real(255), real(0), real(255));
+                dst[yy * m_width + x].b() = (uint8_t)aten::clamp(colors[y * m_width + x].z * real(255), real(0), real(255));
             }
         }
 
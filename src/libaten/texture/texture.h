@@ -28,39 +28,122 @@ namespace aten
     public:
         void init(uint32_t width, uint32_t height, uint32_t channels);
 
+        /**
+         * @brief Storage format of the texel.
+         * Only the channels which the texture has are stored, except RGBA32F.
+         */
+        enum class Format {
+            RGBA32F,    ///< 32bit float. Same as the layout of colors().
+            RGBA16F,    ///< 16bit half float.
+            RGBA16,     ///< 16bit unsigned normalized integer.
+            RGBA8,      ///< 8bit unsigned normalized integer.
+        };
+
+        enum class Filter {
+            Nearest,
+            Bilinear,
+            Trilinear,  ///< Bilinear in the two nearest mip levels, and interpolate them.
+        };
+
+        enum class Wrap {
+            Repeat,
+            Clamp,
+            Mirror,
+        };
+
+        /**
+         * @brief Sample the texture in the top mip level.
+         */
         vec3 at(real u, real v) const
         {
-            u -= floor(u);
-            v -= floor(v);
-
-            uint32_t x = (uint32_t)(aten::cmpMin(u, real(1)) * (m_width - 1));
-            uint32_t y = (uint32_t)(aten::cmpMin(v, real(1)) * (m_height - 1));
-
-            uint32_t pos = y * m_width + x;
+            return at(u, v, real(0));
+        }
 
-            const auto clr = m_colors[pos];
+        /**
+         * @brief Sample the texture in the specified mip level.
+         */
+        vec3 at(real u, real v, real lod) const;
+
+        /**
+         * @brief Sample the texture in the mip level which is computed from the uv derivatives of the ray differentials.
+         */
+        vec3 at(
+            real u, real v,
+            real dudx, real dvdx,
+            real dudy, real dvdy) const
+        {
+            auto lod = computeLod(dudx, dvdx, dudy, dvdy);
+            return at(u, v, lod);
+        }
 
-            // TODO
-            // Note use alpha channel...
-            uint32_t ch = std::min<uint32_t>(m_channels, 3);
+        /**
+         * @brief Compute the mip level from the uv derivatives in the screen space.
+         */
+        real computeLod(
+            real dudx, real dvdx,
+            real dudy, real dvdy) const;
+
+        /**
+         * @brief Set the width of the ray footprint in the uv space for the calling thread.
+         * The renderer sets it while shading the hit point, and sampleTexture selects the mip level from it.
+         * If it is zero, the top level is sampled.
+         */
+        static void setFootprint(real width);
+
+        /**
+         * @brief Return the width of the ray footprint in the uv space for the calling thread.
+         */
+        static real getFootprint();
+
+        /**
+         * @brief Generate the mip chain with the box filter.
+         */
+        void buildMipmap();
+
+        /**
+         * @brief Convert the storage format.
+         * If the texels are accessed with operator() or non-const colors(), they are converted back to RGBA32F.
+         */
+        void convert(Format format);
+
+        /**
+         * @brief Decode the texels in the specified mip level as RGBA32F.
+         */
+        void decode(uint32_t level, std::vector<vec4>& dst) const;
+
+        void setFilter(Filter filter)
+        {
+            m_filter = filter;
+        }
 
-            vec3 ret;
+        void setWrap(Wrap wrapU, Wrap wrapV)
+        {
+            m_wrapU = wrapU;
+            m_wrapV = wrapV;
+        }
 
-            switch (ch) {
-            case 3:
-                ret[2] = clr[2];
-            case 2:
-                ret[1] = clr[1];
-            case 1:
-                ret[0] = clr[0];
-                break;
-            }
+        Format getFormat() const
+        {
+            return m_format;
+        }
 
-            return std::move(ret);
+        uint32_t getMipLevelNum() const
+        {
+            return (uint32_t)m_levels.size();
         }
 
+        /**
+         * @brief Return the size of the texels [bytes] including the mip chain.
+         */
+        uint32_t getMemorySize() const;
+
+        /**
+         * @brief Return the texel to modify. If the texel is stored in the compact format, it is converted back to RGBA32F at first.
+         */
         real& operator()(uint32_t x, uint32_t y, uint32_t c)
         {
+            convert(Format::RGBA32F);
+
             x = std::min(x, m_width - 1);
             y = std::min(y, m_height - 1);
             c = std::min(c, m_channels - 1);
@@ -70,9 +153,25 @@ namespace aten
             return m_colors[pos][c];
         }
 
+        /**
+         * @brief Return the texels as RGBA32F. If the texel is stored in the compact format, it is converted back to RGBA32F at first.
+         */
+        const vec4* colors()
+        {
+            convert(Format::RGBA32F);
+            return m_colors.empty() ? nullptr : &m_colors[0];
+        }
+
+        /**
+         * @brief Return the texels as RGBA32F. If the texel is stored in the compact format, return nullptr.
+         */
         const vec4* colors() const
         {
-            return &m_colors[0];
+            if (m_format != Format::RGBA32F) {
+                AT_PRINTF("Texture (%s) is compacted, so the texels are not available as RGBA32F\n", m_name.c_str());
+                return nullptr;
+            }
+            return m_colors.empty() ? nullptr : &m_colors[0];
         }
 
         uint32_t width() const
@@ -128,6 +227,14 @@ namespace aten
     private:
         static void resetIdWhenAnyTextureLeave(aten::texture* tex);
 
+        vec4 fetch(const uint8_t* texels, uint32_t level, int x, int y) const;
+
+        vec4 sampleNearest(uint32_t level, real u, real v) const;
+        vec4 sampleBilinear(uint32_t level, real u, real v) const;
+
+        void decodeAll(std::vector<vec4>& dst) const;
+        void encodeAll(const std::vector<vec4>& src);
+
         void addToDataList(aten::DataList<aten::texture>& list)
         {
             list.add(&m_listItem);
@@ -143,8 +250,26 @@ namespace aten
 
         uint32_t m_size{ 0 };
 
+        // Texels for RGBA32F. The mip levels follow the top level.
         std::vector<vec4> m_colors;
 
+        // Texels for the compact formats. The mip levels follow the top level.
+        std::vector<uint8_t> m_texels;
+
+        struct Level {
+            uint32_t width;
+            uint32_t height;
+
+            // Offset [texels] from the top level.
+            uint32_t offset;
+        };
+        std::vector<Level> m_levels;
+
+        Format m_format{ Format::RGBA32F };
+        Filter m_filter{ Filter::Nearest };
+        Wrap m_wrapU{ Wrap::Repeat };
+        Wrap m_wrapV{ Wrap::Repeat };
+
         uint32_t m_gltex{ 0 };
 
         std::string m_name;
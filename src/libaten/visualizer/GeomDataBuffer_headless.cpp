@@ -0,0 +1,160 @@
+#include "visualizer/GeomDataBuffer.h"
+
+// NOTE
+// Geometry buffers for the headless build (__AT_HEADLESS__).
+// There is no GL, so nothing is uploaded and nothing is drawn.
+// The buffers keep only the counts, and stay uninitialized.
+
+namespace aten {
+    void GeomVertexBuffer::init(
+        uint32_t stride,
+        uint32_t vtxNum,
+        uint32_t offset,
+        const void* data,
+        bool isDynamic/*= false*/)
+    {
+        init(stride, vtxNum, offset, nullptr, 0, data, isDynamic);
+    }
+
+    void GeomVertexBuffer::init(
+        uint32_t stride,
+        uint32_t vtxNum,
+        uint32_t offset,
+        const VertexAttrib* attribs,
+        uint32_t attribNum,
+        const void* data,
+        bool isDynamic/*= false*/)
+    {
+        m_vtxStride = stride;
+        m_vtxNum = vtxNum;
+        m_vtxOffset = offset;
+        m_initVtxNum = vtxNum;
+    }
+
+    void GeomVertexBuffer::initNoVAO(
+        uint32_t stride,
+        uint32_t vtxNum,
+        uint32_t offset,
+        const void* data)
+    {
+        init(stride, vtxNum, offset, nullptr, 0, data, false);
+    }
+
+    void GeomVertexBuffer::createVAOByAttribName(
+        const shader* shd,
+        const VertexAttrib* attribs,
+        uint32_t attribNum)
+    {
+    }
+
+    void GeomVertexBuffer::update(
+        uint32_t vtxNum,
+        const void* data)
+    {
+        AT_ASSERT(vtxNum <= m_initVtxNum);
+        m_vtxNum = vtxNum;
+    }
+
+    void GeomVertexBuffer::draw(
+        Primitive mode,
+        uint32_t idxOffset,
+        uint32_t primNum)
+    {
+    }
+
+    void* GeomVertexBuffer::beginMap(bool isRead)
+    {
+        // There is no buffer to map.
+        AT_ASSERT(false);
+        return nullptr;
+    }
+
+    void GeomVertexBuffer::endMap()
+    {
+    }
+
+    void GeomVertexBuffer::clear()
+    {
+        m_vbo = 0;
+        m_vao = 0;
+    }
+
+    //////////////////////////////////////////////////////////
+
+    void GeomMultiVertexBuffer::init(
+        uint32_t vtxNum,
+        const VertexAttrib* attribs,
+        uint32_t attribNum,
+        const void* data[],
+        bool isDynamic/*= false*/)
+    {
+        m_vtxNum = vtxNum;
+        m_initVtxNum = vtxNum;
+    }
+
+    void* GeomMultiVertexBuffer::beginMap(bool isRead, uint32_t idx)
+    {
+        AT_ASSERT(false);
+        return nullptr;
+    }
+
+    void GeomMultiVertexBuffer::endMap(uint32_t idx)
+    {
+    }
+
+    //////////////////////////////////////////////////////////
+
+    GeomIndexBuffer::~GeomIndexBuffer()
+    {
+    }
+
+    void GeomIndexBuffer::init(
+        uint32_t idxNum,
+        const void* data)
+    {
+        m_idxNum = idxNum;
+        m_initIdxNum = idxNum;
+    }
+
+    void GeomIndexBuffer::update(
+        uint32_t idxNum,
+        const void* data)
+    {
+        AT_ASSERT(idxNum <= m_initIdxNum);
+        m_idxNum = idxNum;
+    }
+
+    void GeomIndexBuffer::lock(void** dst)
+    {
+        AT_ASSERT(false);
+        *dst = nullptr;
+    }
+
+    void GeomIndexBuffer::unlock()
+    {
+    }
+
+    void GeomIndexBuffer::draw(
+        const GeomVertexBuffer& vb,
+        Primitive mode,
+        uint32_t idxOffset,
+        uint32_t primNum) const
+    {
+    }
+
+    void GeomIndexBuffer::draw(
+        const GeomMultiVertexBuffer& vb,
+        Primitive mode,
+        uint32_t idxOffset,
+        uint32_t primNum) const
+    {
+    }
+
+    void GeomIndexBuffer::draw(
+        uint32_t vao,
+        Primitive mode,
+        uint32_t idxOffset,
+        uint32_t primNum) const
+    {
+    }
+}
@@ -1,6 +1,5 @@
 #include <vector>
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
 #include "visualizer/atengl.h"
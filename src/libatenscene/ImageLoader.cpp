@@ -9,12 +9,30 @@
 
 namespace aten {
     static std::string g_base;
+    static bool g_enableCompactTexture = false;
+    static bool g_enableMipmap = false;
+    static texture::Filter g_filter = texture::Filter::Nearest;
 
     void ImageLoader::setBasePath(const std::string& base)
     {
         g_base = removeTailPathSeparator(base);
     }
 
+    void ImageLoader::enableCompactTexture(bool enable)
+    {
+        g_enableCompactTexture = enable;
+    }
+
+    void ImageLoader::enableMipmap(bool enable)
+    {
+        g_enableMipmap = enable;
+    }
+
+    void ImageLoader::setFilter(texture::Filter filter)
+    {
+        g_filter = filter;
+    }
+
     texture* ImageLoader::load(
         const std::string& path,
         context& ctxt,
@@ -102,6 +120,8 @@ namespace aten {
         int height = 0;
         int channels = 0;
 
+        auto compactFormat = texture::Format::RGBA32F;
+
         if (stbi_is_hdr(fullpath.c_str())) {
             auto src = stbi_loadf(fullpath.c_str(), &width, &height, &channels, 0);
             if (src) {
@@ -109,6 +129,8 @@ namespace aten {
                 real norm = real(1);
                 read<float>(src, tex, width, height, channels, norm);
 
+                compactFormat = texture::Format::RGBA16F;
+
                 STBI_FREE(src);
             }
         }
@@ -128,10 +150,14 @@ namespace aten {
                 if (fmt == ImgFormat::Fmt8Bit) {
                     real norm = real(1) / real(255);
                     read<stbi_uc>((stbi_uc*)src, tex, width, height, channels, norm);
+
+                    compactFormat = texture::Format::RGBA8;
                 }
                 else {
                     real norm = real(1) / real(65535);
                     read<uint16_t>((uint16_t*)src, tex, width, height, channels, norm);
+
+                    compactFormat = texture::Format::RGBA16;
                 }
 
                 STBI_FREE(src);
@@ -139,6 +165,15 @@ namespace aten {
         }
 
         if (tex) {
+            tex->setFilter(g_filter);
+
+            if (g_enableMipmap) {
+                tex->buildMipmap();
+            }
+            if (g_enableCompactTexture) {
+                tex->convert(compactFormat);
+            }
+
             AssetManager::registerTex(tag, tex);
         }
         else {
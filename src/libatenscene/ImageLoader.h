@@ -18,6 +18,23 @@ namespace aten {
 
         static void setBasePath(const std::string& base);
 
+        /**
+         * @brief Store the loaded textures in the compact format which matches the source bit depth.
+         * The compact textures can't be uploaded to GPU with colors(), so this is for the CPU renderers.
+         */
+        static void enableCompactTexture(bool enable);
+
+        /**
+         * @brief Generate the mip chain of the loaded textures.
+         */
+        static void enableMipmap(bool enable);
+
+        /**
+         * @brief Set the filter of the loaded textures.
+         * Trilinear needs the mip chain (see enableMipmap).
+         */
+        static void setFilter(texture::Filter filter);
+
         static texture* load(
             const std::string& path,
             context& ctxt,
@@ -10,12 +10,18 @@
 namespace aten
 {
     static std::string g_base;
+    static VertexFormat g_vertexFormat = VertexFormat::Full;
 
     void SceneLoader::setBasePath(const std::string& base)
     {
         g_base = removeTailPathSeparator(base);
     }
 
+    void SceneLoader::setVertexFormat(VertexFormat format)
+    {
+        g_vertexFormat = format;
+    }
+
     // NOTE
     // <scene width=<uint> height=<uint>>
     //        <camera 
@@ -230,6 +236,16 @@ namespace aten
             return;
         }
 
+        struct MeshInfo {
+            std::string tag;
+            object* obj;
+            mat4 mtxL2W;
+        };
+
+        // Instances of the meshes are created after all vertices are loaded,
+        // because the acceleration structures of the meshes are built when the instances are created.
+        std::vector<MeshInfo> meshes;
+
         for (auto elem = objRoot->FirstChildElement("object"); elem != nullptr; elem = elem->NextSiblingElement("object")) {
             std::string path;
             std::string tag;
@@ -296,8 +312,7 @@ namespace aten
             auto mtxL2W = mtxT * mtxRotX * mtxRotY * mtxRotZ * mtxS;
 
             if (obj) {
-                auto instance = aten::TransformableFactory::createInstance<aten::object>(ctxt, obj, mtxL2W);
-                objs.insert(std::pair<std::string, transformable*>(tag, instance));
+                meshes.push_back(MeshInfo{ tag, obj, mtxL2W });
             }
             else {
                 if (type == "cube") {
@@ -324,6 +339,18 @@ namespace aten
                 }
             }
         }
+
+        if (g_vertexFormat != VertexFormat::Full
+            && ctxt.getVertexFormat() == VertexFormat::Full
+            && ctxt.getVertexNum() > 0)
+        {
+            ctxt.compactVertices(g_vertexFormat);
+        }
+
+        for (const auto& mesh : meshes) {
+            auto instance = aten::TransformableFactory::createInstance<aten::object>(ctxt, mesh.obj, mesh.mtxL2W);
+            objs.insert(std::pair<std::string, transformable*>(mesh.tag, instance));
+        }
     }
 
     void readLights(
@@ -532,6 +559,7 @@ namespace aten
         info.dst.russianRouletteDepth = val.get("rrdepth", int(3));
         info.dst.mutation = val.get("mutation", int(100));
         info.dst.mltNum = val.get("mlt", int(100));
+        info.dst.bootstrapNum = val.get("bootstrap", int(0));
     }
 
     SceneLoader::SceneInfo SceneLoader::load(
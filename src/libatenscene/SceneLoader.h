@@ -12,6 +12,12 @@ namespace aten
     public:
         static void setBasePath(const std::string& base);
 
+        /**
+         * @brief Set the format to compact the vertices of the loaded meshes.
+         * The vertices are compacted after all meshes are loaded and before their acceleration structures are built.
+         */
+        static void setVertexFormat(VertexFormat format);
+
         struct ProcInfo {
             std::string type;
             Values val;